@@ -0,0 +1,338 @@
+/**
+ * @file bench-bmp.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief BMP benchmark: cost of monitoring on the receiving BgpFsm, with a
+ * local collector stand-in.
+ * @version 0.1
+ * @date 2019-09-10
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-bmp.h"
+#include "bgp-fsm.h"
+#include "loopback-out-handler.h"
+#include "manual-clock.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace libbgp;
+
+#define BMP_GROUP_SIZE 20
+#define BMP_SRC_ROUTER_ID 0x03030303
+
+// bytes per run() call.
+#define BMP_CHUNK 65536
+
+/**
+ * @brief Monitoring setups benchmarked.
+ *
+ */
+enum BenchBmpMode {
+    // no monitoring.
+    BMP_MODE_NONE,
+
+    // log every message at DEBUG level to a log handler that drops it, the
+    // cheapest way to see the UPDATEs without BMP.
+    BMP_MODE_DEBUG_LOG,
+
+    // BMP pre-policy Route Monitoring.
+    BMP_MODE_PRE,
+
+    // BMP pre- and post-policy Route Monitoring.
+    BMP_MODE_POST,
+
+    // BMP pre-policy, the collector does not read until the table is received.
+    BMP_MODE_STALLED
+};
+
+static const char *bench_bmp_mode_str[] = {
+    "none",
+    "debug-log",
+    "bmp",
+    "bmp-post-policy",
+    "bmp-stalled-collector"
+};
+
+/**
+ * @brief Log handler that drops everything, after formatting.
+ *
+ */
+class NullLogHandler : public BgpLogHandler {
+public:
+    NullLogHandler() : bytes(0) {}
+    size_t bytes;
+
+protected:
+    void logImpl(const char* str) {
+        bytes += strlen(str);
+    }
+};
+
+/**
+ * @brief BMP collector stand-in: reads messages from a socket on a thread of
+ * its own, checks the framing, and counts messages by type until Termination.
+ *
+ */
+class BenchBmpCollector {
+public:
+    BenchBmpCollector(int fd, bool stalled) : bad(false), fd(fd), go(!stalled) {
+        for (size_t i = 0; i <= BMP_TERMINATION; i++) counts[i] = 0;
+        thread = std::thread(&BenchBmpCollector::main, this);
+    }
+
+    // start reading. (if stalled)
+    void resume() { go.store(true); }
+
+    // wait for Termination or EOF.
+    void join() { thread.join(); }
+
+    size_t counts[BMP_TERMINATION + 1];
+    bool bad;
+
+private:
+    void main() {
+        while (!go.load()) std::this_thread::yield();
+
+        std::vector<uint8_t> buffer;
+        uint8_t chunk[65536];
+        size_t offset = 0;
+
+        while (true) {
+            ssize_t len = read(fd, chunk, sizeof(chunk));
+            if (len <= 0) return;
+            buffer.insert(buffer.end(), chunk, chunk + len);
+
+            while (buffer.size() - offset >= 6) {
+                const uint8_t *msg = buffer.data() + offset;
+                uint32_t msg_len;
+                memcpy(&msg_len, msg + 1, 4);
+                msg_len = ntohl(msg_len);
+
+                if (msg[0] != 3 || msg_len < 6 || msg[5] > BMP_TERMINATION) {
+                    bad = true;
+                    return;
+                }
+
+                if (buffer.size() - offset < msg_len) break;
+
+                counts[msg[5]]++;
+                offset += msg_len;
+                if (msg[5] == BMP_TERMINATION) return;
+            }
+
+            buffer.erase(buffer.begin(), buffer.begin() + offset);
+            offset = 0;
+        }
+    }
+
+    int fd;
+    std::atomic<bool> go;
+    std::thread thread;
+};
+
+/**
+ * @brief Measure the time the receiving FSM takes to run() a full table, with
+ * and without monitoring.
+ *
+ * The table is recorded from a sending FSM first, and fed to the receiver in
+ * BMP_CHUNK byte chunks. With BMP, the exporter writes to a collector
+ * stand-in over a socketpair. The collector must see every message the
+ * exporter queued; messages dropped because a ring was full are reported.
+ */
+static void benchReceive(const std::vector<Prefix4> &prefixes, BenchBmpMode mode) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "bmp/ipv4/%zu/receive/%s", prefixes.size(), bench_bmp_mode_str[mode]);
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 sender_rib4(&logger);
+    BgpRib6 sender_rib6(&logger);
+    BenchRng rng(1);
+    uint32_t nexthop = htonl(0xc0000201);
+    for (size_t i = 0; i < prefixes.size(); i += BMP_GROUP_SIZE) {
+        size_t end = i + BMP_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + BMP_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        sender_rib4.insert(BMP_SRC_ROUTER_ID, group, benchAttribs(&logger, rng, nexthop), 0, 0);
+    }
+
+    ManualClock clock;
+
+    uint64_t best = UINT64_MAX;
+    uint64_t dropped = 0;
+    for (int run = 0; run < benchOptions().runs; run++) {
+        NullLogHandler debug_logger;
+        debug_logger.setLogLevel(DEBUG);
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            fprintf(stderr, "bench-bmp: socketpair() failed.\n");
+            exit(1);
+        }
+
+        bool use_bmp = mode >= BMP_MODE_PRE;
+        BenchBmpCollector *collector = use_bmp ? new BenchBmpCollector(fds[1], mode == BMP_MODE_STALLED) : NULL;
+        BgpBmpExporter exporter(fds[0], "bench-bmp", "libbgp bench-bmp", mode == BMP_MODE_POST, BGP_BMP_RING_SIZE, &logger);
+        if (use_bmp && !exporter.start()) {
+            fprintf(stderr, "bench-bmp: failed to start exporter.\n");
+            exit(1);
+        }
+
+        size_t n_updates = 0;
+
+        {
+            LoopbackOutHandler to_sender;
+            BgpRib4 receiver_rib4(&logger);
+            BgpRib6 receiver_rib6(&logger);
+
+            BgpConfig sender_config, receiver_config;
+            benchConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &logger, &sender_rib4, &sender_rib6, &clock);
+            benchConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &logger, &receiver_rib4, &receiver_rib6, &clock);
+            if (mode == BMP_MODE_DEBUG_LOG) receiver_config.log_handler = &debug_logger;
+            if (use_bmp) {
+                receiver_config.bmp = &exporter;
+                inet_pton(AF_INET, "10.0.0.1", &receiver_config.bmp_peer_addr);
+                inet_pton(AF_INET, "10.0.0.2", &receiver_config.bmp_local_addr);
+            }
+
+            BgpFsm receiver(receiver_config);
+            RecordOutHandler to_receiver(&receiver);
+            sender_config.out_handler = &to_receiver;
+            BgpFsm sender(sender_config);
+            to_sender.setPeer(&sender, &receiver);
+
+            sender.start();
+            const std::vector<uint8_t> &wire = to_receiver.recorded;
+
+            // count the UPDATEs (KEEPALIVEs may be in between).
+            for (size_t off = 0; off + 19 <= wire.size();) {
+                uint16_t len = (wire[off + 16] << 8) | wire[off + 17];
+                if (wire[off + 18] == UPDATE) n_updates++;
+                off += len;
+            }
+
+            uint64_t start = benchNow();
+            for (size_t off = 0; off < wire.size(); off += BMP_CHUNK) {
+                size_t len = wire.size() - off < BMP_CHUNK ? wire.size() - off : BMP_CHUNK;
+                int ret = receiver.run(wire.data() + off, len);
+                if (ret < 0) {
+                    fprintf(stderr, "bench-bmp: run() returned %d.\n", ret);
+                    exit(1);
+                }
+            }
+            uint64_t elapsed = benchNow() - start;
+
+            size_t received = receiver_rib4.get().size();
+            if (received != prefixes.size() || receiver.getState() != ESTABLISHED) {
+                fprintf(stderr, "bench-bmp: receiver got %zu of %zu routes.\n", received, prefixes.size());
+                exit(1);
+            }
+
+            if (elapsed < best) best = elapsed;
+        }
+
+        if (use_bmp) {
+            // receiver gone: Peer Down queued.
+            collector->resume();
+            exporter.stop();
+            collector->join();
+
+            size_t want_rm = n_updates * (mode == BMP_MODE_POST ? 2 : 1);
+            size_t queued = exporter.getMessageCount();
+            size_t drops = exporter.getDropCount();
+            size_t got = collector->counts[BMP_ROUTE_MONITORING] + collector->counts[BMP_PEER_UP] + collector->counts[BMP_PEER_DOWN];
+
+            if (collector->bad || got != queued || queued + drops != want_rm + 2 || collector->counts[BMP_INITIATION] != 1 || collector->counts[BMP_TERMINATION] != 1) {
+                fprintf(stderr, "bench-bmp: collector got %zu of %zu messages queued (%zu dropped, %zu expected), bad framing: %d.\n", got, queued, drops, want_rm + 2, collector->bad);
+                exit(1);
+            }
+
+            if (drops > dropped) dropped = drops;
+            delete collector;
+        }
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    benchReport(bench_name, prefixes.size(), best);
+    if (dropped > 0) printf("  (up to %llu messages dropped by the exporter)\n", (unsigned long long) dropped);
+}
+
+/**
+ * @brief Check that messages queued by other threads while stop() runs are
+ * either written before Termination, or counted dropped.
+ *
+ */
+static void checkStopRace() {
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpBmpPeer peer;
+    memset(&peer, 0, sizeof(peer));
+    uint8_t pdu[19];
+    memset(pdu, 0xff, 16);
+    pdu[16] = 0;
+    pdu[17] = sizeof(pdu);
+    pdu[18] = KEEPALIVE;
+
+    for (int i = 0; i < 200; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            fprintf(stderr, "bench-bmp: socketpair() failed.\n");
+            exit(1);
+        }
+
+        BenchBmpCollector collector(fds[1], false);
+        BgpBmpExporter exporter(fds[0], "bench-bmp", "libbgp bench-bmp", false, 64, &logger);
+        if (!exporter.start()) {
+            fprintf(stderr, "bench-bmp: failed to start exporter.\n");
+            exit(1);
+        }
+
+        std::atomic<bool> done(false);
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 4; t++) {
+            producers.emplace_back([&]() {
+                while (!done.load()) exporter.routeMonitoring(peer, 0, false, pdu, sizeof(pdu));
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100 + (i % 10) * 50));
+        exporter.stop();
+        collector.join();
+        done.store(true);
+        for (std::thread &producer : producers) producer.join();
+
+        if (collector.bad || collector.counts[BMP_ROUTE_MONITORING] != exporter.getMessageCount() || collector.counts[BMP_TERMINATION] != 1) {
+            fprintf(stderr, "bench-bmp: stop() race: collector got %zu of %llu messages queued, bad framing: %d.\n", collector.counts[BMP_ROUTE_MONITORING], (unsigned long long) exporter.getMessageCount(), collector.bad);
+            exit(1);
+        }
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    checkStopRace();
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        std::vector<Prefix4> prefixes = benchPrefixes4(n, 1);
+        benchReceive(prefixes, BMP_MODE_NONE);
+        benchReceive(prefixes, BMP_MODE_DEBUG_LOG);
+        benchReceive(prefixes, BMP_MODE_PRE);
+        benchReceive(prefixes, BMP_MODE_POST);
+        benchReceive(prefixes, BMP_MODE_STALLED);
+    }
+
+    return 0;
+}
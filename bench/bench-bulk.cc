@@ -0,0 +1,188 @@
+/**
+ * @file bench-bulk.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmarks for bulk RIB and message access with packed buffers.
+ * @version 0.1
+ * @date 2019-09-11
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-bulk.h"
+#include "bgp-packet.h"
+#include "bgp-update-message.h"
+#include <arpa/inet.h>
+#include <memory>
+
+using namespace libbgp;
+
+#define BULK_GROUP_SIZE 20
+#define BULK_SRC_ROUTER_ID 0x03030303
+#define BULK_DST_ROUTER_ID 0x04040404
+
+static BgpLogHandler logger;
+
+static void fill(BgpRib4 &rib, const std::vector<Prefix4> &prefixes) {
+    BenchRng rng(1);
+    uint32_t nexthop = htonl(0xc0000201);
+    for (size_t i = 0; i < prefixes.size(); i += BULK_GROUP_SIZE) {
+        size_t end = i + BULK_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + BULK_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        rib.insert(BULK_SRC_ROUTER_ID, group, benchAttribs(&logger, rng, nexthop), 0, 0);
+    }
+}
+
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "bench-bulk: %s.\n", what);
+    exit(1);
+}
+
+/**
+ * @brief Measure moving a full table out of and into a RIB, with packed
+ * buffers and one entry / route at a time.
+ *
+ * The one at a time variants are what a binding without bulk access does per
+ * route, without the binding overhead: copy the entry and write its
+ * attributes out, or insert the route with its attributes.
+ */
+static void benchRib(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+
+    BgpRib4 rib(&logger);
+    fill(rib, prefixes);
+
+    BgpBulkRib4 bulk(&rib, &logger);
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/dump", n);
+    benchRun(bench_name, n, [&]() {
+        benchKeep(bulk.dump());
+    });
+
+    // buffers are used by the insert benchmarks.
+    bulk.dump();
+    check(bulk.getRouteCount() == n, "dump() missed routes");
+    check(bulk.getAttribSetCount() == (n + BULK_GROUP_SIZE - 1) / BULK_GROUP_SIZE, "dump() did not share attribute sets");
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/dump-per-entry", n);
+    benchRun(bench_name, n, [&]() {
+        std::lock_guard<BgpLock> lock(rib.getMutex());
+        uint8_t buffer[4096];
+        for (const rib4_t::value_type &it : rib.get()) {
+            BgpRib4Entry entry = it.second;
+            for (const std::shared_ptr<BgpPathAttrib> &attr : entry.attribs) {
+                benchKeep(attr->writeWire(buffer, sizeof(buffer)));
+            }
+        }
+    });
+
+    BgpBulkBuffer routes = bulk.getRoutes();
+    BgpBulkBuffer sets = bulk.getAttribSets();
+    BgpBulkBuffer attribs = bulk.getAttribs();
+    std::unique_ptr<BgpRib4> dst;
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/insert", n);
+    benchRun(bench_name, n, [&]() {
+        dst.reset(new BgpRib4(&logger));
+    }, [&]() {
+        BgpBulkRib4 dst_bulk(dst.get(), &logger);
+        benchKeep(dst_bulk.insert(BULK_DST_ROUTER_ID, (const uint8_t *) routes.data, routes.size, (const uint8_t *) sets.data, sets.size, (const uint8_t *) attribs.data, attribs.size));
+    });
+
+    // round trip: same routes and attributes.
+    if (dst) {
+        BgpBulkRib4 dst_bulk(dst.get(), &logger);
+        check(dst_bulk.dump() == n, "insert() missed routes");
+        check(dst_bulk.getAttribSetCount() == bulk.getAttribSetCount() && dst_bulk.getAttribs().size == attribs.size, "insert() changed attribute sets");
+    }
+
+    std::vector<std::pair<Prefix4, std::vector<std::shared_ptr<BgpPathAttrib>>>> entries;
+    for (const rib4_t::value_type &it : rib.get()) entries.push_back(std::make_pair(it.second.route, it.second.attribs));
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/insert-per-route", n);
+    benchRun(bench_name, n, [&]() {
+        dst.reset(new BgpRib4(&logger));
+    }, [&]() {
+        for (const auto &entry : entries) {
+            benchKeep(dst->insert(BULK_DST_ROUTER_ID, entry.first, entry.second, 0, 0));
+        }
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/withdraw", n);
+    benchRun(bench_name, n, [&]() {
+        dst.reset(new BgpRib4(&logger));
+        BgpBulkRib4 dst_bulk(dst.get(), &logger);
+        dst_bulk.insert(BULK_DST_ROUTER_ID, (const uint8_t *) routes.data, routes.size, (const uint8_t *) sets.data, sets.size, (const uint8_t *) attribs.data, attribs.size);
+    }, [&]() {
+        BgpBulkRib4 dst_bulk(dst.get(), &logger);
+        benchKeep(dst_bulk.withdraw(BULK_DST_ROUTER_ID, (const uint8_t *) routes.data, routes.size));
+    });
+
+    if (dst) check(dst->get().size() == 0, "withdraw() missed routes");
+}
+
+/**
+ * @brief Measure parsing a stream of UPDATE messages into packed buffers,
+ * and into message objects one at a time, and loading the stream into a RIB.
+ *
+ */
+static void benchParse(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+
+    std::vector<std::vector<uint8_t>> updates = benchUpdates4(&logger, prefixes, BULK_GROUP_SIZE, htonl(0xc0000201), 1);
+    std::vector<uint8_t> stream;
+    for (const std::vector<uint8_t> &update : updates) stream.insert(stream.end(), update.begin(), update.end());
+
+    BgpBulkParser parser(&logger);
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/parse", n);
+    benchRun(bench_name, n, [&]() {
+        benchKeep(parser.parse(stream.data(), stream.size()));
+    });
+
+    parser.parse(stream.data(), stream.size());
+    check(parser.getMessageCount() == updates.size() && parser.getAnnouncedCount() == n, "parse() missed routes");
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/parse-per-message", n);
+    benchRun(bench_name, n, [&]() {
+        size_t routes = 0;
+        for (const std::vector<uint8_t> &update : updates) {
+            BgpPacket packet(&logger, true);
+            check(packet.parse(update.data(), update.size()) >= 0, "failed to parse UPDATE");
+            routes += static_cast<const BgpUpdateMessage *>(packet.getMessage())->nlri.size();
+        }
+        benchKeep(routes);
+    });
+
+    std::unique_ptr<BgpRib4> rib;
+
+    snprintf(bench_name, sizeof(bench_name), "bulk/ipv4/%zu/parse-and-insert", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+    }, [&]() {
+        BgpBulkRib4 bulk(rib.get(), &logger);
+        parser.parse(stream.data(), stream.size());
+        BgpBulkBuffer announced = parser.getAnnounced();
+        BgpBulkBuffer sets = parser.getAttribSets();
+        benchKeep(bulk.insert(BULK_SRC_ROUTER_ID, (const uint8_t *) announced.data, announced.size, (const uint8_t *) sets.data, sets.size, stream.data(), stream.size()));
+    });
+
+    if (rib) check(rib->get().size() == n, "insert() of parsed routes missed routes");
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    logger.setLogLevel(FATAL);
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        std::vector<Prefix4> prefixes = benchPrefixes4(n, 1);
+        benchRib(prefixes);
+        benchParse(prefixes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file bench-codec.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark BgpPacket parse/write/length for each message type.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp.h"
+#include "bgp-sink.h"
+#include <arpa/inet.h>
+
+using namespace libbgp;
+
+#define CODEC_OPS 200000
+
+static void benchMessage(const char *name, BgpLogHandler *logger, const BgpMessage &msg, bool use_4b_asn = true) {
+    uint8_t wire[4096];
+    uint8_t out[4096];
+    char bench_name[128];
+
+    BgpPacket src(logger, use_4b_asn, &msg);
+    ssize_t len = src.write(wire, sizeof(wire));
+    if (len < 0) {
+        fprintf(stderr, "bench-codec: failed to write %s.\n", name);
+        exit(1);
+    }
+
+    snprintf(bench_name, sizeof(bench_name), "codec/parse/%s (%zd bytes)", name, len);
+    benchRun(bench_name, CODEC_OPS, [&]() {
+        for (int i = 0; i < CODEC_OPS; i++) {
+            BgpPacket pkt(logger, use_4b_asn);
+            ssize_t ret = pkt.parse(wire, len);
+            benchKeep(ret);
+        }
+    });
+
+    // a parsed message keeps the wire bytes of its attributes.
+    BgpPacket parsed(logger, use_4b_asn);
+    if (parsed.parse(wire, len) != len) {
+        fprintf(stderr, "bench-codec: failed to parse %s.\n", name);
+        exit(1);
+    }
+
+    snprintf(bench_name, sizeof(bench_name), "codec/write-parsed/%s (%zd bytes)", name, len);
+    benchRun(bench_name, CODEC_OPS, [&]() {
+        for (int i = 0; i < CODEC_OPS; i++) {
+            ssize_t ret = parsed.write(out, sizeof(out));
+            benchKeep(ret);
+        }
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "codec/write/%s (%zd bytes)", name, len);
+    benchRun(bench_name, CODEC_OPS, [&]() {
+        for (int i = 0; i < CODEC_OPS; i++) {
+            BgpPacket pkt(logger, use_4b_asn, &msg);
+            ssize_t ret = pkt.write(out, sizeof(out));
+            benchKeep(ret);
+        }
+    });
+
+    if (src.length() != len) {
+        fprintf(stderr, "bench-codec: length() of %s is %zd, but %zd bytes written.\n", name, src.length(), len);
+        exit(1);
+    }
+
+    snprintf(bench_name, sizeof(bench_name), "codec/length/%s (%zd bytes)", name, len);
+    benchRun(bench_name, CODEC_OPS, [&]() {
+        for (int i = 0; i < CODEC_OPS; i++) {
+            BgpPacket pkt(logger, use_4b_asn, &msg);
+            ssize_t ret = pkt.length();
+            benchKeep(ret);
+        }
+    });
+}
+
+/**
+ * @brief Build an UPDATE with an AS_PATH of asn_count ASNs, prepended one by
+ * one, like a path with heavy prepending.
+ */
+static void buildLongPath(BgpLogHandler *logger, BgpUpdateMessage &update, size_t asn_count, uint32_t nexthop) {
+    BgpPathAttribOrigin origin(logger);
+    origin.origin = IGP;
+    update.updateAttribute(origin);
+
+    BgpPathAttribNexthop nh(logger);
+    nh.next_hop = nexthop;
+    update.updateAttribute(nh);
+
+    for (size_t i = 0; i < asn_count; i++) update.prepend(i % 2 == 0 ? 65000 + i : 4200000000U + i);
+}
+
+static void benchAsPath(BgpLogHandler *logger, uint32_t nexthop) {
+    // AS_PATH is limited to 255 bytes.
+    BgpUpdateMessage path4(logger, true);
+    buildLongPath(logger, path4, 60, nexthop);
+    benchMessage("update4/as-path-60x4b", logger, path4);
+
+    BgpUpdateMessage path2(logger, false);
+    buildLongPath(logger, path2, 120, nexthop);
+    benchMessage("update4/as-path-120x2b", logger, path2, false);
+
+    benchRun("codec/as-path/downgrade-restore/60-asn", CODEC_OPS, [&]() {
+        for (int i = 0; i < CODEC_OPS; i++) {
+            path4.downgradeAsPath();
+            path4.restoreAsPath();
+        }
+    });
+}
+
+#define SINK_BATCH 64
+
+static void benchSink(const char *name, BgpLogHandler *logger, const BgpMessage &msg) {
+    uint8_t wire[4096];
+    char bench_name[128];
+
+    BgpPacket src(logger, true, &msg);
+    ssize_t len = src.write(wire, sizeof(wire));
+    if (len < 0) {
+        fprintf(stderr, "bench-codec: failed to write %s.\n", name);
+        exit(1);
+    }
+
+    // a read() worth of messages.
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < SINK_BATCH; i++) stream.insert(stream.end(), wire, wire + len);
+
+    int rounds = CODEC_OPS / SINK_BATCH;
+    BgpSink sink(true);
+
+    snprintf(bench_name, sizeof(bench_name), "codec/sink-pour/%s x%d", name, SINK_BATCH);
+    benchRun(bench_name, rounds * SINK_BATCH, [&]() {
+        for (int i = 0; i < rounds; i++) {
+            sink.fill(stream.data(), stream.size());
+            const uint8_t *frame = NULL;
+            while (sink.pourFrame(&frame) > 0) benchKeep(frame[18]);
+        }
+    });
+
+    std::vector<BgpFrame> frames;
+    snprintf(bench_name, sizeof(bench_name), "codec/sink-frame/%s x%d", name, SINK_BATCH);
+    benchRun(bench_name, rounds * SINK_BATCH, [&]() {
+        for (int i = 0; i < rounds; i++) {
+            sink.fill(stream.data(), stream.size());
+            frames.clear();
+            ssize_t n = sink.frame(frames);
+            if (n != SINK_BATCH) {
+                fprintf(stderr, "bench-codec: frame() found %zd messages, want %d.\n", n, SINK_BATCH);
+                exit(1);
+            }
+            for (const BgpFrame &frame : frames) benchKeep(frame.type);
+            sink.consume(frames.back().offset + frames.back().length);
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+    BenchRng rng(1);
+
+    uint32_t nexthop;
+    inet_pton(AF_INET, "192.0.2.1", &nexthop);
+
+    uint8_t nexthop6[16];
+    inet_pton(AF_INET6, "2001:db8::1", nexthop6);
+
+    BgpOpenMessage open(&logger, true, 65000, 90, "192.0.2.1");
+    open.setAsn(65000);
+    BgpCapabilityMpBgp *mp4 = new BgpCapabilityMpBgp(&logger);
+    mp4->afi = IPV4;
+    mp4->safi = UNICAST;
+    open.addCapability(std::shared_ptr<BgpCapability>(mp4));
+    BgpCapabilityMpBgp *mp6 = new BgpCapabilityMpBgp(&logger);
+    mp6->afi = IPV6;
+    mp6->safi = UNICAST;
+    open.addCapability(std::shared_ptr<BgpCapability>(mp6));
+    benchMessage("open", &logger, open);
+
+    BgpKeepaliveMessage keepalive(&logger);
+    benchMessage("keepalive", &logger, keepalive);
+
+    BgpNotificationMessage notify(&logger, E_CEASE, E_RESET, NULL, 0);
+    benchMessage("notification", &logger, notify);
+
+    std::vector<Prefix4> prefixes4 = benchPrefixes4(500, 1);
+
+    BgpUpdateMessage update_small(&logger, true);
+    update_small.setAttribs(benchAttribs(&logger, rng, nexthop));
+    update_small.addNlri4(prefixes4[0]);
+    benchMessage("update4/1-nlri", &logger, update_small);
+
+    BgpUpdateMessage update_large(&logger, true);
+    update_large.setAttribs(benchAttribs(&logger, rng, nexthop));
+    for (size_t i = 0; i < 500; i++) update_large.addNlri4(prefixes4[i]);
+    benchMessage("update4/500-nlri", &logger, update_large);
+
+    BgpUpdateMessage withdraw(&logger, true);
+    for (size_t i = 0; i < 500; i++) withdraw.addWithdrawn4(prefixes4[i]);
+    benchMessage("update4/500-withdrawn", &logger, withdraw);
+
+    std::vector<Prefix6> prefixes6 = benchPrefixes6(200, 1);
+    BgpUpdateMessage update6(&logger, true);
+    update6.setAttribs(benchAttribs(&logger, rng, 0));
+    update6.setNlri6(prefixes6, nexthop6, NULL);
+    benchMessage("update6/200-nlri", &logger, update6);
+
+    benchAsPath(&logger, nexthop);
+
+    benchSink("keepalive", &logger, keepalive);
+    benchSink("update4/1-nlri", &logger, update_small);
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file bench-corpus.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark the fuzz target over a corpus, so parser speedups can be
+ * measured on the same inputs used to harden the parsers.
+ * @version 0.1
+ * @date 2019-08-29
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "fuzz-packet.h"
+#include <dirent.h>
+#include <string>
+
+// directory to load the corpus from. built-in seeds are used if not set.
+#define CORPUS_ENV "BENCH_CORPUS"
+
+// number of mutated inputs to make from the corpus.
+#define CORPUS_MUTATIONS 10000
+
+// load all files in dir.
+static bool loadCorpus(const char *dir, std::vector<FuzzInput> &corpus) {
+    DIR *d = opendir(dir);
+    if (d == NULL) return false;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+
+        FILE *f = fopen((std::string(dir) + "/" + ent->d_name).c_str(), "rb");
+        if (f == NULL) continue;
+
+        FuzzInput input;
+        uint8_t buffer[4096];
+        size_t len;
+        while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) input.insert(input.end(), buffer, buffer + len);
+        fclose(f);
+
+        corpus.push_back(input);
+    }
+
+    closedir(d);
+    return true;
+}
+
+static uint64_t corpusBytes(const std::vector<FuzzInput> &corpus) {
+    uint64_t bytes = 0;
+    for (const FuzzInput &input : corpus) bytes += input.size();
+    return bytes;
+}
+
+/**
+ * @brief Run every input of the corpus through the fuzz target. One op is one
+ * input.
+ *
+ * @param name Name of the benchmark.
+ * @param corpus The corpus.
+ */
+static void benchCorpus(const char *name, const std::vector<FuzzInput> &corpus) {
+    if (!benchEnabled(name)) return;
+
+    // make sure a run does at least ~max_prefixes inputs, so small corpora
+    // still give stable numbers.
+    size_t rounds = benchOptions().max_prefixes / corpus.size() + 1;
+
+    benchRun(name, rounds * corpus.size(), [&]() {
+        for (size_t r = 0; r < rounds; r++) {
+            for (const FuzzInput &input : corpus) fuzzPacket(input.data(), input.size());
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+
+    std::vector<FuzzInput> corpus;
+    const char *dir = getenv(CORPUS_ENV);
+    if (dir != NULL) {
+        if (!loadCorpus(dir, corpus)) {
+            fprintf(stderr, "bench-corpus: can't read corpus directory %s.\n", dir);
+            return 1;
+        }
+    }
+
+    if (corpus.size() == 0) corpus = fuzzSeeds();
+
+    fprintf(stderr, "bench-corpus: %zu inputs, %llu bytes.\n", corpus.size(), (unsigned long long) corpusBytes(corpus));
+
+    benchCorpus("corpus/parse-write/seeds", corpus);
+
+    // deterministic mutations: mostly malformed input, exercises error paths.
+    std::vector<FuzzInput> mutated;
+    FuzzMutator mutator(1);
+    for (int i = 0; i < CORPUS_MUTATIONS; i++) {
+        FuzzInput input = corpus[mutator.range(corpus.size())];
+        mutator.mutate(input, corpus[mutator.range(corpus.size())]);
+        mutated.push_back(input);
+    }
+
+    benchCorpus("corpus/parse-write/mutated", mutated);
+
+    return 0;
+}
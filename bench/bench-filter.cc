@@ -0,0 +1,89 @@
+/**
+ * @file bench-filter.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark BgpFilterRules::apply with large rule sets.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-filter.h"
+#include <arpa/inet.h>
+
+using namespace libbgp;
+
+#define FILTER_ROUTES 10000
+
+static BgpLogHandler logger;
+
+// build a rule set of nrules prefix rules (M_LE, like a prefix-list), one
+// AS_PATH rule and one COMMUNITY rule for every 10 prefix rules.
+static BgpFilterRules makeRules4(size_t nrules) {
+    BgpFilterRules rules(ACCEPT);
+    std::vector<Prefix4> rule_prefixes = benchPrefixes4(nrules, 42);
+
+    for (size_t i = 0; i < nrules; i++) {
+        rules.append<BgpFilterRuleRoute4>(BgpFilterRuleRoute4(REJECT, M_LE, rule_prefixes[i]));
+        if (i % 10 == 0) {
+            rules.append<BgpFilterRuleAsPath>(BgpFilterRuleAsPath(REJECT, M_HAS_ASN, 4200000000U + i));
+            rules.append<BgpFilterRuleCommunity>(BgpFilterRuleCommunity(REJECT, M_HAS_COMMUNITY, 65535, i));
+        }
+    }
+
+    return rules;
+}
+
+static BgpFilterRules makeRules6(size_t nrules) {
+    BgpFilterRules rules(ACCEPT);
+    std::vector<Prefix6> rule_prefixes = benchPrefixes6(nrules, 42);
+
+    for (size_t i = 0; i < nrules; i++) {
+        rules.append<BgpFilterRuleRoute6>(BgpFilterRuleRoute6(REJECT, M_LE, rule_prefixes[i]));
+    }
+
+    return rules;
+}
+
+template <typename P>
+static void benchFilter(const char *family, BgpFilterRules &rules, size_t nrules, const std::vector<P> &routes, const std::vector<BenchAttribs> &attribs) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "filter/%s/%zu-rules/apply", family, nrules);
+
+    // fewer routes for large rule sets to keep the runtime sane.
+    size_t nroutes = nrules >= 1000 ? routes.size() / 10 : routes.size();
+
+    benchRun(bench_name, nroutes, [&]() {
+        size_t accepted = 0;
+        for (size_t i = 0; i < nroutes; i++) {
+            if (rules.apply(routes[i], attribs[i % attribs.size()]) == ACCEPT) accepted++;
+        }
+        benchKeep(accepted);
+    });
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    logger.setLogLevel(FATAL);
+
+    BenchRng rng(1);
+    std::vector<BenchAttribs> attribs;
+    for (size_t i = 0; i < 1000; i++) {
+        attribs.push_back(benchAttribs(&logger, rng, htonl(0xc0000201)));
+    }
+
+    std::vector<Prefix4> routes4 = benchPrefixes4(FILTER_ROUTES, 1);
+    std::vector<Prefix6> routes6 = benchPrefixes6(FILTER_ROUTES, 1);
+
+    for (size_t nrules = 10; nrules <= 10000; nrules *= 10) {
+        BgpFilterRules rules4 = makeRules4(nrules);
+        benchFilter("ipv4", rules4, nrules, routes4, attribs);
+
+        BgpFilterRules rules6 = makeRules6(nrules);
+        benchFilter("ipv6", rules6, nrules, routes6, attribs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,772 @@
+/**
+ * @file bench-fsm.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief End-to-end benchmark: full-table convergence between two BgpFsm
+ * connected back to back in memory.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-fsm.h"
+#include "bgp-keepalive-message.h"
+#include "loopback-out-handler.h"
+#include "manual-clock.h"
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace libbgp;
+
+#define FSM_GROUP_SIZE 20
+#define FSM_SRC_ROUTER_ID 0x03030303
+
+// multi-peer benchmark: number of peers, link model, and largest table.
+#define FSM_PEERS 8
+#define FSM_LINK_BANDWIDTH 1000000000
+#define FSM_LINK_LATENCY 1000
+#define FSM_PEERS_MAX_PREFIXES 100000
+#define FSM_PEERS_QUEUE_SIZE (1 << 17)
+
+// decode pipeline benchmark: bytes per run() call, largest worker count.
+#define FSM_DECODE_CHUNK 65536
+#define FSM_DECODE_MAX_THREADS 4
+
+// idle memory benchmark: number of sessions.
+#define FSM_IDLE_SESSIONS 1000
+
+// session setup benchmark: number of sessions.
+#define FSM_SETUP_SESSIONS 2000
+
+// flap dampening benchmark: one in FSM_FLAP_RATIO prefixes flaps (withdrawn,
+// then announced FSM_FLAP_INTERVAL_MS / 2 later) FSM_FLAP_CYCLES times, then
+// the peer goes quiet for FSM_FLAP_QUIET_MS with a tick every
+// FSM_FLAP_TICK_MS.
+#define FSM_FLAP_RATIO 100
+#define FSM_FLAP_CYCLES 30
+#define FSM_FLAP_INTERVAL_MS 60000
+#define FSM_FLAP_QUIET_MS (90 * 60 * 1000)
+#define FSM_FLAP_TICK_MS 5000
+#define FSM_FLAP_UPDATE_SIZE 500
+
+/**
+ * @brief Out handler that checks, from another thread, whether a RIB is
+ * locked during each write, then passes the write on.
+ * 
+ */
+class LockCheckOutHandler : public BgpOutHandler {
+public:
+    LockCheckOutHandler(BgpRib4 *rib, BgpOutHandler *out) : writes(0), locked_writes(0), rib(rib), out(out) {}
+
+    bool handleOut(const uint8_t *buffer, size_t length) {
+        bool locked = std::async(std::launch::async, [this]() {
+            if (!rib->getMutex().try_lock()) return true;
+            rib->getMutex().unlock();
+            return false;
+        }).get();
+
+        writes++;
+        if (locked) locked_writes++;
+
+        return out->handleOut(buffer, length);
+    }
+
+    size_t writes;
+    size_t locked_writes;
+
+private:
+    BgpRib4 *rib;
+    BgpOutHandler *out;
+};
+
+// both address families over MP-BGP.
+static void makeConfig(BgpConfig &config, uint32_t asn, uint32_t peer_asn, const char *router_id, BgpOutHandler *out, BgpLogHandler *logger, BgpRib4 *rib4, BgpRib6 *rib6, Clock *clock) {
+    benchConfig(config, asn, peer_asn, router_id, out, logger, rib4, rib6, clock);
+    config.mp_bgp_ipv4 = true;
+    config.mp_bgp_ipv6 = true;
+    config.no_nexthop_check6 = true;
+}
+
+template <typename P>
+static void fillRib(BgpLogHandler *logger, BgpRib4 &rib4, BgpRib6 &rib6, const std::vector<P> &prefixes);
+
+template <>
+void fillRib<Prefix4>(BgpLogHandler *logger, BgpRib4 &rib4, __attribute__((unused)) BgpRib6 &rib6, const std::vector<Prefix4> &prefixes) {
+    BenchRng rng(1);
+    uint32_t nexthop = htonl(0xc0000201);
+    for (size_t i = 0; i < prefixes.size(); i += FSM_GROUP_SIZE) {
+        size_t end = i + FSM_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + FSM_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        rib4.insert(FSM_SRC_ROUTER_ID, group, benchAttribs(logger, rng, nexthop), 0, 0);
+    }
+}
+
+template <>
+void fillRib<Prefix6>(BgpLogHandler *logger, __attribute__((unused)) BgpRib4 &rib4, BgpRib6 &rib6, const std::vector<Prefix6> &prefixes) {
+    BenchRng rng(1);
+    uint8_t nexthop[16];
+    inet_pton(AF_INET6, "2001:db8::1", nexthop);
+    for (size_t i = 0; i < prefixes.size(); i += FSM_GROUP_SIZE) {
+        size_t end = i + FSM_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + FSM_GROUP_SIZE;
+        std::vector<Prefix6> group(prefixes.begin() + i, prefixes.begin() + end);
+        rib6.insert(FSM_SRC_ROUTER_ID, group, nexthop, NULL, benchAttribs(logger, rng, 0), 0, 0);
+    }
+}
+
+/**
+ * @brief Measure the time from start() until the receiving FSM has the full
+ * table in its RIB.
+ * 
+ * The sending FSM has the table in its RIB before the session comes up, and
+ * sends it to the peer once the session is ESTABLISHED. With single_threaded,
+ * the FSMs and the receiving RIB skip locking. (BgpConfig::single_threaded)
+ */
+template <typename P>
+static void benchConvergence(const char *family, const std::vector<P> &prefixes, bool single_threaded = false) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/%s/%zu/full-table-convergence%s", family, prefixes.size(), single_threaded ? "/no-locks" : "");
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 sender_rib4(&logger);
+    BgpRib6 sender_rib6(&logger);
+    fillRib(&logger, sender_rib4, sender_rib6, prefixes);
+
+    ManualClock clock;
+
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < benchOptions().runs; run++) {
+        LoopbackOutHandler to_receiver, to_sender;
+        BgpRib4 receiver_rib4(&logger, !single_threaded);
+        BgpRib6 receiver_rib6(&logger, !single_threaded);
+
+        BgpConfig sender_config, receiver_config;
+        makeConfig(sender_config, 65000, 65001, "10.0.0.1", &to_receiver, &logger, &sender_rib4, &sender_rib6, &clock);
+        makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &logger, &receiver_rib4, &receiver_rib6, &clock);
+        sender_config.single_threaded = receiver_config.single_threaded = single_threaded;
+
+        BgpFsm sender(sender_config);
+        BgpFsm receiver(receiver_config);
+        to_receiver.setPeer(&receiver, &sender);
+        to_sender.setPeer(&sender, &receiver);
+
+        uint64_t start = benchNow();
+        sender.start();
+        LoopbackOutHandler::flush();
+        uint64_t elapsed = benchNow() - start;
+
+        size_t received = P().afi == IPV4 ? receiver_rib4.get().size() : receiver_rib6.get().size();
+        if (received != prefixes.size() || receiver.getState() != ESTABLISHED) {
+            fprintf(stderr, "bench-fsm: receiver got %zu of %zu routes.\n", received, prefixes.size());
+            exit(1);
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(bench_name, prefixes.size(), best);
+}
+
+/**
+ * @brief Measure the time from start() until a route server has the full
+ * table from all of its FSM_PEERS peers.
+ * 
+ * Every peer sends the same table to its own FSM on the route server, and the
+ * route server FSMs share one RIB. Links go through queued loopback handlers
+ * with FSM_LINK_BANDWIDTH bps and FSM_LINK_LATENCY us, and the event loop
+ * jumps the simulated time to the next delivery, so the result does not
+ * depend on the wall clock.
+ */
+static void benchPeersConvergence(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/ipv4/%zu/%d-peers-convergence", prefixes.size(), FSM_PEERS);
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 peer_rib4(&logger);
+    BgpRib6 peer_rib6(&logger);
+    fillRib(&logger, peer_rib4, peer_rib6, prefixes);
+
+    uint64_t best = UINT64_MAX;
+    uint64_t sim_time = 0;
+    for (int run = 0; run < benchOptions().runs; run++) {
+        ManualClock clock;
+        BgpRib4 server_rib4(&logger);
+        BgpRib6 server_rib6(&logger);
+
+        std::vector<std::unique_ptr<LoopbackOutHandler>> handlers;
+        std::vector<std::unique_ptr<BgpFsm>> peers, servers;
+
+        for (int i = 0; i < FSM_PEERS; i++) {
+            LoopbackOutHandler *to_server = new LoopbackOutHandler(FSM_PEERS_QUEUE_SIZE, FSM_LINK_BANDWIDTH, FSM_LINK_LATENCY);
+            LoopbackOutHandler *to_peer = new LoopbackOutHandler(FSM_PEERS_QUEUE_SIZE, FSM_LINK_BANDWIDTH, FSM_LINK_LATENCY);
+            handlers.push_back(std::unique_ptr<LoopbackOutHandler>(to_server));
+            handlers.push_back(std::unique_ptr<LoopbackOutHandler>(to_peer));
+
+            char peer_id[INET_ADDRSTRLEN], server_id[INET_ADDRSTRLEN];
+            snprintf(peer_id, sizeof(peer_id), "10.0.1.%d", i + 1);
+            snprintf(server_id, sizeof(server_id), "10.0.2.%d", i + 1);
+
+            BgpConfig peer_config, server_config;
+            makeConfig(peer_config, 65100 + i, 65000, peer_id, to_server, &logger, &peer_rib4, &peer_rib6, &clock);
+            makeConfig(server_config, 65000, 65100 + i, server_id, to_peer, &logger, &server_rib4, &server_rib6, &clock);
+            peer_config.mp_bgp_ipv6 = server_config.mp_bgp_ipv6 = false;
+
+            peers.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(peer_config)));
+            servers.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(server_config)));
+            to_server->setPeer(servers.back().get(), peers.back().get());
+            to_peer->setPeer(peers.back().get(), servers.back().get());
+        }
+
+        uint64_t start = benchNow();
+        for (std::unique_ptr<BgpFsm> &peer : peers) peer->start();
+
+        uint64_t now = 0;
+        for (;;) {
+            uint64_t next = UINT64_MAX;
+            for (std::unique_ptr<LoopbackOutHandler> &handler : handlers) {
+                uint64_t t = handler->getNextDelivery();
+                if (t < next) next = t;
+            }
+            if (next == UINT64_MAX) break;
+
+            now = next;
+            clock.setTime(now / 1000000);
+            for (std::unique_ptr<LoopbackOutHandler> &handler : handlers) handler->setTime(now);
+            for (std::unique_ptr<LoopbackOutHandler> &handler : handlers) {
+                if (handler->pump(now) < 0) {
+                    fprintf(stderr, "bench-fsm: run() returned %d.\n", handler->getLastResult());
+                    exit(1);
+                }
+            }
+        }
+        uint64_t elapsed = benchNow() - start;
+
+        size_t received = server_rib4.get().size();
+        if (received != prefixes.size() * FSM_PEERS) {
+            fprintf(stderr, "bench-fsm: route server got %zu of %zu routes.\n", received, prefixes.size() * FSM_PEERS);
+            exit(1);
+        }
+
+        if (elapsed < best) best = elapsed;
+        sim_time = now;
+    }
+
+    benchReport(bench_name, prefixes.size() * FSM_PEERS, best);
+    printf("  (simulated convergence time: %.3f ms)\n", sim_time / 1000.0);
+}
+
+/**
+ * @brief Measure the time for the receiving FSM to take in a full table that
+ * is already on the wire, with the given number of decode threads.
+ * 
+ * The table is fed to run() FSM_DECODE_CHUNK bytes at a time, like a socket
+ * read loop on a fast link would.
+ */
+static void benchDecode(const std::vector<Prefix4> &prefixes, size_t threads) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/ipv4/%zu/decode-threads-%zu", prefixes.size(), threads);
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 sender_rib4(&logger);
+    BgpRib6 sender_rib6(&logger);
+    fillRib(&logger, sender_rib4, sender_rib6, prefixes);
+
+    ManualClock clock;
+
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < benchOptions().runs; run++) {
+        LoopbackOutHandler to_sender;
+        BgpRib4 receiver_rib4(&logger);
+        BgpRib6 receiver_rib6(&logger);
+
+        BgpConfig sender_config, receiver_config;
+        makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &logger, &sender_rib4, &sender_rib6, &clock);
+        makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &logger, &receiver_rib4, &receiver_rib6, &clock);
+        sender_config.mp_bgp_ipv6 = receiver_config.mp_bgp_ipv6 = false;
+        receiver_config.decode_threads = threads;
+
+        BgpFsm receiver(receiver_config);
+        RecordOutHandler to_receiver(&receiver);
+        sender_config.out_handler = &to_receiver;
+        BgpFsm sender(sender_config);
+        to_sender.setPeer(&sender, &receiver);
+
+        sender.start();
+        const std::vector<uint8_t> &wire = to_receiver.recorded;
+
+        uint64_t start = benchNow();
+        for (size_t off = 0; off < wire.size(); off += FSM_DECODE_CHUNK) {
+            size_t len = wire.size() - off < FSM_DECODE_CHUNK ? wire.size() - off : FSM_DECODE_CHUNK;
+            int ret = receiver.run(wire.data() + off, len);
+            if (ret < 0) {
+                fprintf(stderr, "bench-fsm: run() returned %d.\n", ret);
+                exit(1);
+            }
+        }
+        uint64_t elapsed = benchNow() - start;
+
+        size_t received = receiver_rib4.get().size();
+        if (received != prefixes.size() || receiver.getState() != ESTABLISHED) {
+            fprintf(stderr, "bench-fsm: receiver got %zu of %zu routes.\n", received, prefixes.size());
+            exit(1);
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(bench_name, prefixes.size(), best);
+    if (threads > 0 && std::thread::hardware_concurrency() <= 1) printf("  (one CPU: decoded inline)\n");
+}
+
+/**
+ * @brief Measure the heap used per idle session: right after the sessions are
+ * ESTABLISHED, and after they have been idle for BGP_FSM_BUFFER_IDLE_MS, with
+ * and without a shared BgpBufferPool.
+ * 
+ * Each session is a pair of FSMs sharing one RIB with no routes, so the heap
+ * used is the FSMs and their buffers. Reported per FSM.
+ */
+static void benchIdleMemory(bool use_pool) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/idle-memory/%d-sessions%s", FSM_IDLE_SESSIONS, use_pool ? "/pool" : "");
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    ManualClock clock;
+    BgpRib4 rib4(&logger);
+    BgpRib6 rib6(&logger);
+    BgpBufferPool pool;
+
+    std::vector<std::unique_ptr<LoopbackOutHandler>> handlers;
+    for (int i = 0; i < FSM_IDLE_SESSIONS * 2; i++) handlers.push_back(std::unique_ptr<LoopbackOutHandler>(new LoopbackOutHandler()));
+
+    std::vector<std::unique_ptr<BgpFsm>> fsms;
+    fsms.reserve(FSM_IDLE_SESSIONS * 2);
+
+    size_t heap_before = mallinfo2().uordblks;
+
+    for (int i = 0; i < FSM_IDLE_SESSIONS; i++) {
+        BgpConfig local_config, remote_config;
+        makeConfig(local_config, 65000, 65001, "10.0.0.1", handlers[i * 2].get(), &logger, &rib4, &rib6, &clock);
+        makeConfig(remote_config, 65001, 65000, "10.0.0.2", handlers[i * 2 + 1].get(), &logger, &rib4, &rib6, &clock);
+        if (use_pool) local_config.buffer_pool = remote_config.buffer_pool = &pool;
+
+        fsms.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(local_config)));
+        fsms.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(remote_config)));
+        handlers[i * 2]->setPeer(fsms[i * 2 + 1].get(), fsms[i * 2].get());
+        handlers[i * 2 + 1]->setPeer(fsms[i * 2].get(), fsms[i * 2 + 1].get());
+        fsms[i * 2]->start();
+        LoopbackOutHandler::flush();
+
+        if (fsms[i * 2]->getState() != ESTABLISHED) {
+            fprintf(stderr, "bench-fsm: session %d not established.\n", i);
+            exit(1);
+        }
+    }
+
+    size_t heap_established = mallinfo2().uordblks;
+
+    // idle, then a KEEPALIVE: the buffers are not released by the run()
+    // receiving it.
+    if (use_pool) {
+        uint8_t keepalive[64];
+        BgpKeepaliveMessage keep(&logger);
+        BgpPacket pkt(&logger, true, &keep);
+        ssize_t len = pkt.write(keepalive, sizeof(keepalive));
+        size_t in_use = pool.getBytesInUse();
+
+        clock.setTimeMs(clock.getTimeMs() + BGP_FSM_BUFFER_IDLE_MS);
+        for (std::unique_ptr<BgpFsm> &fsm : fsms) {
+            if (len < 0 || fsm->run(keepalive, len) <= 0) {
+                fprintf(stderr, "bench-fsm: failed to run KEEPALIVE after idle.\n");
+                exit(1);
+            }
+        }
+        LoopbackOutHandler::flush();
+
+        if (pool.getBytesInUse() != in_use) {
+            fprintf(stderr, "bench-fsm: buffers in use went from %zu to %zu receiving after idle.\n", in_use, pool.getBytesInUse());
+            exit(1);
+        }
+    }
+
+    clock.setTimeMs(clock.getTimeMs() + BGP_FSM_BUFFER_IDLE_MS);
+    for (std::unique_ptr<BgpFsm> &fsm : fsms) fsm->tick();
+    LoopbackOutHandler::flush();
+
+    size_t heap_idle = mallinfo2().uordblks;
+    size_t nfsms = FSM_IDLE_SESSIONS * 2;
+
+    printf("%-52s %10zu %12s %14s\n", bench_name, nfsms, "bytes/fsm", "");
+    printf("  established: %zu, idle: %zu", (heap_established - heap_before) / nfsms, (heap_idle - heap_before) / nfsms);
+    if (use_pool) printf(" (of which %zu cached in pool)", pool.getBytesCached() / nfsms);
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief Measure the time to bring up FSM_SETUP_SESSIONS sessions to one
+ * speaker, with collision detection on.
+ * 
+ * The speaker's FSMs share a route event bus, and a BgpSessionRegistry if
+ * use_registry is set. Without the registry, every OPEN asks every FSM on the
+ * bus about collisions. Reported per session.
+ */
+static void benchSessionSetup(bool use_registry) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/session-setup/%d-sessions%s", FSM_SETUP_SESSIONS, use_registry ? "/registry" : "/bus");
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    uint64_t best = UINT64_MAX;
+
+    for (int run = 0; run < benchOptions().runs; run++) {
+        ManualClock clock;
+        BgpRib4 rib4(&logger);
+        BgpRib6 rib6(&logger);
+        RouteEventBus bus;
+        BgpSessionRegistry registry;
+
+        std::vector<std::unique_ptr<LoopbackOutHandler>> handlers;
+        std::vector<std::unique_ptr<BgpRib4>> client_ribs4;
+        std::vector<std::unique_ptr<BgpRib6>> client_ribs6;
+        std::vector<std::unique_ptr<BgpFsm>> fsms;
+        fsms.reserve(FSM_SETUP_SESSIONS * 2);
+
+        for (int i = 0; i < FSM_SETUP_SESSIONS; i++) {
+            char client_id[32];
+            snprintf(client_id, sizeof(client_id), "10.1.%d.%d", i / 250, i % 250 + 1);
+
+            handlers.push_back(std::unique_ptr<LoopbackOutHandler>(new LoopbackOutHandler()));
+            handlers.push_back(std::unique_ptr<LoopbackOutHandler>(new LoopbackOutHandler()));
+            client_ribs4.push_back(std::unique_ptr<BgpRib4>(new BgpRib4(&logger)));
+            client_ribs6.push_back(std::unique_ptr<BgpRib6>(new BgpRib6(&logger)));
+
+            BgpConfig server_config, client_config;
+            makeConfig(server_config, 65000, 0, "10.0.0.1", handlers[i * 2].get(), &logger, &rib4, &rib6, &clock);
+            makeConfig(client_config, 65001, 65000, client_id, handlers[i * 2 + 1].get(), &logger, client_ribs4[i].get(), client_ribs6[i].get(), &clock);
+            server_config.no_collision_detection = false;
+            server_config.rev_bus = &bus;
+            if (use_registry) server_config.session_registry = &registry;
+
+            fsms.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(server_config)));
+            fsms.push_back(std::unique_ptr<BgpFsm>(new BgpFsm(client_config)));
+            handlers[i * 2]->setPeer(fsms[i * 2 + 1].get(), fsms[i * 2].get());
+            handlers[i * 2 + 1]->setPeer(fsms[i * 2].get(), fsms[i * 2 + 1].get());
+        }
+
+        uint64_t start = benchNow();
+        for (int i = 0; i < FSM_SETUP_SESSIONS; i++) {
+            fsms[i * 2 + 1]->start();
+            LoopbackOutHandler::flush();
+        }
+        uint64_t elapsed = benchNow() - start;
+
+        for (int i = 0; i < FSM_SETUP_SESSIONS; i++) {
+            if (fsms[i * 2]->getState() != ESTABLISHED) {
+                fprintf(stderr, "bench-fsm: session %d not established.\n", i);
+                exit(1);
+            }
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(bench_name, FSM_SETUP_SESSIONS, best);
+}
+
+// wire format UPDATE messages withdrawing or announcing the prefixes.
+static void flapUpdates(BgpLogHandler *logger, const std::vector<Prefix4> &prefixes, bool withdraw, std::vector<uint8_t> &wire) {
+    BenchRng rng(2);
+    uint8_t buffer[4096];
+
+    for (size_t i = 0; i < prefixes.size(); i += FSM_FLAP_UPDATE_SIZE) {
+        BgpUpdateMessage update(logger, true);
+        if (!withdraw) update.setAttribs(benchAttribs(logger, rng, htonl(0xc0000201)));
+        for (size_t j = i; j < i + FSM_FLAP_UPDATE_SIZE && j < prefixes.size(); j++) {
+            if (withdraw) update.addWithdrawn4(prefixes[j]);
+            else update.addNlri4(prefixes[j]);
+        }
+
+        BgpPacket pkt(logger, true, &update);
+        ssize_t len = pkt.write(buffer, sizeof(buffer));
+        if (len < 0) {
+            fprintf(stderr, "bench-fsm: failed to write UPDATE.\n");
+            exit(1);
+        }
+
+        wire.insert(wire.end(), buffer, buffer + len);
+    }
+}
+
+/**
+ * @brief Measure the cost of flap dampening on the inbound path, and the
+ * outbound churn it suppresses.
+ * 
+ * The receiving FSM has the full table. One in FSM_FLAP_RATIO prefixes then
+ * flaps FSM_FLAP_CYCLES times, and the peer goes quiet long enough for the
+ * suppressed routes to be reused. Reported per flapping route update, with
+ * the number of route changes published on the route event bus (i.e., sent
+ * on to other peers).
+ */
+static void benchFlap(const std::vector<Prefix4> &prefixes, bool dampening) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "fsm/ipv4/%zu/flap-%zu%s", prefixes.size(), prefixes.size() / FSM_FLAP_RATIO, dampening ? "/dampening" : "");
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 sender_rib4(&logger);
+    BgpRib6 sender_rib6(&logger);
+    fillRib(&logger, sender_rib4, sender_rib6, prefixes);
+
+    std::vector<Prefix4> flapping;
+    for (size_t i = 0; i < prefixes.size(); i += FSM_FLAP_RATIO) flapping.push_back(prefixes[i]);
+
+    std::vector<uint8_t> withdraw_wire, announce_wire;
+    flapUpdates(&logger, flapping, true, withdraw_wire);
+    flapUpdates(&logger, flapping, false, announce_wire);
+
+    uint64_t best = UINT64_MAX;
+    size_t churn = 0;
+    BgpFsmStatsSnapshot snap;
+
+    for (int run = 0; run < benchOptions().runs; run++) {
+        ManualClock clock;
+        LoopbackOutHandler to_sender;
+        BgpRib4 receiver_rib4(&logger);
+        BgpRib6 receiver_rib6(&logger);
+        RouteEventBus bus;
+        ChurnCounter counter;
+        bus.subscribe(&counter);
+
+        BgpConfig sender_config, receiver_config;
+        makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &logger, &sender_rib4, &sender_rib6, &clock);
+        makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &logger, &receiver_rib4, &receiver_rib6, &clock);
+        sender_config.mp_bgp_ipv6 = receiver_config.mp_bgp_ipv6 = false;
+        sender_config.hold_timer = receiver_config.hold_timer = 0;
+        receiver_config.rev_bus = &bus;
+        receiver_config.dampening = dampening;
+
+        BgpFsm receiver(receiver_config);
+        RecordOutHandler to_receiver(&receiver);
+        sender_config.out_handler = &to_receiver;
+        BgpFsm sender(sender_config);
+        to_sender.setPeer(&sender, &receiver);
+
+        sender.start();
+        const std::vector<uint8_t> &table = to_receiver.recorded;
+        if (receiver.run(table.data(), table.size()) < 0 || receiver_rib4.get().size() != prefixes.size()) {
+            fprintf(stderr, "bench-fsm: receiver did not get the table.\n");
+            exit(1);
+        }
+
+        counter.changes = 0;
+
+        uint64_t start = benchNow();
+        for (int cycle = 0; cycle < FSM_FLAP_CYCLES; cycle++) {
+            receiver.run(withdraw_wire.data(), withdraw_wire.size());
+            clock.setTimeMs(clock.getTimeMs() + FSM_FLAP_INTERVAL_MS / 2);
+            receiver.tick();
+            receiver.run(announce_wire.data(), announce_wire.size());
+            clock.setTimeMs(clock.getTimeMs() + FSM_FLAP_INTERVAL_MS / 2);
+            receiver.tick();
+        }
+
+        for (uint64_t quiet = 0; quiet < FSM_FLAP_QUIET_MS; quiet += FSM_FLAP_TICK_MS) {
+            clock.setTimeMs(clock.getTimeMs() + FSM_FLAP_TICK_MS);
+            receiver.tick();
+        }
+        uint64_t elapsed = benchNow() - start;
+
+        if (receiver.getState() != ESTABLISHED || receiver_rib4.get().size() != prefixes.size()) {
+            fprintf(stderr, "bench-fsm: receiver has %zu of %zu routes after flapping.\n", receiver_rib4.get().size(), prefixes.size());
+            exit(1);
+        }
+
+        churn = counter.changes;
+        receiver.getStats().snapshot(snap);
+        bus.unsubscribe(&counter);
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(bench_name, flapping.size() * FSM_FLAP_CYCLES * 2, best);
+    printf("  published: %zu, held back: %llu, suppressed: %llu, reused: %llu\n", churn, (unsigned long long) snap.prefixes_dampened, (unsigned long long) snap.prefixes_suppressed, (unsigned long long) snap.prefixes_reused);
+    fflush(stdout);
+}
+
+/**
+ * @brief Check that the receiving FSM doesn't write with its RIB locked: a
+ * batch of UPDATEs, read at once, ending with a malformed one is answered
+ * with a NOTIFICATION. Writing with the lock held can deadlock an out handler
+ * that runs another FSM. (e.g., LoopbackOutHandler in direct mode)
+ * 
+ */
+static void checkWriteUnlocked() {
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    ManualClock clock;
+    BgpRib4 sender_rib4(&logger), receiver_rib4(&logger);
+    BgpRib6 sender_rib6(&logger), receiver_rib6(&logger);
+    LoopbackOutHandler to_sender;
+    LockCheckOutHandler checker(&receiver_rib4, &to_sender);
+
+    BgpConfig sender_config, receiver_config;
+    makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &logger, &sender_rib4, &sender_rib6, &clock);
+    makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &checker, &logger, &receiver_rib4, &receiver_rib6, &clock);
+
+    BgpFsm receiver(receiver_config);
+    RecordOutHandler to_receiver(&receiver);
+    sender_config.out_handler = &to_receiver;
+    BgpFsm sender(sender_config);
+    to_sender.setPeer(&sender, &receiver);
+
+    sender.start();
+    if (receiver.getState() != ESTABLISHED) {
+        fprintf(stderr, "bench-fsm: lock check session not established.\n");
+        exit(1);
+    }
+
+    std::vector<Prefix4> prefixes = benchPrefixes4(100, 1);
+    std::vector<std::vector<uint8_t>> updates = benchUpdates4(&logger, prefixes, FSM_GROUP_SIZE, htonl(0xc0000201), 1);
+    std::vector<uint8_t> batch;
+    for (const std::vector<uint8_t> &update : updates) batch.insert(batch.end(), update.begin(), update.end());
+
+    // ORIGIN is the first attribute: header, withdrawn routes length (0),
+    // attributes length, then flags, type, length and the value.
+    std::vector<uint8_t> bad = updates[0];
+    bad[19 + 2 + 2 + 3] = 7;
+    batch.insert(batch.end(), bad.begin(), bad.end());
+
+    checker.writes = 0;
+    receiver.run(batch.data(), batch.size());
+
+    if (receiver.getState() == ESTABLISHED || checker.writes == 0 || checker.locked_writes != 0) {
+        fprintf(stderr, "bench-fsm: %zu of %zu writes made with the RIB locked.\n", checker.locked_writes, checker.writes);
+        exit(1);
+    }
+}
+
+/**
+ * @brief Check that route events are published with the RIB unlocked: a
+ * route server session, sharing the receiver's RIB, writes the routes the
+ * receiver learns (new best routes) and drops (replaced by routes of another
+ * speaker) to its own peer. A slow peer would otherwise stall every session
+ * on the RIB.
+ * 
+ */
+static void checkEgressUnlocked() {
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    ManualClock clock;
+    RouteEventBus bus;
+    BgpRib4 sender_rib4(&logger), receiver_rib4(&logger), downstream_rib4(&logger);
+    BgpRib6 sender_rib6(&logger), receiver_rib6(&logger), downstream_rib6(&logger);
+
+    // routes of another speaker, replaced by the receiver's and back.
+    std::vector<Prefix4> prefixes = benchPrefixes4(100, 1);
+    BenchRng rng(2);
+    receiver_rib4.insert(0x09090909, prefixes, benchAttribs(&logger, rng, htonl(0xc0000202)), -1, 0);
+
+    LoopbackOutHandler to_sender, to_subscriber, to_downstream;
+    LockCheckOutHandler checker(&receiver_rib4, &to_downstream);
+
+    BgpConfig sender_config, receiver_config, subscriber_config, downstream_config;
+    makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &logger, &sender_rib4, &sender_rib6, &clock);
+    makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &logger, &receiver_rib4, &receiver_rib6, &clock);
+    makeConfig(subscriber_config, 65001, 65002, "10.0.0.3", &checker, &logger, &receiver_rib4, &receiver_rib6, &clock);
+    makeConfig(downstream_config, 65002, 65001, "10.0.0.4", &to_subscriber, &logger, &downstream_rib4, &downstream_rib6, &clock);
+    receiver_config.rev_bus = subscriber_config.rev_bus = &bus;
+
+    BgpFsm receiver(receiver_config);
+    BgpFsm subscriber(subscriber_config);
+    BgpFsm downstream(downstream_config);
+    RecordOutHandler to_receiver(&receiver);
+    sender_config.out_handler = &to_receiver;
+    BgpFsm sender(sender_config);
+    to_sender.setPeer(&sender, &receiver);
+    to_downstream.setPeer(&downstream, &subscriber);
+    to_subscriber.setPeer(&subscriber, &downstream);
+
+    subscriber.start();
+    sender.start();
+    if (receiver.getState() != ESTABLISHED || subscriber.getState() != ESTABLISHED) {
+        fprintf(stderr, "bench-fsm: egress check sessions not established.\n");
+        exit(1);
+    }
+
+    std::vector<std::vector<uint8_t>> updates = benchUpdates4(&logger, prefixes, FSM_GROUP_SIZE, htonl(0xc0000201), 1);
+    std::vector<uint8_t> batch;
+    for (const std::vector<uint8_t> &update : updates) batch.insert(batch.end(), update.begin(), update.end());
+
+    checker.writes = 0;
+    receiver.run(batch.data(), batch.size());
+    size_t add_writes = checker.writes;
+
+    // session goes down, the other speaker's routes are best again.
+    receiver.stop();
+
+    if (add_writes == 0 || checker.writes == add_writes || checker.locked_writes != 0) {
+        fprintf(stderr, "bench-fsm: %zu of %zu route server writes made with the RIB locked (%zu for new routes).\n", checker.locked_writes, checker.writes, add_writes);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+
+    checkWriteUnlocked();
+    checkEgressUnlocked();
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        benchConvergence("ipv4", benchPrefixes4(n, 1));
+        benchConvergence("ipv6", benchPrefixes6(n, 1));
+        benchConvergence("ipv4", benchPrefixes4(n, 1), true);
+    }
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes && n <= FSM_PEERS_MAX_PREFIXES; n *= 10) {
+        benchPeersConvergence(benchPrefixes4(n, 1));
+    }
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        std::vector<Prefix4> prefixes = benchPrefixes4(n, 1);
+        for (size_t threads = 0; threads <= FSM_DECODE_MAX_THREADS; threads = threads == 0 ? 1 : threads * 2) {
+            benchDecode(prefixes, threads);
+        }
+    }
+
+    benchIdleMemory(false);
+    benchIdleMemory(true);
+
+    benchSessionSetup(false);
+    benchSessionSetup(true);
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        std::vector<Prefix4> prefixes = benchPrefixes4(n, 1);
+        benchFlap(prefixes, false);
+        benchFlap(prefixes, true);
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file bench-prefix.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark Prefix4/Prefix6 parse, write and includes.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench.h"
+#include "bench-table.h"
+
+using namespace libbgp;
+
+#define PREFIX_COUNT 100000
+
+template <typename T>
+static void benchPrefix(const char *family, const std::vector<T> &prefixes) {
+    char bench_name[128];
+    std::vector<uint8_t> wire(prefixes.size() * 17);
+    size_t wire_len = 0;
+
+    for (const T &prefix : prefixes) {
+        wire_len += prefix.write(&wire[wire_len], wire.size() - wire_len);
+    }
+
+    snprintf(bench_name, sizeof(bench_name), "prefix/%s/parse", family);
+    benchRun(bench_name, prefixes.size(), [&]() {
+        size_t offset = 0;
+        T prefix;
+        while (offset < wire_len) {
+            offset += prefix.parse(&wire[offset], wire_len - offset);
+        }
+        benchKeep(prefix);
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "prefix/%s/write", family);
+    benchRun(bench_name, prefixes.size(), [&]() {
+        size_t offset = 0;
+        for (const T &prefix : prefixes) {
+            offset += prefix.write(&wire[offset], wire.size() - offset);
+        }
+        benchKeep(offset);
+    });
+
+    // includes() against a neighbour, so roughly half the checks match on
+    // the leading bits and need the full mask compare.
+    snprintf(bench_name, sizeof(bench_name), "prefix/%s/includes", family);
+    benchRun(bench_name, prefixes.size(), [&]() {
+        size_t matches = 0;
+        for (size_t i = 0; i < prefixes.size(); i++) {
+            if (prefixes[i].includes(prefixes[(i + 1) % prefixes.size()])) matches++;
+        }
+        benchKeep(matches);
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "prefix/%s/compare", family);
+    benchRun(bench_name, prefixes.size(), [&]() {
+        size_t matches = 0;
+        for (size_t i = 0; i < prefixes.size(); i++) {
+            if (prefixes[i] == prefixes[(i * 7) % prefixes.size()]) matches++;
+        }
+        benchKeep(matches);
+    });
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+
+    benchPrefix("ipv4", benchPrefixes4(PREFIX_COUNT, 1));
+    benchPrefix("ipv6", benchPrefixes6(PREFIX_COUNT, 1));
+
+    return 0;
+}
@@ -0,0 +1,372 @@
+/**
+ * @file bench-rib.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark BgpRib4/BgpRib6 insert, withdraw, discard and lookup,
+ * BgpRib4Views for route servers, and nexthop tracking.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-rib4.h"
+#include "bgp-rib6.h"
+#include "bgp-rib4-views.h"
+#include "bgp-nexthop-tracker.h"
+#include <arpa/inet.h>
+#include <malloc.h>
+
+using namespace libbgp;
+
+// number of prefixes sharing one attribute set (one UPDATE message).
+#define RIB_GROUP_SIZE 20
+
+// router IDs of the two simulated peers.
+#define RIB_PEER_A 0x01010101
+#define RIB_PEER_B 0x02020202
+
+// route server benchmark: number of peers sending a full table, and number of
+// client views.
+#define RIB_VIEWS_PEERS 4
+#define RIB_VIEWS_CLIENTS 200
+
+// nexthop tracking benchmark: number of distinct IBGP nexthops, and number of
+// IGP changes.
+#define RIB_NEXTHOPS 1000
+#define RIB_NEXTHOP_CHANGES 1000
+
+static BgpLogHandler logger;
+static uint8_t nexthop6[16];
+
+static void ribInsert(BgpRib4 &rib, uint32_t src, const std::vector<Prefix4> &routes, const BenchAttribs &attribs) {
+    rib.insert(src, routes, attribs, 0, 0);
+}
+
+static void ribInsert(BgpRib6 &rib, uint32_t src, const std::vector<Prefix6> &routes, const BenchAttribs &attribs) {
+    rib.insert(src, routes, nexthop6, NULL, attribs, 0, 0);
+}
+
+static const void* ribLookup(BgpRib4 &rib, const Prefix4 &prefix) {
+    return rib.lookup(prefix.getPrefix());
+}
+
+static const void* ribLookup(BgpRib6 &rib, const Prefix6 &prefix) {
+    uint8_t addr[16];
+    prefix.getPrefix(addr);
+    return rib.lookup(addr);
+}
+
+/**
+ * @brief A generated table: prefixes split in groups, each group has its own
+ * attribute set.
+ * 
+ */
+template <typename P>
+struct RibTable {
+    std::vector<std::vector<P>> groups;
+    std::vector<BenchAttribs> attribs;
+};
+
+template <typename P>
+static RibTable<P> makeTable(const std::vector<P> &prefixes, uint64_t seed) {
+    RibTable<P> table;
+    BenchRng rng(seed);
+    uint32_t nexthop = htonl(0xc0000201);
+
+    for (size_t i = 0; i < prefixes.size(); i += RIB_GROUP_SIZE) {
+        size_t end = i + RIB_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + RIB_GROUP_SIZE;
+        table.groups.push_back(std::vector<P>(prefixes.begin() + i, prefixes.begin() + end));
+        table.attribs.push_back(benchAttribs(&logger, rng, P().afi == IPV4 ? nexthop : 0));
+    }
+
+    return table;
+}
+
+template <typename R, typename P>
+static void fill(R &rib, uint32_t src, const RibTable<P> &table) {
+    for (size_t i = 0; i < table.groups.size(); i++) {
+        ribInsert(rib, src, table.groups[i], table.attribs[i]);
+    }
+}
+
+template <typename R, typename P>
+static void benchRib(const char *family, const std::vector<P> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+    RibTable<P> table_a = makeTable(prefixes, 1);
+    RibTable<P> table_b = makeTable(prefixes, 2);
+    std::unique_ptr<R> rib;
+
+    snprintf(bench_name, sizeof(bench_name), "rib/%s/%zu/insert", family, n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new R(&logger));
+    }, [&]() {
+        fill(*rib, RIB_PEER_A, table_a);
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/%s/%zu/insert-second-path", family, n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new R(&logger));
+        fill(*rib, RIB_PEER_A, table_a);
+    }, [&]() {
+        fill(*rib, RIB_PEER_B, table_b);
+    });
+
+    // lookup() scans the RIB, scale the number of lookups down with size.
+    size_t lookups = 10000000 / n;
+    if (lookups < 10) lookups = 10;
+    rib.reset(new R(&logger));
+    fill(*rib, RIB_PEER_A, table_a);
+    snprintf(bench_name, sizeof(bench_name), "rib/%s/%zu/lookup", family, n);
+    benchRun(bench_name, lookups, [&]() {
+        for (size_t i = 0; i < lookups; i++) {
+            benchKeep(ribLookup(*rib, prefixes[(i * 7919) % n]));
+        }
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/%s/%zu/withdraw", family, n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new R(&logger));
+        fill(*rib, RIB_PEER_A, table_a);
+        fill(*rib, RIB_PEER_B, table_b);
+    }, [&]() {
+        for (const P &prefix : prefixes) {
+            benchKeep(rib->withdraw(RIB_PEER_A, prefix));
+        }
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/%s/%zu/discard", family, n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new R(&logger));
+        fill(*rib, RIB_PEER_A, table_a);
+        fill(*rib, RIB_PEER_B, table_b);
+    }, [&]() {
+        benchKeep(rib->discard(RIB_PEER_A));
+    });
+}
+
+/**
+ * @brief Same as the insert and withdraw benchmarks, but with the whole table
+ * applied as one BgpRib4Batch.
+ * 
+ */
+static void benchRibBatch(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+    RibTable<Prefix4> table_a = makeTable(prefixes, 1);
+    RibTable<Prefix4> table_b = makeTable(prefixes, 2);
+    std::unique_ptr<BgpRib4> rib;
+    BgpRibChanges<BgpRib4Entry> changes;
+
+    BgpRib4Batch insert_batch;
+    for (size_t i = 0; i < table_a.groups.size(); i++) {
+        insert_batch.insert(table_a.groups[i], insert_batch.addAttribs(table_a.attribs[i]));
+    }
+
+    BgpRib4Batch withdraw_batch;
+    withdraw_batch.withdraw(prefixes);
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/insert-batch", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+        changes.clear();
+    }, [&]() {
+        benchKeep(rib->apply(RIB_PEER_A, insert_batch, 0, 0, changes));
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/withdraw-batch", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+        fill(*rib, RIB_PEER_A, table_a);
+        fill(*rib, RIB_PEER_B, table_b);
+        changes.clear();
+    }, [&]() {
+        benchKeep(rib->apply(RIB_PEER_A, withdraw_batch, 0, 0, changes));
+    });
+}
+
+/**
+ * @brief Local route origination: one route at a time with the local insert(),
+ * and the whole table with originate() / retract().
+ * 
+ */
+static void benchRibLocal(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+    uint32_t nexthop;
+    inet_pton(AF_INET, "192.0.2.1", &nexthop);
+    std::unique_ptr<BgpRib4> rib;
+    BgpRibChanges<BgpRib4Entry> changes;
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/insert-local", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+    }, [&]() {
+        for (const Prefix4 &prefix : prefixes) benchKeep(rib->insert(&logger, prefix, nexthop));
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/originate", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+        changes.clear();
+    }, [&]() {
+        benchKeep(rib->originate(&logger, prefixes, nexthop, 0, changes));
+    });
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/retract", n);
+    benchRun(bench_name, n, [&]() {
+        rib.reset(new BgpRib4(&logger));
+        rib->originate(&logger, prefixes, nexthop, 0, changes);
+        changes.clear();
+    }, [&]() {
+        benchKeep(rib->retract(prefixes, changes));
+    });
+}
+
+/**
+ * @brief Route server with RIB_VIEWS_CLIENTS clients, RIB_VIEWS_PEERS of them
+ * sending a full table: time to insert the tables into BgpRib4Views, and the
+ * heap used by the views compared to one BgpRib4 holding the same tables.
+ * 
+ */
+static void benchRibViews(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+    std::vector<RibTable<Prefix4>> tables;
+    for (int i = 0; i < RIB_VIEWS_PEERS; i++) tables.push_back(makeTable(prefixes, i + 1));
+
+    std::unique_ptr<BgpRib4Views> views;
+    std::vector<BgpRib4ViewChange> changes;
+
+    auto addViews = [&]() {
+        views.reset(new BgpRib4Views(&logger));
+        for (int i = 0; i < RIB_VIEWS_CLIENTS; i++) views->addView(htonl(0x0a000001 + i));
+    };
+
+    auto fillViews = [&]() {
+        for (int peer = 0; peer < RIB_VIEWS_PEERS; peer++) {
+            const RibTable<Prefix4> &table = tables[peer];
+            for (size_t i = 0; i < table.groups.size(); i++) {
+                changes.clear();
+                views->insert(htonl(0x0a000001 + peer), table.groups[i], table.attribs[i], 0, 0, changes);
+            }
+        }
+    };
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/views-insert/%d-views", n, RIB_VIEWS_CLIENTS);
+    benchRun(bench_name, n * RIB_VIEWS_PEERS, addViews, fillViews);
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/views-memory/%d-views", n, RIB_VIEWS_CLIENTS);
+    if (!benchEnabled(bench_name)) return;
+
+    views.reset();
+    changes.clear();
+    changes.shrink_to_fit();
+
+    size_t heap_before = mallinfo2().uordblks;
+    std::unique_ptr<BgpRib4> rib(new BgpRib4(&logger));
+    for (int peer = 0; peer < RIB_VIEWS_PEERS; peer++) fill(*rib, htonl(0x0a000001 + peer), tables[peer]);
+    size_t heap_rib = mallinfo2().uordblks - heap_before;
+    rib.reset();
+
+    heap_before = mallinfo2().uordblks;
+    addViews();
+    fillViews();
+    changes.clear();
+    changes.shrink_to_fit();
+    size_t heap_views = mallinfo2().uordblks - heap_before;
+    views.reset();
+
+    printf("%-52s %10d %12s %14s\n", bench_name, RIB_VIEWS_CLIENTS, "MiB", "");
+    printf("  one BgpRib4: %.1f, %d views: %.1f (%.1f BgpRib4s)\n", heap_rib / 1048576.0, RIB_VIEWS_CLIENTS, heap_views / 1048576.0, (double) heap_views / heap_rib);
+    fflush(stdout);
+}
+
+/**
+ * @brief IBGP table with RIB_NEXTHOPS nexthops, each resolved by an IGP /32:
+ * time to handle an IGP metric change of one nexthop with BgpNexthopTracker
+ * (find the changed nexthop and the routes using it), compared to walking the
+ * whole table and resolving every route's nexthop again.
+ * 
+ */
+static void benchRibNexthop(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128];
+    size_t n = prefixes.size();
+    BenchRng rng(1);
+
+    BgpNexthopTable igp;
+    BgpNexthopTracker tracker(&igp);
+    BgpRib4 rib(&logger);
+    rib.setNexthopTracker(&tracker);
+
+    std::vector<uint32_t> nexthops;
+    for (int i = 0; i < RIB_NEXTHOPS; i++) {
+        nexthops.push_back(htonl(0x0a000001 + i));
+        igp.add(Prefix4(nexthops[i], 32), 10);
+    }
+
+    for (size_t i = 0; i < n; i += RIB_GROUP_SIZE) {
+        size_t end = i + RIB_GROUP_SIZE > n ? n : i + RIB_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        rib.insert(RIB_PEER_A, group, benchAttribs(&logger, rng, nexthops[(i / RIB_GROUP_SIZE) % RIB_NEXTHOPS]), 0, 65000);
+    }
+
+    std::vector<BgpNexthopChange> changes;
+    std::vector<BgpNexthopRoute> routes;
+    uint32_t metric = 10;
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/nexthop-igp-change/tracked", n);
+    benchRun(bench_name, RIB_NEXTHOP_CHANGES, [&]() {
+        for (int i = 0; i < RIB_NEXTHOP_CHANGES; i++) {
+            Prefix4 igp_route(nexthops[i % RIB_NEXTHOPS], 32);
+            igp.add(igp_route, ++metric);
+
+            changes.clear();
+            tracker.invalidate(igp_route, changes);
+
+            routes.clear();
+            for (const BgpNexthopChange &change : changes) tracker.getRoutes(change.nexthop, routes);
+            benchKeep(routes.size());
+        }
+    });
+
+    // a full walk per change, scale the number of changes down with size.
+    size_t walks = 10000000 / n;
+    if (walks < 10) walks = 10;
+
+    snprintf(bench_name, sizeof(bench_name), "rib/ipv4/%zu/nexthop-igp-change/rewalk", n);
+    benchRun(bench_name, walks, [&]() {
+        for (size_t i = 0; i < walks; i++) {
+            igp.add(Prefix4(nexthops[i % RIB_NEXTHOPS], 32), ++metric);
+
+            size_t reachable = 0;
+            for (const auto &entry : rib.get()) {
+                if (entry.second.src != SRC_IBGP) continue;
+                uint32_t nexthop_metric;
+                if (igp.resolve(entry.second.getNexthop(), nexthop_metric)) reachable++;
+            }
+            benchKeep(reachable);
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    logger.setLogLevel(FATAL);
+    inet_pton(AF_INET6, "2001:db8::1", nexthop6);
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        benchRib<BgpRib4>("ipv4", benchPrefixes4(n, 1));
+        benchRibBatch(benchPrefixes4(n, 1));
+        benchRibLocal(benchPrefixes4(n, 1));
+        benchRibNexthop(benchPrefixes4(n, 1));
+        benchRib<BgpRib6>("ipv6", benchPrefixes6(n, 1));
+    }
+
+    size_t views_n = benchOptions().max_prefixes < 100000 ? benchOptions().max_prefixes : 100000;
+    benchRibViews(benchPrefixes4(views_n, 1));
+
+    return 0;
+}
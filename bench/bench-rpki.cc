@@ -0,0 +1,666 @@
+/**
+ * @file bench-rpki.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark RPKI origin validation: VRP trie lookups, RTR sync with a
+ * stand-in cache, and incremental revalidation of a full table on VRP deltas.
+ * @version 0.1
+ * @date 2019-09-09
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-fsm.h"
+#include "bgp-packet.h"
+#include "bgp-rpki.h"
+#include "bgp-rtr-client.h"
+#include "bgp-update-message.h"
+#include "loopback-out-handler.h"
+#include "manual-clock.h"
+#include <arpa/inet.h>
+#include <memory>
+#include <set>
+#include <tuple>
+
+using namespace libbgp;
+
+#define RPKI_ROUTES 100000
+#define RPKI_LINEAR_MAX_VRPS 10000
+#define RPKI_GROUP_SIZE 20
+#define RPKI_SRC_ROUTER_ID 0x03030303
+
+// bytes passed to BgpRtrClient::run() at a time, like TCP segments.
+#define RPKI_SEGMENT_SIZE 1460
+
+// delta benchmark: one in RPKI_DELTA_RATIO routes turns invalid and back,
+// RPKI_DELTA_CYCLES times.
+#define RPKI_DELTA_RATIO 1000
+#define RPKI_DELTA_CYCLES 10
+
+static BgpLogHandler logger;
+
+// netmask of a prefix length, in host bytes order.
+static inline uint32_t hostMask(uint8_t length) {
+    return length == 0 ? 0 : 0xffffffff << (32 - length);
+}
+
+/**
+ * @brief A stand-in RPKI cache: answers the queries written by a
+ * BgpRtrClient, as an RTR server would. (RFC 8210)
+ *
+ * Only the last delta is kept; older Serial Queries get a Cache Reset.
+ */
+class BenchRtrCache : public BgpOutHandler {
+public:
+    BenchRtrCache(uint8_t max_version, const std::vector<BgpVrp> &vrps) : max_version(max_version), version(max_version), session_id(42), serial(1) {
+        for (const BgpVrp &vrp : vrps) this->vrps.insert(key(vrp));
+    }
+
+    // change the VRPs, and notify the client.
+    void update(const std::vector<BgpVrp> &announced, const std::vector<BgpVrp> &withdrawn) {
+        last_announced = announced;
+        last_withdrawn = withdrawn;
+        for (const BgpVrp &vrp : withdrawn) vrps.erase(key(vrp));
+        for (const BgpVrp &vrp : announced) vrps.insert(key(vrp));
+        serial++;
+
+        uint8_t *ptr = header(RTR_SERIAL_NOTIFY, session_id, 12);
+        putLong(ptr, serial);
+    }
+
+    // pass the responses to the client. returns the last result of run().
+    int pump(BgpRtrClient &client) {
+        int ret = 1;
+
+        while (out.size() > 0) {
+            std::vector<uint8_t> pending;
+            pending.swap(out);
+
+            for (size_t off = 0; off < pending.size() && ret > 0; off += RPKI_SEGMENT_SIZE) {
+                size_t len = pending.size() - off < RPKI_SEGMENT_SIZE ? pending.size() - off : RPKI_SEGMENT_SIZE;
+                ret = client.run(pending.data() + off, len);
+            }
+
+            // version downgrade: reconnect.
+            if (ret == 0) {
+                out.clear();
+                version = max_version;
+                ret = client.start();
+            }
+
+            if (ret < 0) return ret;
+        }
+
+        return ret;
+    }
+
+    size_t getVrpCount() const {
+        return vrps.size();
+    }
+
+    uint32_t getSerial() const {
+        return serial;
+    }
+
+    bool handleOut(const uint8_t *buffer, size_t length) {
+        if (length < 8) return false;
+
+        uint8_t query_version = buffer[0];
+        uint8_t type = buffer[1];
+
+        if (query_version > max_version) {
+            // error report: no PDU or text included.
+            version = max_version;
+            uint8_t *ptr = header(RTR_ERROR_REPORT, RTR_E_UNSUPPORTED_VERSION, 16);
+            ptr = putLong(ptr, 0);
+            putLong(ptr, 0);
+            return true;
+        }
+
+        version = query_version;
+
+        if (type == RTR_RESET_QUERY) {
+            header(RTR_CACHE_RESPONSE, session_id, 8);
+            for (const VrpKey &vrp : vrps) prefix(vrp, true);
+            endOfData();
+            return true;
+        }
+
+        if (type == RTR_SERIAL_QUERY) {
+            uint32_t client_serial;
+            memcpy(&client_serial, buffer + 8, sizeof(client_serial));
+            client_serial = ntohl(client_serial);
+
+            if (client_serial != serial && client_serial != serial - 1) {
+                header(RTR_CACHE_RESET, 0, 8);
+                return true;
+            }
+
+            header(RTR_CACHE_RESPONSE, session_id, 8);
+            if (client_serial != serial) {
+                for (const BgpVrp &vrp : last_withdrawn) prefix(key(vrp), false);
+                for (const BgpVrp &vrp : last_announced) prefix(key(vrp), true);
+            }
+            endOfData();
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+    typedef std::tuple<uint32_t, uint8_t, uint8_t, uint32_t> VrpKey;
+
+    static VrpKey key(const BgpVrp &vrp) {
+        uint8_t length = vrp.prefix.getLength();
+        return VrpKey(ntohl(vrp.prefix.getPrefix()) & hostMask(length), length, vrp.max_length, vrp.asn);
+    }
+
+    static uint8_t* putLong(uint8_t *ptr, uint32_t value) {
+        value = htonl(value);
+        memcpy(ptr, &value, sizeof(value));
+        return ptr + sizeof(value);
+    }
+
+    // append a PDU of length bytes to out, returns pointer past its header.
+    uint8_t* header(uint8_t type, uint16_t field, uint32_t length) {
+        size_t off = out.size();
+        out.resize(off + length);
+        uint8_t *ptr = out.data() + off;
+        ptr[0] = version;
+        ptr[1] = type;
+        field = htons(field);
+        memcpy(ptr + 2, &field, sizeof(field));
+        return putLong(ptr + 4, length);
+    }
+
+    void prefix(const VrpKey &vrp, bool announce) {
+        uint8_t *ptr = header(RTR_IPV4_PREFIX, 0, 20);
+        ptr[0] = announce ? 1 : 0;
+        ptr[1] = std::get<1>(vrp);
+        ptr[2] = std::get<2>(vrp);
+        ptr[3] = 0;
+        ptr = putLong(ptr + 4, std::get<0>(vrp));
+        putLong(ptr, std::get<3>(vrp));
+    }
+
+    void endOfData() {
+        uint8_t *ptr = header(RTR_END_OF_DATA, session_id, version == 0 ? 12 : 24);
+        ptr = putLong(ptr, serial);
+        if (version == 0) return;
+        ptr = putLong(ptr, 3600);
+        ptr = putLong(ptr, 600);
+        putLong(ptr, 7200);
+    }
+
+    uint8_t max_version;
+    uint8_t version;
+    uint16_t session_id;
+    uint32_t serial;
+    std::set<VrpKey> vrps;
+    std::vector<BgpVrp> last_announced;
+    std::vector<BgpVrp> last_withdrawn;
+    std::vector<uint8_t> out;
+};
+
+// generate n VRPs covering the routes: the prefix shortened by up to 3 bits,
+// max length up to 1 more than the route. one in 8 has another origin AS.
+static std::vector<BgpVrp> makeVrps(const std::vector<Prefix4> &routes, const std::vector<uint32_t> &origins, size_t n, uint64_t seed) {
+    BenchRng rng(seed);
+    std::vector<BgpVrp> vrps;
+    vrps.reserve(n);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t r = rng.range(routes.size());
+        uint8_t route_length = routes[r].getLength();
+        uint8_t shorten = rng.range(4);
+        uint8_t length = route_length > 8 + shorten ? route_length - shorten : 8;
+
+        BgpVrp vrp;
+        vrp.prefix = Prefix4(htonl(ntohl(routes[r].getPrefix()) & hostMask(length)), length);
+        vrp.max_length = route_length + rng.range(2);
+        if (vrp.max_length > 32) vrp.max_length = 32;
+        if (vrp.max_length < length) vrp.max_length = length;
+        vrp.asn = rng.range(8) == 0 ? 64512 + rng.range(1000) : origins[r];
+        vrps.push_back(vrp);
+    }
+
+    return vrps;
+}
+
+// the naive way: scan all VRPs for each route.
+static BgpRpkiState validateLinear(const std::vector<BgpVrp> &vrps, const Prefix4 &route, uint32_t origin_as) {
+    uint32_t addr = ntohl(route.getPrefix());
+    uint8_t route_length = route.getLength();
+    BgpRpkiState state = RPKI_NOT_FOUND;
+
+    for (const BgpVrp &vrp : vrps) {
+        uint8_t length = vrp.prefix.getLength();
+        if (length > route_length || (addr & hostMask(length)) != ntohl(vrp.prefix.getPrefix())) continue;
+        if (vrp.asn != 0 && vrp.asn == origin_as && route_length <= vrp.max_length) return RPKI_VALID;
+        state = RPKI_INVALID;
+    }
+
+    return state;
+}
+
+/**
+ * @brief Measure validation of routes against n VRPs, with the trie and with
+ * a linear scan of the VRPs.
+ *
+ */
+static void benchValidate(size_t n) {
+    char bench_name[128];
+
+    std::vector<Prefix4> routes = benchPrefixes4(RPKI_ROUTES, 1);
+    std::vector<uint32_t> origins;
+    BenchRng rng(7);
+    for (size_t i = 0; i < routes.size(); i++) origins.push_back(64512 + rng.range(1000));
+
+    std::vector<BgpVrp> vrps = makeVrps(routes, origins, n, 42);
+    BgpRpkiValidator validator(false);
+    validator.replace(vrps);
+
+    size_t counts[3] = {0, 0, 0};
+    for (size_t i = 0; i < routes.size(); i++) counts[validator.validate(routes[i], origins[i])]++;
+
+    snprintf(bench_name, sizeof(bench_name), "rpki/ipv4/%zu-vrps/validate", n);
+    benchRun(bench_name, routes.size(), [&]() {
+        for (size_t i = 0; i < routes.size(); i++) benchKeep(validator.validate(routes[i], origins[i]));
+    });
+
+    if (benchEnabled(bench_name)) {
+        printf("  valid: %zu, invalid: %zu, not found: %zu\n", counts[RPKI_VALID], counts[RPKI_INVALID], counts[RPKI_NOT_FOUND]);
+    }
+
+    if (n > RPKI_LINEAR_MAX_VRPS) return;
+
+    // fewer routes for large VRP sets to keep the runtime sane.
+    size_t nroutes = n >= 1000 ? routes.size() / 10 : routes.size();
+
+    for (size_t i = 0; i < nroutes; i++) {
+        if (validateLinear(vrps, routes[i], origins[i]) != validator.validate(routes[i], origins[i])) {
+            fprintf(stderr, "bench-rpki: trie and linear scan disagree on route %zu.\n", i);
+            exit(1);
+        }
+    }
+
+    snprintf(bench_name, sizeof(bench_name), "rpki/ipv4/%zu-vrps/validate/linear", n);
+    benchRun(bench_name, nroutes, [&]() {
+        for (size_t i = 0; i < nroutes; i++) benchKeep(validateLinear(vrps, routes[i], origins[i]));
+    });
+}
+
+/**
+ * @brief Measure a full sync of n VRPs from the stand-in cache, over RTR
+ * version 1, or version 0 after the client downgraded.
+ *
+ */
+static void benchSync(size_t n, uint8_t version) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "rpki/rtr/%zu-vrps/reset%s", n, version == 0 ? "/v0" : "");
+    if (!benchEnabled(bench_name)) return;
+
+    std::vector<Prefix4> routes = benchPrefixes4(n, 1);
+    std::vector<uint32_t> origins(routes.size(), 65000);
+    BenchRtrCache cache(version, makeVrps(routes, origins, n, 42));
+
+    logger.setLogLevel(FATAL);
+    ManualClock clock;
+    size_t synced = 0;
+
+    benchRun(bench_name, cache.getVrpCount(), [&]() {
+        BgpRpkiValidator validator(false);
+        BgpRtrClient client(&validator, &cache, &clock, &logger);
+        if (client.start() < 0 || cache.pump(client) < 0 || client.getVersion() != version) {
+            fprintf(stderr, "bench-rpki: sync failed.\n");
+            exit(1);
+        }
+        synced = validator.getVrpCount();
+    });
+
+    if (synced != cache.getVrpCount()) {
+        fprintf(stderr, "bench-rpki: synced %zu of %zu VRPs.\n", synced, cache.getVrpCount());
+        exit(1);
+    }
+}
+
+// IPv4 only, no hold timer.
+static void makeConfig(BgpConfig &config, uint32_t asn, uint32_t peer_asn, const char *router_id, BgpOutHandler *out, BgpRib4 *rib4, BgpRib6 *rib6, Clock *clock) {
+    benchConfig(config, asn, peer_asn, router_id, out, &logger, rib4, rib6, clock);
+    config.mp_bgp_ipv4 = true;
+    config.hold_timer = 0;
+}
+
+/**
+ * @brief Measure the cost of a VRP delta on a full table: one in
+ * RPKI_DELTA_RATIO routes turns invalid (its VRP is replaced by one with
+ * another origin AS), then valid again. The delta goes from the stand-in
+ * cache through BgpRtrClient to the validator, and the receiving FSM withdraws
+ * / inserts the routes affected in tick().
+ *
+ * Compared with validating the whole table again on each delta, which is what
+ * has to be done without the reverse index. (and that doesn't even include
+ * updating the RIB)
+ */
+static void benchDelta(const std::vector<Prefix4> &prefixes) {
+    char bench_name[128], rescan_name[128];
+    size_t n_delta = prefixes.size() / RPKI_DELTA_RATIO;
+    snprintf(bench_name, sizeof(bench_name), "rpki/ipv4/%zu/delta-%zu/rtr", prefixes.size(), n_delta);
+    snprintf(rescan_name, sizeof(rescan_name), "rpki/ipv4/%zu/delta-%zu/full-rescan", prefixes.size(), n_delta);
+    if (!benchEnabled(bench_name) && !benchEnabled(rescan_name)) return;
+
+    logger.setLogLevel(FATAL);
+
+    BgpRib4 sender_rib4(&logger);
+    BgpRib6 sender_rib6(&logger);
+    BenchRng rng(1);
+    for (size_t i = 0; i < prefixes.size(); i += RPKI_GROUP_SIZE) {
+        size_t end = i + RPKI_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + RPKI_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        sender_rib4.insert(RPKI_SRC_ROUTER_ID, group, benchAttribs(&logger, rng, htonl(0xc0000201)), 0, 0);
+    }
+
+    // one exact VRP per route, for the origin AS the receiver will see.
+    std::vector<BgpVrp> vrps;
+    for (const auto &entry : sender_rib4.get()) {
+        BgpVrp vrp;
+        vrp.prefix = entry.second.route;
+        vrp.max_length = vrp.prefix.getLength();
+        vrp.asn = BgpRpkiValidator::getOriginAs(entry.second.attribs, 65000);
+        vrps.push_back(vrp);
+    }
+
+    std::vector<BgpVrp> good, bad;
+    for (size_t i = 0; i < vrps.size(); i += RPKI_DELTA_RATIO) {
+        good.push_back(vrps[i]);
+        bad.push_back(vrps[i]);
+        bad.back().asn = 64496;
+    }
+
+    uint64_t best = UINT64_MAX, best_rescan = UINT64_MAX;
+    size_t churn = 0;
+
+    for (int run = 0; run < benchOptions().runs; run++) {
+        ManualClock clock;
+        LoopbackOutHandler to_sender;
+        BgpRib4 receiver_rib4(&logger);
+        BgpRib6 receiver_rib6(&logger);
+        RouteEventBus bus;
+        ChurnCounter counter;
+        bus.subscribe(&counter);
+
+        BgpRpkiValidator validator;
+        BenchRtrCache cache(1, vrps);
+        BgpRtrClient client(&validator, &cache, &clock, &logger);
+        if (client.start() < 0 || cache.pump(client) < 0) {
+            fprintf(stderr, "bench-rpki: sync failed.\n");
+            exit(1);
+        }
+
+        BgpConfig sender_config, receiver_config;
+        makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &sender_rib4, &sender_rib6, &clock);
+        makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &receiver_rib4, &receiver_rib6, &clock);
+        receiver_config.rev_bus = &bus;
+        receiver_config.rpki = &validator;
+
+        BgpFsm receiver(receiver_config);
+        RecordOutHandler to_receiver(&receiver);
+        sender_config.out_handler = &to_receiver;
+        BgpFsm sender(sender_config);
+        to_sender.setPeer(&sender, &receiver);
+
+        sender.start();
+        const std::vector<uint8_t> &table = to_receiver.recorded;
+        if (receiver.run(table.data(), table.size()) < 0 || receiver_rib4.get().size() != prefixes.size()) {
+            fprintf(stderr, "bench-rpki: receiver did not get the table.\n");
+            exit(1);
+        }
+
+        counter.changes = 0;
+        uint64_t elapsed = 0;
+
+        for (int cycle = 0; cycle < RPKI_DELTA_CYCLES; cycle++) {
+            cache.update(bad, good);
+            uint64_t start = benchNow();
+            int ret = cache.pump(client);
+            receiver.tick();
+            elapsed += benchNow() - start;
+
+            if (ret < 0 || receiver_rib4.get().size() != prefixes.size() - n_delta) {
+                fprintf(stderr, "bench-rpki: receiver has %zu routes, expected %zu.\n", receiver_rib4.get().size(), prefixes.size() - n_delta);
+                exit(1);
+            }
+
+            cache.update(good, bad);
+            start = benchNow();
+            ret = cache.pump(client);
+            receiver.tick();
+            elapsed += benchNow() - start;
+
+            if (ret < 0 || receiver_rib4.get().size() != prefixes.size() || client.getSerial() != cache.getSerial()) {
+                fprintf(stderr, "bench-rpki: receiver has %zu routes, expected %zu.\n", receiver_rib4.get().size(), prefixes.size());
+                exit(1);
+            }
+        }
+
+        churn = counter.changes;
+        if (elapsed < best) best = elapsed;
+
+        uint64_t start = benchNow();
+        for (int i = 0; i < RPKI_DELTA_CYCLES * 2; i++) {
+            for (const auto &entry : receiver_rib4.get()) {
+                benchKeep(validator.validate(entry.second.route, BgpRpkiValidator::getOriginAs(entry.second.attribs, 65001)));
+            }
+        }
+        elapsed = benchNow() - start;
+        if (elapsed < best_rescan) best_rescan = elapsed;
+
+        bus.unsubscribe(&counter);
+    }
+
+    if (benchEnabled(bench_name)) {
+        benchReport(bench_name, n_delta * RPKI_DELTA_CYCLES * 2, best);
+        printf("  published: %zu\n", churn);
+        fflush(stdout);
+    }
+
+    if (benchEnabled(rescan_name)) benchReport(rescan_name, n_delta * RPKI_DELTA_CYCLES * 2, best_rescan);
+}
+
+// an UPDATE from AS 65000 announcing a route with an origin AS, or
+// withdrawing it (origin_as 0).
+static std::vector<uint8_t> checkUpdate(const Prefix4 &route, uint32_t origin_as) {
+    BgpUpdateMessage update(&logger, true);
+
+    if (origin_as == 0) update.addWithdrawn4(route);
+    else {
+        BgpPathAttribOrigin origin(&logger);
+        origin.origin = IGP;
+        update.addAttrib(origin);
+
+        BgpPathAttribAsPath as_path(&logger, true);
+        BgpAsPathSegment seg(true, AS_SEQUENCE);
+        seg.value.push_back(65000);
+        seg.value.push_back(origin_as);
+        as_path.as_paths.push_back(seg);
+        update.addAttrib(as_path);
+
+        update.setNextHop(htonl(0xc0000201));
+        update.addNlri4(route);
+    }
+
+    uint8_t buffer[4096];
+    BgpPacket pkt(&logger, true, &update);
+    ssize_t len = pkt.write(buffer, sizeof(buffer));
+    if (len < 0) {
+        fprintf(stderr, "bench-rpki: failed to write UPDATE.\n");
+        exit(1);
+    }
+
+    return std::vector<uint8_t>(buffer, buffer + len);
+}
+
+/**
+ * @brief A session whose receiving FSM does RPKI origin validation and flap
+ * dampening, with the route to flap. Used by checkDampening().
+ *
+ */
+class DampenedSession {
+public:
+    DampenedSession() : route(htonl(0xc6336400), 24), receiver_rib4(&logger), receiver_rib6(&logger), sender_rib4(&logger), sender_rib6(&logger) {
+        logger.setLogLevel(FATAL);
+        clock.setTimeMs(1000000);
+
+        BgpConfig sender_config, receiver_config;
+        makeConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, &sender_rib4, &sender_rib6, &clock);
+        makeConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, &receiver_rib4, &receiver_rib6, &clock);
+        receiver_config.rpki = &validator;
+        receiver_config.dampening = true;
+
+        receiver.reset(new BgpFsm(receiver_config));
+        to_receiver.reset(new RecordOutHandler(receiver.get()));
+        sender_config.out_handler = to_receiver.get();
+        sender.reset(new BgpFsm(sender_config));
+        to_sender.setPeer(sender.get(), receiver.get());
+
+        sender->start();
+        if (receiver->getState() != ESTABLISHED) fail("session not established");
+    }
+
+    // the peer announces the route with an origin AS, or withdraws it (0).
+    void update(uint32_t origin_as) {
+        std::vector<uint8_t> msg = checkUpdate(route, origin_as);
+        if (receiver->run(msg.data(), msg.size()) < 0) fail("failed to run UPDATE");
+    }
+
+    // VRP for the route, origin_as only.
+    void vrp(uint32_t origin_as) {
+        BgpVrp vrp;
+        vrp.prefix = route;
+        vrp.max_length = 24;
+        vrp.asn = origin_as;
+        validator.replace(std::vector<BgpVrp>(1, vrp));
+        receiver->tick();
+    }
+
+    // stay quiet until the route is no longer suppressed.
+    void quiet() {
+        for (int i = 0; i < 90 * 60 / 5; i++) {
+            clock.setTimeMs(clock.getTimeMs() + 5000);
+            receiver->tick();
+        }
+    }
+
+    // origin AS of the route in RIB, 0 if not in RIB.
+    uint32_t ribOrigin() {
+        for (const rib4_t::value_type &it : receiver_rib4.get()) {
+            if (it.second.route == route) return BgpRpkiValidator::getOriginAs(it.second.attribs, 65001);
+        }
+
+        return 0;
+    }
+
+    BgpFsmStatsSnapshot stats() {
+        BgpFsmStatsSnapshot snap;
+        receiver->getStats().snapshot(snap);
+        return snap;
+    }
+
+    void fail(const char *what) {
+        fprintf(stderr, "bench-rpki: dampening check: %s.\n", what);
+        exit(1);
+    }
+
+    Prefix4 route;
+
+private:
+    ManualClock clock;
+    BgpRpkiValidator validator;
+    BgpRib4 receiver_rib4;
+    BgpRib6 receiver_rib6;
+    BgpRib4 sender_rib4;
+    BgpRib6 sender_rib6;
+    LoopbackOutHandler to_sender;
+    std::unique_ptr<BgpFsm> receiver;
+    std::unique_ptr<RecordOutHandler> to_receiver;
+    std::unique_ptr<BgpFsm> sender;
+};
+
+/**
+ * @brief Check that RPKI holding and flap dampening agree on the state of a
+ * route: flapping while invalid, replaced while suppressed, and with VRPs
+ * changing while suppressed.
+ *
+ */
+static void checkDampening() {
+    // a route held back as invalid that flaps is still suppressed.
+    {
+        DampenedSession session;
+        session.vrp(64500);
+        session.update(64501);
+        session.update(0);
+        session.update(64501);
+        session.update(0);
+        if (session.stats().prefixes_suppressed != 1) session.fail("flaps of an invalid route not counted");
+    }
+
+    // a suppressed route replaced by an invalid one: the invalid one is
+    // held back on reuse, the replaced one is gone.
+    {
+        DampenedSession session;
+        session.vrp(64500);
+        session.update(64500);
+        session.update(0);
+        session.update(64500);
+        session.update(0);
+        session.update(64500);
+        session.update(64501);
+        if (session.ribOrigin() != 0) session.fail("suppressed route in RIB");
+
+        session.quiet();
+        if (session.stats().prefixes_reused != 1) session.fail("route not reused");
+        if (session.ribOrigin() != 0) session.fail("replaced or invalid route installed on reuse");
+
+        session.vrp(64501);
+        if (session.ribOrigin() != 64501) session.fail("route not installed once valid");
+    }
+
+    // VRPs change while suppressed: the route stays out until reused.
+    {
+        DampenedSession session;
+        session.vrp(64500);
+        session.update(64500);
+        session.update(0);
+        session.update(64500);
+        session.update(0);
+        session.update(64501);
+        session.vrp(64501);
+        if (session.ribOrigin() != 0) session.fail("suppressed route installed by a VRP change");
+
+        session.quiet();
+        if (session.ribOrigin() != 64501) session.fail("route not installed on reuse");
+    }
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+
+    checkDampening();
+
+    for (size_t n = 100; n <= benchOptions().max_prefixes; n *= 10) {
+        benchValidate(n);
+    }
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        benchSync(n, 1);
+        benchSync(n, 0);
+    }
+
+    for (size_t n = 10000; n <= benchOptions().max_prefixes; n *= 10) {
+        benchDelta(benchPrefixes4(n, 1));
+    }
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file bench-table.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Synthetic routing table generators and session fixtures for
+ * benchmarks.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "bench-table.h"
+#include "bgp-packet.h"
+#include "bgp-update-message.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_set>
+
+using namespace libbgp;
+
+BenchRng::BenchRng(uint64_t seed) {
+    state = seed == 0 ? 0x9e3779b97f4a7c15ULL : seed;
+}
+
+uint64_t BenchRng::next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+uint32_t BenchRng::range(uint32_t n) {
+    return (uint32_t) ((next() >> 32) % n);
+}
+
+static uint8_t benchLength4(BenchRng &rng) {
+    uint32_t r = rng.range(100);
+    if (r < 60) return 24;
+    if (r < 70) return 23;
+    if (r < 80) return 22;
+    if (r < 86) return 21;
+    if (r < 91) return 20;
+    if (r < 95) return 19;
+    return 16 + rng.range(3);
+}
+
+static uint8_t benchLength6(BenchRng &rng) {
+    uint32_t r = rng.range(100);
+    if (r < 50) return 48;
+    if (r < 60) return 44;
+    if (r < 70) return 40;
+    if (r < 80) return 36;
+    if (r < 90) return 32;
+    return 29 + rng.range(3);
+}
+
+/**
+ * @brief Generate unique IPv4 prefixes.
+ * 
+ * Prefixes are picked from unicast space (1.0.0.0 - 223.255.255.255, without
+ * 10/8 and 127/8) with a length distribution similar to the IPv4 DFZ.
+ * 
+ * @param n Number of prefixes.
+ * @param seed Random seed.
+ * @return std::vector<Prefix4> The prefixes.
+ */
+std::vector<Prefix4> benchPrefixes4(size_t n, uint64_t seed) {
+    BenchRng rng(seed);
+    std::unordered_set<uint64_t> seen;
+    std::vector<Prefix4> prefixes;
+    prefixes.reserve(n);
+    seen.reserve(n);
+
+    while (prefixes.size() < n) {
+        uint8_t len = benchLength4(rng);
+        uint32_t first = 1 + rng.range(223);
+        if (first == 10 || first == 127) continue;
+        uint32_t addr = (first << 24) | (rng.range(1 << 24));
+        addr &= 0xffffffff << (32 - len);
+
+        uint64_t key = ((uint64_t) addr << 8) | len;
+        if (!seen.insert(key).second) continue;
+
+        prefixes.push_back(Prefix4(htonl(addr), len));
+    }
+
+    return prefixes;
+}
+
+/**
+ * @brief Generate unique IPv6 prefixes.
+ * 
+ * Prefixes are picked from 2000::/3 with a length distribution similar to the
+ * IPv6 DFZ.
+ * 
+ * @param n Number of prefixes.
+ * @param seed Random seed.
+ * @return std::vector<Prefix6> The prefixes.
+ */
+std::vector<Prefix6> benchPrefixes6(size_t n, uint64_t seed) {
+    BenchRng rng(seed);
+    std::unordered_set<uint64_t> seen;
+    std::vector<Prefix6> prefixes;
+    prefixes.reserve(n);
+    seen.reserve(n);
+
+    while (prefixes.size() < n) {
+        uint8_t len = benchLength6(rng);
+
+        // all generated prefixes are <= /48, so only the first 48 bits vary.
+        uint64_t hi = (0x2000ULL << 48) | (rng.next() & 0x1fffffffffffffULL);
+        hi &= 0xffffffffffffffffULL << (64 - len);
+
+        uint64_t key = (hi & 0xffffffffffff0000ULL) | len;
+        if (!seen.insert(key).second) continue;
+
+        uint8_t addr[16];
+        memset(addr, 0, 16);
+        for (int i = 0; i < 8; i++) addr[i] = (uint8_t) (hi >> (56 - i * 8));
+
+        prefixes.push_back(Prefix6(addr, len));
+    }
+
+    return prefixes;
+}
+
+/**
+ * @brief Generate a path attribute set.
+ * 
+ * @param logger Logger for the attributes.
+ * @param rng Random source.
+ * @param nexthop IPv4 nexthop in network byte order. 0 to omit NEXT_HOP.
+ * @return BenchAttribs The attributes.
+ */
+BenchAttribs benchAttribs(BgpLogHandler *logger, BenchRng &rng, uint32_t nexthop) {
+    BenchAttribs attribs;
+
+    BgpPathAttribOrigin *origin = new BgpPathAttribOrigin(logger);
+    origin->origin = rng.range(3) == 0 ? INCOMPLETE : IGP;
+    attribs.push_back(std::shared_ptr<BgpPathAttrib>(origin));
+
+    BgpPathAttribAsPath *as_path = new BgpPathAttribAsPath(logger, true);
+    BgpAsPathSegment seg(true, AS_SEQUENCE);
+    uint32_t hops = 1 + rng.range(8);
+    for (uint32_t i = 0; i < hops; i++) {
+        seg.value.push_back(rng.range(4) == 0 ? 4200000000U + rng.range(1000000) : 1 + rng.range(64000));
+    }
+    as_path->as_paths.push_back(seg);
+    attribs.push_back(std::shared_ptr<BgpPathAttrib>(as_path));
+
+    if (nexthop != 0) {
+        BgpPathAttribNexthop *nh = new BgpPathAttribNexthop(logger);
+        nh->next_hop = nexthop;
+        attribs.push_back(std::shared_ptr<BgpPathAttrib>(nh));
+    }
+
+    if (rng.range(2) == 0) {
+        BgpPathAttribMed *med = new BgpPathAttribMed(logger);
+        med->med = rng.range(1000);
+        attribs.push_back(std::shared_ptr<BgpPathAttrib>(med));
+    }
+
+    if (rng.range(2) == 0) {
+        BgpPathAttribCommunity *comm = new BgpPathAttribCommunity(logger);
+        uint32_t ncomm = 1 + rng.range(4);
+        for (uint32_t i = 0; i < ncomm; i++) {
+            comm->communites.push_back(((1 + rng.range(64000)) << 16) | rng.range(1000));
+        }
+        attribs.push_back(std::shared_ptr<BgpPathAttrib>(comm));
+    }
+
+    return attribs;
+}
+
+static std::vector<uint8_t> benchWrite(BgpLogHandler *logger, const BgpUpdateMessage &update) {
+    uint8_t buffer[4096];
+    BgpPacket pkt(logger, true, &update);
+    ssize_t len = pkt.write(buffer, sizeof(buffer));
+    if (len < 0) {
+        fprintf(stderr, "benchWrite: failed to write UPDATE.\n");
+        abort();
+    }
+
+    return std::vector<uint8_t>(buffer, buffer + len);
+}
+
+/**
+ * @brief Generate IPv4 UPDATE messages in wire format.
+ * 
+ * @param logger Logger for the messages.
+ * @param prefixes Prefixes to announce.
+ * @param prefixes_per_update Number of prefixes per UPDATE message.
+ * @param nexthop Nexthop in network byte order.
+ * @param seed Random seed for the attributes.
+ * @return std::vector<std::vector<uint8_t>> The messages.
+ */
+std::vector<std::vector<uint8_t>> benchUpdates4(BgpLogHandler *logger, const std::vector<Prefix4> &prefixes, size_t prefixes_per_update, uint32_t nexthop, uint64_t seed) {
+    BenchRng rng(seed);
+    std::vector<std::vector<uint8_t>> updates;
+
+    for (size_t i = 0; i < prefixes.size(); i += prefixes_per_update) {
+        BgpUpdateMessage update(logger, true);
+        update.setAttribs(benchAttribs(logger, rng, nexthop));
+        for (size_t j = i; j < i + prefixes_per_update && j < prefixes.size(); j++) {
+            update.addNlri4(prefixes[j]);
+        }
+        updates.push_back(benchWrite(logger, update));
+    }
+
+    return updates;
+}
+
+/**
+ * @brief Generate IPv6 UPDATE messages in wire format.
+ * 
+ * @param logger Logger for the messages.
+ * @param prefixes Prefixes to announce.
+ * @param prefixes_per_update Number of prefixes per UPDATE message.
+ * @param nexthop Global IPv6 nexthop.
+ * @param seed Random seed for the attributes.
+ * @return std::vector<std::vector<uint8_t>> The messages.
+ */
+std::vector<std::vector<uint8_t>> benchUpdates6(BgpLogHandler *logger, const std::vector<Prefix6> &prefixes, size_t prefixes_per_update, const uint8_t nexthop[16], uint64_t seed) {
+    BenchRng rng(seed);
+    std::vector<std::vector<uint8_t>> updates;
+
+    for (size_t i = 0; i < prefixes.size(); i += prefixes_per_update) {
+        BgpUpdateMessage update(logger, true);
+        update.setAttribs(benchAttribs(logger, rng, 0));
+        std::vector<Prefix6> nlri;
+        for (size_t j = i; j < i + prefixes_per_update && j < prefixes.size(); j++) {
+            nlri.push_back(prefixes[j]);
+        }
+        update.setNlri6(nlri, nexthop, NULL);
+        updates.push_back(benchWrite(logger, update));
+    }
+
+    return updates;
+}
+
+RecordOutHandler::RecordOutHandler(BgpFsm *peer, bool record_all) : peer(peer), record_all(record_all) {}
+
+bool RecordOutHandler::handleOut(const uint8_t *buffer, size_t length) {
+    if (peer->getState() == ESTABLISHED) {
+        recorded.insert(recorded.end(), buffer, buffer + length);
+        return true;
+    }
+
+    if (record_all) recorded.insert(recorded.end(), buffer, buffer + length);
+    return peer->run(buffer, length) >= 0;
+}
+
+ChurnCounter::ChurnCounter() : changes(0) {}
+
+bool ChurnCounter::handleRouteEvent(const RouteEvent &ev) {
+    if (ev.type == ADD4) {
+        const Route4AddEvent &aev = static_cast<const Route4AddEvent &>(ev);
+        if (aev.new_routes != NULL) changes += aev.new_routes->size();
+        if (aev.replaced_entries != NULL) changes += aev.replaced_entries->size();
+    } else if (ev.type == WITHDRAW4) {
+        changes += static_cast<const Route4WithdrawEvent &>(ev).routes->size();
+    }
+
+    return true;
+}
+
+void benchConfig(BgpConfig &config, uint32_t asn, uint32_t peer_asn, const char *router_id, BgpOutHandler *out, BgpLogHandler *logger, BgpRib4 *rib4, BgpRib6 *rib6, Clock *clock) {
+    config.asn = asn;
+    config.peer_asn = peer_asn;
+    config.use_4b_asn = true;
+    config.hold_timer = 120;
+    config.out_handler = out;
+    config.log_handler = logger;
+    config.no_collision_detection = true;
+    config.rib4 = rib4;
+    config.rib6 = rib6;
+    config.clock = clock;
+    inet_pton(AF_INET, router_id, &config.router_id);
+    config.default_nexthop4 = config.router_id;
+    config.forced_default_nexthop4 = true;
+    config.no_nexthop_check4 = true;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file bench-table.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Synthetic routing table generators and session fixtures for
+ * benchmarks.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#ifndef BGP_BENCH_TABLE_H_
+#define BGP_BENCH_TABLE_H_
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "bgp-fsm.h"
+#include "bgp-log-handler.h"
+#include "bgp-path-attrib.h"
+#include "route-event-receiver.h"
+#include "prefix4.h"
+#include "prefix6.h"
+
+/**
+ * @brief Small deterministic PRNG (xorshift64*), so generated tables are the
+ * same on every machine.
+ * 
+ */
+class BenchRng {
+public:
+    BenchRng(uint64_t seed);
+
+    // get next random number.
+    uint64_t next();
+
+    // get a random number in [0, n).
+    uint32_t range(uint32_t n);
+
+private:
+    uint64_t state;
+};
+
+/**
+ * @brief A set of path attributes shared by a group of prefixes.
+ * 
+ */
+typedef std::vector<std::shared_ptr<libbgp::BgpPathAttrib>> BenchAttribs;
+
+// generate n unique IPv4 prefixes, with a prefix length distribution similar
+// to the IPv4 DFZ (mostly /24).
+std::vector<libbgp::Prefix4> benchPrefixes4(size_t n, uint64_t seed);
+
+// generate n unique IPv6 prefixes, with a prefix length distribution similar
+// to the IPv6 DFZ (mostly /48).
+std::vector<libbgp::Prefix6> benchPrefixes6(size_t n, uint64_t seed);
+
+// generate a path attribute set: ORIGIN, AS_PATH (1 - 8 hops), NEXT_HOP (if
+// nexthop is not 0) and optionally MED and COMMUNITY.
+BenchAttribs benchAttribs(libbgp::BgpLogHandler *logger, BenchRng &rng, uint32_t nexthop);
+
+// generate wire format UPDATE messages announcing the IPv4 prefixes,
+// prefixes_per_update prefixes share an attribute set.
+std::vector<std::vector<uint8_t>> benchUpdates4(libbgp::BgpLogHandler *logger, const std::vector<libbgp::Prefix4> &prefixes, size_t prefixes_per_update, uint32_t nexthop, uint64_t seed);
+
+// generate wire format UPDATE messages announcing the IPv6 prefixes with
+// MP_REACH_NLRI, prefixes_per_update prefixes share an attribute set.
+std::vector<std::vector<uint8_t>> benchUpdates6(libbgp::BgpLogHandler *logger, const std::vector<libbgp::Prefix6> &prefixes, size_t prefixes_per_update, const uint8_t nexthop[16], uint64_t seed);
+
+/**
+ * @brief Out handler that passes messages to the peer until the peer is
+ * ESTABLISHED, and records them after that. With record_all, the messages
+ * passed to the peer (OPEN, KEEPALIVE) are recorded too.
+ * 
+ */
+class RecordOutHandler : public libbgp::BgpOutHandler {
+public:
+    RecordOutHandler(libbgp::BgpFsm *peer, bool record_all = false);
+
+    bool handleOut(const uint8_t *buffer, size_t length);
+
+    std::vector<uint8_t> recorded;
+
+private:
+    libbgp::BgpFsm *peer;
+    bool record_all;
+};
+
+/**
+ * @brief Route event receiver that counts the IPv4 route changes published,
+ * i.e., the updates to be sent to other peers.
+ * 
+ */
+class ChurnCounter : public libbgp::RouteEventReceiver {
+public:
+    ChurnCounter();
+
+    size_t changes;
+
+protected:
+    bool handleRouteEvent(const libbgp::RouteEvent &ev);
+};
+
+// fill in the parts of a session config common to the benchmarks: 4-byte ASN,
+// no collision detection, and the router ID as the forced IPv4 nexthop (not
+// checked). Address families are left to the caller.
+void benchConfig(libbgp::BgpConfig &config, uint32_t asn, uint32_t peer_asn, const char *router_id, libbgp::BgpOutHandler *out, libbgp::BgpLogHandler *logger, libbgp::BgpRib4 *rib4, libbgp::BgpRib6 *rib6, libbgp::Clock *clock);
+
+#endif // BGP_BENCH_TABLE_H_
@@ -0,0 +1,203 @@
+/**
+ * @file bench-timer.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Benchmark timer load (KEEPALIVE bursts, synchronized hold timer
+ * expiries) of many sessions, with a simulated clock.
+ * @version 0.1
+ * @date 2019-08-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "bgp-fsm.h"
+#include "loopback-out-handler.h"
+#include "manual-clock.h"
+#include <arpa/inet.h>
+#include <memory>
+
+using namespace libbgp;
+
+#define TIMER_HOLD_TIME 90
+
+// simulated time of the keepalive benchmark, in seconds.
+#define TIMER_SIM_TIME 3600
+
+/**
+ * @brief A pair of FSMs connected back to back.
+ *
+ */
+struct TimerSession {
+    LoopbackOutHandler to_server;
+    LoopbackOutHandler to_client;
+    std::unique_ptr<BgpFsm> client;
+    std::unique_ptr<BgpFsm> server;
+};
+
+typedef std::vector<std::unique_ptr<TimerSession>> TimerSessions;
+
+static BgpLogHandler logger;
+
+static void makeConfig(BgpConfig &config, uint32_t asn, uint32_t peer_asn, uint32_t router_id, BgpOutHandler *out, Clock *clock) {
+    config.asn = asn;
+    config.peer_asn = peer_asn;
+    config.use_4b_asn = true;
+    config.mp_bgp_ipv4 = true;
+    config.hold_timer = TIMER_HOLD_TIME;
+    config.out_handler = out;
+    config.log_handler = &logger;
+    config.no_collision_detection = true;
+    config.clock = clock;
+    config.router_id = htonl(router_id);
+}
+
+// create n established sessions.
+static void makeSessions(TimerSessions &sessions, size_t n, ManualClock &clock) {
+    sessions.clear();
+    clock.setTimeMs(0);
+
+    for (size_t i = 0; i < n; i++) {
+        TimerSession *session = new TimerSession;
+        sessions.push_back(std::unique_ptr<TimerSession>(session));
+
+        BgpConfig client_config, server_config;
+        makeConfig(client_config, 65001, 65000, 0x0a000000 + i, &session->to_server, &clock);
+        makeConfig(server_config, 65000, 65001, 0x0b000000 + i, &session->to_client, &clock);
+
+        session->client.reset(new BgpFsm(client_config));
+        session->server.reset(new BgpFsm(server_config));
+        session->to_server.setPeer(session->server.get(), session->client.get());
+        session->to_client.setPeer(session->client.get(), session->server.get());
+
+        session->client->start();
+        LoopbackOutHandler::flush();
+
+        if (session->client->getState() != ESTABLISHED || session->server->getState() != ESTABLISHED) {
+            fprintf(stderr, "bench-timer: session %zu failed to establish.\n", i);
+            exit(1);
+        }
+    }
+}
+
+// tick fsm if its next timer event is due.
+static void tickIfDue(BgpFsm &fsm, uint64_t now) {
+    if (fsm.getNextTick() > now) return;
+
+    int ret = fsm.tick();
+    if (ret < 0) {
+        fprintf(stderr, "bench-timer: tick() returned %d.\n", ret);
+        exit(1);
+    }
+}
+
+// count KEEPALIVE messages sent by all sessions.
+static uint64_t keepalivesSent(const TimerSessions &sessions) {
+    uint64_t sent = 0;
+    for (const std::unique_ptr<TimerSession> &session : sessions) {
+        sent += session->client->getStats().msgs_out[KEEPALIVE].get();
+        sent += session->server->getStats().msgs_out[KEEPALIVE].get();
+    }
+    return sent;
+}
+
+/**
+ * @brief Run TIMER_SIM_TIME seconds of KEEPALIVE exchange, jumping the clock
+ * from one timer event to the next.
+ *
+ * All sessions come up at the same time, so KEEPALIVEs are sent in bursts.
+ */
+static void benchKeepalive(size_t n) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "timer/%zu-sessions/%ds-keepalive", n, TIMER_SIM_TIME);
+    if (!benchEnabled(bench_name)) return;
+
+    ManualClock clock;
+    TimerSessions sessions;
+
+    uint64_t best = UINT64_MAX;
+    uint64_t sent = 0;
+    for (int run = 0; run < benchOptions().runs; run++) {
+        makeSessions(sessions, n, clock);
+        sent = keepalivesSent(sessions);
+
+        uint64_t start = benchNow();
+        for (;;) {
+            uint64_t next = UINT64_MAX;
+            for (const std::unique_ptr<TimerSession> &session : sessions) {
+                uint64_t t = session->client->getNextTick();
+                if (t < next) next = t;
+                t = session->server->getNextTick();
+                if (t < next) next = t;
+            }
+            if (next > TIMER_SIM_TIME * 1000) break;
+
+            clock.setTimeMs(next);
+            for (const std::unique_ptr<TimerSession> &session : sessions) {
+                tickIfDue(*session->client, next);
+                tickIfDue(*session->server, next);
+            }
+            LoopbackOutHandler::flush();
+        }
+        uint64_t elapsed = benchNow() - start;
+        sent = keepalivesSent(sessions) - sent;
+
+        for (const std::unique_ptr<TimerSession> &session : sessions) {
+            if (session->client->getState() != ESTABLISHED || session->server->getState() != ESTABLISHED) {
+                fprintf(stderr, "bench-timer: session dropped during keepalive run.\n");
+                exit(1);
+            }
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(bench_name, sent, best);
+}
+
+/**
+ * @brief Measure the time to handle the hold timer of all sessions expiring
+ * at once.
+ *
+ * The clock jumps past the hold time, and the server side of every session is
+ * ticked. Each server sends a NOTIFICATION and goes IDLE, and the client goes
+ * IDLE on receiving it.
+ */
+static void benchHoldExpiry(size_t n) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "timer/%zu-sessions/hold-expiry", n);
+
+    ManualClock clock;
+    TimerSessions sessions;
+
+    benchRun(bench_name, n, [&]() {
+        makeSessions(sessions, n, clock);
+    }, [&]() {
+        clock.advance(TIMER_HOLD_TIME + 1);
+        for (const std::unique_ptr<TimerSession> &session : sessions) {
+            if (session->server->tick() != 0) {
+                fprintf(stderr, "bench-timer: hold timer did not expire.\n");
+                exit(1);
+            }
+        }
+        LoopbackOutHandler::flush();
+    });
+
+    for (const std::unique_ptr<TimerSession> &session : sessions) {
+        if (session->client->getState() != IDLE) {
+            fprintf(stderr, "bench-timer: client did not go IDLE after hold timer expiry.\n");
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    logger.setLogLevel(FATAL);
+
+    for (size_t n = 1000; n <= benchOptions().max_prefixes && n <= 10000; n *= 10) {
+        benchKeepalive(n);
+        benchHoldExpiry(n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+/**
+ * @file bench-transport.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Transport benchmark: many sessions receiving a table over sockets,
+ * with a thread per session and with BgpTransport.
+ * @version 0.1
+ * @date 2019-09-12
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bench.h"
+#include "bench-table.h"
+#include "bgp-fsm.h"
+#include "bgp-transport.h"
+#include "fd-out-handler.h"
+#include "loopback-out-handler.h"
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+using namespace libbgp;
+
+#define TRANSPORT_GROUP_SIZE 20
+#define TRANSPORT_SRC_ROUTER_ID 0x03030303
+#define TRANSPORT_ROUTES_PER_SESSION 2000
+
+// bytes per write() of the feeder.
+#define TRANSPORT_FEED_CHUNK 65536
+
+/**
+ * @brief Transport setups benchmarked.
+ *
+ */
+enum BenchTransportMode {
+    // a thread per session, blocking read() of 4096 bytes and a write() per
+    // message, as in the examples.
+    TRANSPORT_MODE_THREADS,
+
+    // BgpTransport, epoll backend.
+    TRANSPORT_MODE_EPOLL,
+
+    // BgpTransport, io_uring backend.
+    TRANSPORT_MODE_URING,
+
+    // BgpTransport, io_uring backend with registered send buffers.
+    TRANSPORT_MODE_URING_FIXED
+};
+
+static const char *bench_transport_mode_str[] = {
+    "threads",
+    "epoll",
+    "io_uring",
+    "io_uring-fixed"
+};
+
+/**
+ * @brief FdOutHandler that counts the writes.
+ *
+ */
+class CountingFdOutHandler : public FdOutHandler {
+public:
+    CountingFdOutHandler(int fd, std::atomic<uint64_t> *count) : FdOutHandler(fd), count(count) {}
+
+    bool handleOut(const uint8_t *buffer, size_t length) {
+        count->fetch_add(1, std::memory_order_relaxed);
+        return FdOutHandler::handleOut(buffer, length);
+    }
+
+private:
+    std::atomic<uint64_t> *count;
+};
+
+/**
+ * @brief Record what a sender writes to a passive receiver: OPEN, KEEPALIVE
+ * and the table.
+ *
+ */
+static std::vector<uint8_t> record(BgpLogHandler *logger, const std::vector<Prefix4> &prefixes) {
+    BgpRib4 sender_rib4(logger);
+    BgpRib6 sender_rib6(logger);
+    BenchRng rng(1);
+    uint32_t nexthop = htonl(0xc0000201);
+    for (size_t i = 0; i < prefixes.size(); i += TRANSPORT_GROUP_SIZE) {
+        size_t end = i + TRANSPORT_GROUP_SIZE > prefixes.size() ? prefixes.size() : i + TRANSPORT_GROUP_SIZE;
+        std::vector<Prefix4> group(prefixes.begin() + i, prefixes.begin() + end);
+        sender_rib4.insert(TRANSPORT_SRC_ROUTER_ID, group, benchAttribs(logger, rng, nexthop), 0, 0);
+    }
+
+    LoopbackOutHandler to_sender;
+    BgpRib4 receiver_rib4(logger);
+    BgpRib6 receiver_rib6(logger);
+    BgpConfig sender_config, receiver_config;
+    benchConfig(sender_config, 65000, 65001, "10.0.0.1", NULL, logger, &sender_rib4, &sender_rib6, NULL);
+    benchConfig(receiver_config, 65001, 65000, "10.0.0.2", &to_sender, logger, &receiver_rib4, &receiver_rib6, NULL);
+
+    BgpFsm receiver(receiver_config);
+    RecordOutHandler to_receiver(&receiver, true);
+    sender_config.out_handler = &to_receiver;
+    BgpFsm sender(sender_config);
+    to_sender.setPeer(&sender, &receiver);
+
+    sender.start();
+    return to_receiver.recorded;
+}
+
+static uint64_t contextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+/**
+ * @brief Measure the time n_sessions passive sessions take to receive a table
+ * each, over socketpairs.
+ *
+ * A feeder thread writes the recorded sender side of every session in
+ * TRANSPORT_FEED_CHUNK byte chunks, round robin. The receivers' replies
+ * (OPEN, KEEPALIVE) stay in the socket buffers. The system calls made by the
+ * receiving side and the context switches of the process are reported.
+ */
+static void benchReceive(const std::vector<uint8_t> &wire, size_t n_routes, size_t n_sessions, BenchTransportMode mode) {
+    char bench_name[128];
+    snprintf(bench_name, sizeof(bench_name), "transport/%zu-sessions/receive/%s", n_sessions, bench_transport_mode_str[mode]);
+    if (!benchEnabled(bench_name)) return;
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    uint64_t best = UINT64_MAX;
+    uint64_t best_syscalls = 0;
+    uint64_t best_switches = 0;
+
+    for (int run = 0; run < benchOptions().runs; run++) {
+        std::vector<int> local_fds, remote_fds;
+        for (size_t i = 0; i < n_sessions; i++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+                fprintf(stderr, "bench-transport: socketpair() failed.\n");
+                exit(1);
+            }
+            local_fds.push_back(fds[0]);
+            remote_fds.push_back(fds[1]);
+        }
+
+        std::vector<std::unique_ptr<BgpRib4>> rib4s;
+        std::vector<std::unique_ptr<BgpRib6>> rib6s;
+        for (size_t i = 0; i < n_sessions; i++) {
+            rib4s.emplace_back(new BgpRib4(&logger));
+            rib6s.emplace_back(new BgpRib6(&logger));
+        }
+
+        std::unique_ptr<BgpTransport> transport;
+        if (mode != TRANSPORT_MODE_THREADS) {
+            BgpTransportBackend backend = mode == TRANSPORT_MODE_EPOLL ? TRANSPORT_EPOLL : TRANSPORT_IO_URING;
+            transport.reset(new BgpTransport(backend, mode == TRANSPORT_MODE_URING_FIXED ? n_sessions : 0, BGP_TRANSPORT_FIXED_BUFFER_SIZE, &logger));
+            if (!transport->start()) {
+                printf("%-52s (backend not available)\n", bench_name);
+                for (size_t i = 0; i < n_sessions; i++) {
+                    close(local_fds[i]);
+                    close(remote_fds[i]);
+                }
+                return;
+            }
+        }
+
+        // FSMs go before their out handlers.
+        std::vector<std::unique_ptr<BgpOutHandler>> outs;
+        std::vector<std::unique_ptr<BgpFsm>> fsms;
+        std::atomic<uint64_t> thread_syscalls(0);
+
+        for (size_t i = 0; i < n_sessions; i++) {
+            BgpOutHandler *out;
+            if (transport) out = transport->add(local_fds[i]);
+            else {
+                out = new CountingFdOutHandler(local_fds[i], &thread_syscalls);
+                outs.emplace_back(out);
+            }
+
+            BgpConfig config;
+            benchConfig(config, 65001, 65000, "10.0.0.2", out, &logger, rib4s[i].get(), rib6s[i].get(), NULL);
+            fsms.emplace_back(new BgpFsm(config));
+            if (transport) transport->attach(local_fds[i], fsms.back().get());
+        }
+
+        uint64_t switches = contextSwitches();
+        uint64_t start = benchNow();
+
+        std::thread feeder([&]() {
+            for (size_t off = 0; off < wire.size(); off += TRANSPORT_FEED_CHUNK) {
+                size_t len = wire.size() - off < TRANSPORT_FEED_CHUNK ? wire.size() - off : TRANSPORT_FEED_CHUNK;
+                for (int fd : remote_fds) {
+                    if (write(fd, wire.data() + off, len) != (ssize_t) len) {
+                        fprintf(stderr, "bench-transport: feeder write() failed.\n");
+                        exit(1);
+                    }
+                }
+            }
+        });
+
+        if (transport) {
+            size_t done = 0;
+            while (done < n_sessions) {
+                if (transport->poll(100) < 0) {
+                    fprintf(stderr, "bench-transport: poll() failed.\n");
+                    exit(1);
+                }
+
+                done = 0;
+                for (size_t i = 0; i < n_sessions; i++) {
+                    if (rib4s[i]->get().size() == n_routes) done++;
+                }
+            }
+        } else {
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < n_sessions; i++) {
+                threads.emplace_back([&, i]() {
+                    uint8_t buffer[4096];
+                    while (rib4s[i]->get().size() < n_routes) {
+                        thread_syscalls.fetch_add(1, std::memory_order_relaxed);
+                        ssize_t len = read(local_fds[i], buffer, sizeof(buffer));
+                        int ret = len > 0 ? fsms[i]->run(buffer, len) : -1;
+                        if (ret <= 0 || ret == 2) {
+                            fprintf(stderr, "bench-transport: session %zu failed.\n", i);
+                            exit(1);
+                        }
+                    }
+                });
+            }
+            for (std::thread &thread : threads) thread.join();
+        }
+
+        uint64_t elapsed = benchNow() - start;
+        switches = contextSwitches() - switches;
+        feeder.join();
+
+        uint64_t syscalls = transport ? transport->getSyscallCount() : thread_syscalls.load();
+        if (elapsed < best) {
+            best = elapsed;
+            best_syscalls = syscalls;
+            best_switches = switches;
+        }
+
+        fsms.clear();
+        transport.reset();
+        for (size_t i = 0; i < n_sessions; i++) {
+            close(local_fds[i]);
+            close(remote_fds[i]);
+        }
+    }
+
+    benchReport(bench_name, n_routes * n_sessions, best);
+    printf("  (%llu system calls, %llu context switches)\n", (unsigned long long) best_syscalls, (unsigned long long) best_switches);
+}
+
+/**
+ * @brief Check that a peer resetting the connection while a write from a
+ * registered buffer is pending closes the session with an error, instead of
+ * raising SIGPIPE.
+ *
+ */
+static void checkPeerReset() {
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpTransport transport(TRANSPORT_IO_URING, 1, BGP_TRANSPORT_FIXED_BUFFER_SIZE, &logger);
+    if (!transport.start()) return;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        fprintf(stderr, "bench-transport: socketpair() failed.\n");
+        exit(1);
+    }
+
+    // small send buffer: the write can't complete until the peer reads.
+    int sndbuf = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    int closes = 0;
+    BgpTransportCloseReason reason = TRANSPORT_CLOSED_EOF;
+    transport.setCloseHandler([&](int, BgpFsm *, BgpTransportCloseReason why) {
+        closes++;
+        reason = why;
+    });
+
+    BgpOutHandler *out = transport.add(fds[0]);
+    std::vector<uint8_t> data(BGP_TRANSPORT_FIXED_BUFFER_SIZE / 2, 0x55);
+    if (out == NULL || !out->handleOut(data.data(), data.size()) || !out->handleOut(data.data(), data.size()) || transport.poll(10) < 0) {
+        fprintf(stderr, "bench-transport: failed to queue data.\n");
+        exit(1);
+    }
+
+    close(fds[1]);
+
+    for (int i = 0; i < 100 && closes == 0; i++) {
+        if (transport.poll(10) < 0) break;
+    }
+
+    if (closes != 1 || reason != TRANSPORT_CLOSED_ERROR) {
+        fprintf(stderr, "bench-transport: peer reset: session closed %d times, reason %d.\n", closes, reason);
+        exit(1);
+    }
+
+    transport.remove(fds[0]);
+    transport.poll(0);
+    close(fds[0]);
+}
+
+/**
+ * @brief Check that a session removed while a write is in progress doesn't
+ * write to another socket that gets its number.
+ *
+ * After a small write, to get past the fallback from send with registered
+ * buffers where it isn't supported, the next send is short (small send
+ * buffer, peer not reading), so the rest is queued for submission when poll()
+ * returns. The socket is then removed, closed, and its number taken by
+ * another socket before the next poll().
+ */
+static void checkRemoveWriting() {
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    BgpTransport transport(TRANSPORT_IO_URING, 1, BGP_TRANSPORT_FIXED_BUFFER_SIZE, &logger);
+    if (!transport.start()) return;
+
+    int fds[2], other_fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, other_fds) < 0) {
+        fprintf(stderr, "bench-transport: socketpair() failed.\n");
+        exit(1);
+    }
+
+    int sndbuf = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    BgpOutHandler *out = transport.add(fds[0]);
+    std::vector<uint8_t> data(BGP_TRANSPORT_FIXED_BUFFER_SIZE / 2, 0x55);
+    uint8_t buffer[65536];
+    ssize_t len = 0;
+
+    if (out == NULL || !out->handleOut(data.data(), 64)) {
+        fprintf(stderr, "bench-transport: failed to queue data.\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < 100 && len <= 0; i++) {
+        if (transport.poll(10) < 0) break;
+        len = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+    }
+
+    if (len != 64 || !out->handleOut(data.data(), data.size()) || !out->handleOut(data.data(), data.size()) || transport.poll(10) < 0) {
+        fprintf(stderr, "bench-transport: failed to queue data.\n");
+        exit(1);
+    }
+
+    transport.remove(fds[0]);
+    close(fds[0]);
+    dup2(other_fds[0], fds[0]);
+
+    size_t received = 0, misdirected = 0;
+    for (int i = 0; i < 1000 && received < data.size() * 2; i++) {
+        if (transport.poll(1) < 0) break;
+
+        while ((len = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) received += len;
+        while ((len = recv(other_fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) misdirected += len;
+    }
+
+    if (received != data.size() * 2 || misdirected != 0) {
+        fprintf(stderr, "bench-transport: remove while writing: %zu of %zu bytes received, %zu bytes written to another socket.\n", received, data.size() * 2, misdirected);
+        exit(1);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    close(other_fds[0]);
+    close(other_fds[1]);
+}
+
+int main(int argc, char **argv) {
+    benchInit(argc, argv);
+    checkPeerReset();
+    checkRemoveWriting();
+
+    BgpLogHandler logger;
+    logger.setLogLevel(FATAL);
+
+    std::vector<Prefix4> prefixes = benchPrefixes4(TRANSPORT_ROUTES_PER_SESSION, 1);
+    std::vector<uint8_t> wire = record(&logger, prefixes);
+
+    static const size_t sessions[] = { 10, 100, 500 };
+    for (size_t n : sessions) {
+        if (n * TRANSPORT_ROUTES_PER_SESSION > benchOptions().max_prefixes) break;
+        benchReceive(wire, prefixes.size(), n, TRANSPORT_MODE_THREADS);
+        benchReceive(wire, prefixes.size(), n, TRANSPORT_MODE_EPOLL);
+        benchReceive(wire, prefixes.size(), n, TRANSPORT_MODE_URING);
+        benchReceive(wire, prefixes.size(), n, TRANSPORT_MODE_URING_FIXED);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file bench.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Microbenchmark harness for libbgp.
+ * @version 0.1
+ * @date 2019-08-24
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#ifndef BGP_BENCH_H_
+#define BGP_BENCH_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief Options shared by all benchmarks.
+ * 
+ * Options are read from the command line by benchInit():
+ * 
+ * -r <runs> Number of runs per benchmark. The fastest run is reported.
+ * -n <prefixes> Largest table size to use in table-size dependent benchmarks.
+ * -f <filter> Only run benchmarks with name containing the filter.
+ */
+struct BenchOptions {
+    BenchOptions() {
+        runs = 5;
+        max_prefixes = 1000000;
+        filter = NULL;
+    }
+
+    int runs;
+    size_t max_prefixes;
+    const char *filter;
+};
+
+inline BenchOptions& benchOptions() {
+    static BenchOptions options;
+    return options;
+}
+
+/**
+ * @brief Parse the benchmark command line options.
+ * 
+ * @param argc argc.
+ * @param argv argv.
+ */
+inline void benchInit(int argc, char **argv) {
+    BenchOptions &opts = benchOptions();
+
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-r") == 0) opts.runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0) opts.max_prefixes = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-f") == 0) opts.filter = argv[++i];
+    }
+
+    if (opts.runs < 1) opts.runs = 1;
+
+    printf("%-52s %10s %12s %14s\n", "benchmark", "ops", "ns/op", "ops/s");
+}
+
+/**
+ * @brief Get a monotonic timestamp in nanoseconds.
+ * 
+ * @return uint64_t timestamp.
+ */
+inline uint64_t benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief Prevent the compiler from optimizing away a value.
+ * 
+ * @param value The value.
+ */
+template <typename T>
+inline void benchKeep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @brief Check if a benchmark should run with the current filter.
+ * 
+ * @param name Name of the benchmark.
+ * @return true Benchmark should run.
+ * @return false Benchmark should be skipped.
+ */
+inline bool benchEnabled(const char *name) {
+    const char *filter = benchOptions().filter;
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+/**
+ * @brief Report the result of a benchmark.
+ * 
+ * @param name Name of the benchmark.
+ * @param ops Number of operations performed.
+ * @param elapsed_ns Time used, in nanoseconds.
+ */
+inline void benchReport(const char *name, uint64_t ops, uint64_t elapsed_ns) {
+    double ns_per_op = ops == 0 ? 0 : (double) elapsed_ns / ops;
+    double ops_per_sec = elapsed_ns == 0 ? 0 : ops / (elapsed_ns / 1e9);
+    printf("%-52s %10llu %12.1f %14.0f\n", name, (unsigned long long) ops, ns_per_op, ops_per_sec);
+    fflush(stdout);
+}
+
+/**
+ * @brief Run a benchmark.
+ * 
+ * setup() is called before every run and is not timed. fn() performs ops
+ * operations and is timed. The fastest run is reported.
+ * 
+ * @param name Name of the benchmark.
+ * @param ops Number of operations fn() performs.
+ * @param setup Untimed setup function.
+ * @param fn Timed function.
+ */
+template <typename S, typename F>
+void benchRun(const char *name, uint64_t ops, S setup, F fn) {
+    if (!benchEnabled(name)) return;
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < benchOptions().runs; i++) {
+        setup();
+        uint64_t start = benchNow();
+        fn();
+        uint64_t elapsed = benchNow() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    benchReport(name, ops, best);
+}
+
+/**
+ * @brief Run a benchmark without setup.
+ * 
+ * @param name Name of the benchmark.
+ * @param ops Number of operations fn() performs.
+ * @param fn Timed function.
+ */
+template <typename F>
+void benchRun(const char *name, uint64_t ops, F fn) {
+    benchRun(name, ops, [](){}, fn);
+}
+
+#endif // BGP_BENCH_H_
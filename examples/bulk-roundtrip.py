@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Round trip of routes through the bulk buffers of the Python bindings:
+# parse an UPDATE with BgpBulkParser, insert the records into a RIB with
+# BgpBulkRib4, dump them back and withdraw them. Exits non-zero if anything
+# read back differs from what went in.
+#
+# Needs the libbgp module built from src/libbgp.swg.
+
+import socket
+import struct
+import sys
+
+import libbgp
+
+ROUTE4 = struct.Struct('=4s4s4sIiBBBB')
+
+# UPDATE: ORIGIN IGP, AS_PATH 65000 65001 (4-byte ASNs), NEXT_HOP 192.0.2.1,
+# 198.51.100.0/24 and 203.0.113.0/24.
+ATTRIBS = bytes([
+    0x40, 1, 1, 0,
+    0x40, 2, 10, 2, 2, 0, 0, 0xfd, 0xe8, 0, 0, 0xfd, 0xe9,
+    0x40, 3, 4, 192, 0, 2, 1
+])
+NLRI = bytes([24, 198, 51, 100, 24, 203, 0, 113])
+BODY = struct.pack('>HH', 0, len(ATTRIBS)) + ATTRIBS + NLRI
+WIRE = b'\xff' * 16 + struct.pack('>HB', 19 + len(BODY), 2) + BODY
+
+WANT = {
+    (socket.inet_aton('198.51.100.0'), 24, socket.inet_aton('192.0.2.1')),
+    (socket.inet_aton('203.0.113.0'), 24, socket.inet_aton('192.0.2.1'))
+}
+
+def routes(buffer):
+    return {(r[0], r[5], r[1]) for r in ROUTE4.iter_unpack(buffer)}
+
+def check(what, got, want):
+    if got != want:
+        print('bulk-roundtrip: %s: got %r, want %r.' % (what, got, want))
+        sys.exit(1)
+
+logger = libbgp.BgpLogHandler()
+logger.setLogLevel(libbgp.FATAL)
+
+# any object with the buffer protocol goes in, memoryviews come out.
+parser = libbgp.BgpBulkParser(logger)
+check('parse', parser.parse(bytearray(WIRE)), len(WIRE))
+check('messages', parser.getMessageCount(), 1)
+check('announced', routes(parser.getAnnounced()), WANT)
+
+# copy the records out: they are only valid until the next parse().
+announced = bytes(parser.getAnnounced())
+sets = bytes(parser.getAttribSets())
+
+rib = libbgp.BgpRib4(logger)
+bulk = libbgp.BgpBulkRib4(rib, logger)
+src_router_id = struct.unpack('=I', socket.inet_aton('10.0.0.1'))[0]
+
+check('insert', bulk.insert(src_router_id, memoryview(announced), sets, WIRE), 2)
+check('dump', bulk.dump(), 2)
+check('dumped routes', routes(bulk.getRoutes()), WANT)
+check('attribute sets', bulk.getAttribSetCount(), 1)
+check('attributes', bytes(bulk.getAttribs()), ATTRIBS)
+
+check('withdraw', bulk.withdraw(src_router_id, announced), 2)
+check('dump after withdraw', bulk.dump(), 0)
+
+print('bulk-roundtrip: ok.')
@@ -39,7 +39,7 @@ protected:
             if (add_ev.new_routes) printRoutes("add", *(add_ev.new_routes));
             if (add_ev.replaced_entries) {
                 std::vector<libbgp::Prefix4> altered;
-                for (const libbgp::BgpRib4Entry &e : *(add_ev.replaced_entries)) {
+                for (const libbgp::Route4Replacement &e : *(add_ev.replaced_entries)) {
                     altered.push_back(e.route);
                 }
                 printRoutes("changed", *(add_ev.new_routes));
@@ -252,6 +252,14 @@ int main(void) {
     withdraw_event.routes = &drop_routes;
     local_bus.publish(&local_handler, withdraw_event);
 
+    // to add or remove many routes at once, originate() and retract() update
+    // the RIB and publish the changes in as few events as possible.
+    std::vector<libbgp::Prefix4> blackholes;
+    blackholes.push_back(libbgp::Prefix4("192.0.2.0", 24));
+    blackholes.push_back(libbgp::Prefix4("198.51.100.0", 24));
+    local_rib.originate(&local_logger, blackholes, local_bgp_config.default_nexthop4, 0, &local_bus, &local_handler);
+    local_rib.retract(blackholes, &local_bus, &local_handler);
+
     // clean up
     local.stop();
     remote.stop();
@@ -0,0 +1,157 @@
+/**
+ * @file fuzz-packet.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Fuzz target for BGP packet parsing. Works with libFuzzer (configure
+ * with --enable-libfuzzer) or AFL (afl-fuzz -i corpus -o out ./fuzz-packet
+ * @@), and has a standalone mode with a built-in mutator.
+ * @version 0.1
+ * @date 2019-08-29
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "fuzz-packet.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzzPacket(data, size);
+    return 0;
+}
+
+#ifndef LIBBGP_LIBFUZZER
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+// input being run, saved to FUZZ_CRASH_FILE on crash.
+static const FuzzInput *current = NULL;
+
+#define FUZZ_CRASH_FILE "fuzz-crash.bin"
+
+static void saveCrash(int sig) {
+    if (current != NULL) {
+        int fd = open(FUZZ_CRASH_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            ssize_t ret = write(fd, current->data(), current->size());
+            (void) ret;
+            close(fd);
+        }
+        const char msg[] = "fuzz-packet: crashed, input saved to " FUZZ_CRASH_FILE ".\n";
+        ssize_t ret = write(2, msg, sizeof(msg) - 1);
+        (void) ret;
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static bool readFile(const char *path, FuzzInput &input) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (f == NULL) return false;
+
+    uint8_t buffer[4096];
+    size_t len;
+    input.clear();
+    while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) input.insert(input.end(), buffer, buffer + len);
+
+    if (f != stdin) fclose(f);
+    return true;
+}
+
+// load a file, or all files in a directory.
+static void load(const char *path, std::vector<FuzzInput> &inputs) {
+    struct stat st;
+    if (strcmp(path, "-") != 0 && stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) return;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.') continue;
+            load((std::string(path) + "/" + ent->d_name).c_str(), inputs);
+        }
+        closedir(dir);
+        return;
+    }
+
+    FuzzInput input;
+    if (!readFile(path, input)) {
+        fprintf(stderr, "fuzz-packet: can't read %s.\n", path);
+        exit(1);
+    }
+    inputs.push_back(input);
+}
+
+static int writeSeeds(const char *dir) {
+    std::vector<FuzzInput> seeds = fuzzSeeds();
+    for (size_t i = 0; i < seeds.size(); i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/seed-%02zu.bin", dir, i);
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || fwrite(seeds[i].data(), 1, seeds[i].size(), f) != seeds[i].size()) {
+            fprintf(stderr, "fuzz-packet: can't write %s.\n", path);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    printf("fuzz-packet: wrote %zu seeds to %s.\n", seeds.size(), dir);
+    return 0;
+}
+
+static void usage(const char *me) {
+    fprintf(stderr, "usage: %s [-w dir] [-m iterations] [-s seed] [input ...]\n", me);
+    fprintf(stderr, "  run each input (file or directory; stdin if none) through the fuzz target.\n");
+    fprintf(stderr, "  -w dir: write the seed corpus to dir and exit.\n");
+    fprintf(stderr, "  -m iterations: run mutations of the inputs (built-in seeds if none).\n");
+    fprintf(stderr, "  -s seed: mutator seed.\n");
+}
+
+int main(int argc, char **argv) {
+    uint64_t iterations = 0;
+    uint64_t seed = 1;
+    std::vector<FuzzInput> inputs;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) return writeSeeds(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) iterations = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else break;
+    }
+
+    for (; i < argc; i++) load(argv[i], inputs);
+
+    signal(SIGSEGV, saveCrash);
+    signal(SIGABRT, saveCrash);
+    signal(SIGBUS, saveCrash);
+    signal(SIGFPE, saveCrash);
+
+    if (iterations == 0) {
+        if (inputs.size() == 0) load("-", inputs);
+        for (const FuzzInput &input : inputs) {
+            current = &input;
+            fuzzPacket(input.data(), input.size());
+        }
+        return 0;
+    }
+
+    if (inputs.size() == 0) inputs = fuzzSeeds();
+
+    FuzzMutator mutator(seed);
+    FuzzInput input;
+    current = &input;
+    for (uint64_t n = 0; n < iterations; n++) {
+        input = inputs[mutator.range(inputs.size())];
+        mutator.mutate(input, inputs[mutator.range(inputs.size())]);
+        fuzzPacket(input.data(), input.size());
+    }
+
+    printf("fuzz-packet: %llu iterations done.\n", (unsigned long long) iterations);
+    return 0;
+}
+#endif
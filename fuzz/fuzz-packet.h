@@ -0,0 +1,392 @@
+/**
+ * @file fuzz-packet.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Fuzzing harness for BGP packet parsing: the fuzz target, a seed
+ * corpus and a simple mutator.
+ * @version 0.1
+ * @date 2019-08-29
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_FUZZ_PACKET_H_
+#define BGP_FUZZ_PACKET_H_
+#include "bgp-sink.h"
+#include "bgp-packet.h"
+#include "bgp-open-message.h"
+#include "bgp-update-message.h"
+#include "bgp-notification-message.h"
+#include "bgp-keepalive-message.h"
+#include "bgp-errcode.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// set FUZZ_VERBOSE in the environment to log everything, for reproducing a
+// crash.
+#define FUZZ_VERBOSE_ENV "FUZZ_VERBOSE"
+
+// first byte of a fuzz input: flags. the rest: BGP messages.
+#define FUZZ_FLAG_4B_ASN 0x01
+
+typedef std::vector<uint8_t> FuzzInput;
+
+inline libbgp::BgpLogHandler* fuzzLogger() {
+    static libbgp::BgpLogHandler logger;
+    static bool init = false;
+    if (!init) {
+        logger.setLogLevel(getenv(FUZZ_VERBOSE_ENV) != NULL ? libbgp::DEBUG : libbgp::FATAL);
+        init = true;
+    }
+    return &logger;
+}
+
+/**
+ * @brief Write a packet, and check that the written size matches length() and
+ * the written message parses again.
+ *
+ * @param pkt The packet.
+ * @param is_4b Four octets ASN.
+ */
+inline void fuzzCheckWrite(const libbgp::BgpPacket &pkt, bool is_4b) {
+    using namespace libbgp;
+
+    static uint8_t write_buffer[4096];
+    libbgp::BgpLogHandler *logger = fuzzLogger();
+
+    ssize_t len = pkt.write(write_buffer, sizeof(write_buffer));
+    if (len < 0) return;
+
+    if (pkt.length() != len) {
+        fprintf(stderr, "fuzzCheckWrite: length() says %zd, but %zd bytes written.\n", pkt.length(), len);
+        abort();
+    }
+
+    if (getenv(FUZZ_VERBOSE_ENV) != NULL) {
+        fprintf(stderr, "fuzzCheckWrite: written:");
+        for (ssize_t i = 0; i < len; i++) fprintf(stderr, " %02x", write_buffer[i]);
+        fprintf(stderr, "\n");
+    }
+
+    BgpPacket reparsed(logger, is_4b);
+    if (reparsed.parse(write_buffer, len) != len) {
+        fprintf(stderr, "fuzzCheckWrite: written packet failed to parse again.\n");
+        abort();
+    }
+}
+
+/**
+ * @brief Check what can be done with a successfully parsed packet.
+ *
+ * The packet is printed and written back (see fuzzCheckWrite()). UPDATE 
+ * messages are also written from their parsed fields instead of the wire 
+ * bytes, and go through the AS_PATH and AGGREGATOR conversions BgpFsm does on
+ * them.
+ *
+ * @param pkt The parsed packet.
+ * @param is_4b Four octets ASN.
+ */
+inline void fuzzCheckPacket(libbgp::BgpPacket &pkt, bool is_4b) {
+    using namespace libbgp;
+
+    static uint8_t print_buffer[65536];
+    libbgp::BgpLogHandler *logger = fuzzLogger();
+
+    pkt.print(print_buffer, sizeof(print_buffer));
+    if (getenv(FUZZ_VERBOSE_ENV) != NULL) fprintf(stderr, "%s", print_buffer);
+
+    fuzzCheckWrite(pkt, is_4b);
+
+    const BgpMessage *msg = pkt.getMessage();
+    if (msg->type != UPDATE) return;
+
+    const BgpUpdateMessage *parsed = (const BgpUpdateMessage *) msg;
+    BgpUpdateMessage update(logger, is_4b);
+    update.setAttribs(parsed->path_attribute);
+    update.withdrawn_routes = parsed->withdrawn_routes;
+    update.nlri = parsed->nlri;
+    for (const std::shared_ptr<BgpPathAttrib> &attrib : update.path_attribute) attrib->markDirty();
+
+    BgpPacket fields(logger, is_4b, &update);
+    fuzzCheckWrite(fields, is_4b);
+
+    if (!is_4b) {
+        update.restoreAsPath();
+        update.restoreAggregator();
+        update.downgradeAsPath();
+        update.downgradeAggregator();
+        BgpPacket out(logger, is_4b, &update);
+        out.write(print_buffer, sizeof(print_buffer));
+    }
+}
+
+/**
+ * @brief The fuzz target.
+ *
+ * Feed the input to a BgpSink, pour all packets out, and check them.
+ *
+ * @param data The input. The first byte is flags (FUZZ_FLAG_*), the rest is
+ * BGP messages.
+ * @param size Size of the input.
+ */
+inline void fuzzPacket(const uint8_t *data, size_t size) {
+    using namespace libbgp;
+
+    if (size < 1) return;
+    bool is_4b = data[0] & FUZZ_FLAG_4B_ASN;
+
+    BgpSink sink(is_4b);
+    sink.setLogger(fuzzLogger());
+    sink.fill(data + 1, size - 1);
+
+    for (;;) {
+        BgpPacket *pkt = NULL;
+        ssize_t ret = sink.pour(&pkt);
+        if (ret >= 0 && pkt != NULL) fuzzCheckPacket(*pkt, is_4b);
+        if (pkt != NULL) delete pkt;
+        if (ret <= 0 && ret != -1) break;
+    }
+}
+
+inline FuzzInput fuzzWrite(const libbgp::BgpMessage &msg, bool is_4b) {
+    uint8_t buffer[4096];
+    libbgp::BgpPacket pkt(fuzzLogger(), is_4b, &msg);
+    ssize_t len = pkt.write(buffer, sizeof(buffer));
+    if (len < 0) {
+        fprintf(stderr, "fuzzWrite: failed to write seed.\n");
+        abort();
+    }
+
+    FuzzInput input;
+    input.push_back(is_4b ? FUZZ_FLAG_4B_ASN : 0);
+    input.insert(input.end(), buffer, buffer + len);
+    return input;
+}
+
+inline libbgp::BgpUpdateMessage fuzzSeedUpdate4(bool is_4b) {
+    using namespace libbgp;
+
+    BgpLogHandler *logger = fuzzLogger();
+    BgpUpdateMessage update(logger, is_4b);
+
+    BgpPathAttribOrigin origin(logger);
+    origin.origin = IGP;
+    update.addAttrib(origin);
+
+    BgpPathAttribAsPath path(logger, is_4b);
+    BgpAsPathSegment seq(is_4b, AS_SEQUENCE);
+    seq.value.push_back(65000);
+    seq.value.push_back(is_4b ? 4200000001U : 23456);
+    BgpAsPathSegment set(is_4b, AS_SET);
+    set.value.push_back(65001);
+    set.value.push_back(65002);
+    path.as_paths.push_back(seq);
+    path.as_paths.push_back(set);
+    update.addAttrib(path);
+
+    BgpPathAttribNexthop nexthop(logger);
+    nexthop.next_hop = htonl(0xc0000201);
+    update.addAttrib(nexthop);
+
+    BgpPathAttribMed med(logger);
+    med.med = 100;
+    update.addAttrib(med);
+
+    BgpPathAttribLocalPref local_pref(logger);
+    local_pref.local_pref = 200;
+    update.addAttrib(local_pref);
+
+    update.addAttrib(BgpPathAttribAtomicAggregate(logger));
+
+    BgpPathAttribAggregator aggregator(logger, is_4b);
+    aggregator.aggregator = htonl(0x0a000001);
+    aggregator.aggregator_asn = is_4b ? 4200000001U : 23456;
+    update.addAttrib(aggregator);
+
+    if (!is_4b) {
+        BgpPathAttribAs4Path as4_path(logger);
+        BgpAsPathSegment as4_seq(true, AS_SEQUENCE);
+        as4_seq.value.push_back(4200000001U);
+        as4_path.as4_paths.push_back(as4_seq);
+        update.addAttrib(as4_path);
+
+        BgpPathAttribAs4Aggregator as4_aggregator(logger);
+        as4_aggregator.aggregator = htonl(0x0a000001);
+        as4_aggregator.aggregator_asn4 = 4200000001U;
+        update.addAttrib(as4_aggregator);
+    }
+
+    BgpPathAttribCommunity community(logger);
+    community.communites.push_back(htonl((65000 << 16) | 1));
+    community.communites.push_back(htonl(0xffffff01));
+    update.addAttrib(community);
+
+    const uint8_t unknown_value[] = { 1, 2, 3, 4, 5 };
+    BgpPathAttrib unknown(logger, unknown_value, sizeof(unknown_value));
+    unknown.type_code = 99;
+    unknown.optional = true;
+    unknown.transitive = true;
+    update.addAttrib(unknown);
+
+    update.addNlri4(htonl(0xcb007100), 24);
+    update.addNlri4(htonl(0x0a000000), 8);
+    update.addNlri4(htonl(0xc6336401), 32);
+    update.addNlri4(0, 0);
+    update.addWithdrawn4(htonl(0xc0000000), 24);
+
+    return update;
+}
+
+/**
+ * @brief Get the seed corpus.
+ *
+ * One of each message type, and UPDATE messages with every attribute known to
+ * the library, in both two and four octets ASN flavours.
+ *
+ * @return std::vector<FuzzInput> The seeds.
+ */
+inline std::vector<FuzzInput> fuzzSeeds() {
+    using namespace libbgp;
+
+    BgpLogHandler *logger = fuzzLogger();
+    std::vector<FuzzInput> seeds;
+
+    for (int is_4b = 0; is_4b <= 1; is_4b++) {
+        BgpOpenMessage open(logger, is_4b, 65000, 90, htonl(0x0a000001));
+        if (is_4b) {
+            open.setAsn(4200000001U);
+            BgpCapabilityMpBgp mp6(logger);
+            mp6.afi = IPV6;
+            mp6.safi = UNICAST;
+            open.addCapability(std::shared_ptr<BgpCapability>(new BgpCapabilityMpBgp(mp6)));
+        }
+        seeds.push_back(fuzzWrite(open, is_4b));
+
+        seeds.push_back(fuzzWrite(fuzzSeedUpdate4(is_4b), is_4b));
+    }
+
+    // OPEN with an unknown capability and an unknown optional parameter.
+    const uint8_t open_unknown[] = {
+        FUZZ_FLAG_4B_ASN,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x00, 0x2d, OPEN,
+        0x04, 0xfd, 0xe8, 0x00, 0x5a, 0x0a, 0x00, 0x00, 0x01, 0x10,
+        0x02, 0x0a, 0x41, 0x04, 0x00, 0x00, 0xfd, 0xe8, 0x80, 0x02, 0xab, 0xcd,
+        0x09, 0x02, 0x12, 0x34
+    };
+    seeds.push_back(FuzzInput(open_unknown, open_unknown + sizeof(open_unknown)));
+
+    seeds.push_back(fuzzWrite(BgpKeepaliveMessage(logger), true));
+
+    const uint8_t notify_data[] = { 0x00, 0x5a };
+    seeds.push_back(fuzzWrite(BgpNotificationMessage(logger, E_OPEN, E_HOLD_TIME, notify_data, sizeof(notify_data)), true));
+
+    // IPv6 reach and unreach.
+    BgpUpdateMessage update6(logger, true);
+    BgpPathAttribOrigin origin(logger);
+    update6.addAttrib(origin);
+    update6.addAttrib(BgpPathAttribAsPath(logger, true));
+    uint8_t nh_global[16], nh_linklocal[16], prefix[16];
+    inet_pton(AF_INET6, "2001:db8::1", nh_global);
+    inet_pton(AF_INET6, "fe80::1", nh_linklocal);
+    inet_pton(AF_INET6, "2001:db8:1::", prefix);
+    std::vector<Prefix6> routes6;
+    routes6.push_back(Prefix6(prefix, 48));
+    routes6.push_back(Prefix6(prefix, 127));
+    update6.setNlri6(routes6, nh_global, nh_linklocal);
+    seeds.push_back(fuzzWrite(update6, true));
+
+    BgpUpdateMessage withdraw6(logger, true);
+    withdraw6.setWithdrawn6(routes6);
+    seeds.push_back(fuzzWrite(withdraw6, true));
+
+    // enough IPv6 routes to need extended length MP_REACH/MP_UNREACH.
+    std::vector<Prefix6> many_routes6;
+    for (int i = 0; i < 64; i++) {
+        prefix[5] = i;
+        many_routes6.push_back(Prefix6(prefix, 48));
+    }
+    BgpUpdateMessage update6_ext(logger, true);
+    update6_ext.addAttrib(origin);
+    update6_ext.addAttrib(BgpPathAttribAsPath(logger, true));
+    update6_ext.setNlri6(many_routes6, nh_global, nh_linklocal);
+    seeds.push_back(fuzzWrite(update6_ext, true));
+
+    BgpUpdateMessage withdraw6_ext(logger, true);
+    withdraw6_ext.setWithdrawn6(many_routes6);
+    seeds.push_back(fuzzWrite(withdraw6_ext, true));
+
+    // two messages back to back, to exercise framing.
+    FuzzInput stream = fuzzWrite(BgpKeepaliveMessage(logger), true);
+    FuzzInput update = fuzzWrite(fuzzSeedUpdate4(true), true);
+    stream.insert(stream.end(), update.begin() + 1, update.end());
+    seeds.push_back(stream);
+
+    return seeds;
+}
+
+/**
+ * @brief A simple deterministic mutator.
+ *
+ * Good enough to exercise the error paths of the parsers without an external
+ * fuzzer. Use libFuzzer or AFL for coverage-guided fuzzing.
+ */
+class FuzzMutator {
+public:
+    FuzzMutator(uint64_t seed) : state(seed == 0 ? 0x9e3779b97f4a7c15ULL : seed) {}
+
+    uint32_t range(uint32_t n) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (uint32_t) (((state * 0x2545f4914f6cdd1dULL) >> 32) % n);
+    }
+
+    /**
+     * @brief Mutate an input.
+     *
+     * The first byte (flags) is left alone, except by bit flips. Unless
+     * asked not to, the length field of a single-message input is fixed
+     * after mutating, so the mutated message gets past the framing.
+     *
+     * @param input The input.
+     * @param other Another input to splice from.
+     */
+    void mutate(FuzzInput &input, const FuzzInput &other) {
+        static const uint8_t interesting[] = { 0x00, 0x01, 0x02, 0x04, 0x10, 0x20, 0x21, 0x40, 0x7f, 0x80, 0x81, 0xfe, 0xff };
+
+        uint32_t n = 1 + range(4);
+        for (uint32_t i = 0; i < n && input.size() > 1; i++) {
+            size_t pos = range(input.size());
+            switch (range(7)) {
+                case 0: input[pos] ^= 1 << range(8); break;
+                case 1: input[pos] = interesting[range(sizeof(interesting))]; break;
+                case 2: input[pos] = range(256); break;
+                case 3: if (pos > 0) input.insert(input.begin() + pos, (uint8_t) range(256)); break;
+                case 4: if (pos > 0) input.erase(input.begin() + pos); break;
+                case 5: if (pos > 0) input.resize(pos); break;
+                case 6:
+                    if (pos > 0 && other.size() > 1) {
+                        size_t from = 1 + range(other.size() - 1);
+                        size_t len = 1 + range(other.size() - from);
+                        input.insert(input.begin() + pos, other.begin() + from, other.begin() + from + len);
+                    }
+                    break;
+            }
+        }
+
+        if (range(4) != 0 && input.size() >= 20 && input.size() <= 4097) {
+            uint16_t len = htons(input.size() - 1);
+            memcpy(input.data() + 17, &len, 2);
+        }
+    }
+
+private:
+    uint64_t state;
+};
+
+#endif // BGP_FUZZ_PACKET_H_
@@ -0,0 +1,129 @@
+/**
+ * @file bgp-asn-codec.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Codecs for two and four octets ASN arrays.
+ * @version 0.1
+ * @date 2019-09-05
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-asn-codec.h"
+#include "value-op.h"
+#include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace libbgp {
+
+const bool BgpAsnCodec<uint16_t>::is_4b;
+const size_t BgpAsnCodec<uint16_t>::max_segment_size;
+const bool BgpAsnCodec<uint32_t>::is_4b;
+const size_t BgpAsnCodec<uint32_t>::max_segment_size;
+
+#ifdef __SSE2__
+// swap the two bytes of each 16 bits lane.
+static inline __m128i bswap16x8(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+// swap the four bytes of each 32 bits lane.
+static inline __m128i bswap32x4(__m128i v) {
+    v = bswap16x8(v);
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+}
+#endif
+
+/**
+ * @brief Decode two octets ASNs.
+ *
+ * @param from Pointer to ASNs on the wire.
+ * @param count Number of ASNs.
+ * @param to Array of at least count ASNs to write to.
+ */
+void BgpAsnCodec<uint16_t>::decode(const uint8_t *from, size_t count, uint32_t *to) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = bswap16x8(_mm_loadu_si128((const __m128i *) (from + i * 2)));
+        _mm_storeu_si128((__m128i *) (to + i), _mm_unpacklo_epi16(v, zero));
+        _mm_storeu_si128((__m128i *) (to + i + 4), _mm_unpackhi_epi16(v, zero));
+    }
+#endif
+
+    const uint8_t *buffer = from + i * 2;
+    for (; i < count; i++) to[i] = ntohs(getValue<uint16_t>(&buffer));
+}
+
+/**
+ * @brief Encode two octets ASNs. ASNs must fit in two octets, see toWire().
+ *
+ * @param from ASNs to encode.
+ * @param count Number of ASNs.
+ * @param to Buffer of at least count * 2 bytes to write to.
+ */
+void BgpAsnCodec<uint16_t>::encode(const uint32_t *from, size_t count, uint8_t *to) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 8 <= count; i += 8) {
+        // sign-extend the low 16 bits, so the signed saturating pack keeps
+        // them as they are.
+        __m128i lo = _mm_loadu_si128((const __m128i *) (from + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (from + i + 4));
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+        _mm_storeu_si128((__m128i *) (to + i * 2), bswap16x8(_mm_packs_epi32(lo, hi)));
+    }
+#endif
+
+    uint8_t *buffer = to + i * 2;
+    for (; i < count; i++) putValue<uint16_t>(&buffer, htons((uint16_t) from[i]));
+}
+
+/**
+ * @brief Decode four octets ASNs.
+ *
+ * @param from Pointer to ASNs on the wire.
+ * @param count Number of ASNs.
+ * @param to Array of at least count ASNs to write to.
+ */
+void BgpAsnCodec<uint32_t>::decode(const uint8_t *from, size_t count, uint32_t *to) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (from + i * 4));
+        _mm_storeu_si128((__m128i *) (to + i), bswap32x4(v));
+    }
+#endif
+
+    const uint8_t *buffer = from + i * 4;
+    for (; i < count; i++) to[i] = ntohl(getValue<uint32_t>(&buffer));
+}
+
+/**
+ * @brief Encode four octets ASNs.
+ *
+ * @param from ASNs to encode.
+ * @param count Number of ASNs.
+ * @param to Buffer of at least count * 4 bytes to write to.
+ */
+void BgpAsnCodec<uint32_t>::encode(const uint32_t *from, size_t count, uint8_t *to) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (from + i));
+        _mm_storeu_si128((__m128i *) (to + i * 4), bswap32x4(v));
+    }
+#endif
+
+    uint8_t *buffer = to + i * 4;
+    for (; i < count; i++) putValue<uint32_t>(&buffer, htonl(from[i]));
+}
+
+}
@@ -0,0 +1,79 @@
+/**
+ * @file bgp-asn-codec.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Codecs for two and four octets ASN arrays.
+ * @version 0.1
+ * @date 2019-09-05
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_ASN_CODEC_H_
+#define BGP_ASN_CODEC_H_
+#include <stdint.h>
+#include <unistd.h>
+
+// AS_TRANS, used in place of four octets ASNs when talking to two octets
+// speakers.
+#define BGP_AS_TRANS 23456
+
+namespace libbgp {
+
+/**
+ * @brief Codec for ASNs of one width on the wire.
+ *
+ * Specialized for uint16_t (two octets ASN) and uint32_t (four octets ASN).
+ * The width is fixed once a session has negotiated four octets ASN support,
+ * so the AS_PATH, AS4_PATH and AGGREGATOR codecs pick a specialization once
+ * per attribute instead of checking the width for every ASN. Arrays are
+ * byte-swapped with SSE2 where available.
+ *
+ * @tparam AsnT Type of ASN on the wire.
+ */
+template <typename AsnT> struct BgpAsnCodec;
+
+/**
+ * @brief Two octets ASN codec.
+ *
+ */
+template <> struct BgpAsnCodec<uint16_t> {
+    // four octets ASN?
+    static const bool is_4b = false;
+
+    // max number of ASNs in one AS_PATH segment.
+    static const size_t max_segment_size = 255;
+
+    // map an ASN to the value to put on the wire. (AS_TRANS if too large)
+    static uint32_t toWire(uint32_t asn) { return asn >= 0xffff ? BGP_AS_TRANS : asn; }
+
+    // read count ASNs in network byte order from "from" to "to".
+    static void decode(const uint8_t *from, size_t count, uint32_t *to);
+
+    // write count ASNs from "from" to "to" in network byte order.
+    static void encode(const uint32_t *from, size_t count, uint8_t *to);
+};
+
+/**
+ * @brief Four octets ASN codec.
+ *
+ */
+template <> struct BgpAsnCodec<uint32_t> {
+    // four octets ASN?
+    static const bool is_4b = true;
+
+    // max number of ASNs in one AS_PATH segment.
+    static const size_t max_segment_size = 127;
+
+    // map an ASN to the value to put on the wire.
+    static uint32_t toWire(uint32_t asn) { return asn; }
+
+    // read count ASNs in network byte order from "from" to "to".
+    static void decode(const uint8_t *from, size_t count, uint32_t *to);
+
+    // write count ASNs from "from" to "to" in network byte order.
+    static void encode(const uint32_t *from, size_t count, uint8_t *to);
+};
+
+}
+
+#endif // BGP_ASN_CODEC_H_
@@ -35,6 +35,10 @@ ssize_t BgpBadMessage::write(__attribute__((unused)) uint8_t *to, __attribute__(
     return -1;
 }
 
+ssize_t BgpBadMessage::length() const {
+    return -1;
+}
+
 ssize_t BgpBadMessage::doPrint(__attribute__((unused)) size_t indent, uint8_t **to, __attribute__((unused)) size_t *buf_sz) const {
     return _print(indent, to, buf_sz, "InvalidMessage { }\n");
 }
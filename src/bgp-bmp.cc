@@ -0,0 +1,489 @@
+/**
+ * @file bgp-bmp.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief BGP Monitoring Protocol exporter. (RFC 7854)
+ * @version 0.1
+ * @date 2019-09-10
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-bmp.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <chrono>
+
+#define BMP_VERSION 3
+#define BMP_COMMON_HEADER_SIZE 6
+#define BMP_PEER_HEADER_SIZE 42
+
+// per-peer header flags.
+#define BMP_PEER_FLAG_POST_POLICY 0x40
+#define BMP_PEER_FLAG_2B_ASN 0x20
+
+// information TLV types.
+#define BMP_INFO_STRING 0
+#define BMP_INFO_SYS_DESCR 1
+#define BMP_INFO_SYS_NAME 2
+#define BMP_TERM_REASON 1
+
+namespace libbgp {
+
+static std::atomic<uint64_t> bmp_next_id(1);
+
+/**
+ * @brief Rings of the exporters the thread produced messages for. Closed when
+ * the thread exits, so the writer can free them once drained.
+ *
+ */
+struct BgpBmpThreadRings {
+    ~BgpBmpThreadRings() {
+        for (auto &ring : rings) ring.second->store(true, std::memory_order_release);
+    }
+
+    std::vector<std::pair<uint64_t, std::shared_ptr<std::atomic<bool>>>> rings;
+    std::vector<void *> ring_ptrs;
+};
+
+static thread_local BgpBmpThreadRings bmp_thread_rings;
+
+static inline uint8_t* putShort(uint8_t *ptr, uint16_t value) {
+    value = htons(value);
+    memcpy(ptr, &value, sizeof(value));
+    return ptr + sizeof(value);
+}
+
+static inline uint8_t* putLong(uint8_t *ptr, uint32_t value) {
+    value = htonl(value);
+    memcpy(ptr, &value, sizeof(value));
+    return ptr + sizeof(value);
+}
+
+// write the common header, returns pointer past it.
+static inline uint8_t* putCommonHeader(uint8_t *ptr, uint8_t type, uint32_t length) {
+    ptr[0] = BMP_VERSION;
+    ptr = putLong(ptr + 1, length);
+    ptr[0] = type;
+    return ptr + 1;
+}
+
+// write the per-peer header, returns pointer past it.
+static inline uint8_t* putPeerHeader(uint8_t *ptr, const BgpBmpPeer &peer, uint64_t time_ms, bool post_policy) {
+    ptr[0] = 0; // global instance peer
+    ptr[1] = (post_policy ? BMP_PEER_FLAG_POST_POLICY : 0) | (peer.two_byte_asn ? BMP_PEER_FLAG_2B_ASN : 0);
+    memset(ptr + 2, 0, 8 + 12); // distinguisher, IPv4 padding
+    memcpy(ptr + 22, &peer.peer_addr, 4);
+    ptr = putLong(ptr + 26, peer.peer_asn);
+    memcpy(ptr, &peer.peer_bgp_id, 4);
+    ptr = putLong(ptr + 4, time_ms / 1000);
+    return putLong(ptr, (time_ms % 1000) * 1000);
+}
+
+// write an information TLV, returns pointer past it.
+static inline uint8_t* putTlv(uint8_t *ptr, uint16_t type, const void *value, uint16_t length) {
+    ptr = putShort(ptr, type);
+    ptr = putShort(ptr, length);
+    memcpy(ptr, value, length);
+    return ptr + length;
+}
+
+/**
+ * @brief Construct a new BgpBmpExporter.
+ *
+ * @param fd File descriptor of the collector socket, or a file, to write
+ * messages to. Not closed by the exporter.
+ * @param sys_name System name sent in Initiation.
+ * @param sys_descr System description sent in Initiation.
+ * @param post_policy Send post-policy Route Monitoring (routes accepted by
+ * ingress filters) too. Costs an encode of each filtered UPDATE.
+ * @param ring_size Number of messages buffered per producing thread.
+ * @param logger Log handler. (NULL to log to stderr)
+ */
+BgpBmpExporter::BgpBmpExporter(int fd, const char *sys_name, const char *sys_descr, bool post_policy, size_t ring_size, BgpLogHandler *logger) : running(false), stopping(false), writer_idle(false) {
+    id = bmp_next_id.fetch_add(1);
+    this->fd = fd;
+    this->sys_name = sys_name;
+    this->sys_descr = sys_descr;
+    this->post_policy = post_policy;
+    this->ring_size = ring_size;
+    failed = false;
+
+    if (logger == NULL) {
+        this->logger = new BgpLogHandler();
+        log_local = true;
+    } else {
+        this->logger = logger;
+        log_local = false;
+    }
+}
+
+BgpBmpExporter::~BgpBmpExporter() {
+    stop();
+
+    // the producing threads may still hold the rings.
+    for (auto &ring : rings) ring->closed.store(true, std::memory_order_release);
+
+    if (log_local) delete logger;
+}
+
+/**
+ * @brief Write Initiation to the fd, and start the writer thread.
+ *
+ * @return true Started.
+ * @return false Failed to write, or already started.
+ */
+bool BgpBmpExporter::start() {
+    if (running.load()) return false;
+
+    uint16_t name_len = sys_name.size() > 0xffff ? 0xffff : sys_name.size();
+    uint16_t descr_len = sys_descr.size() > 0xffff ? 0xffff : sys_descr.size();
+    std::vector<uint8_t> msg(BMP_COMMON_HEADER_SIZE + 4 + descr_len + 4 + name_len);
+
+    uint8_t *ptr = putCommonHeader(msg.data(), BMP_INITIATION, msg.size());
+    ptr = putTlv(ptr, BMP_INFO_SYS_DESCR, sys_descr.data(), descr_len);
+    putTlv(ptr, BMP_INFO_SYS_NAME, sys_name.data(), name_len);
+
+    failed = false;
+    if (!writeAll(msg.data(), msg.size())) return false;
+
+    stopping.store(false);
+    running.store(true);
+    writer = std::thread(&BgpBmpExporter::writerMain, this);
+
+    return true;
+}
+
+/**
+ * @brief Write out the messages queued, then Termination, and stop the writer
+ * thread. Messages other threads are queuing are waited for and written,
+ * messages queued after this are dropped.
+ *
+ */
+void BgpBmpExporter::stop() {
+    if (!running.load()) return;
+
+    // no more messages from now. wait for the ones being queued, getRing()
+    // either sees stopping, or the ring busy here.
+    stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const std::shared_ptr<Ring> &ring : rings) {
+            while (ring->busy.load()) std::this_thread::yield();
+        }
+    }
+
+    wake_cv.notify_one();
+    writer.join();
+    running.store(false);
+
+    // the writer may have made its last pass before the messages waited for
+    // above were committed.
+    std::vector<uint8_t> batch;
+    drain(batch);
+
+    uint8_t msg[BMP_COMMON_HEADER_SIZE + 4 + 2];
+    uint8_t *ptr = putCommonHeader(msg, BMP_TERMINATION, sizeof(msg));
+    uint16_t reason = htons(0); // administratively closed
+    putTlv(ptr, BMP_TERM_REASON, &reason, sizeof(reason));
+
+    if (!failed) writeAll(msg, sizeof(msg));
+}
+
+/**
+ * @brief Queue a Route Monitoring message.
+ *
+ * @param peer The peer the UPDATE is from.
+ * @param time_ms Time the UPDATE was received, in milliseconds.
+ * @param post_policy The UPDATE is post-policy.
+ * @param pdu The UPDATE message, BGP header included.
+ * @param length Length of the UPDATE message.
+ * @return true Queued.
+ * @return false Dropped.
+ */
+bool BgpBmpExporter::routeMonitoring(const BgpBmpPeer &peer, uint64_t time_ms, bool post_policy, const uint8_t *pdu, size_t length) {
+    Ring *ring = getRing();
+    std::vector<uint8_t> *msg = ring == NULL ? NULL : ring->queue.back();
+    if (msg == NULL) {
+        drop(ring);
+        return false;
+    }
+
+    msg->resize(BMP_COMMON_HEADER_SIZE + BMP_PEER_HEADER_SIZE + length);
+
+    uint8_t *ptr = putCommonHeader(msg->data(), BMP_ROUTE_MONITORING, msg->size());
+    ptr = putPeerHeader(ptr, peer, time_ms, post_policy);
+    memcpy(ptr, pdu, length);
+
+    commit(ring);
+
+    return true;
+}
+
+/**
+ * @brief Queue a Peer Up message.
+ *
+ * @param peer The peer.
+ * @param time_ms Time the session was established, in milliseconds.
+ * @param local_addr Local IPv4 address of the session. (network bytes order,
+ * 0 if unknown)
+ * @param open_sent The OPEN message sent, BGP header included.
+ * @param open_sent_length Length of the OPEN message sent.
+ * @param open_recv The OPEN message received, BGP header included.
+ * @param open_recv_length Length of the OPEN message received.
+ * @return true Queued.
+ * @return false Dropped.
+ */
+bool BgpBmpExporter::peerUp(const BgpBmpPeer &peer, uint64_t time_ms, uint32_t local_addr, const uint8_t *open_sent, size_t open_sent_length, const uint8_t *open_recv, size_t open_recv_length) {
+    Ring *ring = getRing();
+    std::vector<uint8_t> *msg = ring == NULL ? NULL : ring->queue.back();
+    if (msg == NULL) {
+        drop(ring);
+        return false;
+    }
+
+    msg->resize(BMP_COMMON_HEADER_SIZE + BMP_PEER_HEADER_SIZE + 20 + open_sent_length + open_recv_length);
+
+    uint8_t *ptr = putCommonHeader(msg->data(), BMP_PEER_UP, msg->size());
+    ptr = putPeerHeader(ptr, peer, time_ms, false);
+    memset(ptr, 0, 12);
+    memcpy(ptr + 12, &local_addr, 4);
+    memset(ptr + 16, 0, 4); // ports unknown
+    ptr += 20;
+    memcpy(ptr, open_sent, open_sent_length);
+    memcpy(ptr + open_sent_length, open_recv, open_recv_length);
+
+    commit(ring);
+
+    return true;
+}
+
+/**
+ * @brief Queue a Peer Down message.
+ *
+ * @param peer The peer.
+ * @param time_ms Time the session went down, in milliseconds.
+ * @param reason Reason of the session going down.
+ * @param data Data for the reason. (see BgpBmpPeerDownReason)
+ * @param length Length of the data.
+ * @return true Queued.
+ * @return false Dropped.
+ */
+bool BgpBmpExporter::peerDown(const BgpBmpPeer &peer, uint64_t time_ms, BgpBmpPeerDownReason reason, const uint8_t *data, size_t length) {
+    Ring *ring = getRing();
+    std::vector<uint8_t> *msg = ring == NULL ? NULL : ring->queue.back();
+    if (msg == NULL) {
+        drop(ring);
+        return false;
+    }
+
+    msg->resize(BMP_COMMON_HEADER_SIZE + BMP_PEER_HEADER_SIZE + 1 + length);
+
+    uint8_t *ptr = putCommonHeader(msg->data(), BMP_PEER_DOWN, msg->size());
+    ptr = putPeerHeader(ptr, peer, time_ms, false);
+    ptr[0] = reason;
+    if (length > 0) memcpy(ptr + 1, data, length);
+
+    commit(ring);
+
+    return true;
+}
+
+/**
+ * @brief Test if post-policy Route Monitoring should be sent.
+ *
+ * @return true Send post-policy Route Monitoring.
+ * @return false Pre-policy only.
+ */
+bool BgpBmpExporter::isPostPolicy() const {
+    return post_policy;
+}
+
+/**
+ * @brief Get number of messages queued.
+ *
+ * @return uint64_t Number of messages.
+ */
+uint64_t BgpBmpExporter::getMessageCount() const {
+    return messages.get();
+}
+
+/**
+ * @brief Get number of messages dropped, because a ring was full or the
+ * exporter not running.
+ *
+ * @return uint64_t Number of messages.
+ */
+uint64_t BgpBmpExporter::getDropCount() const {
+    return drops.get();
+}
+
+/**
+ * @brief Get number of bytes written to the fd.
+ *
+ * @return uint64_t Number of bytes.
+ */
+uint64_t BgpBmpExporter::getByteCount() const {
+    return bytes.get();
+}
+
+// get the ring of the calling thread, registered on first use, and mark it
+// busy until commit() or drop(). NULL if not running.
+BgpBmpExporter::Ring* BgpBmpExporter::getRing() {
+    if (!running.load(std::memory_order_acquire) || stopping.load(std::memory_order_acquire)) return NULL;
+
+    Ring *ring = NULL;
+    BgpBmpThreadRings &mine = bmp_thread_rings;
+    for (size_t i = 0; i < mine.rings.size(); i++) {
+        if (mine.rings[i].first == id) {
+            ring = (Ring *) mine.ring_ptrs[i];
+            break;
+        }
+    }
+
+    if (ring == NULL) ring = addRing();
+
+    // pairs with stop(): sequentially consistent, so that stop() sees the
+    // ring busy, or we see stopping.
+    ring->busy.store(true);
+    if (stopping.load()) {
+        ring->busy.store(false, std::memory_order_release);
+        return NULL;
+    }
+
+    return ring;
+}
+
+// register a ring for the calling thread.
+BgpBmpExporter::Ring* BgpBmpExporter::addRing() {
+    BgpBmpThreadRings &mine = bmp_thread_rings;
+
+    // rings of exporters gone are closed, forget them.
+    for (size_t i = 0; i < mine.rings.size();) {
+        if (mine.rings[i].second->load(std::memory_order_acquire)) {
+            mine.rings.erase(mine.rings.begin() + i);
+            mine.ring_ptrs.erase(mine.ring_ptrs.begin() + i);
+        } else i++;
+    }
+
+    std::shared_ptr<Ring> ring = std::make_shared<Ring>(ring_size);
+
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+
+    // the closed flag is shared with the thread, the ring itself only with
+    // the writer.
+    mine.rings.push_back(std::make_pair(id, std::shared_ptr<std::atomic<bool>>(ring, &ring->closed)));
+    mine.ring_ptrs.push_back(ring.get());
+
+    return ring.get();
+}
+
+// publish the message at the back of the ring. wake the writer if it sleeps
+// and the ring is half full, so it writes in batches and has time to drain the
+// ring before it overflows. (never blocks: if missed, the writer wakes up on
+// its own)
+void BgpBmpExporter::commit(Ring *ring) {
+    ring->queue.commit();
+    messages.inc();
+    ring->busy.store(false, std::memory_order_release);
+
+    if (writer_idle.load(std::memory_order_relaxed) && ring->queue.size() >= ring->queue.capacity() / 2 && writer_idle.exchange(false)) {
+        wake_cv.notify_one();
+    }
+}
+
+// count a message dropped, and release the ring if got one.
+void BgpBmpExporter::drop(Ring *ring) {
+    if (ring != NULL) ring->busy.store(false, std::memory_order_release);
+    drops.inc();
+}
+
+// move the messages queued in all rings to the fd, in batches. returns number
+// of messages moved.
+size_t BgpBmpExporter::drain(std::vector<uint8_t> &batch) {
+    std::vector<std::shared_ptr<Ring>> current;
+    size_t moved = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        current = rings;
+    }
+
+    for (const std::shared_ptr<Ring> &ring : current) {
+        const std::vector<uint8_t> *msg;
+        while ((msg = ring->queue.front()) != NULL) {
+            if (batch.size() > 0 && batch.size() + msg->size() > BGP_BMP_BATCH_SIZE) {
+                writeAll(batch.data(), batch.size());
+                batch.clear();
+            }
+
+            batch.insert(batch.end(), msg->begin(), msg->end());
+            ring->queue.drop();
+            moved++;
+        }
+    }
+
+    if (batch.size() > 0) {
+        writeAll(batch.data(), batch.size());
+        batch.clear();
+    }
+
+    return moved;
+}
+
+// writer thread: move messages from the rings to the fd in batches.
+void BgpBmpExporter::writerMain() {
+    std::vector<uint8_t> batch;
+    batch.reserve(BGP_BMP_BATCH_SIZE);
+
+    while (true) {
+        // check before draining, so messages queued before stop() are written.
+        bool last = stopping.load(std::memory_order_acquire);
+        size_t moved = drain(batch);
+
+        // free rings of threads gone, once drained.
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            for (size_t i = 0; i < rings.size();) {
+                if (rings[i]->closed.load(std::memory_order_acquire) && rings[i]->queue.size() == 0) {
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                } else i++;
+            }
+        }
+
+        if (moved > 0) continue;
+        if (last) break;
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        writer_idle.store(true);
+        wake_cv.wait_for(lock, std::chrono::milliseconds(BGP_BMP_FLUSH_INTERVAL_MS));
+        writer_idle.store(false);
+    }
+}
+
+// write a buffer to the fd. once a write failed, everything is discarded.
+bool BgpBmpExporter::writeAll(const uint8_t *buffer, size_t length) {
+    if (failed) return false;
+
+    while (length > 0) {
+        ssize_t ret = write(fd, buffer, length);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            logger->log(ERROR, "BgpBmpExporter::writeAll: write(): %s, discarding messages from now.\n", strerror(errno));
+            failed = true;
+            return false;
+        }
+
+        buffer += ret;
+        length -= ret;
+        bytes.inc(ret);
+    }
+
+    return true;
+}
+
+}
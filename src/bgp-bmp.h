@@ -0,0 +1,219 @@
+/**
+ * @file bgp-bmp.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief BGP Monitoring Protocol exporter. (RFC 7854)
+ * @version 0.1
+ * @date 2019-09-10
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_BMP_H_
+#define BGP_BMP_H_
+
+// default number of messages buffered per producing thread.
+#define BGP_BMP_RING_SIZE 4096
+
+// bytes written to the fd at once, at most.
+#define BGP_BMP_BATCH_SIZE 65536
+
+// writer thread sleeps at most this long when there is nothing to write, a
+// ring getting half full wakes it up earlier. (ms)
+#define BGP_BMP_FLUSH_INTERVAL_MS 5
+
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bgp-log-handler.h"
+#include "bgp-stats.h"
+#include "spsc-queue.h"
+
+namespace libbgp {
+
+/**
+ * @brief BMP message types.
+ *
+ */
+enum BgpBmpMessageType {
+    BMP_ROUTE_MONITORING = 0,
+    BMP_STATS_REPORT = 1,
+    BMP_PEER_DOWN = 2,
+    BMP_PEER_UP = 3,
+    BMP_INITIATION = 4,
+    BMP_TERMINATION = 5
+};
+
+/**
+ * @brief BMP Peer Down reasons.
+ *
+ */
+enum BgpBmpPeerDownReason {
+    /**
+     * @brief Local system closed the session, NOTIFICATION sent. (data is
+     * the NOTIFICATION)
+     *
+     */
+    BMP_DOWN_LOCAL_NOTIFY = 1,
+
+    /**
+     * @brief Local system closed the session without NOTIFICATION. (data is
+     * a 2 bytes FSM event code)
+     *
+     */
+    BMP_DOWN_LOCAL_NO_NOTIFY = 2,
+
+    /**
+     * @brief Remote system closed the session with NOTIFICATION. (data is
+     * the NOTIFICATION)
+     *
+     */
+    BMP_DOWN_REMOTE_NOTIFY = 3,
+
+    /**
+     * @brief Remote system closed the session without NOTIFICATION.
+     *
+     */
+    BMP_DOWN_REMOTE_NO_DATA = 4
+};
+
+/**
+ * @brief The monitored peer, for the BMP per-peer header.
+ *
+ */
+struct BgpBmpPeer {
+    /**
+     * @brief IPv4 address of the peer. (network bytes order, 0 if unknown)
+     *
+     */
+    uint32_t peer_addr;
+
+    /**
+     * @brief ASN of the peer.
+     *
+     */
+    uint32_t peer_asn;
+
+    /**
+     * @brief BGP ID of the peer. (network bytes order)
+     *
+     */
+    uint32_t peer_bgp_id;
+
+    /**
+     * @brief Messages use 2 bytes ASN in AS_PATH.
+     *
+     */
+    bool two_byte_asn;
+};
+
+/**
+ * @brief The BgpBmpExporter class.
+ *
+ * Streams BMP messages to a collector over a socket, or to a file. BgpFsm
+ * sends Route Monitoring for UPDATE messages received, and Peer Up / Peer
+ * Down on state changes when BgpConfig::bmp is set.
+ *
+ * Messages are encoded by the thread producing them into a ring of its own,
+ * without locks. A writer thread takes the messages from all rings and writes
+ * them in batches. When a ring is full, e.g., the collector can't keep up,
+ * messages are dropped and counted, so monitoring never blocks a session.
+ * Messages from one thread are written in order.
+ */
+class BgpBmpExporter {
+public:
+    BgpBmpExporter(int fd, const char *sys_name, const char *sys_descr, bool post_policy = false, size_t ring_size = BGP_BMP_RING_SIZE, BgpLogHandler *logger = NULL);
+    ~BgpBmpExporter();
+
+    // write Initiation and start the writer thread. returns false if failed
+    // to write.
+    bool start();
+
+    // write out all messages and Termination, stop the writer thread.
+    void stop();
+
+    // queue a Route Monitoring message. pdu is the full BGP UPDATE message,
+    // header included.
+    bool routeMonitoring(const BgpBmpPeer &peer, uint64_t time_ms, bool post_policy, const uint8_t *pdu, size_t length);
+
+    // queue a Peer Up message. the OPEN messages are full BGP messages,
+    // header included.
+    bool peerUp(const BgpBmpPeer &peer, uint64_t time_ms, uint32_t local_addr, const uint8_t *open_sent, size_t open_sent_length, const uint8_t *open_recv, size_t open_recv_length);
+
+    // queue a Peer Down message.
+    bool peerDown(const BgpBmpPeer &peer, uint64_t time_ms, BgpBmpPeerDownReason reason, const uint8_t *data, size_t length);
+
+    // send post-policy Route Monitoring too?
+    bool isPostPolicy() const;
+
+    // get number of messages queued.
+    uint64_t getMessageCount() const;
+
+    // get number of messages dropped.
+    uint64_t getDropCount() const;
+
+    // get number of bytes written.
+    uint64_t getByteCount() const;
+
+private:
+    BgpBmpExporter(const BgpBmpExporter &);
+    BgpBmpExporter& operator= (const BgpBmpExporter &);
+
+    struct Ring {
+        Ring(size_t size) : queue(size), closed(false), busy(false) {}
+        SpscQueue<std::vector<uint8_t>> queue;
+
+        // producing thread exited, or exporter gone.
+        std::atomic<bool> closed;
+
+        // producing thread is queuing a message, stop() waits for it.
+        std::atomic<bool> busy;
+    };
+
+    Ring* getRing();
+    Ring* addRing();
+    void commit(Ring *ring);
+    void drop(Ring *ring);
+    size_t drain(std::vector<uint8_t> &batch);
+    void writerMain();
+    bool writeAll(const uint8_t *buffer, size_t length);
+
+    // identifies the exporter in the thread local ring lists.
+    uint64_t id;
+
+    int fd;
+    std::string sys_name;
+    std::string sys_descr;
+    bool post_policy;
+    size_t ring_size;
+    BgpLogHandler *logger;
+    bool log_local;
+
+    // rings of all producing threads, guarded by rings_mutex. only taken
+    // when a thread produces its first message, and by the writer.
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::mutex rings_mutex;
+
+    std::thread writer;
+    std::atomic<bool> running;
+    std::atomic<bool> stopping;
+    bool failed;
+
+    // writer sleeping, wake it on the next message.
+    std::atomic<bool> writer_idle;
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+
+    BgpStatsCounter messages;
+    BgpStatsCounter drops;
+    BgpStatsCounter bytes;
+};
+
+}
+
+#endif // BGP_BMP_H_
@@ -0,0 +1,141 @@
+/**
+ * @file bgp-buffer-pool.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Buffer pool shared by BgpSinks and BgpFsms.
+ * @version 0.1
+ * @date 2019-09-03
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-buffer-pool.h"
+#include <stdlib.h>
+
+namespace libbgp {
+
+static int sizeClass(size_t size) {
+    for (int i = 0; i < BGP_BUFFER_POOL_CLASSES; i++) {
+        if (((size_t) BGP_BUFFER_POOL_MIN_SIZE << i) == size) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Construct a new BgpBufferPool.
+ *
+ * @param max_cached Max bytes of free buffers to keep in the pool.
+ * @param thread_safe Lock the pool on access. Set to false if all users of the
+ * pool run on one thread.
+ */
+BgpBufferPool::BgpBufferPool(size_t max_cached, bool thread_safe) : mutex(thread_safe) {
+    this->max_cached = max_cached;
+    cached = in_use = 0;
+}
+
+/**
+ * @brief Destroy the BgpBufferPool and free the cached buffers.
+ *
+ */
+BgpBufferPool::~BgpBufferPool() {
+    trim();
+}
+
+/**
+ * @brief Round a size up to the size alloc() would hand out.
+ *
+ * @param size The size.
+ * @return size_t The rounded size. (a power of two, at least
+ * BGP_BUFFER_POOL_MIN_SIZE)
+ */
+size_t BgpBufferPool::roundSize(size_t size) {
+    size_t rounded = BGP_BUFFER_POOL_MIN_SIZE;
+    while (rounded < size) rounded *= 2;
+    return rounded;
+}
+
+/**
+ * @brief Get a buffer.
+ *
+ * @param size Min size of the buffer. Set to the actual size.
+ * @return uint8_t* The buffer. Return it with release().
+ */
+uint8_t* BgpBufferPool::alloc(size_t &size) {
+    size = roundSize(size);
+    int cls = sizeClass(size);
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        in_use += size;
+
+        if (cls >= 0 && free_lists[cls].size() > 0) {
+            uint8_t *buffer = free_lists[cls].back();
+            free_lists[cls].pop_back();
+            cached -= size;
+            return buffer;
+        }
+    }
+
+    return (uint8_t *) malloc(size);
+}
+
+/**
+ * @brief Return a buffer to the pool.
+ *
+ * @param buffer The buffer, from alloc(). NULL is ignored.
+ * @param size Size of the buffer, as set by alloc().
+ */
+void BgpBufferPool::release(uint8_t *buffer, size_t size) {
+    if (buffer == NULL) return;
+    int cls = sizeClass(size);
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        in_use -= size;
+
+        if (cls >= 0 && cached + size <= max_cached) {
+            free_lists[cls].push_back(buffer);
+            cached += size;
+            return;
+        }
+    }
+
+    free(buffer);
+}
+
+/**
+ * @brief Get bytes of buffers handed out and not yet released.
+ *
+ * @return size_t Bytes in use.
+ */
+size_t BgpBufferPool::getBytesInUse() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return in_use;
+}
+
+/**
+ * @brief Get bytes of free buffers kept in the pool.
+ *
+ * @return size_t Bytes cached.
+ */
+size_t BgpBufferPool::getBytesCached() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return cached;
+}
+
+/**
+ * @brief Free all cached buffers.
+ *
+ */
+void BgpBufferPool::trim() {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    for (std::vector<uint8_t *> &free_list : free_lists) {
+        for (uint8_t *buffer : free_list) free(buffer);
+        free_list.clear();
+    }
+
+    cached = 0;
+}
+
+}
@@ -0,0 +1,79 @@
+/**
+ * @file bgp-buffer-pool.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Buffer pool shared by BgpSinks and BgpFsms.
+ * @version 0.1
+ * @date 2019-09-03
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_BUFFER_POOL_H_
+#define BGP_BUFFER_POOL_H_
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include "bgp-lock.h"
+
+// smallest buffer the pool hands out, max size of a BGP message.
+#define BGP_BUFFER_POOL_MIN_SIZE 4096
+
+// number of size classes, BGP_BUFFER_POOL_MIN_SIZE << 0 ... << 8 (1 MiB).
+#define BGP_BUFFER_POOL_CLASSES 9
+
+// default max bytes of free buffers to keep.
+#define BGP_BUFFER_POOL_DEFAULT_CACHE (16 * 1024 * 1024)
+
+namespace libbgp {
+
+/**
+ * @brief The BgpBufferPool class.
+ *
+ * A pool of buffers with power-of-two sizes, starting from
+ * BGP_BUFFER_POOL_MIN_SIZE. Released buffers are kept on a free list of their
+ * size (up to a total of max_cached bytes) and handed out again by alloc(),
+ * so sessions growing and shrinking their buffers reuse memory instead of
+ * going to malloc() every time. Buffers larger than the largest size class
+ * are not cached.
+ *
+ * One pool can be shared by any number of BgpFsm (see BgpConfig::buffer_pool)
+ * and is safe to use from multiple threads, unless constructed with 
+ * thread_safe = false. The pool must outlive everything using it.
+ */
+class BgpBufferPool {
+public:
+    BgpBufferPool(size_t max_cached = BGP_BUFFER_POOL_DEFAULT_CACHE, bool thread_safe = true);
+    ~BgpBufferPool();
+
+    // get a buffer of at least size bytes. size is set to the actual size.
+    uint8_t* alloc(size_t &size);
+
+    // return a buffer from alloc() to the pool.
+    void release(uint8_t *buffer, size_t size);
+
+    // get bytes of buffers handed out and not yet released.
+    size_t getBytesInUse() const;
+
+    // get bytes of free buffers kept in the pool.
+    size_t getBytesCached() const;
+
+    // free all cached buffers.
+    void trim();
+
+    // round a size up to the size alloc() would hand out.
+    static size_t roundSize(size_t size);
+
+private:
+    BgpBufferPool(const BgpBufferPool &);
+    BgpBufferPool& operator= (const BgpBufferPool &);
+
+    std::vector<uint8_t *> free_lists[BGP_BUFFER_POOL_CLASSES];
+    mutable BgpLock mutex;
+    size_t max_cached;
+    size_t cached;
+    size_t in_use;
+};
+
+}
+
+#endif // BGP_BUFFER_POOL_H_
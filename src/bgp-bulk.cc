@@ -0,0 +1,506 @@
+/**
+ * @file bgp-bulk.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Bulk access to RIB and messages with packed buffers, for bindings.
+ * @version 0.1
+ * @date 2019-09-11
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-bulk.h"
+#include "bgp-update-message.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <unordered_map>
+
+// max size of a BGP message.
+#define BULK_MAX_MESSAGE_SIZE 4096
+#define BULK_HEADER_SIZE 19
+
+namespace libbgp {
+
+static_assert(sizeof(BgpBulkRoute4) == 24, "BgpBulkRoute4 must be packed");
+static_assert(sizeof(BgpBulkAttribSet) == 16, "BgpBulkAttribSet must be packed");
+static_assert(sizeof(BgpBulkMessage) == 16, "BgpBulkMessage must be packed");
+
+/**
+ * @brief Construct a new BgpBulkRib4.
+ *
+ * @param rib The RIB.
+ * @param logger Log handler, for the path attributes inserted too.
+ */
+BgpBulkRib4::BgpBulkRib4(BgpRib4 *rib, BgpLogHandler *logger) {
+    this->rib = rib;
+    this->logger = logger;
+}
+
+/**
+ * @brief Fill the buffers with the routes in the RIB.
+ *
+ * Routes of an update group (i.e., inserted together) share an attribute
+ * set. Attributes are written as stored, except 2 bytes ASN AS_PATH and
+ * AGGREGATOR, which are restored to 4 bytes ASN, so all sets are in 4 bytes
+ * ASN.
+ *
+ * @param active_only Only dump active routes. (i.e., best path of the prefix)
+ * @return size_t Number of routes.
+ */
+size_t BgpBulkRib4::dump(bool active_only) {
+    routes.clear();
+    attrib_sets.clear();
+    attribs.clear();
+
+    std::lock_guard<BgpLock> lock(rib->getMutex());
+    const rib4_t &entries = rib->get();
+    routes.reserve(entries.size());
+
+    // update group -> set. the attributes of the group's first route are kept
+    // to check, so a group with different attributes gets sets of its own.
+    std::unordered_map<uint64_t, uint32_t> groups;
+    std::vector<const std::vector<std::shared_ptr<BgpPathAttrib>> *> set_attribs;
+
+    for (const rib4_t::value_type &it : entries) {
+        const BgpRib4Entry &entry = it.second;
+        if (active_only && entry.status != RS_ACTIVE) continue;
+
+        std::unordered_map<uint64_t, uint32_t>::iterator group = groups.find(entry.update_id);
+        uint32_t set_id;
+
+        if (group != groups.end() && *set_attribs[group->second] == entry.attribs) {
+            set_id = group->second;
+        } else {
+            set_id = attrib_sets.size();
+            groups[entry.update_id] = set_id;
+            set_attribs.push_back(&entry.attribs);
+
+            BgpBulkAttribSet set;
+            set.offset = attribs.size();
+            set.reserved = 0;
+
+            const std::vector<std::shared_ptr<BgpPathAttrib>> *set_attrs = &entry.attribs;
+
+            // 2b ASN: restore on copies, the RIB's are shared.
+            BgpUpdateMessage restored(logger, true);
+            const BgpPathAttribAsPath *path = NULL;
+            for (const std::shared_ptr<BgpPathAttrib> &attr : entry.attribs) {
+                if (attr->type_code == AS_PATH) path = static_cast<const BgpPathAttribAsPath *>(attr.get());
+            }
+
+            if (path != NULL && !path->is_4b) {
+                restored.setAttribs(entry.attribs);
+                restored.restoreAsPath();
+                restored.restoreAggregator();
+                set_attrs = &restored.path_attribute;
+            }
+
+            for (const std::shared_ptr<BgpPathAttrib> &attr : *set_attrs) {
+                size_t at = attribs.size();
+                ssize_t wire_len = attr->wireLength();
+                if (wire_len > 0) attribs.resize(at + wire_len);
+                if (wire_len <= 0 || attr->writeWire(attribs.data() + at, wire_len) != wire_len) {
+                    logger->log(ERROR, "BgpBulkRib4::dump: failed to write attribute %d, skipped.\n", attr->type_code);
+                    attribs.resize(at);
+                }
+            }
+
+            set.length = attribs.size() - set.offset;
+            attrib_sets.push_back(set);
+        }
+
+        BgpBulkRoute4 route;
+        route.prefix = entry.route.getPrefix();
+        route.nexthop = entry.getNexthop();
+        route.src_router_id = entry.src_router_id;
+        route.attrib_set = set_id;
+        route.weight = entry.weight;
+        route.length = entry.route.getLength();
+        route.status = entry.status;
+        route.src = entry.src;
+        route.reserved = 0;
+        routes.push_back(route);
+    }
+
+    return routes.size();
+}
+
+/**
+ * @brief Get the routes dumped.
+ *
+ * @return BgpBulkBuffer BgpBulkRoute4 records.
+ */
+BgpBulkBuffer BgpBulkRib4::getRoutes() const {
+    return BgpBulkBuffer(routes.data(), routes.size() * sizeof(BgpBulkRoute4));
+}
+
+/**
+ * @brief Get the attribute sets dumped.
+ *
+ * @return BgpBulkBuffer BgpBulkAttribSet records, offsets in getAttribs().
+ */
+BgpBulkBuffer BgpBulkRib4::getAttribSets() const {
+    return BgpBulkBuffer(attrib_sets.data(), attrib_sets.size() * sizeof(BgpBulkAttribSet));
+}
+
+/**
+ * @brief Get the path attributes dumped.
+ *
+ * @return BgpBulkBuffer Path attributes in wire format.
+ */
+BgpBulkBuffer BgpBulkRib4::getAttribs() const {
+    return BgpBulkBuffer(attribs.data(), attribs.size());
+}
+
+/**
+ * @brief Get number of routes dumped.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpBulkRib4::getRouteCount() const {
+    return routes.size();
+}
+
+/**
+ * @brief Get number of attribute sets dumped.
+ *
+ * @return size_t Number of sets.
+ */
+size_t BgpBulkRib4::getAttribSetCount() const {
+    return attrib_sets.size();
+}
+
+/**
+ * @brief Insert routes from buffers, with one BgpRib4::apply().
+ *
+ * Only the prefix, length and attrib_set of the route records are used. The
+ * attribute sets used are parsed once each. Routes sharing a set are in the
+ * same update group. Peers are not notified.
+ *
+ * Buffers from dump() or BgpBulkParser can be passed as-is.
+ *
+ * @param src_router_id BGP ID of the route source. (network bytes order)
+ * @param routes BgpBulkRoute4 records.
+ * @param routes_length Size of routes in bytes.
+ * @param sets BgpBulkAttribSet records.
+ * @param sets_length Size of sets in bytes.
+ * @param attribs Path attributes in wire format, referenced by sets.
+ * @param attribs_length Size of attribs in bytes.
+ * @param weight Weight of the routes.
+ * @param use_4b_asn The attributes are in 4 bytes ASN.
+ * @return ssize_t Number of routes inserted.
+ * @retval -1 Buffers malformed, nothing inserted.
+ */
+ssize_t BgpBulkRib4::insert(uint32_t src_router_id, const uint8_t *routes, size_t routes_length, const uint8_t *sets, size_t sets_length, const uint8_t *attribs, size_t attribs_length, int32_t weight, bool use_4b_asn) {
+    if (routes_length % sizeof(BgpBulkRoute4) != 0 || sets_length % sizeof(BgpBulkAttribSet) != 0) {
+        logger->log(ERROR, "BgpBulkRib4::insert: buffer size not a multiple of record size.\n");
+        return -1;
+    }
+
+    size_t n_routes = routes_length / sizeof(BgpBulkRoute4);
+    size_t n_sets = sets_length / sizeof(BgpBulkAttribSet);
+
+    BgpRib4Batch batch;
+
+    // set in buffers -> set in batch, parsed on first use.
+    std::vector<int64_t> batch_sets(n_sets, -1);
+    std::vector<uint8_t> body;
+
+    for (size_t i = 0; i < n_routes; i++) {
+        // records may not be aligned in the caller's buffer.
+        BgpBulkRoute4 route;
+        memcpy(&route, routes + i * sizeof(BgpBulkRoute4), sizeof(BgpBulkRoute4));
+
+        if (route.length > 32 || route.attrib_set >= n_sets) {
+            logger->log(ERROR, "BgpBulkRib4::insert: bad route record %zu.\n", i);
+            return -1;
+        }
+
+        int64_t &batch_set = batch_sets[route.attrib_set];
+        if (batch_set < 0) {
+            BgpBulkAttribSet set;
+            memcpy(&set, sets + route.attrib_set * sizeof(BgpBulkAttribSet), sizeof(BgpBulkAttribSet));
+
+            if (set.offset > attribs_length || set.length > attribs_length - set.offset || set.length > 0xffff) {
+                logger->log(ERROR, "BgpBulkRib4::insert: attribute set %u out of buffer.\n", route.attrib_set);
+                return -1;
+            }
+
+            // parse as an UPDATE with attributes only.
+            body.resize(4 + set.length);
+            body[0] = body[1] = 0;
+            body[2] = set.length >> 8;
+            body[3] = set.length & 0xff;
+            if (set.length > 0) memcpy(body.data() + 4, attribs + set.offset, set.length);
+
+            BgpUpdateMessage update(logger, use_4b_asn);
+            if (update.parse(body.data(), body.size()) < 0) {
+                logger->log(ERROR, "BgpBulkRib4::insert: failed to parse attribute set %u.\n", route.attrib_set);
+                return -1;
+            }
+
+            batch_set = batch.addAttribs(update.path_attribute);
+        }
+
+        batch.insert(Prefix4(route.prefix, route.length), batch_set);
+    }
+
+    BgpRibChanges<BgpRib4Entry> changes;
+    rib->apply(src_router_id, batch, weight, 0, changes);
+
+    return n_routes;
+}
+
+/**
+ * @brief Withdraw routes from buffers, with one BgpRib4::apply().
+ *
+ * Only the prefix and length of the route records are used. Peers are not
+ * notified.
+ *
+ * @param src_router_id BGP ID of the route source. (network bytes order)
+ * @param routes BgpBulkRoute4 records.
+ * @param routes_length Size of routes in bytes.
+ * @return ssize_t Number of routes withdrawn.
+ * @retval -1 Buffer malformed, nothing withdrawn.
+ */
+ssize_t BgpBulkRib4::withdraw(uint32_t src_router_id, const uint8_t *routes, size_t routes_length) {
+    if (routes_length % sizeof(BgpBulkRoute4) != 0) {
+        logger->log(ERROR, "BgpBulkRib4::withdraw: buffer size not a multiple of record size.\n");
+        return -1;
+    }
+
+    size_t n_routes = routes_length / sizeof(BgpBulkRoute4);
+    BgpRib4Batch batch;
+
+    for (size_t i = 0; i < n_routes; i++) {
+        BgpBulkRoute4 route;
+        memcpy(&route, routes + i * sizeof(BgpBulkRoute4), sizeof(BgpBulkRoute4));
+
+        if (route.length > 32) {
+            logger->log(ERROR, "BgpBulkRib4::withdraw: bad route record %zu.\n", i);
+            return -1;
+        }
+
+        batch.withdraw(Prefix4(route.prefix, route.length));
+    }
+
+    BgpRibChanges<BgpRib4Entry> changes;
+    rib->apply(src_router_id, batch, 0, 0, changes);
+
+    return n_routes;
+}
+
+/**
+ * @brief Construct a new BgpBulkParser.
+ *
+ * @param logger Log handler. (NULL to log to stderr)
+ */
+BgpBulkParser::BgpBulkParser(BgpLogHandler *logger) {
+    if (logger == NULL) {
+        this->logger = new BgpLogHandler();
+        log_local = true;
+    } else {
+        this->logger = logger;
+        log_local = false;
+    }
+}
+
+BgpBulkParser::~BgpBulkParser() {
+    if (log_local) delete logger;
+}
+
+// read an IPv4 prefix in NLRI format. returns bytes read, -1 if malformed.
+static inline ssize_t readPrefix4(const uint8_t *buffer, size_t length, BgpBulkRoute4 &route) {
+    if (length < 1 || buffer[0] > 32) return -1;
+
+    size_t prefix_len = (buffer[0] + 7) / 8;
+    if (1 + prefix_len > length) return -1;
+
+    route.length = buffer[0];
+    route.prefix = 0;
+    memcpy(&route.prefix, buffer + 1, prefix_len);
+
+    return 1 + prefix_len;
+}
+
+/**
+ * @brief Parse all complete messages in the buffer.
+ *
+ * Records of the last call are replaced. The attribute set offsets are
+ * offsets in this buffer.
+ *
+ * @param buffer The messages.
+ * @param length Length of the buffer.
+ * @return ssize_t Bytes parsed. (a partial message at the end is not)
+ * @retval -1 Malformed message, records up to the message are kept.
+ */
+ssize_t BgpBulkParser::parse(const uint8_t *buffer, size_t length) {
+    messages.clear();
+    announced.clear();
+    withdrawn.clear();
+    attrib_sets.clear();
+
+    static const uint8_t marker[16] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+    };
+
+    size_t offset = 0;
+    while (length - offset >= BULK_HEADER_SIZE) {
+        const uint8_t *msg = buffer + offset;
+        uint16_t msg_len = (msg[16] << 8) | msg[17];
+
+        if (memcmp(msg, marker, sizeof(marker)) != 0 || msg_len < BULK_HEADER_SIZE || msg_len > BULK_MAX_MESSAGE_SIZE) {
+            logger->log(ERROR, "BgpBulkParser::parse: bad message header at offset %zu.\n", offset);
+            return -1;
+        }
+
+        if (length - offset < msg_len) break;
+
+        BgpBulkMessage message;
+        memset(&message, 0, sizeof(message));
+        message.offset = offset;
+        message.length = msg_len;
+        message.type = msg[18];
+
+        uint32_t index = messages.size();
+        messages.push_back(message);
+
+        BgpBulkAttribSet set;
+        memset(&set, 0, sizeof(set));
+        set.offset = offset + BULK_HEADER_SIZE;
+        attrib_sets.push_back(set);
+
+        if (message.type == UPDATE && !parseUpdate(msg + BULK_HEADER_SIZE, msg_len - BULK_HEADER_SIZE, offset + BULK_HEADER_SIZE, index)) {
+            logger->log(ERROR, "BgpBulkParser::parse: bad UPDATE message at offset %zu.\n", offset);
+            return -1;
+        }
+
+        offset += msg_len;
+    }
+
+    return offset;
+}
+
+// parse the routes of an UPDATE message, and find its attributes.
+bool BgpBulkParser::parseUpdate(const uint8_t *buffer, size_t length, uint64_t offset, uint32_t index) {
+    if (length < 4) return false;
+
+    size_t withdrawn_len = (buffer[0] << 8) | buffer[1];
+    if (withdrawn_len + 4 > length) return false;
+
+    BgpBulkRoute4 route;
+    memset(&route, 0, sizeof(route));
+    route.attrib_set = index;
+
+    const uint8_t *ptr = buffer + 2;
+    const uint8_t *end = ptr + withdrawn_len;
+    while (ptr < end) {
+        ssize_t ret = readPrefix4(ptr, end - ptr, route);
+        if (ret < 0) return false;
+        withdrawn.push_back(route);
+        ptr += ret;
+    }
+
+    size_t attrib_len = (ptr[0] << 8) | ptr[1];
+    ptr += 2;
+    if (withdrawn_len + attrib_len + 4 > length) return false;
+
+    BgpBulkAttribSet &set = attrib_sets[index];
+    set.offset = offset + (ptr - buffer);
+    set.length = attrib_len;
+
+    // find the nexthop, the rest is left to the caller.
+    end = ptr + attrib_len;
+    while (ptr < end) {
+        if (end - ptr < 3) return false;
+
+        uint8_t flags = ptr[0];
+        uint8_t type = ptr[1];
+        size_t hdr_len = (flags & 0x10) ? 4 : 3;
+        if ((size_t) (end - ptr) < hdr_len) return false;
+
+        size_t value_len = (flags & 0x10) ? ((ptr[2] << 8) | ptr[3]) : ptr[2];
+        if ((size_t) (end - ptr) < hdr_len + value_len) return false;
+
+        if (type == NEXT_HOP && value_len == 4) memcpy(&route.nexthop, ptr + hdr_len, 4);
+        ptr += hdr_len + value_len;
+    }
+
+    end = buffer + length;
+    while (ptr < end) {
+        ssize_t ret = readPrefix4(ptr, end - ptr, route);
+        if (ret < 0) return false;
+        announced.push_back(route);
+        ptr += ret;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the messages parsed.
+ *
+ * @return BgpBulkBuffer BgpBulkMessage records.
+ */
+BgpBulkBuffer BgpBulkParser::getMessages() const {
+    return BgpBulkBuffer(messages.data(), messages.size() * sizeof(BgpBulkMessage));
+}
+
+/**
+ * @brief Get the IPv4 routes announced.
+ *
+ * @return BgpBulkBuffer BgpBulkRoute4 records, attrib_set is the message
+ * index.
+ */
+BgpBulkBuffer BgpBulkParser::getAnnounced() const {
+    return BgpBulkBuffer(announced.data(), announced.size() * sizeof(BgpBulkRoute4));
+}
+
+/**
+ * @brief Get the IPv4 routes withdrawn.
+ *
+ * @return BgpBulkBuffer BgpBulkRoute4 records, attrib_set is the message
+ * index.
+ */
+BgpBulkBuffer BgpBulkParser::getWithdrawn() const {
+    return BgpBulkBuffer(withdrawn.data(), withdrawn.size() * sizeof(BgpBulkRoute4));
+}
+
+/**
+ * @brief Get the path attributes of each message.
+ *
+ * @return BgpBulkBuffer BgpBulkAttribSet records, offsets in the buffer
+ * parsed.
+ */
+BgpBulkBuffer BgpBulkParser::getAttribSets() const {
+    return BgpBulkBuffer(attrib_sets.data(), attrib_sets.size() * sizeof(BgpBulkAttribSet));
+}
+
+/**
+ * @brief Get number of messages parsed.
+ *
+ * @return size_t Number of messages.
+ */
+size_t BgpBulkParser::getMessageCount() const {
+    return messages.size();
+}
+
+/**
+ * @brief Get number of IPv4 routes announced.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpBulkParser::getAnnouncedCount() const {
+    return announced.size();
+}
+
+/**
+ * @brief Get number of IPv4 routes withdrawn.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpBulkParser::getWithdrawnCount() const {
+    return withdrawn.size();
+}
+
+}
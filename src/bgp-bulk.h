@@ -0,0 +1,274 @@
+/**
+ * @file bgp-bulk.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Bulk access to RIB and messages with packed buffers, for bindings.
+ * @version 0.1
+ * @date 2019-09-11
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_BULK_H_
+#define BGP_BULK_H_
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include "bgp-rib4.h"
+#include "bgp-log-handler.h"
+
+namespace libbgp {
+
+/**
+ * @brief A packed IPv4 route record.
+ *
+ * Records are 24 bytes, with no padding between fields, so an array of them
+ * can be used as a numpy structured array without copying (see
+ * libbgp.ROUTE4_DTYPE in the Python bindings). Addresses are in network
+ * bytes order, other fields in host bytes order.
+ */
+struct BgpBulkRoute4 {
+    /**
+     * @brief The prefix. (network bytes order)
+     *
+     */
+    uint32_t prefix;
+
+    /**
+     * @brief Nexthop of the route. (network bytes order, 0 if none)
+     *
+     */
+    uint32_t nexthop;
+
+    /**
+     * @brief BGP ID of the route source. (network bytes order)
+     *
+     */
+    uint32_t src_router_id;
+
+    /**
+     * @brief Index of the path attribute set of the route, in the
+     * BgpBulkAttribSet records next to the routes.
+     *
+     */
+    uint32_t attrib_set;
+
+    /**
+     * @brief Weight of the route.
+     *
+     */
+    int32_t weight;
+
+    /**
+     * @brief Length of the prefix.
+     *
+     */
+    uint8_t length;
+
+    /**
+     * @brief BgpRouteStatus of the route.
+     *
+     */
+    uint8_t status;
+
+    /**
+     * @brief BgpRouteSource of the route.
+     *
+     */
+    uint8_t src;
+
+    uint8_t reserved;
+};
+
+/**
+ * @brief A packed path attribute set record: where the wire format path
+ * attributes of the set are, in a buffer next to the records. (16 bytes)
+ *
+ */
+struct BgpBulkAttribSet {
+    /**
+     * @brief Offset of the attributes in the buffer.
+     *
+     */
+    uint64_t offset;
+
+    /**
+     * @brief Length of the attributes.
+     *
+     */
+    uint32_t length;
+
+    uint32_t reserved;
+};
+
+/**
+ * @brief A packed BGP message record: where a message is, in the buffer
+ * parsed. (16 bytes)
+ *
+ */
+struct BgpBulkMessage {
+    /**
+     * @brief Offset of the message, header included, in the buffer.
+     *
+     */
+    uint64_t offset;
+
+    /**
+     * @brief Length of the message, header included.
+     *
+     */
+    uint16_t length;
+
+    /**
+     * @brief Type of the message.
+     *
+     */
+    uint8_t type;
+
+    uint8_t reserved[5];
+};
+
+/**
+ * @brief A read-only view of memory owned by a bulk object.
+ *
+ * Valid until the owner is changed or destroyed. The Python bindings turn it
+ * into a memoryview, without copying.
+ */
+struct BgpBulkBuffer {
+    BgpBulkBuffer() : data(NULL), size(0) {}
+    BgpBulkBuffer(const void *data, size_t size) : data(data), size(size) {}
+
+    /**
+     * @brief Pointer to the memory.
+     *
+     */
+    const void *data;
+
+    /**
+     * @brief Size of the memory in bytes.
+     *
+     */
+    size_t size;
+};
+
+/**
+ * @brief The BgpBulkRib4 class.
+ *
+ * Moves IPv4 routes in and out of a BgpRib4 in bulk, as packed buffers:
+ * BgpBulkRoute4 records, BgpBulkAttribSet records, and a buffer with the
+ * path attributes of the sets in wire format. Routes inserted together share
+ * a set, so a full table has far fewer sets than routes.
+ *
+ * Made for bindings: a full table crosses the binding boundary as three
+ * buffers, instead of one call per route and per attribute.
+ *
+ * The path attributes inserted use the log handler given, it must outlive
+ * the routes in the RIB.
+ */
+class BgpBulkRib4 {
+public:
+    BgpBulkRib4(BgpRib4 *rib, BgpLogHandler *logger);
+
+    // fill the buffers with all routes in the RIB (or active routes only).
+    // returns number of routes.
+    size_t dump(bool active_only = false);
+
+    // the routes dumped. (BgpBulkRoute4 records)
+    BgpBulkBuffer getRoutes() const;
+
+    // the attribute sets dumped. (BgpBulkAttribSet records, offsets in
+    // getAttribs())
+    BgpBulkBuffer getAttribSets() const;
+
+    // the path attributes dumped, in wire format.
+    BgpBulkBuffer getAttribs() const;
+
+    // number of routes dumped.
+    size_t getRouteCount() const;
+
+    // number of attribute sets dumped.
+    size_t getAttribSetCount() const;
+
+    // insert routes from buffers. returns number of routes inserted, -1 if
+    // the buffers are malformed (nothing inserted).
+    ssize_t insert(uint32_t src_router_id, const uint8_t *routes, size_t routes_length, const uint8_t *sets, size_t sets_length, const uint8_t *attribs, size_t attribs_length, int32_t weight = 0, bool use_4b_asn = true);
+
+    // withdraw routes from buffers. returns number of routes withdrawn, -1 if
+    // the buffer is malformed.
+    ssize_t withdraw(uint32_t src_router_id, const uint8_t *routes, size_t routes_length);
+
+private:
+    BgpBulkRib4(const BgpBulkRib4 &);
+    BgpBulkRib4& operator= (const BgpBulkRib4 &);
+
+    BgpRib4 *rib;
+    BgpLogHandler *logger;
+
+    std::vector<BgpBulkRoute4> routes;
+    std::vector<BgpBulkAttribSet> attrib_sets;
+    std::vector<uint8_t> attribs;
+};
+
+/**
+ * @brief The BgpBulkParser class.
+ *
+ * Parses a stream of BGP messages (e.g., a recorded session) into packed
+ * buffers: one BgpBulkMessage per message, and BgpBulkRoute4 records for the
+ * IPv4 routes announced and withdrawn by the UPDATE messages. Path attributes
+ * are not parsed nor copied: the BgpBulkAttribSet of an UPDATE points to its
+ * attributes in the buffer parsed.
+ *
+ * The attrib_set of a route record is the index of its message, and there is
+ * one attribute set per message (empty for other message types), so the
+ * routes, the sets and the buffer parsed can be passed to
+ * BgpBulkRib4::insert() as-is.
+ */
+class BgpBulkParser {
+public:
+    BgpBulkParser(BgpLogHandler *logger = NULL);
+    ~BgpBulkParser();
+
+    // parse all complete messages in buffer, replacing the records of the
+    // last call. returns number of bytes parsed, -1 if a message is
+    // malformed.
+    ssize_t parse(const uint8_t *buffer, size_t length);
+
+    // the messages. (BgpBulkMessage records)
+    BgpBulkBuffer getMessages() const;
+
+    // the IPv4 routes announced. (BgpBulkRoute4 records)
+    BgpBulkBuffer getAnnounced() const;
+
+    // the IPv4 routes withdrawn. (BgpBulkRoute4 records)
+    BgpBulkBuffer getWithdrawn() const;
+
+    // the path attributes of each message. (BgpBulkAttribSet records, offsets
+    // in the buffer parsed)
+    BgpBulkBuffer getAttribSets() const;
+
+    // number of messages parsed.
+    size_t getMessageCount() const;
+
+    // number of routes announced.
+    size_t getAnnouncedCount() const;
+
+    // number of routes withdrawn.
+    size_t getWithdrawnCount() const;
+
+private:
+    BgpBulkParser(const BgpBulkParser &);
+    BgpBulkParser& operator= (const BgpBulkParser &);
+
+    bool parseUpdate(const uint8_t *buffer, size_t length, uint64_t offset, uint32_t index);
+
+    BgpLogHandler *logger;
+    bool log_local;
+
+    std::vector<BgpBulkMessage> messages;
+    std::vector<BgpBulkRoute4> announced;
+    std::vector<BgpBulkRoute4> withdrawn;
+    std::vector<BgpBulkAttribSet> attrib_sets;
+};
+
+}
+
+#endif // BGP_BULK_H_
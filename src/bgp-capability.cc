@@ -23,11 +23,11 @@ namespace libbgp {
  * @param logger Pointer to logger object for error logging.
  */
 BgpCapability::BgpCapability(BgpLogHandler *logger) : Serializable(logger) {
-    length = 0;
+    value_len = 0;
 }
 
 /**
- * @brief Parse the capability header (code, length).
+ * @brief Parse the capability header (code, value_len).
  * 
  * @param from Pointer to buffer.
  * @param msg_sz Max read size.
@@ -44,9 +44,9 @@ ssize_t BgpCapability::parseHeader(const uint8_t *from, size_t msg_sz) {
     }
 
     code = getValue<uint8_t>(&from);
-    length = getValue<uint8_t>(&from);
+    value_len = getValue<uint8_t>(&from);
 
-    if ((size_t) (length + 2) > msg_sz) {
+    if ((size_t) (value_len + 2) > msg_sz) {
         setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
         logger->log(ERROR, "BgpCapability::parseHeader: capability size exceed capabilities list.\n");
         return -1;
@@ -79,16 +79,17 @@ ssize_t BgpCapability4BytesAsn::doPrint(size_t indent, uint8_t **to, size_t *buf
 
 ssize_t BgpCapability4BytesAsn::parse(const uint8_t *from, size_t msg_sz) {
     ssize_t hdr_len = parseHeader(from, msg_sz);
+    if (hdr_len < 0) return hdr_len;
 
     if (code != ASN_4B) {
         logger->log(FATAL, "BgpCapability4BytesAsn::parse: typecode mismatch with object type.\n");
-        throw "bad_type";
+        setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+        return -1;
     }
 
-    if (hdr_len < 0) return hdr_len;
-    if (length != 4) {
+    if (value_len != 4) {
         setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
-        logger->log(ERROR, "BgpCapability4BytesAsn::parse: bad length field (saw %d, want 4).\n", length);
+        logger->log(ERROR, "BgpCapability4BytesAsn::parse: bad length field (saw %d, want 4).\n", value_len);
         return -1;
     }
 
@@ -112,6 +113,10 @@ ssize_t BgpCapability4BytesAsn::write(uint8_t *to, size_t buf_sz) const {
     return 6;
 }
 
+ssize_t BgpCapability4BytesAsn::length() const {
+    return 6;
+}
+
 BgpCapabilityMpBgp::BgpCapabilityMpBgp(BgpLogHandler *logger) : BgpCapability(logger) {
     code = MP_BGP;
 }
@@ -147,17 +152,18 @@ ssize_t BgpCapabilityMpBgp::doPrint(size_t indent, uint8_t **to, size_t *buf_sz)
 
 ssize_t BgpCapabilityMpBgp::parse(const uint8_t *from, size_t msg_sz) {
     ssize_t hdr_len = parseHeader(from, msg_sz);
+    if (hdr_len < 0) return hdr_len;
 
     if (code != MP_BGP) {
         logger->log(FATAL, "BgpCapabilityMpBgp::parse: typecode mismatch with object type.\n");
-        throw "bad_type";
+        setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+        return -1;
     }
 
-    if (hdr_len < 0) return hdr_len;
-
-    if (length != 4) {
+    if (value_len != 4) {
         setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
-        logger->log(ERROR, "BgpCapabilityMpBgp::parse: bad length field, want 4, saw %d.\n", length);
+        logger->log(ERROR, "BgpCapabilityMpBgp::parse: bad length field, want 4, saw %d.\n", value_len);
+        return -1;
     }
 
     const uint8_t *buffer = from + hdr_len;
@@ -189,6 +195,10 @@ ssize_t BgpCapabilityMpBgp::write(uint8_t *to, size_t buf_sz) const {
     return 6;
 }
 
+ssize_t BgpCapabilityMpBgp::length() const {
+    return 6;
+}
+
 /**
  * @brief Construct a new BgpCapabilityUnknow object
  * 
@@ -203,7 +213,7 @@ BgpCapabilityUnknow::BgpCapabilityUnknow(BgpLogHandler *logger) : BgpCapability(
  * 
  */
 BgpCapabilityUnknow::~BgpCapabilityUnknow() {
-    if (length > 0 && value != NULL) free(value);
+    if (value_len > 0 && value != NULL) free(value);
 }
 
 ssize_t BgpCapabilityUnknow::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
@@ -221,31 +231,35 @@ ssize_t BgpCapabilityUnknow::parse(const uint8_t *from, size_t msg_sz) {
     ssize_t hdr_len = parseHeader(from, msg_sz);
 
     if (hdr_len < 0) return hdr_len;
-    if (length == 0) return hdr_len;
+    if (value_len == 0) return hdr_len;
 
-    value = (uint8_t *) malloc(length);
-    memcpy(value, from + hdr_len, length);
+    value = (uint8_t *) malloc(value_len);
+    memcpy(value, from + hdr_len, value_len);
 
-    return hdr_len + length;
+    return hdr_len + value_len;
 }
 
 ssize_t BgpCapabilityUnknow::write(uint8_t *to, size_t buf_sz) const {
-    if (buf_sz < (size_t) (length + 2)) {
+    if (buf_sz < (size_t) (value_len + 2)) {
         logger->log(ERROR, "BgpCapabilityUnknow::write: dest buffer too small.\n");
         return -1;
     }
 
     uint8_t *buffer = to;
     putValue<uint8_t>(&buffer, code);
-    putValue<uint8_t>(&buffer, length);
-    if (length == 0) return 2;
+    putValue<uint8_t>(&buffer, value_len);
+    if (value_len == 0) return 2;
     if (value == NULL) {
         logger->log(ERROR, "BgpCapabilityUnknow: missing value pointer.\n");
         return -1;
     }
-    memcpy(buffer, value, length);
+    memcpy(buffer, value, value_len);
+
+    return value_len + 2;
+}
 
-    return length + 2;
+ssize_t BgpCapabilityUnknow::length() const {
+    return value_len + 2;
 }
 
 }
\ No newline at end of file
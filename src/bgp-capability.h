@@ -51,11 +51,9 @@ public:
      * @param from Pointer to message body buffer.
      * @param msg_sz Size of message.
      * @return ssize_t Bytes read.
-     * @retval -1 Deserialization error. Error may be logged.
+     * @retval -1 Deserialization error, or the type of message/field member in
+     * buffer does not match the type of container. Error may be logged.
      * @retval >=0 Bytes read.
-     * @throws "bad_parse" Internal deserialization error.
-     * @throws "bad_type" The type of message/field member in buffer does not 
-     * match the attribute type of container.
      */
     virtual ssize_t parse(const uint8_t *from, size_t msg_sz) = 0;
 
@@ -69,6 +67,13 @@ public:
      * @retval >=0 Bytes written.
      */
     virtual ssize_t write(uint8_t *to, size_t buf_sz) const = 0;
+
+    /**
+     * @brief Get the size of the serialized capability.
+     * 
+     * @return ssize_t Bytes write() would write.
+     */
+    virtual ssize_t length() const = 0;
 protected:
 
     ssize_t parseHeader(const uint8_t *from, size_t msg_sz);
@@ -81,7 +86,7 @@ protected:
      * ignored when serialize (except BgpCapabilityUnknow). 
      * 
      */
-    uint8_t length;
+    uint8_t value_len;
 };
 
 /**
@@ -95,6 +100,7 @@ public:
     ssize_t doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const;
     ssize_t parse(const uint8_t *from, size_t msg_sz);
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+    ssize_t length() const;
 
     /**
      * @brief The ASN.
@@ -114,6 +120,7 @@ public:
     ssize_t doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const;
     ssize_t parse(const uint8_t *from, size_t msg_sz);
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+    ssize_t length() const;
 
     /**
      * @brief Address Family Identifier.
@@ -140,6 +147,7 @@ public:
     ssize_t doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const;
     ssize_t parse(const uint8_t *from, size_t msg_sz);
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+    ssize_t length() const;
 
 private:
     uint8_t *value;
@@ -17,7 +17,12 @@
 #include "bgp-filter.h"
 #include "bgp-out-handler.h"
 #include "bgp-log-handler.h"
+#include "bgp-buffer-pool.h"
 #include "route-event-bus.h"
+#include "bgp-session-registry.h"
+#include "bgp-dampening.h"
+#include "bgp-rpki.h"
+#include "bgp-bmp.h"
 
 namespace libbgp {
 
@@ -42,6 +47,14 @@ typedef struct BgpConfig {
         weight = 0;
         no_autotick = false;
         ibgp_alter_nexthop = false;
+        decode_threads = 0;
+        buffer_pool = NULL;
+        single_threaded = false;
+        session_registry = NULL;
+        dampening = false;
+        rpki = NULL;
+        bmp = NULL;
+        bmp_peer_addr = bmp_local_addr = 0;
     }
 
     /**
@@ -126,7 +139,7 @@ typedef struct BgpConfig {
      * The route event bus is used to share information and communicate with 
      * other BGP FSMs. For example, route add/withdrawn events are sent to other
      * FSMs with route event bus. Collision resolution also depends on the route
-     * event bus. You will need to create a route event bus object and pass it 
+     * event bus, unless session_registry is set. You will need to create a route event bus object and pass it 
      * in as the configuration parameter for every FSMs. You may set route event
      * bus to NULL if you are only using one FSM.
      * (default: NULL)
@@ -337,6 +350,138 @@ typedef struct BgpConfig {
      * (default: false)
      */
     bool ibgp_alter_nexthop;
+
+    /**
+     * @brief Number of threads to decode UPDATE messages with.
+     * 
+     * If non-zero, UPDATE messages received in ESTABLISHED state are parsed,
+     * checked and run through the ingress filters on a pool of this many 
+     * worker threads owned by the FSM, while the thread calling run() frames
+     * packets and applies decoded messages to the RIB, in the order they were
+     * received. This lets the initial table of a fast peer use more than one
+     * core. Ingress filters and the log handler must be safe to call from the
+     * worker threads. (the ones in libbgp are)
+     * 
+     * Ignored on a machine with one CPU: the workers only add the hand-off
+     * there. (in bench-fsm, a full table takes about 3 times as long with
+     * workers on one core as decoded inline: 2400 - 2600 ns against 830 ns
+     * per route)
+     * 
+     * (default: 0, decode on the thread calling run())
+     */
+    size_t decode_threads;
+
+    /**
+     * @brief Pool to get the input and output buffers from.
+     * 
+     * Buffers start small, grow as needed and are released when the session 
+     * goes idle (see BgpFsm::shrinkBuffers()). With a pool shared by many 
+     * FSMs, released buffers are reused by other sessions instead of going
+     * back to malloc(). The pool must outlive the FSM.
+     * 
+     * (default: NULL, use malloc())
+     */
+    BgpBufferPool *buffer_pool;
+
+    /**
+     * @brief The FSM is only ever used from one thread.
+     * 
+     * Skip the locking of the input sink and the output buffer, and update 
+     * statistics without atomic read-modify-write operations. RIBs and the log
+     * handler created by the FSM (rib4, rib6 or log_handler not set) are 
+     * created single-threaded too. RIBs, log handler and buffer pool passed in
+     * here keep their own setting, see their constructors.
+     * 
+     * This is for event loops that run each FSM, and everything it shares, on
+     * one thread. route events from FSMs on other threads must not be 
+     * delivered to this FSM. decode_threads is ignored.
+     * 
+     * (default: false)
+     */
+    bool single_threaded;
+
+    /**
+     * @brief Registry of sessions by peer BGP ID.
+     * 
+     * The FSM adds itself once the peer's OPEN is accepted, and removes itself
+     * when the session goes IDLE. If set, collision detection only asks the
+     * sessions in the registry with the same peer BGP ID, instead of 
+     * publishing a RouteCollisionEvent to every FSM on the route event bus. 
+     * Use one registry for all FSMs that may collide with each other. The 
+     * registry must outlive the FSM.
+     * 
+     * (default: NULL, collision detection with route event bus)
+     */
+    BgpSessionRegistry *session_registry;
+
+    /**
+     * @brief Enable route flap dampening (RFC 2439) on IPv4 routes from the
+     * peer.
+     * 
+     * Routes withdrawn or changed too often are suppressed: held back from the
+     * RIB, and inserted again once their penalty decays below the reuse limit.
+     * Only routes that flap cost memory and time. The held back updates are
+     * counted in BgpFsmStats::prefixes_dampened.
+     * 
+     * (default: false)
+     */
+    bool dampening;
+
+    /**
+     * @brief Route flap dampening parameters. (Valid iff dampening)
+     * 
+     */
+    BgpDampeningParams dampening_params;
+
+    /**
+     * @brief RPKI validator for route origin validation (RFC 6811) of IPv4
+     * routes from the peer.
+     * 
+     * RPKI-invalid routes are held back from the RIB. When the VRPs in the
+     * validator change, only the routes affected are validated again: routes
+     * turned invalid are withdrawn, and held back routes turned valid (or not
+     * found) are inserted. Changes are applied in BgpFsm::tick(). The held
+     * back routes are counted in BgpFsmStats::prefixes_rpki_invalid.
+     * 
+     * One validator can be shared by all FSMs. The validator must outlive the
+     * FSM. Use BgpRtrClient to keep the VRPs in sync with an RPKI cache.
+     * 
+     * (default: NULL, no validation)
+     */
+    BgpRpkiValidator *rpki;
+
+    /**
+     * @brief BMP exporter to stream the session to a monitoring station.
+     * (RFC 7854)
+     * 
+     * UPDATE messages received are sent as pre-policy Route Monitoring, as
+     * received, and as post-policy Route Monitoring (routes accepted by
+     * ingress filters) if BgpBmpExporter::isPostPolicy(). Peer Up and Peer
+     * Down are sent on entering and leaving ESTABLISHED.
+     * 
+     * Messages are queued to the exporter without blocking, and dropped if
+     * the exporter can't keep up. One exporter can be shared by all FSMs. The
+     * exporter must outlive the FSM.
+     * 
+     * (default: NULL, no monitoring)
+     */
+    BgpBmpExporter *bmp;
+
+    /**
+     * @brief IPv4 address of the peer in BMP messages. (network bytes order)
+     * (Valid iff bmp != NULL)
+     * 
+     * (default: 0)
+     */
+    uint32_t bmp_peer_addr;
+
+    /**
+     * @brief IPv4 address of the local end of the session in BMP Peer Up.
+     * (network bytes order) (Valid iff bmp != NULL)
+     * 
+     * (default: 0)
+     */
+    uint32_t bmp_local_addr;
 } BgpConfig;
 
 /**
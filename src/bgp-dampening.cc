@@ -0,0 +1,346 @@
+/**
+ * @file bgp-dampening.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Route flap dampening. (RFC 2439)
+ * @version 0.1
+ * @date 2019-09-08
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-dampening.h"
+#include <math.h>
+
+namespace libbgp {
+
+/**
+ * @brief Construct a new BgpDampening.
+ *
+ * @param params Dampening parameters.
+ * @param thread_safe Lock the state on access. (see BgpLock)
+ */
+BgpDampening::BgpDampening(const BgpDampeningParams &params, bool thread_safe) : mutex(thread_safe) {
+    this->params = params;
+    if (this->params.half_life_ms == 0) this->params.half_life_ms = 1;
+    if (this->params.granularity_ms == 0) this->params.granularity_ms = 1;
+    if (this->params.reuse_limit == 0) this->params.reuse_limit = 1;
+
+    ceiling = this->params.reuse_limit * exp2((double) this->params.max_suppress_ms / this->params.half_life_ms);
+
+    // nothing is ever due further than max_suppress + half_life away: the
+    // penalty is capped so it decays to the reuse limit in max_suppress, and
+    // half of that in another half_life.
+    size_t n_slots = ((uint64_t) this->params.max_suppress_ms + this->params.half_life_ms) / this->params.granularity_ms + 2;
+    wheel.resize(n_slots);
+    wheel_pos = 0;
+    n_suppressed = 0;
+}
+
+/**
+ * @brief A route was withdrawn by the peer.
+ *
+ * The route is penalized, and suppressed if the penalty reaches the suppress
+ * limit. A route suppressed before is not in the RIB, so the withdrawal
+ * should be ignored.
+ *
+ * @param route The route.
+ * @param now Current time in milliseconds.
+ * @return BgpDampeningAction DA_SUPPRESS if the withdrawal should be ignored,
+ * DA_ACCEPT or DA_SUPPRESS_WITHDRAW (suppressed from now) otherwise.
+ */
+BgpDampeningAction BgpDampening::withdraw(const Prefix4 &route, uint64_t now) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    // nothing on the wheel, catch it up.
+    if (states.size() == 0) wheel_pos = now / params.granularity_ms;
+
+    BgpRib4EntryKey key(route);
+    auto ins = states.emplace(key, State());
+    State &state = ins.first->second;
+
+    if (ins.second) {
+        state.penalty = 0;
+        state.updated = now;
+        state.due = UINT64_MAX;
+        state.suppressed = false;
+        state.announced = false;
+    }
+
+    BgpDampeningAction action = state.suppressed ? DA_SUPPRESS : DA_ACCEPT;
+
+    decay(state, now);
+    penalize(state, params.withdraw_penalty);
+    state.announced = false;
+    state.attribs.reset();
+
+    if (!state.suppressed && state.penalty >= params.suppress_limit) {
+        state.suppressed = true;
+        n_suppressed++;
+        action = DA_SUPPRESS_WITHDRAW;
+    }
+
+    schedule(key, state, now);
+
+    return action;
+}
+
+/**
+ * @brief A route was announced by the peer.
+ *
+ * Routes without dampening state are accepted with a single lookup. Routes
+ * with state are penalized if they were already announced (attributes
+ * changed), and suppressed if the penalty reaches the suppress limit. The
+ * attributes of a suppressed route are kept, so the route can be inserted
+ * again when reused.
+ *
+ * @param route The route.
+ * @param attribs Path attributes of the route.
+ * @param held Copy of the attributes to keep. Allocated from attribs when
+ * first needed; pass the same pointer for all routes of an UPDATE to share
+ * one copy.
+ * @param now Current time in milliseconds.
+ * @return BgpDampeningAction What to do with the route.
+ */
+BgpDampeningAction BgpDampening::announce(const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> &held, uint64_t now) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (states.size() == 0) return DA_ACCEPT;
+
+    BgpRib4EntryKey key(route);
+    auto it = states.find(key);
+    if (it == states.end()) return DA_ACCEPT;
+
+    State &state = it->second;
+    bool was_announced = state.announced;
+
+    decay(state, now);
+    if (was_announced) penalize(state, params.attrib_change_penalty);
+    state.announced = true;
+
+    BgpDampeningAction action = DA_SUPPRESS;
+
+    if (!state.suppressed && state.penalty < params.suppress_limit) {
+        action = DA_ACCEPT;
+    } else {
+        if (!state.suppressed) {
+            state.suppressed = true;
+            n_suppressed++;
+            if (was_announced) action = DA_SUPPRESS_WITHDRAW;
+        }
+
+        if (!held) held = std::make_shared<const std::vector<std::shared_ptr<BgpPathAttrib>>>(attribs);
+        state.attribs = held;
+    }
+
+    if (was_announced || action != DA_ACCEPT) schedule(key, state, now);
+
+    return action;
+}
+
+/**
+ * @brief Process the entries of the wheel due by now.
+ *
+ * Suppressed routes whose penalty decayed below the reuse limit are
+ * unsuppressed, and the ones still announced by the peer are appended to
+ * routes for the caller to insert to the RIB. State of routes whose penalty
+ * decayed below half of the reuse limit is dropped.
+ *
+ * @param now Current time in milliseconds.
+ * @param routes Routes to append to.
+ * @return size_t Number of routes appended.
+ */
+size_t BgpDampening::reuse(uint64_t now, std::vector<BgpDampenedRoute> &routes) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint64_t now_tick = now / params.granularity_ms;
+    uint64_t n_slots = wheel.size();
+
+    // lagging more than one revolution: every slot once is enough.
+    uint64_t tick = wheel_pos;
+    if (now_tick >= n_slots && tick < now_tick - n_slots + 1) tick = now_tick - n_slots + 1;
+
+    size_t n_routes = 0;
+    std::vector<WheelEntry> entries;
+
+    for (; tick <= now_tick; tick++) {
+        std::vector<WheelEntry> &slot = wheel[tick % n_slots];
+        if (slot.size() == 0) continue;
+
+        entries.clear();
+        entries.swap(slot);
+
+        for (const WheelEntry &entry : entries) {
+            auto it = states.find(entry.key);
+
+            // stale entry, state dropped or rescheduled.
+            if (it == states.end() || it->second.due != entry.due) continue;
+
+            // a later revolution.
+            if (entry.due > now) {
+                wheel[(entry.due / params.granularity_ms) % n_slots].push_back(entry);
+                continue;
+            }
+
+            State &state = it->second;
+            decay(state, now);
+            state.due = UINT64_MAX;
+
+            if (state.suppressed) {
+                state.suppressed = false;
+                n_suppressed--;
+
+                if (state.announced) {
+                    BgpDampenedRoute route;
+                    route.route = Prefix4(entry.key.prefix, entry.key.length);
+                    route.attribs = state.attribs;
+                    routes.push_back(route);
+                    n_routes++;
+                }
+
+                state.attribs.reset();
+                schedule(entry.key, state, now);
+                continue;
+            }
+
+            // forget time reached, history decayed.
+            states.erase(it);
+        }
+    }
+
+    // the current slot may still get entries due in this tick.
+    wheel_pos = now_tick;
+
+    return n_routes;
+}
+
+/**
+ * @brief Forget which routes are announced, e.g., when the session goes
+ * down and the peer's routes are discarded from the RIB. The penalties are
+ * kept, so a flapping session doesn't reset the history.
+ *
+ */
+void BgpDampening::reset() {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    for (auto &state : states) {
+        state.second.announced = false;
+        state.second.attribs.reset();
+    }
+}
+
+/**
+ * @brief Get the time the next entry of the wheel is due. Call reuse() then.
+ *
+ * @return uint64_t Time in milliseconds, UINT64_MAX if nothing is due.
+ */
+uint64_t BgpDampening::getNextDue() const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (states.size() == 0) return UINT64_MAX;
+
+    uint64_t n_slots = wheel.size();
+
+    for (uint64_t tick = wheel_pos; tick < wheel_pos + n_slots; tick++) {
+        for (const WheelEntry &entry : wheel[tick % n_slots]) {
+            if (entry.due / params.granularity_ms != tick) continue;
+
+            auto it = states.find(entry.key);
+            if (it != states.end() && it->second.due == entry.due) return entry.due;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+/**
+ * @brief Get the penalty of a route.
+ *
+ * @param route The route.
+ * @param now Current time in milliseconds.
+ * @return double The penalty decayed to now, 0 if the route has no state.
+ */
+double BgpDampening::getPenalty(const Prefix4 &route, uint64_t now) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = states.find(BgpRib4EntryKey(route));
+    if (it == states.end()) return 0;
+
+    State state = it->second;
+    decay(state, now);
+
+    return state.penalty;
+}
+
+/**
+ * @brief Test if a route is suppressed.
+ *
+ * @param route The route.
+ * @return true The route is suppressed.
+ * @return false The route is not suppressed.
+ */
+bool BgpDampening::isSuppressed(const Prefix4 &route) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = states.find(BgpRib4EntryKey(route));
+    return it != states.end() && it->second.suppressed;
+}
+
+/**
+ * @brief Get number of routes with dampening state.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpDampening::getStateCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return states.size();
+}
+
+/**
+ * @brief Get number of suppressed routes.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpDampening::getSuppressedCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return n_suppressed;
+}
+
+// decay the penalty of a state from its last update to now.
+void BgpDampening::decay(State &state, uint64_t now) const {
+    if (now <= state.updated) return;
+
+    state.penalty *= exp2(-(double) (now - state.updated) / params.half_life_ms);
+    state.updated = now;
+}
+
+// add penalty to a state, capped to the ceiling.
+void BgpDampening::penalize(State &state, uint32_t penalty) {
+    state.penalty += penalty;
+    if (state.penalty > ceiling) state.penalty = ceiling;
+}
+
+// put a state on the wheel: due to reuse if suppressed, or due to be dropped.
+void BgpDampening::schedule(const BgpRib4EntryKey &key, State &state, uint64_t now) {
+    double target = state.suppressed ? params.reuse_limit : params.reuse_limit / 2.0;
+    uint64_t due = now + timeToDecay(state.penalty, target);
+
+    // round up to the granularity.
+    due = (due + params.granularity_ms - 1) / params.granularity_ms * params.granularity_ms;
+
+    if (due == state.due) return;
+
+    state.due = due;
+
+    WheelEntry entry;
+    entry.key = key;
+    entry.due = due;
+    wheel[(due / params.granularity_ms) % wheel.size()].push_back(entry);
+}
+
+// time for a penalty to decay to the target, in milliseconds.
+uint64_t BgpDampening::timeToDecay(double penalty, double target) const {
+    if (penalty <= target) return 0;
+    return (uint64_t) ceil(params.half_life_ms * log2(penalty / target));
+}
+
+}
@@ -0,0 +1,213 @@
+/**
+ * @file bgp-dampening.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Route flap dampening. (RFC 2439)
+ * @version 0.1
+ * @date 2019-09-08
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_DAMPENING_H_
+#define BGP_DAMPENING_H_
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "bgp-lock.h"
+#include "bgp-rib4.h"
+#include "bgp-path-attrib.h"
+#include "prefix4.h"
+
+namespace libbgp {
+
+/**
+ * @brief Route flap dampening parameters.
+ *
+ * Defaults are the commonly used vendor defaults.
+ */
+struct BgpDampeningParams {
+    BgpDampeningParams() {
+        half_life_ms = 15 * 60 * 1000;
+        max_suppress_ms = 60 * 60 * 1000;
+        reuse_limit = 750;
+        suppress_limit = 2000;
+        withdraw_penalty = 1000;
+        attrib_change_penalty = 500;
+        granularity_ms = 5000;
+    }
+
+    /**
+     * @brief Time for the penalty to decay to half of its value, in
+     * milliseconds.
+     *
+     */
+    uint32_t half_life_ms;
+
+    /**
+     * @brief Max time a route can stay suppressed without flapping again, in
+     * milliseconds. The penalty is capped to keep this.
+     *
+     */
+    uint32_t max_suppress_ms;
+
+    /**
+     * @brief A suppressed route is reused when its penalty decays below this.
+     *
+     */
+    uint32_t reuse_limit;
+
+    /**
+     * @brief A route is suppressed when its penalty reaches this.
+     *
+     */
+    uint32_t suppress_limit;
+
+    /**
+     * @brief Penalty added when the route is withdrawn.
+     *
+     */
+    uint32_t withdraw_penalty;
+
+    /**
+     * @brief Penalty added when the route is announced again while already
+     * announced (i.e., the attributes changed).
+     *
+     */
+    uint32_t attrib_change_penalty;
+
+    /**
+     * @brief Time granularity of the reuse wheel, in milliseconds.
+     *
+     */
+    uint32_t granularity_ms;
+};
+
+/**
+ * @brief What to do with an announced or withdrawn route, see
+ * BgpDampening::announce() and BgpDampening::withdraw().
+ *
+ */
+enum BgpDampeningAction {
+    /**
+     * @brief Not suppressed, insert / withdraw the route.
+     *
+     */
+    DA_ACCEPT = 0,
+
+    /**
+     * @brief Suppressed, ignore the update. (the route is not in the RIB)
+     *
+     */
+    DA_SUPPRESS = 1,
+
+    /**
+     * @brief Suppressed from now, withdraw the route from the RIB.
+     *
+     */
+    DA_SUPPRESS_WITHDRAW = 2
+};
+
+/**
+ * @brief A suppressed route to be reused.
+ *
+ */
+struct BgpDampenedRoute {
+    /**
+     * @brief The route.
+     *
+     */
+    Prefix4 route;
+
+    /**
+     * @brief The path attributes the route was last announced with. Routes
+     * announced in the same UPDATE share the pointer.
+     *
+     */
+    std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> attribs;
+};
+
+/**
+ * @brief The BgpDampening class.
+ *
+ * IPv4 route flap dampening state for the routes from one peer. BgpFsm keeps
+ * one when BgpConfig::dampening is set.
+ *
+ * State is only kept for routes that flap: the first withdrawal of a route
+ * creates it, and it is dropped once the penalty has decayed below half of
+ * the reuse limit. The penalty is decayed lazily, from the time it was last
+ * updated, whenever the route flaps again. Each route with state has one
+ * entry in a time wheel, due when the route can be reused, or when the state
+ * can be dropped. reuse() only looks at the entries that are due.
+ *
+ * Attribute changes are only penalized for routes that already have state,
+ * since unflapped routes are not tracked.
+ */
+class BgpDampening {
+public:
+    BgpDampening(const BgpDampeningParams &params, bool thread_safe = true);
+
+    // a route was withdrawn, returns what to do with it.
+    BgpDampeningAction withdraw(const Prefix4 &route, uint64_t now);
+
+    // a route was announced, returns what to do with it. if the route gets
+    // suppressed, the attributes are kept in held (allocated once per UPDATE).
+    BgpDampeningAction announce(const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> &held, uint64_t now);
+
+    // process due entries of the wheel, append routes to reuse to routes.
+    // returns number of routes appended.
+    size_t reuse(uint64_t now, std::vector<BgpDampenedRoute> &routes);
+
+    // the session went down: forget announced routes, keep the penalties.
+    void reset();
+
+    // get time of the next due entry of the wheel. UINT64_MAX if none.
+    uint64_t getNextDue() const;
+
+    // get penalty of a route, decayed to now.
+    double getPenalty(const Prefix4 &route, uint64_t now) const;
+
+    // is a route suppressed?
+    bool isSuppressed(const Prefix4 &route) const;
+
+    // get number of routes with state.
+    size_t getStateCount() const;
+
+    // get number of suppressed routes.
+    size_t getSuppressedCount() const;
+
+private:
+    BgpDampening(const BgpDampening &);
+    BgpDampening& operator= (const BgpDampening &);
+
+    struct State {
+        double penalty;
+        uint64_t updated;
+        uint64_t due;
+        bool suppressed;
+        bool announced;
+        std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> attribs;
+    };
+
+    struct WheelEntry {
+        BgpRib4EntryKey key;
+        uint64_t due;
+    };
+
+    void decay(State &state, uint64_t now) const;
+    void penalize(State &state, uint32_t penalty);
+    void schedule(const BgpRib4EntryKey &key, State &state, uint64_t now);
+    uint64_t timeToDecay(double penalty, double target) const;
+
+    BgpDampeningParams params;
+    double ceiling;
+    std::unordered_map<BgpRib4EntryKey, State, BgpRib4EntryHash> states;
+    std::vector<std::vector<WheelEntry>> wheel;
+    uint64_t wheel_pos;
+    size_t n_suppressed;
+    mutable BgpLock mutex;
+};
+
+}
+
+#endif // BGP_DAMPENING_H_
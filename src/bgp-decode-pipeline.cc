@@ -0,0 +1,141 @@
+/**
+ * @file bgp-decode-pipeline.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Multi-threaded UPDATE decoding for BgpFsm.
+ * @version 0.1
+ * @date 2019-09-01
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-decode-pipeline.h"
+
+namespace libbgp {
+
+BgpFilteredUpdate::BgpFilteredUpdate() {
+    ignore_routes = bad_nexthop6 = false;
+    filtered = 0;
+}
+
+BgpDecodeItem::BgpDecodeItem() {
+    packet = NULL;
+    parse_ret = -2;
+    has_filtered = false;
+}
+
+BgpDecodePipeline::Worker::Worker(size_t depth) : in(depth), out(depth) {
+    stopping = false;
+}
+
+/**
+ * @brief Construct a new BgpDecodePipeline and start the workers.
+ *
+ * @param threads Number of worker threads.
+ * @param depth Maximum number of packets in flight per worker.
+ * @param decode The decoder. Called on worker threads for each packet.
+ */
+BgpDecodePipeline::BgpDecodePipeline(size_t threads, size_t depth, const std::function<void (BgpDecodeItem &)> &decode) {
+    this->decode = decode;
+    this->depth = depth;
+    push_at = pop_at = in_flight = 0;
+
+    for (size_t i = 0; i < threads; i++) workers.push_back(new Worker(depth));
+    for (Worker *worker : workers) worker->thread = std::thread(&BgpDecodePipeline::work, this, worker);
+}
+
+/**
+ * @brief Stop the workers and destroy the pipeline.
+ *
+ * Packets still in the pipeline are discarded.
+ */
+BgpDecodePipeline::~BgpDecodePipeline() {
+    BgpDecodeItem item;
+    while (pop(item)) {
+        if (item.packet != NULL) delete item.packet;
+    }
+
+    for (Worker *worker : workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stopping = true;
+        }
+        worker->cv.notify_one();
+    }
+
+    for (Worker *worker : workers) {
+        worker->thread.join();
+        delete worker;
+    }
+}
+
+void BgpDecodePipeline::work(Worker *worker) {
+    BgpDecodeItem item;
+
+    while (true) {
+        if (worker->in.pop(item)) {
+            decode(item);
+
+            // can't be full: at most depth packets in flight per worker.
+            worker->out.push(item);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        worker->cv.wait(lock, [&]() { return worker->stopping || worker->in.size() > 0; });
+        if (worker->stopping && worker->in.size() == 0) return;
+    }
+}
+
+/**
+ * @brief Hand a packet to the next worker.
+ *
+ * @param item The packet. Moved into the pipeline on success.
+ * @return true Packet handed over.
+ * @return false Pipeline full, pop() first.
+ */
+bool BgpDecodePipeline::push(BgpDecodeItem &item) {
+    if (in_flight >= depth * workers.size()) return false;
+
+    Worker *worker = workers[push_at];
+    if (!worker->in.push(item)) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+    }
+    worker->cv.notify_one();
+
+    push_at = (push_at + 1) % workers.size();
+    in_flight++;
+    return true;
+}
+
+/**
+ * @brief Get the next decoded packet, in the order they were pushed.
+ *
+ * Waits for the packet if it is still being decoded.
+ *
+ * @param item Where to move the packet to.
+ * @return true Packet popped.
+ * @return false No packet in pipeline.
+ */
+bool BgpDecodePipeline::pop(BgpDecodeItem &item) {
+    if (in_flight == 0) return false;
+
+    Worker *worker = workers[pop_at];
+    while (!worker->out.pop(item)) std::this_thread::yield();
+
+    pop_at = (pop_at + 1) % workers.size();
+    in_flight--;
+    return true;
+}
+
+/**
+ * @brief Get number of packets in pipeline.
+ *
+ * @return size_t Number of packets.
+ */
+size_t BgpDecodePipeline::size() const {
+    return in_flight;
+}
+
+}
@@ -0,0 +1,162 @@
+/**
+ * @file bgp-decode-pipeline.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Multi-threaded UPDATE decoding for BgpFsm.
+ * @version 0.1
+ * @date 2019-09-01
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_DECODE_PIPELINE_H_
+#define BGP_DECODE_PIPELINE_H_
+#include "bgp-packet.h"
+#include "prefix4.h"
+#include "prefix6.h"
+#include "spsc-queue.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace libbgp {
+
+/**
+ * @brief Routes of an UPDATE message that passed the checks and ingress
+ * filters of BgpFsm.
+ *
+ */
+struct BgpFilteredUpdate {
+    BgpFilteredUpdate();
+
+    /**
+     * @brief Ignore all routes in the message (e.g., AS_PATH loop, bad IPv4
+     * nexthop). Withdrawn routes are still processed.
+     *
+     */
+    bool ignore_routes;
+
+    /**
+     * @brief MP_REACH_NLRI has a bad IPv6 nexthop.
+     *
+     */
+    bool bad_nexthop6;
+
+    /**
+     * @brief IPv4 NLRI accepted by ingress filters.
+     *
+     */
+    std::vector<Prefix4> routes4;
+
+    /**
+     * @brief IPv6 NLRI accepted by ingress filters.
+     *
+     */
+    std::vector<Prefix6> routes6;
+
+    /**
+     * @brief Number of routes rejected by ingress filters.
+     *
+     */
+    uint64_t filtered;
+};
+
+/**
+ * @brief A packet going through the decode pipeline.
+ *
+ */
+struct BgpDecodeItem {
+    BgpDecodeItem();
+
+    /**
+     * @brief The packet, as poured from the sink.
+     *
+     */
+    std::vector<uint8_t> frame;
+
+    /**
+     * @brief The parsed packet. Owned by whoever holds the item.
+     *
+     */
+    BgpPacket *packet;
+
+    /**
+     * @brief Return value of the parse, as BgpSink::pour().
+     *
+     */
+    ssize_t parse_ret;
+
+    /**
+     * @brief Is filtered set?
+     *
+     */
+    bool has_filtered;
+
+    /**
+     * @brief Checks and ingress filter results.
+     *
+     */
+    BgpFilteredUpdate filtered;
+};
+
+/**
+ * @brief The BgpDecodePipeline class.
+ *
+ * A pool of worker threads decoding packets for one BgpFsm. Each worker has a
+ * pair of SPSC queues, one for packets in and one for decoded packets out.
+ * Packets are handed to the workers round-robin and collected in the same
+ * order, so they come out in the order they went in, while the decoding of
+ * consecutive packets runs in parallel.
+ *
+ * push() and pop() must be called from the same thread.
+ */
+class BgpDecodePipeline {
+public:
+    // decode: called on worker threads for each packet.
+    BgpDecodePipeline(size_t threads, size_t depth, const std::function<void (BgpDecodeItem &)> &decode);
+    ~BgpDecodePipeline();
+
+    // hand a packet to the next worker. false if the pipeline is full, pop()
+    // a packet first.
+    bool push(BgpDecodeItem &item);
+
+    // get the next decoded packet, in push() order. waits for it if still
+    // being decoded. false if no packet in pipeline.
+    bool pop(BgpDecodeItem &item);
+
+    // get number of packets in pipeline.
+    size_t size() const;
+
+private:
+    BgpDecodePipeline(const BgpDecodePipeline &);
+    BgpDecodePipeline& operator= (const BgpDecodePipeline &);
+
+    struct Worker {
+        Worker(size_t depth);
+
+        SpscQueue<BgpDecodeItem> in;
+        SpscQueue<BgpDecodeItem> out;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread thread;
+        bool stopping;
+    };
+
+    void work(Worker *worker);
+
+    std::vector<Worker *> workers;
+    std::function<void (BgpDecodeItem &)> decode;
+    size_t depth;
+
+    // index of worker next push() / pop() goes to.
+    size_t push_at;
+    size_t pop_at;
+    size_t in_flight;
+};
+
+}
+
+#endif // BGP_DECODE_PIPELINE_H_
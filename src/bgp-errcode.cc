@@ -98,4 +98,40 @@ const char *bgp_cease_error_str[9] = {
     "Out of Resources"
 };
 
-}
\ No newline at end of file
+// get an error string from a table, or "Unknown" if code is out of range.
+static const char* errorString(const char **table, size_t table_size, uint8_t code) {
+    return code < table_size ? table[code] : "Unknown";
+}
+
+#define ERROR_STRING(table, code) errorString(table, sizeof(table) / sizeof(table[0]), code)
+
+/**
+ * @brief Get the string of an error code.
+ * 
+ * @param errcode The error code.
+ * @return const char* The string. "Unknown" if out of range.
+ */
+const char* bgpErrorString(uint8_t errcode) {
+    return ERROR_STRING(bgp_error_code_str, errcode);
+}
+
+/**
+ * @brief Get the string of an error subcode.
+ * 
+ * @param errcode The error code.
+ * @param subcode The error subcode.
+ * @return const char* The string. "Unknown" if out of range.
+ */
+const char* bgpErrorSubcodeString(uint8_t errcode, uint8_t subcode) {
+    switch (errcode) {
+        case E_HEADER: return ERROR_STRING(bgp_header_error_subcode_str, subcode);
+        case E_OPEN: return ERROR_STRING(bgp_open_error_subcode_str, subcode);
+        case E_UPDATE: return ERROR_STRING(bgp_update_error_str, subcode);
+        case E_FSM: return ERROR_STRING(bgp_fsm_error_str, subcode);
+        case E_CEASE: return ERROR_STRING(bgp_cease_error_str, subcode);
+    }
+
+    return bgp_error_code_str[0];
+}
+
+}
@@ -10,6 +10,8 @@
  */
 #ifndef BGP_ERRCODE_H_
 #define BGP_ERRCODE_H_
+#include <stdint.h>
+#include <unistd.h>
 
 namespace libbgp {
 
@@ -20,6 +22,12 @@ extern const char *bgp_update_error_str[12];
 extern const char *bgp_fsm_error_str[4];
 extern const char *bgp_cease_error_str[9];
 
+// get the string of an error code, "Unknown" if out of range.
+const char* bgpErrorString(uint8_t errcode);
+
+// get the string of an error subcode, "Unknown" if out of range.
+const char* bgpErrorSubcodeString(uint8_t errcode, uint8_t subcode);
+
 /**
  * @brief BGP Error codes
  * 
@@ -58,7 +58,7 @@ BgpFilterRuleAsPath::BgpFilterRuleAsPath(BgpFilterOP op, BgpFilterRuleAsPathMatc
 BgpFilterOP BgpFilterRuleAsPath::apply(__attribute__((unused)) const Prefix &prefix, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) {
     for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
         if (attr->type_code != AS_PATH) continue;
-        const BgpPathAttribAsPath &as_path = dynamic_cast<const BgpPathAttribAsPath &>(*attr);
+        const BgpPathAttribAsPath &as_path = static_cast<const BgpPathAttribAsPath &>(*attr);
 
         for (const BgpAsPathSegment &as_seg : as_path.as_paths) {
             if (as_seg.type != AS_SEQUENCE) continue;
@@ -110,7 +110,7 @@ BgpFilterRuleCommunity::BgpFilterRuleCommunity(BgpFilterOP op, BgpFilterRuleComm
 BgpFilterOP BgpFilterRuleCommunity::apply(__attribute__((unused)) const Prefix &prefix, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) {
     for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
         if (attr->type_code != COMMUNITY) continue;
-        const BgpPathAttribCommunity &community = dynamic_cast<const BgpPathAttribCommunity &>(*attr);
+        const BgpPathAttribCommunity &community = static_cast<const BgpPathAttribCommunity &>(*attr);
 
         for (uint32_t community_val : community.communites) {
             if (match_type == M_HAS_COMMUNITY && community_val == this->community) return op;
@@ -117,7 +117,7 @@ public:
 
     BgpFilterOP apply(const Prefix &prefix, __attribute__((unused)) const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) {
         if (prefix.afi != this->prefix.afi) return NOP;
-        const T &prefix_t = dynamic_cast<const T &>(prefix);
+        const T &prefix_t = static_cast<const T &>(prefix);
         switch (match_type) {
             case M_EQ: return prefix_t == this->prefix ? op : NOP;
             case M_NE: return prefix_t != this->prefix ? op : NOP;
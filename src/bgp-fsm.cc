@@ -11,9 +11,12 @@
 #include "bgp-fsm.h"
 #include "realtime-clock.h"
 #include "value-op.h"
+#include "bgp-asn-codec.h"
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <arpa/inet.h>
+#include <thread>
 
 namespace libbgp {
 
@@ -25,10 +28,13 @@ const char* bgp_fsm_state_str[] = {
     "Broken"
 };
 
-BgpFsm::BgpFsm(const BgpConfig &config) : in_sink(config.use_4b_asn) {
+BgpFsm::BgpFsm(const BgpConfig &config) : in_sink(config.use_4b_asn, config.buffer_pool, !config.single_threaded), out_buffer_mutex(!config.single_threaded) {
     this->config = config;
+    stats.setSingleWriter(config.single_threaded);
     state = IDLE;
-    out_buffer = (uint8_t *) malloc(BGP_FSM_BUFFER_SIZE);
+    use_4b_asn = config.use_4b_asn;
+    out_buffer = NULL;
+    out_buffer_size = 0;
 
     if (config.rev_bus) {
         rev_bus_exist = true;
@@ -44,7 +50,7 @@ BgpFsm::BgpFsm(const BgpConfig &config) : in_sink(config.use_4b_asn) {
     }
 
     if (!config.log_handler) {
-        logger = new BgpLogHandler();
+        logger = new BgpLogHandler(!config.single_threaded);
         log_local = true;
     } else {
         logger = config.log_handler;
@@ -54,7 +60,7 @@ BgpFsm::BgpFsm(const BgpConfig &config) : in_sink(config.use_4b_asn) {
     in_sink.setLogger(logger);
 
     if (!config.rib4) {
-        rib4 = new BgpRib4(logger);
+        rib4 = new BgpRib4(logger, !config.single_threaded);
         rib4_local = true;
     } else {
         rib4 = config.rib4;
@@ -62,22 +68,49 @@ BgpFsm::BgpFsm(const BgpConfig &config) : in_sink(config.use_4b_asn) {
     }
 
     if (!config.rib6) {
-        rib6 = new BgpRib6(logger);
+        rib6 = new BgpRib6(logger, !config.single_threaded);
         rib6_local = true;
     } else {
         rib6 = config.rib6;
         rib6_local = false;
     }
 
+    dampening = NULL;
+    if (config.dampening) dampening = new BgpDampening(config.dampening_params, !config.single_threaded);
+
     hold_timer = 0;
+    last_sent = last_recv = 0;
     peer_bgp_id = 0;
     peer_asn = 0;
+    registered = false;
+    registered_bgp_id = 0;
+    bmp_down_pending = false;
+
+    pipeline = NULL;
+    if (config.decode_threads > 0 && config.single_threaded) {
+        logger->log(WARN, "BgpFsm::BgpFsm: single_threaded set, ignoring decode_threads.\n");
+    } else if (config.decode_threads > 0 && std::thread::hardware_concurrency() <= 1) {
+        // workers on the same core only add the hand-off.
+        logger->log(INFO, "BgpFsm::BgpFsm: one CPU, ignoring decode_threads.\n");
+    } else if (config.decode_threads > 0) {
+        pipeline = new BgpDecodePipeline(config.decode_threads, BGP_FSM_DECODE_DEPTH, [this](BgpDecodeItem &item) {
+            decodeUpdate(item);
+        });
+    }
 }
 
 BgpFsm::~BgpFsm() {
-    free(out_buffer);
+    if (config.bmp != NULL && (state == ESTABLISHED || bmp_down_pending)) {
+        uint16_t event = 0;
+        bmpPeerDown(BMP_DOWN_LOCAL_NO_NOTIFY, (const uint8_t *) &event, sizeof(event));
+    }
+
+    if (registered) config.session_registry->remove(registered_bgp_id, this);
+    if (pipeline != NULL) delete pipeline;
+    shrinkBuffers();
     if (rib4_local) delete rib4;
     if (rib6_local) delete rib6;
+    if (dampening != NULL) delete dampening;
     if (clock_local) delete clock;
     if (rev_bus_exist) config.rev_bus->unsubscribe(this);
     if (log_local) delete logger;
@@ -111,6 +144,16 @@ BgpRib6& BgpFsm::getRib6() const {
     return rib4_local ? *rib6 : *(config.rib6);
 }
 
+const BgpFsmStats& BgpFsm::getStats() const {
+    return stats;
+}
+
+void BgpFsm::getStatsSnapshot(BgpFsmStatsSnapshot &snap) {
+    stats.snapshot(snap);
+    snap.sink_bytes = in_sink.getBytesInSink();
+    snap.buffer_bytes = in_sink.getBufferSize() + out_buffer_size;
+}
+
 BgpState BgpFsm::getState() const {
     return state;
 }
@@ -126,9 +169,15 @@ int BgpFsm::start() {
         return 0;
     }
     
+    // left ESTABLISHED without NOTIFICATION last time.
+    if (bmp_down_pending) {
+        uint16_t event = 0;
+        bmpPeerDown(BMP_DOWN_LOCAL_NO_NOTIFY, (const uint8_t *) &event, sizeof(event));
+    }
+
     logger->log(DEBUG, "BgpFsm::start: sending OPEN message to peer.\n");
 
-    uint16_t my_asn_2b = config.asn >= 0xffff ? 23456 : config.asn;
+    uint16_t my_asn_2b = BgpAsnCodec<uint16_t>::toWire(config.asn);
 
     BgpOpenMessage msg(logger, config.use_4b_asn, my_asn_2b, config.hold_timer, config.router_id);
     if (config.use_4b_asn) {
@@ -177,6 +226,8 @@ int BgpFsm::stop() {
 }
 
 int BgpFsm::run(const uint8_t *buffer, const size_t buffer_size) {
+    BgpStatsTimer run_timer(stats.run_time);
+
     if (state == BROKEN) {
         logger->log(ERROR, "BgpFsm::run: FSM is broken, consider reset.\n");
         return -1;
@@ -189,111 +240,245 @@ int BgpFsm::run(const uint8_t *buffer, const size_t buffer_size) {
         return -1;
     }
 
+    stats.bytes_in.inc(buffer_size);
+
     // tick the clock
     if (!config.no_autotick) {
         int tick_ret = tick();
         if (tick_ret <= 0) return tick_ret;
     }
     
-    last_recv = clock->getTime();
+    last_recv = clock->getTimeMs();
 
     int final_ret_val = -1;
 
     // keep running untill sink empty
     while (in_sink.getBytesInSink() > 0) {
-        BgpPacket *packet = NULL;
-        ssize_t poured = in_sink.pour(&packet);
+        // find all complete packets in one pass.
+        in_frames.clear();
+        ssize_t n_frames = in_sink.frame(in_frames);
 
-        if (poured <= -2) {
+        if (n_frames <= -2) {
+            if (pipeline != NULL && !drainPipeline(final_ret_val)) return final_ret_val;
             logger->log(ERROR, "BgpFsm::run: sink seems to be broken, please reset.\n");
             setState(BROKEN);
             return -1;
         }
 
-        if (poured == 0) return 3;
-
-        LIBBGP_LOG(logger, DEBUG) {
-            logger->log(DEBUG, "BgpFsm::run: got message (Current state: %s):\n", bgp_fsm_state_str[state]);
-            logger->log(DEBUG, *packet);
+        if (n_frames == 0) {
+            if (pipeline != NULL && !drainPipeline(final_ret_val)) return final_ret_val;
+            return 3;
         }
 
-        const BgpMessage *msg = packet->getMessage();
-        // parse failed / packet invalid (errors like Unsupported Optional 
-        // Parameter falls in this catagory, since those errors are checked by
-        // parsers, other errors like FSM error, Bad Peer AS, etc is handled in 
-        // fsmEval*)
-        if (poured == -1) {
-            if (msg->type == NOTIFICATION) {
-                logger->log(ERROR, "BgpFsm::run: got invalid NOTIFICATION message.\n");
-                if (state == ESTABLISHED) {
-                    logger->log(ERROR, "BgpFsm::run: discarding all routes.\n");
+        // an out handler may call run() again while we evaluate a packet,
+        // the descriptors are stale once that happened.
+        uint64_t generation = in_sink.getGeneration();
+
+        for (size_t i = 0; i < (size_t) n_frames; i++) {
+            if (in_sink.getGeneration() != generation) break;
+
+            const uint8_t *frame = in_sink.peek();
+            uint16_t frame_len = in_frames[i].length;
+
+            // BMP: UPDATEs as received (pre-policy), OPEN and NOTIFICATION
+            // for Peer Up / Peer Down.
+            if (config.bmp != NULL) {
+                uint8_t type = in_frames[i].type;
+                if (type == UPDATE && state == ESTABLISHED) {
+                    BgpBmpPeer peer;
+                    bmpGetPeer(peer);
+                    config.bmp->routeMonitoring(peer, last_recv, false, frame, frame_len);
+                } else if (type == OPEN) bmp_open_recv.assign(frame, frame + frame_len);
+                else if (type == NOTIFICATION && state == ESTABLISHED) bmp_notify_recv.assign(frame, frame + frame_len);
+            }
+
+            // UPDATE in ESTABLISHED: decode on workers.
+            if (pipeline != NULL && state == ESTABLISHED && in_frames[i].type == UPDATE) {
+                decode_item.frame.assign(frame, frame + frame_len);
+                in_sink.consume(frame_len);
+                while (!pipeline->push(decode_item)) {
+                    if (!drainPipeline(final_ret_val)) return final_ret_val;
                 }
+                continue;
+            }
+
+            // anything else: evaluate everything before it first.
+            if (pipeline != NULL) {
+                if (!drainPipeline(final_ret_val)) return final_ret_val;
+                if (in_sink.getGeneration() != generation) break;
+            }
 
+            BgpPacket *packet = new BgpPacket(logger, use_4b_asn);
+            ssize_t par_ret = packet->parse(frame, frame_len);
+            in_sink.consume(frame_len);
+
+            if (par_ret >= 0 && par_ret != frame_len) {
+                logger->log(FATAL, "BgpFsm::run: parsed packet length mismatch (%d, want %d).\n", par_ret, frame_len);
                 delete packet;
-                setState(IDLE);
-                return 0;
+                setState(BROKEN);
+                return -1;
             }
-            BgpNotificationMessage notify (logger, msg->getErrorCode(), msg->getErrorSubCode(), msg->getError(), msg->getErrorLength());
-            setState(IDLE);
-            if(!writeMessage(notify)) return -1;
-            delete packet;
-            return 0;
+
+            if (!evalPacket(packet, par_ret >= 0, NULL, final_ret_val)) return final_ret_val;
         }
+    }
+
+    if (pipeline != NULL && !drainPipeline(final_ret_val)) return final_ret_val;
 
+    return final_ret_val;
+}
+
+bool BgpFsm::evalPacket(BgpPacket *packet, bool parsed, const BgpFilteredUpdate *filtered, int &ret) {
+    const BgpMessage *msg = packet->getMessage();
+    stats.msgs_in[msg->type < BGP_STATS_MSG_TYPES ? msg->type : 0].inc();
+
+    LIBBGP_LOG(logger, DEBUG) {
+        logger->log(DEBUG, "BgpFsm::run: got message (Current state: %s):\n", bgp_fsm_state_str[state]);
+        logger->log(DEBUG, *packet);
+    }
+
+    // parse failed / packet invalid (errors like Unsupported Optional 
+    // Parameter falls in this catagory, since those errors are checked by
+    // parsers, other errors like FSM error, Bad Peer AS, etc is handled in 
+    // fsmEval*)
+    if (!parsed) {
+        stats.parse_errors.inc();
         if (msg->type == NOTIFICATION) {
-            const BgpNotificationMessage *notify = dynamic_cast<const BgpNotificationMessage *>(msg);
-            const char *err_msg = bgp_error_code_str[notify->errcode];
-            const char *err_sub_msg = bgp_error_code_str[0];
-            switch (notify->errcode) {
-                case E_HEADER: err_sub_msg = bgp_header_error_subcode_str[notify->subcode]; break;
-                case E_OPEN: err_sub_msg = bgp_open_error_subcode_str[notify->subcode]; break;
-                case E_UPDATE: err_sub_msg = bgp_update_error_str[notify->subcode]; break;
-                case E_FSM: err_sub_msg = bgp_fsm_error_str[notify->subcode]; break;
-                case E_CEASE: err_sub_msg = bgp_cease_error_str[notify->subcode]; break;
+            logger->log(ERROR, "BgpFsm::run: got invalid NOTIFICATION message.\n");
+            if (state == ESTABLISHED) {
+                logger->log(ERROR, "BgpFsm::run: discarding all routes.\n");
             }
-            logger->log(ERROR, "BgpFsm::run: got NOTIFICATION: %s (%d): %s (%d).\n", err_msg, notify->errcode, err_sub_msg, notify->subcode);
+
             delete packet;
             setState(IDLE);
-            return 0;
+            ret = 0;
+            return false;
+        }
+        BgpNotificationMessage notify (logger, msg->getErrorCode(), msg->getErrorSubCode(), msg->getError(), msg->getErrorLength());
+        setState(IDLE);
+        ret = writeMessage(notify) ? 0 : -1;
+        delete packet;
+        return false;
+    }
+
+    if (msg->type == NOTIFICATION) {
+        const BgpNotificationMessage *notify = static_cast<const BgpNotificationMessage *>(msg);
+        const char *err_msg = bgpErrorString(notify->errcode);
+        const char *err_sub_msg = bgpErrorSubcodeString(notify->errcode, notify->subcode);
+        logger->log(ERROR, "BgpFsm::run: got NOTIFICATION: %s (%d): %s (%d).\n", err_msg, notify->errcode, err_sub_msg, notify->subcode);
+        delete packet;
+        setState(IDLE);
+        ret = 0;
+        return false;
+    }
+
+    int retval = -1;
+
+    int vald_ret = validateState(msg->type);
+    if (vald_ret <= 0) {
+        delete packet;
+        ret = vald_ret;
+        return false;
+    }
+
+    switch (state) {
+        case IDLE: retval = fsmEvalIdle(msg); break;
+        case OPEN_SENT: retval = fsmEvalOpenSent(msg); break;
+        case OPEN_CONFIRM: retval = fsmEvalOpenConfirm(msg); break;
+        case ESTABLISHED: retval = fsmEvalEstablished(msg, filtered); break;
+        default: {
+            logger->log(ERROR, "BgpFsm::run: FSM in invalid state: %d.\n", state);
+            delete packet;
+            ret = -1;
+            return false;
         }
+    }
+
+    delete packet;
+    if (retval < 0) {
+        ret = retval;
+        return false;
+    }
+    if (retval == 0) ret = 0;
+    if (retval == 1 && ret != 0 && ret != 2) ret = 1;
+    if (retval == 2) ret = 2;
 
-        int retval = -1;
+    return true;
+}
+
+void BgpFsm::decodeUpdate(BgpDecodeItem &item) {
+    item.packet = new BgpPacket(logger, use_4b_asn);
+    item.parse_ret = item.packet->parse(item.frame.data(), item.frame.size());
+    item.has_filtered = false;
+
+    if (item.parse_ret >= 0 && (size_t) item.parse_ret != item.frame.size()) {
+        logger->log(FATAL, "BgpFsm::decodeUpdate: parsed packet length mismatch (%d, want %d).\n", item.parse_ret, item.frame.size());
+        item.parse_ret = -2;
+        return;
+    }
 
-        int vald_ret = validateState(msg->type);
-        if (vald_ret <= 0) {
+    if (item.parse_ret < 0) return;
+
+    filterUpdate(static_cast<const BgpUpdateMessage *>(item.packet->getMessage()), item.filtered);
+    item.has_filtered = true;
+}
+
+bool BgpFsm::drainPipeline(int &ret) {
+    while (pipeline->pop(decoded_item)) {
+        BgpPacket *packet = decoded_item.packet;
+        decoded_item.packet = NULL;
+
+        if (decoded_item.parse_ret <= -2) {
             delete packet;
-            return vald_ret;
+            discardPipeline();
+            logger->log(ERROR, "BgpFsm::run: sink seems to be broken, please reset.\n");
+            setState(BROKEN);
+            ret = -1;
+            return false;
         }
 
-        switch (state) {
-            case IDLE: retval = fsmEvalIdle(msg); break;
-            case OPEN_SENT: retval = fsmEvalOpenSent(msg); break;
-            case OPEN_CONFIRM: retval = fsmEvalOpenConfirm(msg); break;
-            case ESTABLISHED: retval = fsmEvalEstablished(msg); break;
-            default: {
-                logger->log(ERROR, "BgpFsm::run: FSM in invalid state: %d.\n", state);
-                delete packet;
-                return -1;
-            }
+        // a message before this one may have ended the session.
+        if (state != ESTABLISHED) {
+            delete packet;
+            continue;
         }
 
-        delete packet;
-        if (retval < 0) return retval;
-        if (retval == 0) final_ret_val = 0;
-        if (retval == 1 && final_ret_val != 0 && final_ret_val != 2) final_ret_val = 1;
-        if (retval == 2) final_ret_val = 2;
+        const BgpFilteredUpdate *filtered = decoded_item.has_filtered ? &decoded_item.filtered : NULL;
+        if (!evalPacket(packet, decoded_item.parse_ret >= 0, filtered, ret)) {
+            discardPipeline();
+            return false;
+        }
     }
 
-    return final_ret_val;
+    return true;
+}
+
+void BgpFsm::discardPipeline() {
+    while (pipeline->pop(decoded_item)) {
+        if (decoded_item.packet != NULL) delete decoded_item.packet;
+        decoded_item.packet = NULL;
+    }
 }
 
 int BgpFsm::tick() {
+    uint64_t now = clock->getTimeMs();
+
+    // idle, give the buffers back. not when run() just filled the sink: the
+    // data would be moved to a new buffer, and the reply needs out_buffer.
+    if (now - last_recv >= BGP_FSM_BUFFER_IDLE_MS && in_sink.getBytesInSink() == 0) shrinkBuffers();
+
     if (state != ESTABLISHED) return 1;
 
+    // suppressed routes due for reuse?
+    if (dampening != NULL) reuseDampened(now);
+
+    // VRPs changed, routes from peer to validate again?
+    if (config.rpki != NULL && config.rpki->hasChanges(peer_bgp_id)) applyRpkiChanges();
+
     // peer hold-timer exipred?
-    uint64_t now = clock->getTime();
-    if (hold_timer > 0 && now - last_recv > hold_timer) {
-        logger->log(ERROR, "BgpFsm::tick: peer hold timer expired (last_recv: %d, now: %d, diff: %d, hold: %d).\n", last_recv, now, now - last_recv, hold_timer);
+    uint64_t hold_ms = (uint64_t) hold_timer * 1000;
+    if (hold_timer > 0 && now - last_recv > hold_ms) {
+        logger->log(ERROR, "BgpFsm::tick: peer hold timer expired (last_recv: %llu ms, now: %llu ms, diff: %llu ms, hold: %d s).\n", (unsigned long long) last_recv, (unsigned long long) now, (unsigned long long) (now - last_recv), hold_timer);
         BgpNotificationMessage notify (logger, E_HOLD, 0, NULL, 0);
         setState(IDLE);
         if(!writeMessage(notify)) return -1;
@@ -301,7 +486,7 @@ int BgpFsm::tick() {
     }
 
     // send keepalive? 
-    if (hold_timer > 0 && now - last_sent > hold_timer / 3) {
+    if (hold_timer > 0 && now - last_sent > hold_ms / 3) {
         BgpKeepaliveMessage keep = BgpKeepaliveMessage(logger);
         if(!writeMessage(keep)) return -1;
         return 2;
@@ -310,6 +495,34 @@ int BgpFsm::tick() {
     return 1;
 }
 
+uint64_t BgpFsm::getNextTick() const {
+    uint64_t next = UINT64_MAX;
+
+    // release buffers once idle.
+    if (in_sink.getBufferSize() > 0 || out_buffer_size > 0) next = last_recv + BGP_FSM_BUFFER_IDLE_MS;
+
+    if (state != ESTABLISHED) return next;
+
+    // RPKI changes to apply now.
+    if (config.rpki != NULL && config.rpki->hasChanges(peer_bgp_id)) return 0;
+
+    if (hold_timer == 0) return next;
+
+    uint64_t hold_ms = (uint64_t) hold_timer * 1000;
+    uint64_t keepalive_at = last_sent + hold_ms / 3 + 1;
+    uint64_t expire_at = last_recv + hold_ms + 1;
+
+    if (keepalive_at < next) next = keepalive_at;
+    if (expire_at < next) next = expire_at;
+
+    if (dampening != NULL) {
+        uint64_t reuse_at = dampening->getNextDue();
+        if (reuse_at < next) next = reuse_at;
+    }
+
+    return next;
+}
+
 int BgpFsm::resetSoft() {
     BgpNotificationMessage notify (logger, E_CEASE, E_RESET, NULL, 0);
     if(!writeMessage(notify)) return -1;
@@ -320,6 +533,25 @@ int BgpFsm::resetSoft() {
 void BgpFsm::resetHard() {
     in_sink.drain();
     setState(IDLE);
+    shrinkBuffers();
+
+    if (bmp_down_pending) {
+        uint16_t event = 0;
+        bmpPeerDown(BMP_DOWN_LOCAL_NO_NOTIFY, (const uint8_t *) &event, sizeof(event));
+    }
+}
+
+void BgpFsm::shrinkBuffers() {
+    in_sink.shrink();
+
+    std::lock_guard<BgpLock> lock(out_buffer_mutex);
+    if (out_buffer == NULL) return;
+
+    if (config.buffer_pool != NULL) config.buffer_pool->release(out_buffer, out_buffer_size);
+    else free(out_buffer);
+
+    out_buffer = NULL;
+    out_buffer_size = 0;
 }
 
 int BgpFsm::openRecv(const BgpOpenMessage *open_msg) {
@@ -362,16 +594,28 @@ int BgpFsm::openRecv(const BgpOpenMessage *open_msg) {
         return 0;
     }
 
-    if (!config.no_collision_detection && rev_bus_exist) {
-        RouteCollisionEvent col = RouteCollisionEvent();
-        col.peer_bgp_id = open_msg->bgp_id;
+    if (!config.no_collision_detection && (config.session_registry != NULL || rev_bus_exist)) {
+        uint32_t bgp_id = open_msg->bgp_id;
+        int complaints = 0;
 
-        // publish returned 0: no one complained about collision (either 
-        // there's no collision, or some fsm has killed themselves)
+        // ask other sessions with the same peer. with a registry, only those
+        // sessions are asked, otherwise, every FSM on the bus is.
+        if (config.session_registry != NULL) {
+            complaints = config.session_registry->forEach(bgp_id, this, [bgp_id](BgpFsm *other) {
+                return other->checkCollision(bgp_id);
+            });
+        } else {
+            RouteCollisionEvent col = RouteCollisionEvent();
+            col.peer_bgp_id = bgp_id;
+            complaints = config.rev_bus->publish(this, col);
+        }
+
+        // 0: no one complained about collision (either there's no collision, 
+        // or some fsm has killed themselves)
         //
-        // publish returned > 0: someone complained about collision, it think 
-        // this session should be dropped
-        if(config.rev_bus->publish(this, col) > 0) {
+        // > 0: someone complained about collision, it think this session 
+        // should be dropped
+        if(complaints > 0) {
             int res_result = resloveCollision(open_msg->bgp_id, true);
 
             if(res_result == -1) return -1;
@@ -391,6 +635,13 @@ int BgpFsm::openRecv(const BgpOpenMessage *open_msg) {
 
     hold_timer = config.hold_timer > open_msg->hold_time ? open_msg->hold_time : config.hold_timer;
     peer_bgp_id = open_msg->bgp_id;
+
+    if (config.session_registry != NULL) {
+        if (registered) config.session_registry->remove(registered_bgp_id, this);
+        config.session_registry->add(peer_bgp_id, this);
+        registered_bgp_id = peer_bgp_id;
+        registered = true;
+    }
     use_4b_asn = open_msg->hasCapability(ASN_4B) && config.use_4b_asn;
     send_ipv4_routes = true;
     if (open_msg->hasCapability(MP_BGP) && (config.mp_bgp_ipv6 || config.mp_bgp_ipv4)) {
@@ -400,7 +651,7 @@ int BgpFsm::openRecv(const BgpOpenMessage *open_msg) {
 
         for (const std::shared_ptr<BgpCapability> &cap : capabilities) {
             if (cap->code == MP_BGP) {
-                const BgpCapabilityMpBgp &mp_cap = dynamic_cast<const BgpCapabilityMpBgp &> (*cap);
+                const BgpCapabilityMpBgp &mp_cap = static_cast<const BgpCapabilityMpBgp &> (*cap);
                 if (mp_cap.safi != UNICAST) continue;
                 if (mp_cap.afi == IPV6) send_ipv6_routes = true && config.mp_bgp_ipv6;
                 if (mp_cap.afi == IPV4) send_ipv4_routes = true && config.mp_bgp_ipv4;
@@ -462,22 +713,26 @@ int BgpFsm::resloveCollision(uint32_t peer_bgp_id, bool is_new) {
 }
 
 bool BgpFsm::handleRouteEvent(const RouteEvent &ev) {
-    if (ev.type == ADD4) return handleRoute4AddEvent(dynamic_cast <const Route4AddEvent&>(ev));
-    if (ev.type == WITHDRAW4) return handleRoute4WithdrawEvent(dynamic_cast <const Route4WithdrawEvent&>(ev));
-    if (ev.type == ADD6) return handleRoute6AddEvent(dynamic_cast <const Route6AddEvent&>(ev));
-    if (ev.type == WITHDRAW6) return handleRoute6WithdrawEvent(dynamic_cast <const Route6WithdrawEvent&>(ev));
-    if (ev.type == COLLISION) return handleRouteCollisionEvent(dynamic_cast <const RouteCollisionEvent&>(ev));
+    if (ev.type == ADD4) return handleRoute4AddEvent(static_cast<const Route4AddEvent&>(ev));
+    if (ev.type == WITHDRAW4) return handleRoute4WithdrawEvent(static_cast<const Route4WithdrawEvent&>(ev));
+    if (ev.type == ADD6) return handleRoute6AddEvent(static_cast<const Route6AddEvent&>(ev));
+    if (ev.type == WITHDRAW6) return handleRoute6WithdrawEvent(static_cast<const Route6WithdrawEvent&>(ev));
+    if (ev.type == COLLISION) return handleRouteCollisionEvent(static_cast<const RouteCollisionEvent&>(ev));
 
     return false;
 }
 
 bool BgpFsm::handleRouteCollisionEvent(const RouteCollisionEvent &ev) {
-    if (state != OPEN_CONFIRM || peer_bgp_id != ev.peer_bgp_id) return false;
+    return checkCollision(ev.peer_bgp_id);
+}
+
+bool BgpFsm::checkCollision(uint32_t peer_bgp_id) {
+    if (state != OPEN_CONFIRM || this->peer_bgp_id != peer_bgp_id) return false;
 
     LIBBGP_LOG(logger, INFO) {
-        logger->log(INFO, "BgpFsm::handleRouteCollisionEvent: detecting collision with %s.\n", inet_ntoa(*(const struct in_addr*) &(ev.peer_bgp_id)));
+        logger->log(INFO, "BgpFsm::checkCollision: detecting collision with %s.\n", inet_ntoa(*(const struct in_addr*) &peer_bgp_id));
     }
-    return resloveCollision(ev.peer_bgp_id, false) == 1;
+    return resloveCollision(peer_bgp_id, false) == 1;
 }
 
 bool BgpFsm::handleRoute6AddEvent(const Route6AddEvent &ev) {
@@ -499,9 +754,10 @@ bool BgpFsm::handleRoute6AddEvent(const Route6AddEvent &ev) {
             alterNexthop6(nh_local, nh_global);
 
             for (const Prefix6 &route : *(ev.new_routes)) {
-                if (config.out_filters6.apply(route, *(ev.shared_attribs))) {
+                if (config.out_filters6.apply(route, *(ev.shared_attribs)) == ACCEPT) {
                     routes.push_back(route);
                 } else {
+                    stats.prefixes_filtered_out.inc();
                     LIBBGP_LOG(logger, DEBUG) {
                         uint8_t prefix[16];
                         route.getPrefix(prefix);
@@ -534,7 +790,7 @@ bool BgpFsm::handleRoute6AddEvent(const Route6AddEvent &ev) {
     }
 
     // consider merging of replaced_entries?
-    for (const BgpRib6Entry &entry : *(ev.replaced_entries)) {
+    for (const Route6Replacement &entry : *(ev.replaced_entries)) {
         if (entry.src_router_id == peer_bgp_id) continue;
 
         if (ibgp && entry.ibgp_peer_asn == peer_asn) {
@@ -549,7 +805,8 @@ bool BgpFsm::handleRoute6AddEvent(const Route6AddEvent &ev) {
             continue;
         }
 
-        if (config.out_filters6.apply(entry.route, entry.attribs) != ACCEPT) {
+        if (config.out_filters6.apply(entry.route, *(entry.attribs)) != ACCEPT) {
+            stats.prefixes_filtered_out.inc();
             LIBBGP_LOG(logger, DEBUG) {
                 uint8_t prefix[16];
                 entry.route.getPrefix(prefix);
@@ -562,7 +819,7 @@ bool BgpFsm::handleRoute6AddEvent(const Route6AddEvent &ev) {
         }
 
         BgpUpdateMessage update (logger, use_4b_asn);
-        update.setAttribs(entry.attribs);
+        update.setAttribs(*(entry.attribs));
         const uint8_t *nh_global = entry.nexthop_global;
         const uint8_t *nh_local = entry.nexthop_linklocal;
         alterNexthop6(nh_local, nh_global);
@@ -583,11 +840,28 @@ bool BgpFsm::handleRoute6WithdrawEvent(const Route6WithdrawEvent &ev) {
 
     logger->log(DEBUG, "BgpFsm::handleRoute6WithdrawEvent: got route-withdraw event with %zu routes.\n", ev.routes->size());
 
+    std::vector<Prefix6>::const_iterator iter = ev.routes->begin();
+    const std::vector<Prefix6>::const_iterator end = ev.routes->end();
+
+    // split into messages of max 4096 bytes.
+    while (iter != end) {
+        std::vector<Prefix6> routes;
+
+        // length of the update message, 19: headers, 4: length fields, 4: 
+        // MP_UNREACH_NLRI header, 3: afi & safi
+        size_t msg_len = 19 + 4 + 4 + 3;
 
-    BgpUpdateMessage withdraw (logger, use_4b_asn);
-    withdraw.setWithdrawn6(*(ev.routes));
+        for (; iter != end && msg_len + 1 + (iter->getLength() + 7) / 8 <= 4096; iter++) {
+            msg_len += 1 + (iter->getLength() + 7) / 8;
+            routes.push_back(*iter);
+        }
+
+        BgpUpdateMessage withdraw (logger, use_4b_asn);
+        withdraw.setWithdrawn6(routes);
+
+        if(!writeMessage(withdraw)) return false;
+    }
 
-    if(!writeMessage(withdraw)) return false;
     return true;
 }
 
@@ -606,11 +880,31 @@ bool BgpFsm::handleRoute4AddEvent(const Route4AddEvent &ev) {
         if (!ibgp || ev.ibgp_peer_asn != peer_asn) {
             BgpUpdateMessage update (logger, use_4b_asn);
             update.setAttribs(*(ev.shared_attribs));
+            alterNexthop4(update);
+            prepareUpdateMessage(update);
+
+            // length of the update message, 19: headers, 4: length fields
+            size_t attribs_len = 19 + 4;
+
+            for (const std::shared_ptr<BgpPathAttrib> &attrib : update.path_attribute) {
+                attribs_len += attrib->wireLength();
+            }
+
+            size_t msg_len = attribs_len;
 
+            // split into messages of max 4096 bytes.
             for (const Prefix4 &route : *(ev.new_routes)) {
                 if (config.out_filters4.apply(route, *(ev.shared_attribs)) == ACCEPT) {
+                    size_t route_len = 1 + (route.getLength() + 7) / 8;
+                    if (msg_len + route_len > 4096 && update.nlri.size() > 0) {
+                        if(!writeMessage(update)) return false;
+                        update.nlri.clear();
+                        msg_len = attribs_len;
+                    }
+                    msg_len += route_len;
                     update.addNlri4(route);
                 } else {
+                    stats.prefixes_filtered_out.inc();
                     LIBBGP_LOG(logger, DEBUG) {
                         uint32_t prefix = route.getPrefix();
                         char ip_str[INET_ADDRSTRLEN];
@@ -621,9 +915,6 @@ bool BgpFsm::handleRoute4AddEvent(const Route4AddEvent &ev) {
             }
 
             if (update.nlri.size() > 0) {
-                alterNexthop4(update);
-                prepareUpdateMessage(update);
-
                 if(!writeMessage(update)) return false;
             }
         } else {
@@ -639,7 +930,7 @@ bool BgpFsm::handleRoute4AddEvent(const Route4AddEvent &ev) {
     }
 
     // consider merging of replaced_entries?
-    for (const BgpRib4Entry &entry : *(ev.replaced_entries)) {
+    for (const Route4Replacement &entry : *(ev.replaced_entries)) {
         if (entry.src_router_id == peer_bgp_id) continue;
 
         if (ibgp && entry.ibgp_peer_asn == peer_asn) {
@@ -653,7 +944,8 @@ bool BgpFsm::handleRoute4AddEvent(const Route4AddEvent &ev) {
             continue;
         }
 
-        if (config.out_filters4.apply(entry.route, entry.attribs) != ACCEPT) {
+        if (config.out_filters4.apply(entry.route, *(entry.attribs)) != ACCEPT) {
+            stats.prefixes_filtered_out.inc();
             LIBBGP_LOG(logger, DEBUG) {
                 uint32_t prefix = entry.route.getPrefix();
                 char ip_str[INET_ADDRSTRLEN];
@@ -665,7 +957,7 @@ bool BgpFsm::handleRoute4AddEvent(const Route4AddEvent &ev) {
         }
 
         BgpUpdateMessage update (logger, use_4b_asn);
-        update.setAttribs(entry.attribs);
+        update.setAttribs(*(entry.attribs));
         update.addNlri4(entry.route);
         alterNexthop4(update);
         prepareUpdateMessage(update);
@@ -682,10 +974,24 @@ bool BgpFsm::handleRoute4WithdrawEvent(const Route4WithdrawEvent &ev) {
 
     logger->log(DEBUG, "BgpFsm::handleRoute4AddEvent: got route-withdraw event with %zu routes.\n", ev.routes->size());
 
-    BgpUpdateMessage withdraw (logger, use_4b_asn);
-    withdraw.setWithdrawn4(*(ev.routes));
+    std::vector<Prefix4>::const_iterator iter = ev.routes->begin();
+    const std::vector<Prefix4>::const_iterator end = ev.routes->end();
+
+    // split into messages of max 4096 bytes.
+    while (iter != end) {
+        BgpUpdateMessage withdraw (logger, use_4b_asn);
+
+        // length of the update message, 19: headers, 4: length fields
+        size_t msg_len = 19 + 4;
+
+        for (; iter != end && msg_len + 1 + (iter->getLength() + 7) / 8 <= 4096; iter++) {
+            msg_len += 1 + (iter->getLength() + 7) / 8;
+            withdraw.addWithdrawn4(*iter);
+        }
+
+        if(!writeMessage(withdraw)) return false;
+    }
 
-    if(!writeMessage(withdraw)) return false;
     return true;
 }
 
@@ -693,8 +999,10 @@ void BgpFsm::alterNexthop4 (BgpUpdateMessage &update) {
     // ibgp
     if (ibgp && !config.ibgp_alter_nexthop) return;
 
+    BgpPathAttribNexthop *nh = static_cast<BgpPathAttribNexthop *> (update.getAttrib(NEXT_HOP));
+
     // configured to fource default nexthop, or does not have a nexthop attribute
-    if (config.forced_default_nexthop4 || !update.hasAttrib(NEXT_HOP)) {
+    if (config.forced_default_nexthop4 || nh == NULL) {
         LIBBGP_LOG(logger, INFO) {
             char ip_str[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &(config.default_nexthop4), ip_str, INET_ADDRSTRLEN);
@@ -707,16 +1015,16 @@ void BgpFsm::alterNexthop4 (BgpUpdateMessage &update) {
         update.setNextHop(config.default_nexthop4);
     } else {
         // nexthop not forced, check w/ peering LAN
-        BgpPathAttribNexthop &nh = dynamic_cast<BgpPathAttribNexthop &> (update.getAttrib(NEXT_HOP));
-        if (!config.peering_lan4.includes(nh.next_hop)) {
+        if (!config.peering_lan4.includes(nh->next_hop)) {
             LIBBGP_LOG(logger, INFO) {
                 char def_nexthop[INET_ADDRSTRLEN];
                 char cur_nexthop[INET_ADDRSTRLEN];
                 inet_ntop(AF_INET, &(config.default_nexthop4), def_nexthop, INET_ADDRSTRLEN);
-                inet_ntop(AF_INET, &(nh.next_hop), cur_nexthop, INET_ADDRSTRLEN);
+                inet_ntop(AF_INET, &(nh->next_hop), cur_nexthop, INET_ADDRSTRLEN);
                 logger->log(INFO, "BgpFsm::alterNexthop4: nexthop %s not in peering lan, using %s.\n", cur_nexthop, def_nexthop);
             }
-            nh.next_hop = config.default_nexthop4;
+            nh->next_hop = config.default_nexthop4;
+            nh->markDirty();
         }
     }
 }
@@ -799,12 +1107,12 @@ int BgpFsm::validateState(uint8_t type) {
 }
 
 int BgpFsm::fsmEvalIdle(const BgpMessage *msg) {
-    const BgpOpenMessage *open_msg = dynamic_cast<const BgpOpenMessage *>(msg);
+    const BgpOpenMessage *open_msg = static_cast<const BgpOpenMessage *>(msg);
 
     int retval = openRecv(open_msg);
     if (retval != 1) return retval;
 
-    uint16_t my_asn_2b = config.asn >= 0xffff ? 23456 : config.asn;
+    uint16_t my_asn_2b = BgpAsnCodec<uint16_t>::toWire(config.asn);
     BgpOpenMessage open_reply (logger, use_4b_asn, my_asn_2b, hold_timer, config.router_id);
 
     if (use_4b_asn) {
@@ -832,7 +1140,7 @@ int BgpFsm::fsmEvalIdle(const BgpMessage *msg) {
 }
 
 int BgpFsm::fsmEvalOpenSent(const BgpMessage *msg) {
-    const BgpOpenMessage *open_msg = dynamic_cast<const BgpOpenMessage *>(msg);
+    const BgpOpenMessage *open_msg = static_cast<const BgpOpenMessage *>(msg);
 
     int retval = openRecv(open_msg);
     if (retval != 1) return retval;
@@ -866,7 +1174,7 @@ int BgpFsm::fsmEvalOpenConfirm(__attribute__((unused)) const BgpMessage *msg) {
             size_t msg_len = 19 + 4;
 
             for (const std::shared_ptr<BgpPathAttrib> &attrib : update.path_attribute) {
-                msg_len += attrib->length(); 
+                msg_len += attrib->wireLength();
             }
 
             for (; iter != end && cur_group_id == iter->second.update_id && msg_len < 4096; iter++) {
@@ -904,6 +1212,7 @@ int BgpFsm::fsmEvalOpenConfirm(__attribute__((unused)) const BgpMessage *msg) {
                     }
                     update.addNlri4(r);
                 } else {
+                    stats.prefixes_filtered_out.inc();
                     LIBBGP_LOG(logger, DEBUG) {
                         uint32_t prefix = r.getPrefix();
                         char ip_str[INET_ADDRSTRLEN];
@@ -939,7 +1248,7 @@ int BgpFsm::fsmEvalOpenConfirm(__attribute__((unused)) const BgpMessage *msg) {
             // 32: max nexthop len
             size_t msg_len = 19 + 4 + 8 + 32;
             for (const std::shared_ptr<BgpPathAttrib> &attrib : update.path_attribute) {
-                msg_len += attrib->length(); 
+                msg_len += attrib->wireLength();
             }
 
             for (; iter != end && cur_group_id == iter->second.update_id && msg_len < 4096; iter++) {
@@ -978,6 +1287,7 @@ int BgpFsm::fsmEvalOpenConfirm(__attribute__((unused)) const BgpMessage *msg) {
                     }
                     filtered_nlri.push_back(r);
                 } else {
+                    stats.prefixes_filtered_out.inc();
                     LIBBGP_LOG(logger, DEBUG) {
                         uint8_t prefix[16]; 
                         r.getPrefix(prefix);
@@ -1001,18 +1311,17 @@ int BgpFsm::fsmEvalOpenConfirm(__attribute__((unused)) const BgpMessage *msg) {
     return 1;
 }
 
-int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
-    if (msg->type == KEEPALIVE) return 1;
-
-    const BgpUpdateMessage *update = dynamic_cast<const BgpUpdateMessage *>(msg);
-
-    bool ignore_routes = false;
+void BgpFsm::filterUpdate(const BgpUpdateMessage *update, BgpFilteredUpdate &result) {
+    result.ignore_routes = false;
+    result.bad_nexthop6 = false;
+    result.routes4.clear();
+    result.routes6.clear();
+    result.filtered = 0;
 
     // checks
-    if (update->hasAttrib(AS_PATH) && update->nlri.size() > 0) {
-        const BgpPathAttribAsPath &as_path = dynamic_cast<const BgpPathAttribAsPath&>(update->getAttrib(AS_PATH));
-
-        for (const BgpAsPathSegment &seg : as_path.as_paths) {
+    const BgpPathAttribAsPath *as_path = static_cast<const BgpPathAttribAsPath *>(update->getAttrib(AS_PATH));
+    if (as_path != NULL && update->nlri.size() > 0) {
+        for (const BgpAsPathSegment &seg : as_path->as_paths) {
             int8_t local_count = 0;
 
             for (uint32_t asn : seg.value) {
@@ -1021,60 +1330,53 @@ int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
 
             if (local_count > config.allow_local_as) {
                 logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignoring routes with %d local asn in as_path (max %d are allowed).\n", local_count, config.allow_local_as);
-                ignore_routes = true;
+                result.ignore_routes = true;
                 break;
             }
         }
-    } else if (update->nlri.size() > 0) ignore_routes = true; // since no AS_PATH and nlri non empty. (should be handleded by update-msg already tho)
+    } else if (update->nlri.size() > 0) result.ignore_routes = true; // since no AS_PATH and nlri non empty. (should be handleded by update-msg already tho)
 
     if (send_ipv4_routes) {
-        std::vector<Prefix4> unreach;
-        std::vector<BgpRib4Entry> changed_entries;
-        for (const Prefix4 &r : update->withdrawn_routes) {
-            std::pair<bool, const void*> w_ret = rib4->withdraw(peer_bgp_id, r);
-            if (!rev_bus_exist) continue;
-            if (!w_ret.first) {
-                if (w_ret.second == NULL) unreach.push_back(r);
-            }
-            else if (w_ret.second != NULL) {
-                changed_entries.push_back(*((BgpRib4Entry *) w_ret.second));
-            }
-        }
-
         // more checks
         if (update->nlri.size() > 0) {
-            const BgpPathAttribNexthop &nh = dynamic_cast<const BgpPathAttribNexthop &>(update->getAttrib(NEXT_HOP));
+            const BgpPathAttribNexthop *nh = static_cast<const BgpPathAttribNexthop *>(update->getAttrib(NEXT_HOP));
 
-            if (!ignore_routes && !validAddr4(nh.next_hop)) {
+            // should be handled by update-msg already, but don't trust that.
+            if (!result.ignore_routes && nh == NULL) {
+                logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignored %zu routes without nexthop.\n", update->nlri.size());
+                result.ignore_routes = true;
+            }
+
+            if (!result.ignore_routes && !validAddr4(nh->next_hop)) {
                 LIBBGP_LOG(logger, WARN) {
                     char ip_str[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &(nh.next_hop), ip_str, INET_ADDRSTRLEN);
+                    inet_ntop(AF_INET, &(nh->next_hop), ip_str, INET_ADDRSTRLEN);
                     logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignored %zu routes with invalid nexthop %s\n", update->nlri.size(), ip_str);
                 }
-                ignore_routes = true;
+                result.ignore_routes = true;
             }
         
-            if (!ignore_routes && !config.no_nexthop_check4 && !config.peering_lan4.includes(nh.next_hop) && !ibgp) {
+            if (!result.ignore_routes && !config.no_nexthop_check4 && !config.peering_lan4.includes(nh->next_hop) && !ibgp) {
                 LIBBGP_LOG(logger, WARN) {
                     char ip_str_nh[INET_ADDRSTRLEN];
                     char ip_str_lan[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &(nh.next_hop), ip_str_nh, INET_ADDRSTRLEN);
+                    inet_ntop(AF_INET, &(nh->next_hop), ip_str_nh, INET_ADDRSTRLEN);
                     uint32_t peering_lan_pfx = config.peering_lan4.getPrefix();
                     inet_ntop(AF_INET, &peering_lan_pfx, ip_str_lan, INET_ADDRSTRLEN);
                     logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignored %zu routes with nexthop outside peering LAN. (%s not in %s/%d)\n", 
                         update->nlri.size(), ip_str_nh, ip_str_lan, config.peering_lan4.getLength());
                 }
-                ignore_routes = true;
+                result.ignore_routes = true;
             };
         }
 
-        // filter & insert to rib
-        if (!ignore_routes) {
-            std::vector<Prefix4> routes = std::vector<Prefix4> ();
+        // filter
+        if (!result.ignore_routes) {
             for (const Prefix4 &route : update->nlri) {
                 if(config.in_filters4.apply(route, update->path_attribute) == ACCEPT) {
-                    routes.push_back(route);
+                    result.routes4.push_back(route);
                 } else {
+                    result.filtered++;
                     LIBBGP_LOG(logger, DEBUG) {
                         uint32_t prefix = route.getPrefix();
                         char ip_str[INET_ADDRSTRLEN];
@@ -1083,20 +1385,115 @@ int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
                     }
                 }
             }
+        }
+    }
+
+    if (send_ipv6_routes && !result.ignore_routes) {
+        const BgpPathAttribMpNlriBase *mp_reach = static_cast<const BgpPathAttribMpNlriBase *>(update->getAttrib(MP_REACH_NLRI));
+        if (mp_reach != NULL && mp_reach->afi == IPV6 && mp_reach->safi == UNICAST) {
+            const BgpPathAttribMpReachNlriIpv6 &reach = *static_cast<const BgpPathAttribMpReachNlriIpv6 *>(mp_reach);
+
+            if (!validAddr6(reach.nexthop_global) || (!v6addr_is_zero(reach.nexthop_linklocal) && !validAddr6(reach.nexthop_linklocal))) {
+                logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignored %zu routes with invalid nexthop:\n", reach.nlri.size());
+                logger->log(WARN, reach);
+                result.bad_nexthop6 = true;
+                return;
+            }
 
-            std::pair<std::vector<BgpRib4Entry>, std::vector<Prefix4>> rslt;
+            // filter toures
+            for (const Prefix6 &route : reach.nlri) {
+                if (config.in_filters6.apply(route, update->path_attribute) == ACCEPT) result.routes6.push_back(route);
+                else result.filtered++;
+            }
+        }
+    }
+}
+
+int BgpFsm::fsmEvalEstablished(const BgpMessage *msg, const BgpFilteredUpdate *filtered) {
+    BgpStatsTimer established_timer(stats.established_time);
+
+    if (msg->type == KEEPALIVE) return 1;
+
+    const BgpUpdateMessage *update = static_cast<const BgpUpdateMessage *>(msg);
+
+    // checks & filters, unless already done by the decode pipeline.
+    BgpFilteredUpdate local_filtered;
+    if (filtered == NULL) {
+        filterUpdate(update, local_filtered);
+        filtered = &local_filtered;
+    }
+
+    bool ignore_routes = filtered->ignore_routes;
+
+    if (config.bmp != NULL && config.bmp->isPostPolicy()) bmpPostPolicy(update, filtered);
+
+    stats.prefixes_added.inc(update->nlri.size());
+    stats.prefixes_withdrawn.inc(update->withdrawn_routes.size());
+    stats.prefixes_filtered_in.inc(filtered->filtered);
+
+    if (send_ipv4_routes) {
+        // changed_entries point into the RIB: copied into replaced before the
+        // RIB is unlocked, and published after that.
+        std::unique_lock<BgpLock> rib_lock(rib4->getMutex());
+        std::vector<Prefix4> unreach;
+        std::vector<const BgpRib4Entry*> changed_entries;
+        std::vector<Route4Replacement> replaced;
+        uint64_t now = dampening != NULL ? clock->getTimeMs() : 0;
+        for (const Prefix4 &r : update->withdrawn_routes) {
+            // held back as RPKI-invalid, not in RIB. (still a flap)
+            bool held = false;
+            if (config.rpki != NULL) {
+                config.rpki->untrack(peer_bgp_id, r);
+                held = rpki_held.size() > 0 && rpki_held.erase(BgpRib4EntryKey(r)) > 0;
+            }
+
+            if (dampening != NULL) {
+                BgpDampeningAction action = dampening->withdraw(r, now);
+                if (action == DA_SUPPRESS) {
+                    // suppressed, not in RIB.
+                    stats.prefixes_dampened.inc();
+                    continue;
+                }
+                if (action == DA_SUPPRESS_WITHDRAW) stats.prefixes_suppressed.inc();
+            }
+
+            if (!held) withdrawRoute4(r, unreach, changed_entries);
+        }
+
+        // insert to rib
+        if (!ignore_routes) {
+            const std::vector<Prefix4> *routes_ptr = &(filtered->routes4);
+
+            // routes held back are dropped from a copy, made only if some
+            // are held back. dampening sees every announcement, RPKI only the
+            // routes not suppressed: a route is held by dampening while
+            // suppressed, or by RPKI while invalid, never by both.
+            std::vector<Prefix4> accepted;
+            if (dampening != NULL && dampenRoutes4(update, *routes_ptr, now, accepted, unreach, changed_entries)) {
+                routes_ptr = &accepted;
+            }
+
+            std::vector<Prefix4> valid;
+            if (config.rpki != NULL && validateRoutes4(update, *routes_ptr, valid, unreach, changed_entries)) {
+                routes_ptr = &valid;
+            }
+
+            const std::vector<Prefix4> &routes = *routes_ptr;
+
+            std::pair<std::vector<const BgpRib4Entry*>, std::vector<Prefix4>> rslt;
             if (routes.size() > 0) {
                 rslt = rib4->insert(peer_bgp_id, routes, update->path_attribute, config.weight, ibgp ? peer_asn : 0);
-                for (const BgpRib4Entry &entry : rslt.first) {
-                    changed_entries.push_back(entry);
-                }
+                changed_entries.insert(changed_entries.end(), rslt.first.begin(), rslt.first.end());
                 logger->log(DEBUG, "BgpFsm::fsmEvalEstablished: rib4.insert(): %zu altered and %zu added in %zu routes.\n", rslt.first.size(), rslt.second.size(), routes.size());
             }
 
-            if (rev_bus_exist && (changed_entries.size() > 0 || rslt.second.size() > 0)) {
+            if (rev_bus_exist) BgpRib4::copyReplacements(changed_entries, replaced);
+            rib_lock.unlock();
+
+            if (rev_bus_exist && (replaced.size() > 0 || rslt.second.size() > 0)) {
                 logger->log(DEBUG, "BgpFsm::fsmEvalEstablished: publishing new v4 routes on event bus...\n");
                 Route4AddEvent aev = Route4AddEvent();
-                aev.replaced_entries = changed_entries.size() > 0 ? &changed_entries : NULL;
+                aev.replaced_entries = replaced.size() > 0 ? &replaced : NULL;
                 aev.shared_attribs = &(update->path_attribute);
                 aev.new_routes = rslt.second.size() > 0 ? &(rslt.second) : NULL;
                 if (ibgp) aev.ibgp_peer_asn = peer_asn;
@@ -1113,45 +1510,40 @@ int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
     }
 
     if (send_ipv6_routes) {
+        // changed_entries point into the RIB: copied into replaced before the
+        // RIB is unlocked, and published after that.
+        std::unique_lock<BgpLock> rib_lock(rib6->getMutex());
         std::vector<Prefix6> unreach;
-        std::vector<BgpRib6Entry> changed_entries;
-        if (update->hasAttrib(MP_UNREACH_NLRI)) {
-            const BgpPathAttrib &attr = update->getAttrib(MP_UNREACH_NLRI);
-            const BgpPathAttribMpNlriBase &mp_unreach = dynamic_cast<const BgpPathAttribMpNlriBase &>(attr);
-            if (mp_unreach.afi == IPV6 && mp_unreach.safi == UNICAST) {
-                const BgpPathAttribMpUnreachNlriIpv6 &u = dynamic_cast<const BgpPathAttribMpUnreachNlriIpv6 &>(mp_unreach);
-
-                for (const Prefix6 &r : u.withdrawn_routes) {
+        std::vector<const BgpRib6Entry*> changed_entries;
+        std::vector<Route6Replacement> replaced;
+        const BgpPathAttribMpNlriBase *mp_unreach = static_cast<const BgpPathAttribMpNlriBase *>(update->getAttrib(MP_UNREACH_NLRI));
+        if (mp_unreach != NULL) {
+            if (mp_unreach->afi == IPV6 && mp_unreach->safi == UNICAST) {
+                const BgpPathAttribMpUnreachNlriIpv6 *u = static_cast<const BgpPathAttribMpUnreachNlriIpv6 *>(mp_unreach);
+                stats.prefixes_withdrawn.inc(u->withdrawn_routes.size());
+
+                for (const Prefix6 &r : u->withdrawn_routes) {
                     std::pair<bool, const void*> w_ret = rib6->withdraw(peer_bgp_id, r);
                     if (!rev_bus_exist) continue;
                     if (!w_ret.first) {
                         if (w_ret.second == NULL) unreach.push_back(r);
                     }
                     else if (w_ret.second != NULL) {
-                        changed_entries.push_back(*((BgpRib6Entry *) w_ret.second));
+                        changed_entries.push_back((const BgpRib6Entry *) w_ret.second);
                     }
                 }
             }
         }
 
-        if (!ignore_routes && update->hasAttrib(MP_REACH_NLRI)) {
-            const BgpPathAttrib &attr = update->getAttrib(MP_REACH_NLRI);
-            const BgpPathAttribMpNlriBase &mp_reach = dynamic_cast<const BgpPathAttribMpNlriBase &>(attr);
-            if (mp_reach.afi == IPV6 && mp_reach.safi == UNICAST) {
-                const BgpPathAttribMpReachNlriIpv6 &reach = dynamic_cast<const BgpPathAttribMpReachNlriIpv6 &>(mp_reach);
-
-                if (!validAddr6(reach.nexthop_global) || (!v6addr_is_zero(reach.nexthop_linklocal) && !validAddr6(reach.nexthop_linklocal))) {
-                    logger->log(WARN, "BgpFsm::fsmEvalEstablished: ignored %zu routes with invalid nexthop:\n", reach.nlri.size());
-                    logger->log(WARN, reach);
-                    return 1;
-                }
+        const BgpPathAttribMpNlriBase *mp_reach = static_cast<const BgpPathAttribMpNlriBase *>(update->getAttrib(MP_REACH_NLRI));
+        if (!ignore_routes && mp_reach != NULL) {
+            if (mp_reach->afi == IPV6 && mp_reach->safi == UNICAST) {
+                const BgpPathAttribMpReachNlriIpv6 &reach = *static_cast<const BgpPathAttribMpReachNlriIpv6 *>(mp_reach);
+                stats.prefixes_added.inc(reach.nlri.size());
 
-                // filter toures
-                std::vector<Prefix6> filtered_routes;
-                for (const Prefix6 &route : reach.nlri) {
-                    if (config.in_filters6.apply(route, update->path_attribute) == ACCEPT) filtered_routes.push_back(route);
-                }
+                if (filtered->bad_nexthop6) return 1;
 
+                const std::vector<Prefix6> &filtered_routes = filtered->routes6;
                 if (filtered_routes.size() <= 0) return 1;
 
                 // TODO verify with no_nexthop_check6
@@ -1164,19 +1556,20 @@ int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
                     attrs.push_back(attr);
                 }
 
-                std::pair<std::vector<BgpRib6Entry>, std::vector<Prefix6>> rslt = rib6->insert(peer_bgp_id, filtered_routes, reach.nexthop_global, reach.nexthop_linklocal, attrs, config.weight, ibgp ? peer_asn : 0);
+                std::pair<std::vector<const BgpRib6Entry*>, std::vector<Prefix6>> rslt = rib6->insert(peer_bgp_id, filtered_routes, reach.nexthop_global, reach.nexthop_linklocal, attrs, config.weight, ibgp ? peer_asn : 0);
                 logger->log(DEBUG, "BgpFsm::fsmEvalEstablished: rib6.insert(): %zu altered and %zu added in %zu routes.\n", rslt.first.size(), rslt.second.size(), filtered_routes.size());
 
-                for (const BgpRib6Entry &e : rslt.first) {
-                    changed_entries.push_back(e);
-                }
+                changed_entries.insert(changed_entries.end(), rslt.first.begin(), rslt.first.end());
 
-                if (rev_bus_exist && (changed_entries.size() > 0 || rslt.second.size() > 0)) {
+                if (rev_bus_exist) BgpRib6::copyReplacements(changed_entries, replaced);
+                rib_lock.unlock();
+
+                if (rev_bus_exist && (replaced.size() > 0 || rslt.second.size() > 0)) {
                     Route6AddEvent aev = Route6AddEvent();
                     memcpy(aev.nexthop_global, reach.nexthop_global, 16);
                     memcpy(aev.nexthop_linklocal, reach.nexthop_linklocal, 16);
                     aev.new_routes = rslt.second.size() > 0 ? &(rslt.second) : NULL;
-                    aev.replaced_entries = changed_entries.size() > 0 ? &changed_entries : NULL;
+                    aev.replaced_entries = replaced.size() > 0 ? &replaced : NULL;
                     aev.shared_attribs = &attrs;
                     if (ibgp) aev.ibgp_peer_asn = peer_asn;
                     config.rev_bus->publish(this, aev);
@@ -1196,49 +1589,383 @@ int BgpFsm::fsmEvalEstablished(const BgpMessage *msg) {
 }
 
 void BgpFsm::dropAllRoutes() {
+    // routes are gone from RIB, keep the penalties.
+    if (dampening != NULL) dampening->reset();
+
+    // held back routes are gone too.
+    if (config.rpki != NULL && peer_bgp_id != 0) config.rpki->untrackAll(peer_bgp_id);
+    rpki_held.clear();
+
     if (peer_bgp_id != 0) {
-        std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> rslt4 = rib4->discard(peer_bgp_id);
+        // the entries replacing ours point into the RIB, copy them before
+        // unlocking.
+        std::unique_lock<BgpLock> rib4_lock(rib4->getMutex());
+        std::pair<std::vector<Prefix4>, std::vector<const BgpRib4Entry*>> rslt4 = rib4->discard(peer_bgp_id);
+        std::vector<Route4Replacement> replaced4;
+        if (rev_bus_exist) BgpRib4::copyReplacements(rslt4.second, replaced4);
+        rib4_lock.unlock();
+
         if (rev_bus_exist && rslt4.first.size() > 0) {
             Route4WithdrawEvent wev;
             wev.routes = &(rslt4.first);
             config.rev_bus->publish(this, wev);
         }
-        if (rev_bus_exist && rslt4.second.size() > 0) {
+        if (rev_bus_exist && replaced4.size() > 0) {
             Route4AddEvent aev;
-            aev.replaced_entries = &(rslt4.second);
+            aev.replaced_entries = &replaced4;
             config.rev_bus->publish(this, aev);
         }
-        std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> rslt6 = rib6->discard(peer_bgp_id);
+
+        std::unique_lock<BgpLock> rib6_lock(rib6->getMutex());
+        std::pair<std::vector<Prefix6>, std::vector<const BgpRib6Entry*>> rslt6 = rib6->discard(peer_bgp_id);
+        std::vector<Route6Replacement> replaced6;
+        if (rev_bus_exist) BgpRib6::copyReplacements(rslt6.second, replaced6);
+        rib6_lock.unlock();
+
         if (rev_bus_exist && rslt6.first.size() > 0) {
             Route6WithdrawEvent wev;
             wev.routes = &(rslt6.first);
             config.rev_bus->publish(this, wev);
         }
-        if (rev_bus_exist && rslt6.second.size() > 0) {
+        if (rev_bus_exist && replaced6.size() > 0) {
             Route6AddEvent aev;
-            aev.replaced_entries = &(rslt6.second);
+            aev.replaced_entries = &replaced6;
             config.rev_bus->publish(this, aev);
         }
     }
 }
 
+void BgpFsm::withdrawRoute4(const Prefix4 &route, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries) {
+    std::pair<bool, const void*> w_ret = rib4->withdraw(peer_bgp_id, route);
+    if (!rev_bus_exist) return;
+    if (!w_ret.first) {
+        if (w_ret.second == NULL) unreach.push_back(route);
+    }
+    else if (w_ret.second != NULL) {
+        changed_entries.push_back((const BgpRib4Entry *) w_ret.second);
+    }
+}
+
+bool BgpFsm::validateRoutes4(const BgpUpdateMessage *update, const std::vector<Prefix4> &routes, std::vector<Prefix4> &accepted, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries) {
+    // origin AS is the same for all routes in the UPDATE.
+    uint32_t origin_as = BgpRpkiValidator::getOriginAs(update->path_attribute, config.asn);
+    std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> held;
+    bool copied = false;
+
+    for (size_t i = 0; i < routes.size(); i++) {
+        const Prefix4 &r = routes[i];
+        BgpRpkiState state = config.rpki->track(peer_bgp_id, r, origin_as);
+
+        if (state != RPKI_INVALID) {
+            // was invalid, now replaced by a valid route.
+            if (rpki_held.size() > 0) rpki_held.erase(BgpRib4EntryKey(r));
+            if (copied) accepted.push_back(r);
+            continue;
+        }
+
+        if (!copied) {
+            accepted.assign(routes.begin(), routes.begin() + i);
+            copied = true;
+        }
+
+        stats.prefixes_rpki_invalid.inc();
+
+        if (!held) held = std::make_shared<const std::vector<std::shared_ptr<BgpPathAttrib>>>(update->path_attribute);
+        std::pair<rpki_held_t::iterator, bool> ins = rpki_held.insert(std::make_pair(BgpRib4EntryKey(r), held));
+        if (!ins.second) {
+            ins.first->second = held;
+            continue;
+        }
+
+        // the route may replace a valid one in RIB.
+        withdrawRoute4(r, unreach, changed_entries);
+    }
+
+    return copied;
+}
+
+bool BgpFsm::dampenRoutes4(const BgpUpdateMessage *update, const std::vector<Prefix4> &routes, uint64_t now, std::vector<Prefix4> &accepted, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries) {
+    std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> held;
+    bool copied = false;
+
+    for (size_t i = 0; i < routes.size(); i++) {
+        const Prefix4 &r = routes[i];
+        BgpDampeningAction action = dampening->announce(r, update->path_attribute, held, now);
+
+        if (action == DA_ACCEPT) {
+            if (copied) accepted.push_back(r);
+            continue;
+        }
+
+        if (!copied) {
+            accepted.assign(routes.begin(), routes.begin() + i);
+            copied = true;
+        }
+
+        stats.prefixes_dampened.inc();
+
+        // dampening keeps the route from now, it is validated on reuse. a
+        // route held back as invalid is replaced.
+        bool held = false;
+        if (config.rpki != NULL) {
+            config.rpki->untrack(peer_bgp_id, r);
+            held = rpki_held.size() > 0 && rpki_held.erase(BgpRib4EntryKey(r)) > 0;
+        }
+
+        if (action != DA_SUPPRESS_WITHDRAW) continue;
+
+        // suppressed from now, take the old route out of RIB.
+        stats.prefixes_suppressed.inc();
+        if (!held) withdrawRoute4(r, unreach, changed_entries);
+    }
+
+    return copied;
+}
+
+void BgpFsm::insertHeldRoutes4(std::vector<BgpDampenedRoute> &routes) {
+    // routes from one UPDATE share attribs, insert them together.
+    std::sort(routes.begin(), routes.end(), [](const BgpDampenedRoute &a, const BgpDampenedRoute &b) {
+        return std::less<const void*>()(a.attribs.get(), b.attribs.get());
+    });
+
+    std::vector<Prefix4> group;
+
+    for (size_t begin = 0; begin < routes.size();) {
+        const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs = *(routes[begin].attribs);
+        group.clear();
+
+        size_t end = begin;
+        for (; end < routes.size() && routes[end].attribs == routes[begin].attribs; end++) {
+            group.push_back(routes[end].route);
+        }
+
+        begin = end;
+
+        std::vector<Route4Replacement> replaced;
+        std::pair<std::vector<const BgpRib4Entry*>, std::vector<Prefix4>> rslt;
+        {
+            std::lock_guard<BgpLock> rib_lock(rib4->getMutex());
+            rslt = rib4->insert(peer_bgp_id, group, attribs, config.weight, ibgp ? peer_asn : 0);
+            if (rev_bus_exist) BgpRib4::copyReplacements(rslt.first, replaced);
+        }
+
+        if (!rev_bus_exist || (replaced.size() == 0 && rslt.second.size() == 0)) continue;
+
+        Route4AddEvent aev = Route4AddEvent();
+        aev.replaced_entries = replaced.size() > 0 ? &replaced : NULL;
+        aev.shared_attribs = &attribs;
+        aev.new_routes = rslt.second.size() > 0 ? &(rslt.second) : NULL;
+        if (ibgp) aev.ibgp_peer_asn = peer_asn;
+        config.rev_bus->publish(this, aev);
+    }
+}
+
+void BgpFsm::applyRpkiChanges() {
+    std::vector<BgpRpkiChange> changes;
+    if (config.rpki->takeChanges(peer_bgp_id, changes) == 0) return;
+
+    std::unique_lock<BgpLock> rib_lock(rib4->getMutex());
+    std::vector<BgpDampenedRoute> reinstated;
+    std::vector<Prefix4> unreach;
+    std::vector<const BgpRib4Entry*> changed_entries;
+    std::vector<Route4Replacement> replaced;
+
+    for (const BgpRpkiChange &change : changes) {
+        BgpRib4EntryKey key(change.route);
+
+        // suppressed: neither in RIB nor held, validated again on reuse.
+        if (dampening != NULL && dampening->isSuppressed(change.route)) continue;
+
+        if (change.state != RPKI_INVALID) {
+            rpki_held_t::iterator it = rpki_held.find(key);
+            if (it == rpki_held.end()) continue;
+
+            BgpDampenedRoute route;
+            route.route = change.route;
+            route.attribs = it->second;
+            reinstated.push_back(route);
+            rpki_held.erase(it);
+            continue;
+        }
+
+        if (rpki_held.count(key) > 0) continue;
+
+        // find our route in RIB to hold it.
+        const BgpRib4Entry *entry = NULL;
+        std::pair<rib4_t::const_iterator, rib4_t::const_iterator> range = rib4->get().equal_range(key);
+        for (rib4_t::const_iterator it = range.first; it != range.second; it++) {
+            if (it->second.src_router_id == peer_bgp_id && it->second.route == change.route) {
+                entry = &(it->second);
+                break;
+            }
+        }
+
+        if (entry == NULL) continue;
+
+        stats.prefixes_rpki_invalid.inc();
+        rpki_held[key] = std::make_shared<const std::vector<std::shared_ptr<BgpPathAttrib>>>(entry->attribs);
+        withdrawRoute4(change.route, unreach, changed_entries);
+    }
+
+    logger->log(DEBUG, "BgpFsm::applyRpkiChanges: %zu routes now invalid, %zu routes reinstated.\n", unreach.size() + changed_entries.size(), reinstated.size());
+
+    if (rev_bus_exist) BgpRib4::copyReplacements(changed_entries, replaced);
+    rib_lock.unlock();
+
+    if (rev_bus_exist && replaced.size() > 0) {
+        Route4AddEvent aev = Route4AddEvent();
+        aev.replaced_entries = &replaced;
+        if (ibgp) aev.ibgp_peer_asn = peer_asn;
+        config.rev_bus->publish(this, aev);
+    }
+
+    if (rev_bus_exist && unreach.size() > 0) {
+        Route4WithdrawEvent wev = Route4WithdrawEvent();
+        wev.routes = &unreach;
+        config.rev_bus->publish(this, wev);
+    }
+
+    if (reinstated.size() > 0) insertHeldRoutes4(reinstated);
+}
+
+void BgpFsm::reuseDampened(uint64_t now) {
+    std::vector<BgpDampenedRoute> reused;
+    if (dampening->reuse(now, reused) == 0) return;
+
+    stats.prefixes_reused.inc(reused.size());
+    logger->log(DEBUG, "BgpFsm::reuseDampened: %zu suppressed routes reused.\n", reused.size());
+
+    // the VRPs may have changed while suppressed. (routes are not tracked
+    // while suppressed)
+    if (config.rpki != NULL) {
+        size_t kept = 0;
+        for (BgpDampenedRoute &route : reused) {
+            uint32_t origin_as = BgpRpkiValidator::getOriginAs(*(route.attribs), config.asn);
+            if (config.rpki->track(peer_bgp_id, route.route, origin_as) != RPKI_INVALID) {
+                reused[kept++] = route;
+                continue;
+            }
+
+            stats.prefixes_rpki_invalid.inc();
+            rpki_held[BgpRib4EntryKey(route.route)] = route.attribs;
+        }
+
+        reused.resize(kept);
+    }
+
+    insertHeldRoutes4(reused);
+}
+
 void BgpFsm::setState(BgpState new_state) {
     if (state == new_state) return;
 
     if (config.out_handler) config.out_handler->notifyStateChange(state, new_state);
 
     logger->log(INFO, "BgpFsm::setState: changing state: %s -> %s\n", bgp_fsm_state_str[state], bgp_fsm_state_str[new_state]); 
+    stats.state_changes.inc();
 
     if (state == ESTABLISHED) {
         logger->log(INFO, "BgpFsm::setState: dropping all routes received from peer...\n");
 
         // moved from ESTABLISHED to something else. Drop all routes.
         dropAllRoutes();
+
+        // BMP Peer Down. the NOTIFICATION is usually written after the state
+        // change, send with it then.
+        if (config.bmp != NULL) {
+            uint16_t event = 0;
+            if (bmp_notify_recv.size() > 0) bmpPeerDown(BMP_DOWN_REMOTE_NOTIFY, bmp_notify_recv.data(), bmp_notify_recv.size());
+            else if (bmp_notify_sent.size() > 0) bmpPeerDown(BMP_DOWN_LOCAL_NOTIFY, bmp_notify_sent.data(), bmp_notify_sent.size());
+            else if (new_state == BROKEN) bmpPeerDown(BMP_DOWN_LOCAL_NO_NOTIFY, (const uint8_t *) &event, sizeof(event));
+            else bmp_down_pending = true;
+        }
+    }
+
+    if (new_state == ESTABLISHED && config.bmp != NULL) {
+        BgpBmpPeer peer;
+        bmpGetPeer(peer);
+        bmp_notify_sent.clear();
+        bmp_notify_recv.clear();
+        config.bmp->peerUp(peer, clock->getTimeMs(), config.bmp_local_addr, bmp_open_sent.data(), bmp_open_sent.size(), bmp_open_recv.data(), bmp_open_recv.size());
+    }
+
+    if (registered && (new_state == IDLE || new_state == BROKEN)) {
+        config.session_registry->remove(registered_bgp_id, this);
+        registered = false;
     }
 
     state = new_state;
 }
 
+void BgpFsm::bmpGetPeer(BgpBmpPeer &peer) const {
+    peer.peer_addr = config.bmp_peer_addr;
+    peer.peer_asn = peer_asn;
+    peer.peer_bgp_id = peer_bgp_id;
+    peer.two_byte_asn = !use_4b_asn;
+}
+
+void BgpFsm::bmpPeerDown(BgpBmpPeerDownReason reason, const uint8_t *data, size_t length) {
+    BgpBmpPeer peer;
+    bmpGetPeer(peer);
+    config.bmp->peerDown(peer, clock->getTimeMs(), reason, data, length);
+
+    bmp_down_pending = false;
+    bmp_notify_sent.clear();
+    bmp_notify_recv.clear();
+}
+
+void BgpFsm::bmpPostPolicy(const BgpUpdateMessage *update, const BgpFilteredUpdate *filtered) {
+    BgpBmpPeer peer;
+    bmpGetPeer(peer);
+
+    uint8_t buffer[BGP_FSM_BUFFER_SIZE];
+    ssize_t len;
+
+    // nothing filtered, same as received.
+    if (filtered->filtered == 0 && !filtered->ignore_routes && !filtered->bad_nexthop6) {
+        BgpPacket pkt(logger, use_4b_asn, update);
+        len = pkt.write(buffer, sizeof(buffer));
+    } else {
+        BgpUpdateMessage post(logger, use_4b_asn);
+        post.withdrawn_routes = update->withdrawn_routes;
+        post.path_attribute = update->path_attribute;
+        if (!filtered->ignore_routes) post.nlri = filtered->routes4;
+
+        const BgpPathAttribMpNlriBase *mp_reach = static_cast<const BgpPathAttribMpNlriBase *>(update->getAttrib(MP_REACH_NLRI));
+        bool has_reach6 = false;
+        if (mp_reach != NULL) {
+            post.dropAttrib(MP_REACH_NLRI);
+            if (mp_reach->afi == IPV6 && mp_reach->safi == UNICAST && !filtered->ignore_routes && !filtered->bad_nexthop6 && filtered->routes6.size() > 0) {
+                const BgpPathAttribMpReachNlriIpv6 *reach = static_cast<const BgpPathAttribMpReachNlriIpv6 *>(mp_reach);
+                post.setNlri6(filtered->routes6, reach->nexthop_global, reach->nexthop_linklocal);
+                has_reach6 = true;
+            }
+        }
+
+        // no routes left, keep only the withdrawals.
+        if (post.nlri.size() == 0 && !has_reach6) {
+            std::shared_ptr<BgpPathAttrib> unreach;
+            for (const std::shared_ptr<BgpPathAttrib> &attr : post.path_attribute) {
+                if (attr->type_code == MP_UNREACH_NLRI) unreach = attr;
+            }
+
+            post.path_attribute.clear();
+            if (unreach) post.path_attribute.push_back(unreach);
+            if (post.withdrawn_routes.size() == 0 && !unreach) return;
+        }
+
+        BgpPacket pkt(logger, use_4b_asn, &post);
+        len = pkt.write(buffer, sizeof(buffer));
+    }
+
+    if (len < 0) {
+        logger->log(ERROR, "BgpFsm::bmpPostPolicy: failed to write post-policy update.\n");
+        return;
+    }
+
+    config.bmp->routeMonitoring(peer, last_recv, true, buffer, len);
+}
+
 bool BgpFsm::validAddr4(uint32_t addr) const {
     if (addr == config.default_nexthop4 || addr == config.router_id) {
         return false;
@@ -1267,21 +1994,59 @@ bool BgpFsm::writeMessage(const BgpMessage &msg) {
         logger->log(DEBUG, pkt);
     }
 
-    std::lock_guard<std::recursive_mutex> lock(out_buffer_mutex);
+    std::lock_guard<BgpLock> lock(out_buffer_mutex);
+
+    // let the out handler provide the memory if it can, so the message is
+    // serialized once, straight into its final location.
+    ssize_t pkt_len = config.out_handler ? pkt.length() : -1;
+    uint8_t *buffer = NULL;
+    if (pkt_len > 0 && pkt_len <= BGP_FSM_BUFFER_SIZE) {
+        buffer = config.out_handler->reserveOut(pkt_len);
+    }
+
+    if (buffer != NULL) {
+        if (pkt.write(buffer, pkt_len) != pkt_len) pkt_len = -1;
+    } else {
+        if (out_buffer == NULL) {
+            out_buffer_size = BGP_FSM_BUFFER_SIZE;
+            if (config.buffer_pool != NULL) out_buffer = config.buffer_pool->alloc(out_buffer_size);
+            else out_buffer = (uint8_t *) malloc(out_buffer_size);
+        }
 
-    ssize_t pkt_len = pkt.write(out_buffer, BGP_FSM_BUFFER_SIZE);
-    last_sent = clock->getTime();
+        pkt_len = pkt.write(out_buffer, BGP_FSM_BUFFER_SIZE);
+    }
+
+    last_sent = clock->getTimeMs();
 
     if (pkt_len < 0) {
+        if (buffer != NULL) config.out_handler->commitOut(buffer, 0);
         logger->log(ERROR, "BgpFsm::writeMessage: failed to write message, abort.\n");
         setState(BROKEN);
         return false;
     }
 
-    if (config.out_handler && !config.out_handler->handleOut(out_buffer, pkt_len)) {
-        logger->log(ERROR, "BgpFsm::writeMessage: out_handler failed, abort.\n");
-        setState(BROKEN);
-        return false;
+    stats.msgs_out[msg.type < BGP_STATS_MSG_TYPES ? msg.type : 0].inc();
+    stats.bytes_out.inc(pkt_len);
+
+    // BMP: OPEN for Peer Up, NOTIFICATION for Peer Down.
+    if (config.bmp != NULL) {
+        const uint8_t *written = buffer != NULL ? buffer : out_buffer;
+        if (msg.type == OPEN) bmp_open_sent.assign(written, written + pkt_len);
+        else if (msg.type == NOTIFICATION && bmp_down_pending) bmpPeerDown(BMP_DOWN_LOCAL_NOTIFY, written, pkt_len);
+        else if (msg.type == NOTIFICATION && state == ESTABLISHED) bmp_notify_sent.assign(written, written + pkt_len);
+    }
+
+    if (config.out_handler) {
+        BgpStatsTimer write_timer(stats.write_time);
+        bool handled = buffer != NULL ? 
+            config.out_handler->commitOut(buffer, pkt_len) :
+            config.out_handler->handleOut(out_buffer, pkt_len);
+
+        if (!handled) {
+            logger->log(ERROR, "BgpFsm::writeMessage: out_handler failed, abort.\n");
+            setState(BROKEN);
+            return false;
+        }
     }
 
     return true;
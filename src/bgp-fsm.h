@@ -12,16 +12,23 @@
 #define BGP_FSM_H_
 #define BGP_FSM_BUFFER_SIZE 4096
 
+// max UPDATE messages in flight per decode worker.
+#define BGP_FSM_DECODE_DEPTH 32
+
+// release buffers after nothing is received for this long. (ms)
+#define BGP_FSM_BUFFER_IDLE_MS 10000
+
 #include "clock.h"
 #include "bgp-rib4.h"
 #include "bgp-rib6.h"
 #include "bgp-config.h"
 #include "bgp-sink.h"
+#include "bgp-stats.h"
+#include "bgp-decode-pipeline.h"
 #include "route-event-receiver.h"
 #include "bgp.h"
 #include <stdint.h>
 #include <unistd.h>
-#include <mutex>
 
 namespace libbgp {
 
@@ -108,6 +115,23 @@ public:
      */
     BgpState getState() const;
 
+    /**
+     * @brief Get the FSM statistics.
+     * 
+     * Counters in the statistics block are updated without locking and can
+     * be read from any thread.
+     * 
+     * @return const BgpFsmStats& reference to the statistics.
+     */
+    const BgpFsmStats& getStats() const;
+
+    /**
+     * @brief Take a snapshot of the FSM statistics.
+     * 
+     * @param snap Where to write the snapshot to.
+     */
+    void getStatsSnapshot(BgpFsmStatsSnapshot &snap);
+
     /**
      * @brief send OPEN message to peer. (IDLE -> OpenSent)
      * 
@@ -152,6 +176,9 @@ public:
      * when run() is called but you should call tink() regularly to ensure the 
      * hold timer on the other side won't expire.
      * 
+     * If nothing has been received for BGP_FSM_BUFFER_IDLE_MS, tick() also 
+     * releases the buffers, see shrinkBuffers().
+     * 
      * @retval 0 Hold timer expired. Notification message was sent to the peer.
      * FSM is now in IDLE state. error may be written to stderr with log 
      * handler.
@@ -160,6 +187,32 @@ public:
      */
     int tick();
 
+    /**
+     * @brief Get the time of the next time-based event.
+     * 
+     * Returns the time (from Clock::getTimeMs()) at which tick() will next
+     * have something to do (send KEEPALIVE, hold timer expires, or release
+     * buffers of an idle session), if nothing
+     * is sent or received before then. Simulators can move a ManualClock
+     * straight to this time instead of ticking at a fixed interval.
+     * 
+     * @return uint64_t Time in millisecond.
+     * @retval UINT64_MAX No timer running.
+     */
+    uint64_t getNextTick() const;
+
+    /**
+     * @brief Release the buffers held by the FSM.
+     * 
+     * Shrink the input sink to the data in it (free it if empty) and free the
+     * output buffer. Buffers are allocated again when needed. With many
+     * mostly-idle sessions, this keeps memory use to what the active sessions
+     * need. Called by tick() after the session is idle for 
+     * BGP_FSM_BUFFER_IDLE_MS, and when the FSM goes IDLE.
+     * 
+     */
+    void shrinkBuffers();
+
     // soft reset: send Administrative Reset and go to idle
     // return value:
     // -1: fatal_error, FSM now BROKEN, check errbuf.
@@ -195,6 +248,10 @@ private:
 
     bool handleRouteEvent(const RouteEvent &ev);
     bool handleRouteCollisionEvent(const RouteCollisionEvent &ev);
+
+    // another session got OPEN from peer_bgp_id, resolve collision if it is
+    // our peer. true if this session stays.
+    bool checkCollision(uint32_t peer_bgp_id);
     bool handleRoute4WithdrawEvent(const Route4WithdrawEvent &ev);
     bool handleRoute4AddEvent(const Route4AddEvent &ev);
     bool handleRoute6WithdrawEvent(const Route6WithdrawEvent &ev);
@@ -204,15 +261,68 @@ private:
     int fsmEvalIdle(const BgpMessage *msg);
     int fsmEvalOpenSent(const BgpMessage *msg);
     int fsmEvalOpenConfirm(const BgpMessage *msg);
-    int fsmEvalEstablished(const BgpMessage *msg);
+    int fsmEvalEstablished(const BgpMessage *msg, const BgpFilteredUpdate *filtered = NULL);
+
+    // the part of UPDATE evaluation that depends only on the message and the
+    // negotiated session (checks & ingress filters). may run on decode 
+    // pipeline workers.
+    void filterUpdate(const BgpUpdateMessage *update, BgpFilteredUpdate &filtered);
+
+    // evaluate a packet poured from sink, and delete it. parsed: false if 
+    // parse failed. filtered: result of filterUpdate(), NULL if not done yet.
+    // returns false if run() should return ret now, otherwise ret is updated
+    // with the result so far.
+    bool evalPacket(BgpPacket *packet, bool parsed, const BgpFilteredUpdate *filtered, int &ret);
+
+    // decode pipeline worker: parse packet and filterUpdate().
+    void decodeUpdate(BgpDecodeItem &item);
+
+    // evaluate all packets in decode pipeline. returns false if run() should
+    // return ret now (rest of the pipeline discarded).
+    bool drainPipeline(int &ret);
+
+    // discard all packets in decode pipeline.
+    void discardPipeline();
 
     // dropAll: drop all routes from peer and notify other FSMs w/ route event
     // bus (if exists) (called on FSM go from ESTABLISED to IDLE)
     void dropAllRoutes();
 
+    // withdraw a route from peer in RIB, collect the result for publishing.
+    void withdrawRoute4(const Prefix4 &route, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries);
+
+    // validate routes with RPKI, hold back the invalid ones. returns true if
+    // some are held back, and accepted is set to the rest.
+    bool validateRoutes4(const BgpUpdateMessage *update, const std::vector<Prefix4> &routes, std::vector<Prefix4> &accepted, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries);
+
+    // apply flap dampening to routes, before RPKI. returns true if some are
+    // suppressed, and accepted is set to the rest.
+    bool dampenRoutes4(const BgpUpdateMessage *update, const std::vector<Prefix4> &routes, uint64_t now, std::vector<Prefix4> &accepted, std::vector<Prefix4> &unreach, std::vector<const BgpRib4Entry*> &changed_entries);
+
+    // insert routes held back before to RIB and notify other FSMs w/ route
+    // event bus (if exists)
+    void insertHeldRoutes4(std::vector<BgpDampenedRoute> &routes);
+
+    // insert routes reused by flap dampening to RIB and notify other FSMs w/
+    // route event bus (if exists)
+    void reuseDampened(uint64_t now);
+
+    // hold back routes turned RPKI-invalid, insert routes no longer invalid.
+    void applyRpkiChanges();
+
     // setState: set the state of FSM. additional operations may be performed.
     void setState(BgpState state);
 
+    // fill the BMP per-peer header info of the peer.
+    void bmpGetPeer(BgpBmpPeer &peer) const;
+
+    // send BMP Peer Down, clear saved NOTIFICATIONs.
+    void bmpPeerDown(BgpBmpPeerDownReason reason, const uint8_t *data, size_t length);
+
+    // send BMP post-policy Route Monitoring of the routes accepted by ingress
+    // filters.
+    void bmpPostPolicy(const BgpUpdateMessage *update, const BgpFilteredUpdate *filtered);
+
     // validAddr4: valid an IPv4 address (nexthop/bgp_id), addr in network btye
     bool validAddr4(uint32_t addr) const;
 
@@ -243,28 +353,54 @@ private:
     void prepareUpdateMessage(BgpUpdateMessage &update);
 
     BgpSink in_sink;
+
+    // packets found in in_sink by run(), kept to reuse the storage.
+    std::vector<BgpFrame> in_frames;
+
+    BgpFsmStats stats;
     BgpState state;
     BgpConfig config;
     BgpRib4 *rib4;
     BgpRib6 *rib6;
     Clock *clock;
+
+    // IPv4 flap dampening state of routes from peer, NULL if not enabled.
+    BgpDampening *dampening;
+
+    // RPKI-invalid IPv4 routes from peer held back from RIB, with attributes.
+    typedef std::unordered_map<BgpRib4EntryKey, std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>>, BgpRib4EntryHash> rpki_held_t;
+    rpki_held_t rpki_held;
     BgpLogHandler *logger;
 
-    std::recursive_mutex out_buffer_mutex;
+    BgpLock out_buffer_mutex;
 
-    // pointer to output buffer
+    // pointer to output buffer, NULL until needed.
     uint8_t *out_buffer;
+    size_t out_buffer_size;
+
+    // UPDATE decode workers, NULL if config.decode_threads is 0. always empty
+    // when run() returns.
+    BgpDecodePipeline *pipeline;
+
+    // next packet to push to pipeline, and last packet popped from it. (keeps
+    // frame storage between packets)
+    BgpDecodeItem decode_item;
+    BgpDecodeItem decoded_item;
 
     // peer's bgp id
     uint32_t peer_bgp_id;
 
+    // in config.session_registry? (under registered_bgp_id)
+    bool registered;
+    uint32_t registered_bgp_id;
+
     // negotiated hold_timer
     uint16_t hold_timer;
 
-    // time last event sent
+    // time last event sent (ms)
     uint64_t last_sent;
 
-    // time last event received
+    // time last event received (ms)
     uint64_t last_recv;
 
     // true if both peer & local support 4B ASN
@@ -276,6 +412,18 @@ private:
 
     uint32_t peer_asn;
 
+    // OPEN messages of the session, for BMP Peer Up. (only if config.bmp)
+    std::vector<uint8_t> bmp_open_sent;
+    std::vector<uint8_t> bmp_open_recv;
+
+    // NOTIFICATION sent/received in ESTABLISHED, for BMP Peer Down. (only if
+    // config.bmp)
+    std::vector<uint8_t> bmp_notify_sent;
+    std::vector<uint8_t> bmp_notify_recv;
+
+    // left ESTABLISHED, BMP Peer Down to send with the next NOTIFICATION.
+    bool bmp_down_pending;
+
 };
 
 /**
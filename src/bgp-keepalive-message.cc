@@ -17,9 +17,9 @@ namespace libbgp {
 /**
  * @brief Construct a new Bgp Keepalive Message:: Bgp Keepalive Message object
  * 
- * @param loggger Pointer to logger object for error logging.
+ * @param logger Pointer to logger object for error logging.
  */
-BgpKeepaliveMessage::BgpKeepaliveMessage(__attribute__((unused)) BgpLogHandler *loggger) : BgpMessage(logger) {
+BgpKeepaliveMessage::BgpKeepaliveMessage(BgpLogHandler *logger) : BgpMessage(logger) {
     type = KEEPALIVE;
 }
 
@@ -37,6 +37,10 @@ ssize_t BgpKeepaliveMessage::write(__attribute__((unused)) uint8_t *to, __attrib
     return 0;
 }
 
+ssize_t BgpKeepaliveMessage::length() const {
+    return 0;
+}
+
 ssize_t BgpKeepaliveMessage::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
     return _print(indent, to, buf_sz, "KeepaliveMessage { }\n");
 }
@@ -0,0 +1,83 @@
+/**
+ * @file bgp-lock.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Lock that can be turned off for single-threaded use.
+ * @version 0.1
+ * @date 2019-09-04
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_LOCK_H_
+#define BGP_LOCK_H_
+#include <mutex>
+
+namespace libbgp {
+
+/**
+ * @brief The BgpLock class.
+ *
+ * A recursive lock used by BgpSink, BgpFsm, the RIBs, BgpLogHandler and
+ * BgpBufferPool. When not thread-safe, lock() and unlock() do nothing, so
+ * objects only ever used from one thread (e.g., one event loop per FSM) don't
+ * pay for atomic operations on every call.
+ *
+ * BgpLock works with std::lock_guard and std::unique_lock.
+ */
+class BgpLock {
+public:
+    /**
+     * @brief Construct a new BgpLock.
+     *
+     * @param thread_safe Lock for real. If false, lock() and unlock() do
+     * nothing.
+     */
+    BgpLock(bool thread_safe = true) : thread_safe(thread_safe) {}
+
+    /**
+     * @brief Lock.
+     *
+     */
+    void lock() { if (thread_safe) mutex.lock(); }
+
+    /**
+     * @brief Try to lock.
+     *
+     * @return true Locked.
+     * @return false Lock held by another thread.
+     */
+    bool try_lock() { return !thread_safe || mutex.try_lock(); }
+
+    /**
+     * @brief Unlock.
+     *
+     */
+    void unlock() { if (thread_safe) mutex.unlock(); }
+
+    /**
+     * @brief Turn locking on or off. Must not be called while the lock is
+     * held.
+     *
+     * @param thread_safe Lock for real.
+     */
+    void setThreadSafe(bool thread_safe) { this->thread_safe = thread_safe; }
+
+    /**
+     * @brief Is locking on?
+     *
+     * @return true Locking on.
+     * @return false Locking off.
+     */
+    bool isThreadSafe() const { return thread_safe; }
+
+private:
+    BgpLock(const BgpLock &);
+    BgpLock& operator= (const BgpLock &);
+
+    std::recursive_mutex mutex;
+    bool thread_safe;
+};
+
+}
+
+#endif // BGP_LOCK_H_
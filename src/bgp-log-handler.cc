@@ -22,7 +22,13 @@ const char* bgp_log_level_str[] = {
     "DEBUG"
 };
 
-BgpLogHandler::BgpLogHandler() {
+/**
+ * @brief Construct a new BgpLogHandler.
+ * 
+ * @param thread_safe Lock the log buffer while logging. Set to false if the
+ * handler is only ever used from one thread.
+ */
+BgpLogHandler::BgpLogHandler(bool thread_safe) : buf_mtx(thread_safe) {
     level = INFO;
 }
 
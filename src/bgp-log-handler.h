@@ -10,7 +10,7 @@
  */
 #ifndef BGP_LOG_H_
 #define BGP_LOG_H_
-#include <mutex>
+#include "bgp-lock.h"
 #include "serializable.h"
 
 // log helper macro. some log taks a lot of resources to produce (e.g., print
@@ -46,7 +46,7 @@ enum LogLevel {
  */
 class BgpLogHandler {
 public:
-    BgpLogHandler();
+    BgpLogHandler(bool thread_safe = true);
 
     void log(LogLevel level, const char* format_str, ...);
     void log(LogLevel level, const Serializable &serializable);
@@ -70,7 +70,7 @@ protected:
 
 private:
     LogLevel level;
-    std::mutex buf_mtx;
+    BgpLock buf_mtx;
     char out_buffer[4096];
 };
 
@@ -31,6 +31,8 @@ enum BgpMessageType {
 /**
  * @brief The BgpMessage base class.
  * 
+ * The type of a message decides its class (e.g. UPDATE is always 
+ * BgpUpdateMessage), so a message can be casted by its type without RTTI.
  */
 class BgpMessage : public Serializable {
 public:
@@ -51,11 +53,9 @@ public:
      * @param from Pointer to message body buffer.
      * @param msg_sz Size of message.
      * @return ssize_t Bytes read.
-     * @retval -1 Deserialization error. Error may be logged.
+     * @retval -1 Deserialization error, or the type of message/field member in
+     * buffer does not match the type of container. Error may be logged.
      * @retval >=0 Bytes read.
-     * @throws "bad_parse" Internal deserialization error.
-     * @throws "bad_type" The type of message/field member in buffer does not 
-     * match the attribute type of container.
      */
     virtual ssize_t parse(const uint8_t *from, size_t msg_sz) = 0;
 
@@ -74,6 +74,18 @@ public:
      */
     virtual ssize_t write(uint8_t *to, size_t buf_sz) const = 0;
 
+    /**
+     * @brief Get the size of the serialized BGP message *body*.
+     * 
+     * The size is computed without writing the message, so the message can be
+     * written straight into a buffer of the exact size.
+     * 
+     * @return ssize_t Bytes write() would write.
+     * @retval -1 The message can't be serialized.
+     * @retval >=0 Bytes write() would write.
+     */
+    virtual ssize_t length() const = 0;
+
     uint8_t type;
 
     virtual ~BgpMessage() {}
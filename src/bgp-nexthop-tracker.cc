@@ -0,0 +1,343 @@
+/**
+ * @file bgp-nexthop-tracker.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Nexthop resolution cache for IBGP routes.
+ * @version 0.1
+ * @date 2019-09-07
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-nexthop-tracker.h"
+#include "bgp-rib4.h"
+#include <arpa/inet.h>
+
+namespace libbgp {
+
+// netmask of a prefix length, in host bytes order.
+static inline uint32_t hostMask(uint8_t length) {
+    return length == 0 ? 0 : 0xffffffff << (32 - length);
+}
+
+/**
+ * @brief Construct a new, empty BgpNexthopTable.
+ *
+ * @param thread_safe Lock the table on access.
+ */
+BgpNexthopTable::BgpNexthopTable(bool thread_safe) : mutex(thread_safe) {
+    lengths = 0;
+}
+
+/**
+ * @brief Add a route to the table, or update the metric of a route.
+ *
+ * @param prefix The route.
+ * @param metric IGP metric of the route.
+ */
+void BgpNexthopTable::add(const Prefix4 &prefix, uint32_t metric) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint8_t length = prefix.getLength();
+    routes[length][ntohl(prefix.getPrefix()) & hostMask(length)] = metric;
+    lengths |= 1ULL << length;
+}
+
+/**
+ * @brief Remove a route from the table.
+ *
+ * @param prefix The route.
+ * @return true Route removed.
+ * @return false Route not in the table.
+ */
+bool BgpNexthopTable::remove(const Prefix4 &prefix) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint8_t length = prefix.getLength();
+    if (routes[length].erase(ntohl(prefix.getPrefix()) & hostMask(length)) == 0) return false;
+    if (routes[length].size() == 0) lengths &= ~(1ULL << length);
+
+    return true;
+}
+
+/**
+ * @brief Resolve a nexthop with the longest matching route in the table.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param metric Set to the metric of the matching route.
+ * @return true Matching route found.
+ * @return false No matching route.
+ */
+bool BgpNexthopTable::resolve(uint32_t nexthop, uint32_t &metric) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint32_t addr = ntohl(nexthop);
+
+    for (int length = 32; length >= 0; length--) {
+        if ((lengths & (1ULL << length)) == 0) continue;
+
+        auto it = routes[length].find(addr & hostMask(length));
+        if (it == routes[length].end()) continue;
+
+        metric = it->second;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Construct a new BgpRib4NexthopResolver.
+ *
+ * @param rib The RIB to resolve nexthops in.
+ */
+BgpRib4NexthopResolver::BgpRib4NexthopResolver(BgpRib4 *rib) {
+    this->rib = rib;
+}
+
+/**
+ * @brief Resolve a nexthop with the longest matching route in the RIB.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param metric Set to 0.
+ * @return true Matching route found.
+ * @return false No matching route.
+ */
+bool BgpRib4NexthopResolver::resolve(uint32_t nexthop, uint32_t &metric) {
+    metric = 0;
+    return rib->lookup(nexthop) != NULL;
+}
+
+/**
+ * @brief Construct a new BgpNexthopTracker.
+ *
+ * @param resolver The resolver to resolve nexthops with.
+ * @param thread_safe Lock the tracker on access. (see BgpLock)
+ */
+BgpNexthopTracker::BgpNexthopTracker(BgpNexthopResolver *resolver, bool thread_safe) : mutex(thread_safe) {
+    this->resolver = resolver;
+    n_routes = 0;
+    n_resolves = 0;
+}
+
+/**
+ * @brief Start tracking a route using a nexthop.
+ *
+ * The nexthop is resolved if it is not tracked yet. Tracking a route again
+ * does nothing.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param route The route.
+ * @param src_router_id The originating BGP speaker's ID of the route.
+ * (network bytes order)
+ * @return true The nexthop is reachable.
+ * @return false The nexthop is not reachable.
+ */
+bool BgpNexthopTracker::track(uint32_t nexthop, const Prefix4 &route, uint32_t src_router_id) {
+    RouteKey key;
+    key.prefix = route.getPrefix();
+    key.length = route.getLength();
+    key.src_router_id = src_router_id;
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+
+        Nexthop &nh = nexthops[ntohl(nexthop)];
+        if (nh.routes.insert(key).second) n_routes++;
+        if (nh.resolved) return nh.reachable;
+    }
+
+    // new nexthop, resolve it. (without the lock held)
+    uint32_t metric = 0;
+    bool reachable = resolve(nexthop, metric);
+
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = nexthops.find(ntohl(nexthop));
+    if (it == nexthops.end()) return reachable;
+
+    if (!it->second.resolved) {
+        it->second.resolved = true;
+        it->second.reachable = reachable;
+        it->second.metric = metric;
+    }
+
+    return it->second.reachable;
+}
+
+/**
+ * @brief Stop tracking a route using a nexthop. The nexthop is dropped from
+ * the cache when no routes use it.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param route The route.
+ * @param src_router_id The originating BGP speaker's ID of the route.
+ * (network bytes order)
+ * @return true Route removed.
+ * @return false Route was not tracked with the nexthop.
+ */
+bool BgpNexthopTracker::untrack(uint32_t nexthop, const Prefix4 &route, uint32_t src_router_id) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = nexthops.find(ntohl(nexthop));
+    if (it == nexthops.end()) return false;
+
+    RouteKey key;
+    key.prefix = route.getPrefix();
+    key.length = route.getLength();
+    key.src_router_id = src_router_id;
+
+    if (it->second.routes.erase(key) == 0) return false;
+    n_routes--;
+
+    if (it->second.routes.size() == 0) nexthops.erase(it);
+
+    return true;
+}
+
+/**
+ * @brief Get the cached resolution of a nexthop.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param metric Set to the IGP metric of the nexthop if reachable.
+ * @return true The nexthop is reachable.
+ * @return false The nexthop is not reachable, or not tracked.
+ */
+bool BgpNexthopTracker::lookup(uint32_t nexthop, uint32_t &metric) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = nexthops.find(ntohl(nexthop));
+    if (it == nexthops.end() || !it->second.reachable) return false;
+
+    metric = it->second.metric;
+    return true;
+}
+
+/**
+ * @brief Resolve the nexthops inside a changed IGP prefix again.
+ *
+ * Call this after a route is added to, removed from, or changed in the IGP /
+ * connected table. Only nexthops inside the prefix are resolved. Use
+ * getRoutes() to find the routes to re-evaluate for each change.
+ *
+ * @param prefix The changed prefix. Use 0.0.0.0/0 to resolve all nexthops.
+ * @param changes Changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpNexthopTracker::invalidate(const Prefix4 &prefix, std::vector<BgpNexthopChange> &changes) {
+    uint32_t first = ntohl(prefix.getPrefix()) & hostMask(prefix.getLength());
+    uint32_t last = first | ~hostMask(prefix.getLength());
+    std::vector<uint32_t> affected;
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        for (auto it = nexthops.lower_bound(first); it != nexthops.end() && it->first <= last; it++) {
+            affected.push_back(it->first);
+        }
+    }
+
+    size_t n_changes = 0;
+
+    for (uint32_t addr : affected) {
+        uint32_t nexthop = htonl(addr);
+        uint32_t metric = 0;
+        bool reachable = resolve(nexthop, metric);
+
+        std::lock_guard<BgpLock> lock(mutex);
+
+        auto it = nexthops.find(addr);
+        if (it == nexthops.end()) continue;
+
+        Nexthop &nh = it->second;
+        bool changed = !nh.resolved || nh.reachable != reachable || (reachable && nh.metric != metric);
+
+        nh.resolved = true;
+        nh.reachable = reachable;
+        nh.metric = metric;
+
+        if (!changed) continue;
+
+        BgpNexthopChange change;
+        change.nexthop = nexthop;
+        change.reachable = reachable;
+        change.metric = reachable ? metric : 0;
+        changes.push_back(change);
+        n_changes++;
+    }
+
+    return n_changes;
+}
+
+/**
+ * @brief Get the routes depending on a nexthop.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param routes Routes to append to.
+ * @return size_t Number of routes appended.
+ */
+size_t BgpNexthopTracker::getRoutes(uint32_t nexthop, std::vector<BgpNexthopRoute> &routes) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = nexthops.find(ntohl(nexthop));
+    if (it == nexthops.end()) return 0;
+
+    routes.reserve(routes.size() + it->second.routes.size());
+
+    for (const RouteKey &key : it->second.routes) {
+        BgpNexthopRoute route;
+        route.route = Prefix4(key.prefix, key.length);
+        route.src_router_id = key.src_router_id;
+        routes.push_back(route);
+    }
+
+    return it->second.routes.size();
+}
+
+/**
+ * @brief Get number of nexthops tracked.
+ *
+ * @return size_t Number of nexthops.
+ */
+size_t BgpNexthopTracker::getNexthopCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return nexthops.size();
+}
+
+/**
+ * @brief Get number of routes tracked.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpNexthopTracker::getRouteCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return n_routes;
+}
+
+/**
+ * @brief Get number of times the resolver has been called.
+ *
+ * @return uint64_t Number of resolves.
+ */
+uint64_t BgpNexthopTracker::getResolveCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return n_resolves;
+}
+
+/**
+ * @brief Resolve a nexthop with the resolver. Must be called without the lock
+ * held.
+ *
+ * @param nexthop The nexthop. (network bytes order)
+ * @param metric Set to the IGP metric of the nexthop if reachable.
+ * @return true The nexthop is reachable.
+ * @return false The nexthop is not reachable.
+ */
+bool BgpNexthopTracker::resolve(uint32_t nexthop, uint32_t &metric) {
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        n_resolves++;
+    }
+
+    return resolver->resolve(nexthop, metric);
+}
+
+}
@@ -0,0 +1,221 @@
+/**
+ * @file bgp-nexthop-tracker.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Nexthop resolution cache for IBGP routes.
+ * @version 0.1
+ * @date 2019-09-07
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_NEXTHOP_TRACKER_H_
+#define BGP_NEXTHOP_TRACKER_H_
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include "bgp-lock.h"
+#include "prefix4.h"
+
+namespace libbgp {
+
+/* forward */
+class BgpRib4;
+
+/**
+ * @brief The BgpNexthopResolver class.
+ *
+ * Resolves BGP nexthops against the IGP / connected routes. Implement this to
+ * resolve against your own routing table, or use BgpNexthopTable or
+ * BgpRib4NexthopResolver.
+ */
+class BgpNexthopResolver {
+public:
+    /**
+     * @brief Resolve a nexthop.
+     *
+     * @param nexthop The nexthop. (network bytes order)
+     * @param metric Set to the IGP metric of the nexthop if reachable.
+     * @return true The nexthop is reachable.
+     * @return false The nexthop is not reachable.
+     */
+    virtual bool resolve(uint32_t nexthop, uint32_t &metric) = 0;
+
+    virtual ~BgpNexthopResolver() {}
+};
+
+/**
+ * @brief The BgpNexthopTable class.
+ *
+ * A simple IGP / connected routing table to resolve nexthops against, with
+ * longest prefix match. After changing the table, call
+ * BgpNexthopTracker::invalidate() with the changed prefix.
+ */
+class BgpNexthopTable : public BgpNexthopResolver {
+public:
+    BgpNexthopTable(bool thread_safe = true);
+
+    // add or update a route.
+    void add(const Prefix4 &prefix, uint32_t metric);
+
+    // remove a route.
+    bool remove(const Prefix4 &prefix);
+
+    // longest prefix match.
+    bool resolve(uint32_t nexthop, uint32_t &metric);
+
+private:
+    std::unordered_map<uint32_t, uint32_t> routes[33];
+    uint64_t lengths;
+    BgpLock mutex;
+};
+
+/**
+ * @brief The BgpRib4NexthopResolver class.
+ *
+ * Resolve nexthops with a longest prefix match in a BgpRib4. The metric is
+ * always 0.
+ */
+class BgpRib4NexthopResolver : public BgpNexthopResolver {
+public:
+    BgpRib4NexthopResolver(BgpRib4 *rib);
+    bool resolve(uint32_t nexthop, uint32_t &metric);
+
+private:
+    BgpRib4 *rib;
+};
+
+/**
+ * @brief A route depending on a nexthop.
+ *
+ */
+struct BgpNexthopRoute {
+    /**
+     * @brief The route.
+     *
+     */
+    Prefix4 route;
+
+    /**
+     * @brief The originating BGP speaker's ID of the route. (network bytes
+     * order)
+     *
+     */
+    uint32_t src_router_id;
+};
+
+/**
+ * @brief A change in the resolution of a nexthop.
+ *
+ */
+struct BgpNexthopChange {
+    /**
+     * @brief The nexthop. (network bytes order)
+     *
+     */
+    uint32_t nexthop;
+
+    /**
+     * @brief The nexthop is now reachable.
+     *
+     */
+    bool reachable;
+
+    /**
+     * @brief IGP metric of the nexthop. (Valid iff reachable)
+     *
+     */
+    uint32_t metric;
+};
+
+/**
+ * @brief The BgpNexthopTracker class.
+ *
+ * Tracks the nexthops of IBGP routes. Each distinct nexthop is resolved once
+ * with a BgpNexthopResolver and the result is cached. The tracker keeps a
+ * reverse index from nexthops to the routes using them, so when the IGP
+ * changes, only the nexthops covered by the changed prefix are resolved again,
+ * and only the routes depending on nexthops that changed need to be
+ * re-evaluated, instead of walking the whole table.
+ *
+ * Set a tracker on a BgpRib4 with BgpRib4::setNexthopTracker() to have the IBGP
+ * routes of the RIB tracked as they are inserted and removed, or call track()
+ * and untrack() yourself.
+ *
+ * The resolver is called without the tracker lock held, so a resolver may
+ * lock a RIB that calls into the tracker.
+ */
+class BgpNexthopTracker {
+public:
+    BgpNexthopTracker(BgpNexthopResolver *resolver, bool thread_safe = true);
+
+    // start tracking a route using a nexthop. returns reachability of the
+    // nexthop.
+    bool track(uint32_t nexthop, const Prefix4 &route, uint32_t src_router_id);
+
+    // stop tracking a route using a nexthop.
+    bool untrack(uint32_t nexthop, const Prefix4 &route, uint32_t src_router_id);
+
+    // get cached resolution of a nexthop. false if unreachable or not tracked.
+    bool lookup(uint32_t nexthop, uint32_t &metric) const;
+
+    // resolve nexthops inside a changed IGP prefix again, append changed
+    // nexthops to changes. returns number of changes appended.
+    size_t invalidate(const Prefix4 &prefix, std::vector<BgpNexthopChange> &changes);
+
+    // get routes depending on a nexthop, append them to routes. returns number
+    // of routes appended.
+    size_t getRoutes(uint32_t nexthop, std::vector<BgpNexthopRoute> &routes) const;
+
+    // get number of nexthops tracked.
+    size_t getNexthopCount() const;
+
+    // get number of routes tracked.
+    size_t getRouteCount() const;
+
+    // get number of times the resolver has been called.
+    uint64_t getResolveCount() const;
+
+private:
+    BgpNexthopTracker(const BgpNexthopTracker &);
+    BgpNexthopTracker& operator= (const BgpNexthopTracker &);
+
+    struct RouteKey {
+        bool operator== (const RouteKey &other) const {
+            return prefix == other.prefix && length == other.length && src_router_id == other.src_router_id;
+        }
+
+        uint32_t prefix;
+        uint32_t src_router_id;
+        uint8_t length;
+    };
+
+    struct RouteKeyHash {
+        std::size_t operator()(const RouteKey &key) const {
+            return ((uint64_t) key.prefix << 32 | key.src_router_id) ^ ((uint64_t) key.length << 56);
+        }
+    };
+
+    struct Nexthop {
+        Nexthop() : resolved(false), reachable(false), metric(0) {}
+
+        bool resolved;
+        bool reachable;
+        uint32_t metric;
+        std::unordered_set<RouteKey, RouteKeyHash> routes;
+    };
+
+    bool resolve(uint32_t nexthop, uint32_t &metric);
+
+    // nexthops, keyed by nexthop in host bytes order so a prefix is a range.
+    std::map<uint32_t, Nexthop> nexthops;
+    BgpNexthopResolver *resolver;
+    mutable BgpLock mutex;
+    size_t n_routes;
+    uint64_t n_resolves;
+};
+
+}
+
+#endif // BGP_NEXTHOP_TRACKER_H_
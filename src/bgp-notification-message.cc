@@ -19,11 +19,12 @@ namespace libbgp {
 /**
  * @brief Construct a new Bgp Notification Message:: Bgp Notification Message object
  * 
- * @param loggger Pointer to logger object for error logging.
+ * @param logger Pointer to logger object for error logging.
  */
-BgpNotificationMessage::BgpNotificationMessage(__attribute__((unused)) BgpLogHandler *loggger) : BgpMessage(logger) {
+BgpNotificationMessage::BgpNotificationMessage(BgpLogHandler *logger) : BgpMessage(logger) {
     type = NOTIFICATION;
     err_data = 0;
+    data = NULL;
     data_len = 0;
 }
 
@@ -39,11 +40,12 @@ BgpNotificationMessage::~BgpNotificationMessage() {
  * @param data The error buffer pointer
  * @param data_len Length of error buffer.
  */
-BgpNotificationMessage::BgpNotificationMessage(__attribute__((unused)) BgpLogHandler *loggger, uint8_t errcode, uint8_t subcode, const uint8_t *data, uint16_t data_len) : BgpMessage(logger) {
+BgpNotificationMessage::BgpNotificationMessage(BgpLogHandler *logger, uint8_t errcode, uint8_t subcode, const uint8_t *data, uint16_t data_len) : BgpMessage(logger) {
     type = NOTIFICATION;
     this->errcode = errcode;
     this->subcode = subcode;
     this->data_len = data_len;
+    this->data = NULL;
     if (data_len > 0) {
         this->data = (uint8_t *) malloc(data_len);
         memcpy(this->data, data, data_len);
@@ -60,10 +62,14 @@ ssize_t BgpNotificationMessage::parse(const uint8_t *from, size_t msg_sz) {
 
     errcode = getValue<uint8_t>(&buffer);
     subcode = getValue<uint8_t>(&buffer);
-    
-    if (msg_sz > 2) {
-        setError(E_HEADER, E_LENGTH, NULL, 0);
-        return -1;
+
+    if (data_len > 0) free(data);
+    data = NULL;
+    data_len = msg_sz - 2;
+
+    if (data_len > 0) {
+        data = (uint8_t *) malloc(data_len);
+        memcpy(data, buffer, data_len);
     }
 
     return msg_sz;
@@ -75,24 +81,21 @@ ssize_t BgpNotificationMessage::write(uint8_t *to, size_t buf_sz) const {
 
     putValue<uint8_t>(&buffer, errcode);
     putValue<uint8_t>(&buffer, subcode);
-    memcpy(buffer, data, data_len);
+    if (data_len > 0) memcpy(buffer, data, data_len);
 
     return data_len + 2;
 }
 
+ssize_t BgpNotificationMessage::length() const {
+    return data_len + 2;
+}
+
 ssize_t BgpNotificationMessage::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
     size_t written = 0;
 
     written += _print(indent, to, buf_sz, "NotificationMessage {\n");
-    const char *err_msg = bgp_error_code_str[errcode];
-    const char *err_sub_msg = bgp_error_code_str[0];
-    switch (errcode) {
-        case E_HEADER: err_sub_msg = bgp_header_error_subcode_str[subcode]; break;
-        case E_OPEN: err_sub_msg = bgp_open_error_subcode_str[subcode]; break;
-        case E_UPDATE: err_sub_msg = bgp_update_error_str[subcode]; break;
-        case E_FSM: err_sub_msg = bgp_fsm_error_str[subcode]; break;
-        case E_CEASE: err_sub_msg = bgp_cease_error_str[subcode]; break;
-    }
+    const char *err_msg = bgpErrorString(errcode);
+    const char *err_sub_msg = bgpErrorSubcodeString(errcode, subcode);
     
     indent++; {
         written += _print(indent, to, buf_sz, "Error { %s }\n", err_msg);
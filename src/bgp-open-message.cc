@@ -11,6 +11,7 @@
 #include "bgp-open-message.h"
 #include "bgp-errcode.h"
 #include "value-op.h"
+#include "bgp-asn-codec.h"
 #include <stdlib.h>
 #include <arpa/inet.h>
 
@@ -74,7 +75,6 @@ BgpOpenMessage::BgpOpenMessage(BgpLogHandler *logger, bool use_4b_asn, uint16_t
  * @return ssize_t Bytes read.
  * @retval -1 Parse error. Error may be logged.
  * @retval >=0 Bytes read.
- * @throws "bad_parse" Internal parser error.
  */
 ssize_t BgpOpenMessage::parse(const uint8_t *from, size_t msg_sz) {
     if (msg_sz < 10) {
@@ -154,6 +154,12 @@ ssize_t BgpOpenMessage::parse(const uint8_t *from, size_t msg_sz) {
             uint8_t capa_code = getValue<uint8_t> (&buffer);
             uint8_t capa_len = getValue<uint8_t> (&buffer);
 
+            if (capa_len + 2 > capa_param_left) {
+                setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+                logger->log(ERROR, "BgpOpenMessage::parse: capability size exceed capabilities list.\n");
+                return -1;
+            }
+
             BgpCapability *cap = NULL;
 
             switch(capa_code) {
@@ -172,7 +178,8 @@ ssize_t BgpOpenMessage::parse(const uint8_t *from, size_t msg_sz) {
 
             if (capa_parsed_len != capa_len + 2) {
                 logger->log(FATAL, "BgpOpenMessage::parse: parsed capability length mismatch but no error reported.\n");
-                throw "bad_parse";
+                setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+                return -1;
             }
 
             capabilities.push_back(std::shared_ptr<BgpCapability> (cap));
@@ -182,7 +189,8 @@ ssize_t BgpOpenMessage::parse(const uint8_t *from, size_t msg_sz) {
 
         if (parsed_capa_param_len != param_length) {
             logger->log(FATAL, "BgpOpenMessage::parse: parsed capabilities length mismatch but no error reported.\n");
-            throw "bad_parse";
+            setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+            return -1;
         }
 
         parsed_opt_params_len += parsed_capa_param_len;
@@ -190,7 +198,8 @@ ssize_t BgpOpenMessage::parse(const uint8_t *from, size_t msg_sz) {
 
     if (parsed_opt_params_len != opt_params_len) {
             logger->log(FATAL, "BgpOpenMessage::parse: parsed opt params length mismatch but no error reported.\n");
-            throw "bad_parse";
+            setError(E_OPEN, E_UNSPEC_OPEN, NULL, 0);
+            return -1;
     }
 
     if ((size_t) (parsed_opt_params_len + 10) != msg_sz) {
@@ -255,6 +264,21 @@ ssize_t BgpOpenMessage::write(uint8_t *to, size_t buf_sz) const {
     return opt_params_len + 10;
 }
 
+ssize_t BgpOpenMessage::length() const {
+    if (capabilities.size() == 0) return 10;
+
+    // 2: opt_param type & length
+    ssize_t len = 10 + 2;
+
+    for (const std::shared_ptr<BgpCapability> &capa : capabilities) {
+        ssize_t capa_len = capa->length();
+        if (capa_len < 0) return capa_len;
+        len += capa_len;
+    }
+
+    return len;
+}
+
 ssize_t BgpOpenMessage::doPrint(size_t indent, uint8_t **to, size_t *buf_left) const {
     size_t written = 0;
     written += _print(indent, to, buf_left, "OpenMessage {\n");
@@ -298,7 +322,7 @@ uint32_t BgpOpenMessage::getAsn() const {
 
     for (const std::shared_ptr<BgpCapability> &capa : capabilities) {
         if (capa->code == ASN_4B) {
-            const BgpCapability4BytesAsn &as4_cap = dynamic_cast<const BgpCapability4BytesAsn &>(*capa);
+            const BgpCapability4BytesAsn &as4_cap = static_cast<const BgpCapability4BytesAsn &>(*capa);
             return as4_cap.my_asn;
         }
     }
@@ -317,13 +341,13 @@ uint32_t BgpOpenMessage::getAsn() const {
  * @return false Failed to set ASN
  */
 bool BgpOpenMessage::setAsn(uint32_t my_asn) {
-    this->my_asn = my_asn >= 0xffff ? 23456 : my_asn;
+    this->my_asn = BgpAsnCodec<uint16_t>::toWire(my_asn);
 
     if (!use_4b_asn) return true;
     
     for (std::shared_ptr<BgpCapability> &capa : capabilities) {
         if (capa->code == ASN_4B) {
-            BgpCapability4BytesAsn &as4_cap = dynamic_cast<BgpCapability4BytesAsn &>(*capa);
+            BgpCapability4BytesAsn &as4_cap = static_cast<BgpCapability4BytesAsn &>(*capa);
             as4_cap.my_asn = my_asn;
             return true;
         }
@@ -55,6 +55,7 @@ public:
     ssize_t parse(const uint8_t *from, size_t msg_sz);
 
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+    ssize_t length() const;
 
     // bgp-fsm only supports 4-bytes asn capability. getCapabilities() allows
     // you to get a full, read-only list of cpabilities.
@@ -33,6 +33,34 @@ public:
      */
     virtual bool handleOut(const uint8_t *buffer, size_t length) = 0;
 
+    /**
+     * @brief Reserve memory for an outgoing message. (optional)
+     * 
+     * Override this and commitOut() to have the FSM serialize messages 
+     * straight into the handler's memory (e.g. the tail of a send ring), 
+     * instead of into the FSM's own buffer and then copied by handleOut().
+     * 
+     * @param length Exact length of the message.
+     * @return uint8_t* Pointer to at least length bytes of writable memory,
+     * valid until the next commitOut().
+     * @retval NULL Can't reserve memory now, pass the message to handleOut()
+     * instead. (default)
+     */
+    virtual uint8_t* reserveOut(__attribute__((unused)) size_t length) { return NULL; }
+
+    /**
+     * @brief Send a message written into memory from reserveOut(). (optional)
+     * 
+     * Called exactly once after each reserveOut() that did not return NULL.
+     * 
+     * @param buffer Pointer returned by reserveOut().
+     * @param length Length of the message. 0 if the message could not be 
+     * written, in which case the reservation should just be dropped.
+     * @return true The output was handled.
+     * @return false The out was not handled.
+     */
+    virtual bool commitOut(__attribute__((unused)) uint8_t *buffer, __attribute__((unused)) size_t length) { return false; }
+
     /**
      * @brief State change notification. Will be call if FSM state changed.
      * 
@@ -59,49 +59,54 @@ ssize_t BgpPacket::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
     return written;
 }
 
+// parse a message with parse() of its concrete class, and store it to *to.
+template <typename T>
+static ssize_t parseAs(T *msg, BgpMessage **to, const uint8_t *from, size_t msg_sz) {
+    *to = msg;
+    return msg->T::parse(from, msg_sz);
+}
+
 /**
  * @brief Deserialize a BGP message.
  * 
  * @param from Pointer to packet buffer.
  * @param msg_sz Size of packet.
  * @return ssize_t Bytes read.
- * @retval -1 Deserialization error. Error may be logged.
+ * @retval -1 Deserialization error, or the type of message/field member in
+ * buffer does not match the type of container. Error may be logged.
  * @retval >=0 Bytes read.
- * @throws "bad_parse" Internal deserialization error.
- * @throws "bad_type" The type of message/field member in buffer does not 
- * match the attribute type of container.
- * @throws "invalid_op" Invalid operation.
  */
 ssize_t BgpPacket::parse(const uint8_t *from, size_t buf_sz) {
-    if (buf_sz < 19 && buf_sz > 4096) {
+    if (buf_sz < 19 || buf_sz > 4096) {
         logger->log(ERROR, "BgpPacket::parse: got a packet with invalid size.\n");
         return -1;
     }
 
     if (!is_message_owner) {
         logger->log(FATAL, "BgpPacket::parse: can't parse: read-only packet.\n");
-        throw "invalid_op";
+        return -1;
     }
 
     if (is_message_owner && m_msg != NULL) {
         logger->log(FATAL, "BgpPacket::parse: can't parse: message pointer not NULL.\n");
-        throw "invalid_op";
+        return -1;
     }
 
     const uint8_t *buffer = from + 18;
     uint8_t msg_type = getValue<uint8_t>(&buffer);
 
+    size_t msg_sz = buf_sz - 19;
+    ssize_t parsed_len = -1;
+
+    // parse with the concrete class, no virtual dispatch here.
     switch (msg_type) {
-        case OPEN: m_msg = new BgpOpenMessage(logger, is_4b); break;
-        case UPDATE: m_msg = new BgpUpdateMessage(logger, is_4b); break;
-        case KEEPALIVE: m_msg = new BgpKeepaliveMessage(logger); break;
-        case NOTIFICATION: m_msg = new BgpNotificationMessage(logger); break;
-        default: m_msg = new BgpBadMessage(logger, msg_type); break;
+        case OPEN: parsed_len = parseAs(new BgpOpenMessage(logger, is_4b), &m_msg, buffer, msg_sz); break;
+        case UPDATE: parsed_len = parseAs(new BgpUpdateMessage(logger, is_4b), &m_msg, buffer, msg_sz); break;
+        case KEEPALIVE: parsed_len = parseAs(new BgpKeepaliveMessage(logger), &m_msg, buffer, msg_sz); break;
+        case NOTIFICATION: parsed_len = parseAs(new BgpNotificationMessage(logger), &m_msg, buffer, msg_sz); break;
+        default: parsed_len = parseAs(new BgpBadMessage(logger, msg_type), &m_msg, buffer, msg_sz); break;
     }
 
-    size_t msg_sz = buf_sz - 19;
-    ssize_t parsed_len = m_msg->parse(buffer, msg_sz);
-
     if (parsed_len < 0) {
         forwardParseError(*m_msg);
         return parsed_len;
@@ -109,7 +114,8 @@ ssize_t BgpPacket::parse(const uint8_t *from, size_t buf_sz) {
 
     if (msg_sz != (size_t) parsed_len) {
         logger->log(FATAL, "BgpPacket::parse: parsed message length invalid but no error reported.\n");
-        throw "bad_parse";
+        setError(E_HEADER, E_LENGTH, NULL, 0);
+        return -1;
     }
 
     return parsed_len + 19;
@@ -123,17 +129,16 @@ ssize_t BgpPacket::parse(const uint8_t *from, size_t buf_sz) {
  * @return ssize_t Bytes written.
  * @retval -1 Serialization error. Error may be logged.
  * @retval >=0 Bytes written.
- * @throws "invalid_op" Invalid operation.
  */
 ssize_t BgpPacket::write(uint8_t *to, size_t buf_sz) const {
     if (is_message_owner && m_msg == NULL) {
         logger->log(FATAL, "BgpPacket::write: can't write: message pointer NULL.\n");
-        throw "invalid_op";
+        return -1;
     }
 
     if (!is_message_owner && msg == NULL) {
         logger->log(FATAL, "BgpPacket::write: can't write: message pointer NULL.\n");
-        throw "invalid_op";
+        return -1;
     }
 
     if (buf_sz < 19) {
@@ -164,6 +169,31 @@ ssize_t BgpPacket::write(uint8_t *to, size_t buf_sz) const {
     return pkt_len;
 }
 
+/**
+ * @brief Get the size of the serialized packet.
+ * 
+ * The size is computed without writing the packet. Use it to reserve exactly
+ * enough room for write() in caller-supplied memory (e.g. the tail of a send
+ * ring).
+ * 
+ * @return ssize_t Bytes write() would write, including the 19 bytes header.
+ * @retval -1 The message can't be serialized.
+ * @retval >=19 Bytes write() would write.
+ */
+ssize_t BgpPacket::length() const {
+    const BgpMessage *message = is_message_owner ? m_msg : msg;
+
+    if (message == NULL) {
+        logger->log(FATAL, "BgpPacket::length: message pointer NULL.\n");
+        return -1;
+    }
+
+    ssize_t msg_len = message->length();
+    if (msg_len < 0) return msg_len;
+
+    return msg_len + 19;
+}
+
 /**
  * @brief Get pointer to the contained message.
  * 
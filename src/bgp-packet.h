@@ -35,6 +35,10 @@ public:
     // the length field in message header is valid and bgp marker is correct.
     ssize_t parse(const uint8_t *from, size_t buf_sz);
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+
+    // get the exact size of the serialized packet (header included), so it
+    // can be written straight into its final location.
+    ssize_t length() const;
     const BgpMessage *getMessage() const;
 private:
     BgpMessage *m_msg;
@@ -12,11 +12,92 @@
 #include "bgp-errcode.h"
 #include "bgp-afi.h"
 #include "value-op.h"
+#include "bgp-throw.h"
+#include "bgp-asn-codec.h"
 #include <stdlib.h>
 #include <arpa/inet.h>
 
 namespace libbgp {
 
+/**
+ * @brief Parse AS_PATH / AS4_PATH segments.
+ * 
+ * @tparam AsnT Type of ASN on the wire.
+ * @param buffer Pointer to the first segment.
+ * @param value_len Length of all segments.
+ * @param segs Vector to append the segments to.
+ * @return ssize_t Bytes parsed.
+ * @retval -1 Incomplete segment.
+ * @retval -2 Segment overflows value_len.
+ * @retval >=0 Bytes parsed.
+ */
+template <typename AsnT>
+static ssize_t parseAsSegments(const uint8_t *buffer, size_t value_len, std::vector<BgpAsPathSegment> &segs) {
+    size_t parsed_len = 0;
+
+    while (parsed_len < value_len) {
+        if (value_len - parsed_len < 3) return -1;
+
+        uint8_t type = getValue<uint8_t>(&buffer);
+        uint8_t n_asn = getValue<uint8_t>(&buffer);
+
+        // type & count
+        parsed_len += 2;
+
+        size_t asns_length = n_asn * sizeof(AsnT);
+        if (parsed_len + asns_length > value_len) return -2;
+
+        segs.push_back(BgpAsPathSegment(BgpAsnCodec<AsnT>::is_4b, type));
+        std::vector<uint32_t> &value = segs.back().value;
+        value.resize(n_asn);
+        BgpAsnCodec<AsnT>::decode(buffer, n_asn, value.data());
+
+        buffer += asns_length;
+        parsed_len += asns_length;
+    }
+
+    return parsed_len;
+}
+
+/**
+ * @brief Write AS_PATH / AS4_PATH segments.
+ * 
+ * @tparam AsnT Type of ASN on the wire.
+ * @param segs The segments.
+ * @param buffer Buffer to write to.
+ * @param buffer_sz Size of buffer.
+ * @param check_width Fail if a segment is not of the width of AsnT.
+ * @return ssize_t Bytes written.
+ * @retval -1 Segment too big.
+ * @retval -2 Buffer too small.
+ * @retval -3 Segment width mismatch.
+ * @retval >=0 Bytes written.
+ */
+template <typename AsnT>
+static ssize_t writeAsSegments(const std::vector<BgpAsPathSegment> &segs, uint8_t *buffer, size_t buffer_sz, bool check_width) {
+    size_t written_len = 0;
+
+    for (const BgpAsPathSegment &seg : segs) {
+        if (check_width && seg.is_4b != BgpAsnCodec<AsnT>::is_4b) return -3;
+
+        size_t asn_count = seg.value.size();
+        if (asn_count > BgpAsnCodec<AsnT>::max_segment_size) return -1;
+
+        // asn list + seg type & asn count
+        size_t bytes_need = asn_count * sizeof(AsnT) + 2;
+        if (written_len + bytes_need > buffer_sz) return -2;
+
+        putValue<uint8_t>(&buffer, seg.type);
+        putValue<uint8_t>(&buffer, asn_count);
+        BgpAsnCodec<AsnT>::encode(seg.value.data(), asn_count, buffer);
+
+        buffer += asn_count * sizeof(AsnT);
+        written_len += bytes_need;
+    }
+
+    return written_len;
+}
+
 /**
  * @brief Get type of attribute from buffer.
  * 
@@ -38,7 +119,11 @@ uint8_t BgpPathAttrib::GetTypeFromBuffer(const uint8_t *from, size_t buffer_sz)
  */
 BgpPathAttrib::BgpPathAttrib(BgpLogHandler *logger) : Serializable(logger) {
     optional = transitive = partial = extended = false;
+    type_code = 0;
+    value_len = 0;
     value_ptr = NULL;
+    raw = NULL;
+    raw_len = 0;
 }
 
 /**
@@ -49,13 +134,16 @@ BgpPathAttrib::BgpPathAttrib(BgpLogHandler *logger) : Serializable(logger) {
  * @param val_len Length of the value buffer.
  */
 BgpPathAttrib::BgpPathAttrib(BgpLogHandler *logger, const uint8_t *value, uint16_t val_len) : BgpPathAttrib(logger) {
-    if (value_len > 0) {
+    if (value == NULL && val_len > 0) {
         logger->log(FATAL, "BgpPathAttrib::BgpPathAttrib: unknow attribute created with length != 0 but buffer NULL.\n");
-        throw "bad_value_buffer";
+        LIBBGP_THROW("bad_value_buffer");
     }
 
+    value_len = val_len;
+    if (val_len == 0) return;
+
     value_ptr = (uint8_t *) malloc(val_len);
-    memcpy(value_ptr, value, value_len);
+    memcpy(value_ptr, value, val_len);
 }
 
 /**
@@ -68,23 +156,96 @@ BgpPathAttrib::~BgpPathAttrib() {
 
 BgpPathAttrib* BgpPathAttrib::clone(BgpLogHandler *new_logger) const {
     BgpPathAttrib* cloned = clone();
-    cloned->setLogger(new_logger);
+    if (cloned != NULL) cloned->setLogger(new_logger);
     return cloned;
 }
 
 BgpPathAttrib* BgpPathAttrib::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttrib::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     BgpPathAttrib *attr = new BgpPathAttrib(logger, value_ptr, value_len);
+    attr->type_code = type_code;
     attr->transitive = transitive;
     attr->optional = optional;
     attr->partial = partial;
-    attr->extended = attr->extended;
+    attr->extended = extended;
+    attr->raw_block = raw_block;
+    attr->raw = raw;
+    attr->raw_len = raw_len;
     return attr;
 }
 
+/**
+ * @brief Keep the wire bytes of the attribute.
+ * 
+ * writeWire() writes these bytes instead of serializing the fields, until 
+ * markDirty() is called.
+ * 
+ * @param block The buffer the bytes are in. Shared by clones of the attribute.
+ * @param raw Pointer to the attribute in block, header included.
+ * @param raw_len Length of the attribute, header included.
+ */
+void BgpPathAttrib::setRaw(const std::shared_ptr<const std::vector<uint8_t>> &block, const uint8_t *raw, uint16_t raw_len) {
+    raw_block = block;
+    this->raw = raw;
+    this->raw_len = raw_len;
+}
+
+/**
+ * @brief Forget the wire bytes, so the attribute is serialized from its 
+ * fields.
+ * 
+ * Must be called after changing fields of a parsed attribute directly.
+ */
+void BgpPathAttrib::markDirty() {
+    raw_block.reset();
+    raw = NULL;
+    raw_len = 0;
+}
+
+/**
+ * @brief Test if the attribute still has its wire bytes.
+ * 
+ * @return true The attribute is unmodified since parse().
+ * @return false The attribute is modified, or not from parse().
+ */
+bool BgpPathAttrib::hasRaw() const {
+    return raw != NULL;
+}
+
+/**
+ * @brief Serialize the attribute, with a single memcpy of the wire bytes if the
+ * attribute is unmodified since parse().
+ * 
+ * @param to Pointer to destination buffer.
+ * @param buf_sz Max write size.
+ * @return ssize_t Bytes written.
+ * @retval -1 Serialization error. Error may be logged.
+ * @retval >=0 Bytes written.
+ */
+ssize_t BgpPathAttrib::writeWire(uint8_t *to, size_t buf_sz) const {
+    if (raw == NULL) return write(to, buf_sz);
+
+    if (buf_sz < raw_len) {
+        logger->log(ERROR, "BgpPathAttrib::writeWire: destination buffer size too small.\n");
+        return -1;
+    }
+
+    memcpy(to, raw, raw_len);
+    return raw_len;
+}
+
+/**
+ * @brief Get the length of what writeWire() writes.
+ * 
+ * @return ssize_t The length.
+ */
+ssize_t BgpPathAttrib::wireLength() const {
+    return raw == NULL ? length() : raw_len;
+}
+
 /**
  * @brief Utility function to print flags for attribute.
  * 
@@ -131,7 +292,7 @@ ssize_t BgpPathAttrib::parse(const uint8_t *from, size_t length) {
 
     if (header_len < 0) return -1;
 
-    const uint8_t *buffer = from + 3;
+    const uint8_t *buffer = from + header_len;
 
     // Well-Known, Mandatory = !optional, transitive
     // Well-Known, Discretionary = !optional, !transitive
@@ -166,13 +327,15 @@ ssize_t BgpPathAttrib::length() const {
 }
 
 ssize_t BgpPathAttrib::write(uint8_t *to, size_t buffer_sz) const {
-    if (buffer_sz < (size_t) (value_len + 3)) {
+    size_t header_len = extended ? 4 : 3;
+
+    if (buffer_sz < value_len + header_len) {
         logger->log(ERROR, "BgpPathAttrib::write: destination buffer size too small.\n");
         return -1;
     }
 
-    if (!extended && value_len >= 0xffff) {
-        logger->log(ERROR, "BgpPathAttrib::write: non-extended value has size > 65535: %d\n", value_len);
+    if (!extended && value_len > 0xff) {
+        logger->log(ERROR, "BgpPathAttrib::write: non-extended value has size > 255: %d\n", value_len);
         return -1;
     }
 
@@ -184,7 +347,7 @@ ssize_t BgpPathAttrib::write(uint8_t *to, size_t buffer_sz) const {
 
     if (value_len > 0) memcpy(buffer, value_ptr, value_len);
 
-    return value_len + 3;   
+    return value_len + header_len;
 }
 
 /**
@@ -221,18 +384,20 @@ ssize_t BgpPathAttrib::parseHeader(const uint8_t *from, size_t buffer_sz) {
     if (extended) value_len = ntohs(getValue<uint16_t>(&buffer));
     else value_len = getValue<uint8_t>(&buffer);
 
-    if (value_len > buffer_sz - 3) {
+    size_t header_len = extended ? 4 : 3;
+
+    if (value_len > buffer_sz - header_len) {
         err_code = E_UPDATE;
         // This is kind of "invalid length", but we are not using E_ATTR_LEN.
         // E_ATTR_LEN: "Attribute Length that conflict with the expected length
         // (based on the attribute type code)." This is not based on type code,
         // but it is buffer overflow, so we set subcode to E_UNSPEC,
         setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
-        logger->log(ERROR, "BgpPathAttrib::parseHeader: value_length (%d) < buffer left (%d).\n", value_len, buffer_sz - 3);
+        logger->log(ERROR, "BgpPathAttrib::parseHeader: value_length (%d) < buffer left (%d).\n", value_len, buffer_sz - header_len);
         return -1;
     }
 
-    return extended ? 4 : 3;
+    return header_len;
 }
 
 /**
@@ -273,7 +438,7 @@ BgpPathAttribOrigin::BgpPathAttribOrigin(BgpLogHandler *logger) : BgpPathAttrib(
 BgpPathAttrib* BgpPathAttribOrigin::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribOrigin::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribOrigin(*this);
 }
@@ -306,7 +471,8 @@ ssize_t BgpPathAttribOrigin::parse(const uint8_t *from, size_t length) {
 
     if (type_code != ORIGIN) {
         logger->log(FATAL, "BgpPathAttribOrigin::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -398,17 +564,21 @@ size_t BgpAsPathSegment::getCount() const {
  * @return false Failed to prepend ASN.
  */
 bool BgpAsPathSegment::prepend(uint32_t asn) {
-    if (value.size() >= (is_4b ? 127 : 255)) return false;
-    uint32_t prepend_asn = is_4b ? asn : (asn >= 0xffff ? 23456 : asn);
+    if (is_4b) {
+        if (value.size() >= BgpAsnCodec<uint32_t>::max_segment_size) return false;
+        value.insert(value.begin(), BgpAsnCodec<uint32_t>::toWire(asn));
+    } else {
+        if (value.size() >= BgpAsnCodec<uint16_t>::max_segment_size) return false;
+        value.insert(value.begin(), BgpAsnCodec<uint16_t>::toWire(asn));
+    }
 
-    value.insert(value.begin(), prepend_asn);
     return true;
 }
 
 BgpPathAttrib* BgpPathAttribAsPath::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribAsPath::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribAsPath(*this);
 }
@@ -451,7 +621,8 @@ ssize_t BgpPathAttribAsPath::parse(const uint8_t *from, size_t length) {
 
     if (type_code != AS_PATH) {
         logger->log(FATAL, "BgpPathAttribAsPath::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     if (optional || !transitive || extended || partial) {
@@ -465,43 +636,28 @@ ssize_t BgpPathAttribAsPath::parse(const uint8_t *from, size_t length) {
     // empty as_path
     if (value_len == 0) return 3; 
 
-    uint8_t parsed_len = 0;
+    ssize_t parsed_len = is_4b ? 
+        parseAsSegments<uint32_t>(buffer, value_len, as_paths) :
+        parseAsSegments<uint16_t>(buffer, value_len, as_paths);
 
-    while (parsed_len < value_len) {
-        // bad as_path
-        if (value_len - parsed_len < 3) {
-            logger->log(ERROR, "BgpPathAttribAsPath::parse: incomplete as_path segment.\n");
-            setError(E_UPDATE, E_AS_PATH, NULL, 0);
-            return -1;
-        }
-
-        uint8_t type = getValue<uint8_t>(&buffer);
-        uint8_t n_asn = getValue<uint8_t>(&buffer);
-
-        // type & count
-        parsed_len += 2;
-
-        uint8_t asns_length = is_4b ? n_asn * sizeof(uint32_t) : n_asn * sizeof(uint16_t);
-
-        // overflow
-        if (parsed_len + asns_length > value_len) {
-            logger->log(ERROR, "BgpPathAttribAsPath::parse: as_path overflow attribute length.\n");
-            setError(E_UPDATE, E_AS_PATH, NULL, 0);
-            return -1;
-        }
-
-        BgpAsPathSegment path(is_4b, type);
-        if (is_4b) for (int i = 0; i < n_asn; i++) path.value.push_back(ntohl(getValue<uint32_t>(&buffer)));
-        else for (int i = 0; i < n_asn; i++) path.value.push_back(ntohs(getValue<uint16_t>(&buffer)));
-        as_paths.push_back(path);
+    // bad as_path
+    if (parsed_len == -1) {
+        logger->log(ERROR, "BgpPathAttribAsPath::parse: incomplete as_path segment.\n");
+        setError(E_UPDATE, E_AS_PATH, NULL, 0);
+        return -1;
+    }
 
-        // parsed asns
-        parsed_len += asns_length;
+    // overflow
+    if (parsed_len < 0) {
+        logger->log(ERROR, "BgpPathAttribAsPath::parse: as_path overflow attribute length.\n");
+        setError(E_UPDATE, E_AS_PATH, NULL, 0);
+        return -1;
     }
 
     if (parsed_len != value_len) {
         logger->log(FATAL, "BgpPathAttribAsPath::parse: parsed length and value length mismatch, but no error reported.\n");
-        throw "bad_parse";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     return parsed_len + 3;
@@ -510,8 +666,9 @@ ssize_t BgpPathAttribAsPath::parse(const uint8_t *from, size_t length) {
 ssize_t BgpPathAttribAsPath::length() const {
     size_t len = 3; // header len = 3
 
+    size_t asn_size = is_4b ? sizeof(uint32_t) : sizeof(uint16_t);
     for (const BgpAsPathSegment &seg : as_paths) {
-        len += (seg.is_4b ? 4 : 2) * seg.value.size() + 2;
+        len += asn_size * seg.value.size() + 2;
     }
 
     return len;
@@ -541,6 +698,8 @@ void BgpPathAttribAsPath::addSeg(uint32_t asn) {
  * handler.
  */
 bool BgpPathAttribAsPath::prepend(uint32_t asn) {
+    markDirty();
+
     if (as_paths.size() == 0) {
         // nothing here yet, add a new sequence. (5.1.2.b.3)
         addSeg(asn);
@@ -556,7 +715,8 @@ bool BgpPathAttribAsPath::prepend(uint32_t asn) {
         addSeg(asn);
         return true;
     } else if (segment->type == AS_SEQUENCE) {
-        if (segment->getCount() >= (is_4b ? 127 : 255)) {
+        size_t max_segment_size = is_4b ? BgpAsnCodec<uint32_t>::max_segment_size : BgpAsnCodec<uint16_t>::max_segment_size;
+        if (segment->getCount() >= max_segment_size) {
             // seg full, create a new segment of type AS_SEQUENCE (5.1.2.b.1)
             addSeg(asn);
             return true;
@@ -585,35 +745,26 @@ ssize_t BgpPathAttribAsPath::write(uint8_t *to, size_t buffer_sz) const {
     // skip length field for now
     buffer++;
 
-    uint8_t written_len = 0;
-
-    for (const BgpAsPathSegment &seg : as_paths) {
-        if (seg.is_4b != is_4b) { // maybe allow 2b-seg in 4b-mode?
-            logger->log(ERROR, "BgpPathAttribAsPath::write: segment 4b-mode and message 4b-mode mismatch.\n");
-            return -1;
-        }
-
-        size_t asn_count = seg.value.size();
+    // maybe allow 2b-seg in 4b-mode?
+    ssize_t written_len = is_4b ?
+        writeAsSegments<uint32_t>(as_paths, buffer, buffer_sz - 3, true) :
+        writeAsSegments<uint16_t>(as_paths, buffer, buffer_sz - 3, true);
 
-        if (asn_count >= (is_4b ? 127 : 255)) {
-            logger->log(ERROR, "BgpPathAttribAsPath::write: segment size too big: %d\n", asn_count);
+    switch (written_len) {
+        case -1: 
+            logger->log(ERROR, "BgpPathAttribAsPath::write: segment size too big.\n");
             return -1;
-        }
-
-        size_t bytes_need = asn_count * (is_4b ? sizeof(uint32_t) : sizeof(uint16_t)) + 2;
-
-        if (written_len + bytes_need > buffer_sz) {
+        case -2:
             logger->log(ERROR, "BgpPathAttribAsPath::write: destination buffer size too small.\n");
             return -1;
-        }
-
-        putValue<uint8_t>(&buffer, seg.type);
-        putValue<uint8_t>(&buffer, asn_count);
-
-        if (seg.is_4b) for (uint32_t asn : seg.value) putValue<uint32_t>(&buffer, htonl(asn));
-        else for (uint16_t asn : seg.value) putValue<uint16_t>(&buffer, htons(asn));
+        case -3:
+            logger->log(ERROR, "BgpPathAttribAsPath::write: segment 4b-mode and message 4b-mode mismatch.\n");
+            return -1;
+    }
 
-        written_len += bytes_need;
+    if (written_len > 0xff) {
+        logger->log(ERROR, "BgpPathAttribAsPath::write: as_path too long (%zd bytes).\n", written_len);
+        return -1;
     }
 
     // fill in the length.
@@ -649,7 +800,7 @@ ssize_t BgpPathAttribNexthop::doPrint(size_t indent, uint8_t **to, size_t *buf_s
 BgpPathAttrib* BgpPathAttribNexthop::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribNexthop::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribNexthop(*this);
 }
@@ -660,7 +811,8 @@ ssize_t BgpPathAttribNexthop::parse(const uint8_t *from, size_t length) {
 
     if (type_code != NEXT_HOP) {
         logger->log(FATAL, "BgpPathAttribNexthop::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -732,7 +884,7 @@ ssize_t BgpPathAttribMed::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) c
 BgpPathAttrib* BgpPathAttribMed::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribMed::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribMed(*this);
 }
@@ -743,7 +895,8 @@ ssize_t BgpPathAttribMed::parse(const uint8_t *from, size_t length) {
 
     if (type_code != MULTI_EXIT_DISC) {
         logger->log(FATAL, "BgpPathAttribMed::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -814,7 +967,7 @@ ssize_t BgpPathAttribLocalPref::doPrint(size_t indent, uint8_t **to, size_t *buf
 BgpPathAttrib* BgpPathAttribLocalPref::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribLocalPref::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribLocalPref(*this);
 }
@@ -825,7 +978,8 @@ ssize_t BgpPathAttribLocalPref::parse(const uint8_t *from, size_t length) {
 
     if (type_code != LOCAL_PREF) {
         logger->log(FATAL, "BgpPathAttribLocalPref::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -896,7 +1050,7 @@ ssize_t BgpPathAttribAtomicAggregate::doPrint(size_t indent, uint8_t **to, size_
 BgpPathAttrib* BgpPathAttribAtomicAggregate::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribAtomicAggregate::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribAtomicAggregate(*this);
 }
@@ -907,7 +1061,8 @@ ssize_t BgpPathAttribAtomicAggregate::parse(const uint8_t *from, size_t length)
 
     if (type_code != ATOMIC_AGGREGATE) {
         logger->log(FATAL, "BgpPathAttribAtomicAggregate::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     if (value_len != 0) {
@@ -973,7 +1128,7 @@ ssize_t BgpPathAttribAggregator::doPrint(size_t indent, uint8_t **to, size_t *bu
 BgpPathAttrib* BgpPathAttribAggregator::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribAggregator::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribAggregator(*this);
 }
@@ -984,7 +1139,8 @@ ssize_t BgpPathAttribAggregator::parse(const uint8_t *from, size_t length) {
 
     if (type_code != AGGREATOR) {
         logger->log(FATAL, "BgpPathAttribAggregator::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -1008,15 +1164,16 @@ ssize_t BgpPathAttribAggregator::parse(const uint8_t *from, size_t length) {
         return -1;
     }
 
-    if (is_4b) aggregator_asn = ntohl(getValue<uint32_t>(&buffer));
-    else aggregator_asn = ntohs(getValue<uint16_t>(&buffer));
+    if (is_4b) BgpAsnCodec<uint32_t>::decode(buffer, 1, &aggregator_asn);
+    else BgpAsnCodec<uint16_t>::decode(buffer, 1, &aggregator_asn);
+    buffer += want_len - sizeof(uint32_t);
     aggregator = getValue<uint32_t>(&buffer);
 
     return 3 + want_len;
 }
 
 ssize_t BgpPathAttribAggregator::write(uint8_t *to, size_t buffer_sz) const {
-    uint8_t write_value_sz = (is_4b ? 6 : 8);
+    uint8_t write_value_sz = (is_4b ? 8 : 6);
 
     if (buffer_sz < (size_t) (write_value_sz + 3)) {
         logger->log(ERROR, "BgpPathAttribAggregator::write: destination buffer size too small.\n");
@@ -1033,15 +1190,16 @@ ssize_t BgpPathAttribAggregator::write(uint8_t *to, size_t buffer_sz) const {
         return -1;
     }
 
-    if (is_4b) putValue<uint32_t>(&buffer, htonl(aggregator_asn));
-    else putValue<uint16_t>(&buffer, htons(aggregator_asn));
+    if (is_4b) BgpAsnCodec<uint32_t>::encode(&aggregator_asn, 1, buffer);
+    else BgpAsnCodec<uint16_t>::encode(&aggregator_asn, 1, buffer);
+    buffer += write_value_sz - sizeof(uint32_t);
     putValue<uint32_t>(&buffer, aggregator);
 
     return write_value_sz + 3;
 }
 
 ssize_t BgpPathAttribAggregator::length() const {
-    return 3 + (is_4b ? 6 : 8);
+    return 3 + (is_4b ? 8 : 6);
 }
 
 /**
@@ -1089,7 +1247,7 @@ ssize_t BgpPathAttribAs4Path::doPrint(size_t indent, uint8_t **to, size_t *buf_s
 BgpPathAttrib* BgpPathAttribAs4Path::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribAs4Path::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribAs4Path(*this);
 }
@@ -1100,7 +1258,8 @@ ssize_t BgpPathAttribAs4Path::parse(const uint8_t *from, size_t length) {
 
     if (type_code != AS4_PATH) {
         logger->log(FATAL, "BgpPathAttribAs4Path::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     if (!optional || !transitive || extended || partial) {
@@ -1114,42 +1273,26 @@ ssize_t BgpPathAttribAs4Path::parse(const uint8_t *from, size_t length) {
     // empty as_path
     if (value_len == 0) return 3; 
 
-    uint8_t parsed_len = 0;
-
-    while (parsed_len < value_len) {
-        // bad as_path
-        if (value_len - parsed_len < 3) {
-            logger->log(ERROR, "BgpPathAttribAs4Path::parse: incomplete as_path segment.\n");
-            setError(E_UPDATE, E_AS_PATH, NULL, 0);
-            return -1;
-        }
+    ssize_t parsed_len = parseAsSegments<uint32_t>(buffer, value_len, as4_paths);
 
-        uint8_t type = getValue<uint8_t>(&buffer);
-        uint8_t n_asn = getValue<uint8_t>(&buffer);
-
-        // type & count
-        parsed_len += 2;
-
-        uint8_t asns_length = n_asn * sizeof(uint32_t);
-
-        // overflow
-        if (parsed_len + asns_length > value_len) {
-            logger->log(ERROR, "BgpPathAttribAs4Path::parse: as_path overflow attribute length.\n");
-            setError(E_UPDATE, E_AS_PATH, NULL, 0);
-            return -1;
-        }
-
-        BgpAsPathSegment path(true, type);
-        for (int i = 0; i < n_asn; i++) path.value.push_back(ntohl(getValue<uint32_t>(&buffer)));
-        as4_paths.push_back(path);
+    // bad as_path
+    if (parsed_len == -1) {
+        logger->log(ERROR, "BgpPathAttribAs4Path::parse: incomplete as_path segment.\n");
+        setError(E_UPDATE, E_AS_PATH, NULL, 0);
+        return -1;
+    }
 
-        // parsed asns
-        parsed_len += asns_length;
+    // overflow
+    if (parsed_len < 0) {
+        logger->log(ERROR, "BgpPathAttribAs4Path::parse: as_path overflow attribute length.\n");
+        setError(E_UPDATE, E_AS_PATH, NULL, 0);
+        return -1;
     }
 
     if (parsed_len != value_len) {
         logger->log(FATAL, "BgpPathAttribAs4Path::parse: parsed length and value length mismatch, but no error reported.\n");
-        throw "bad_parse";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     return parsed_len + 3;
@@ -1189,6 +1332,8 @@ void BgpPathAttribAs4Path::addSeg(uint32_t asn) {
  * handler.
  */
 bool BgpPathAttribAs4Path::prepend(uint32_t asn) {
+    markDirty();
+
     if (as4_paths.size() == 0) {
         // nothing here yet, add a new sequence. (5.1.2.b.3)
         addSeg(asn);
@@ -1204,7 +1349,7 @@ bool BgpPathAttribAs4Path::prepend(uint32_t asn) {
         addSeg(asn);
         return true;
     } else if (segment->type == AS_SEQUENCE) {
-        if (segment->getCount() >= 127) {
+        if (segment->getCount() >= BgpAsnCodec<uint32_t>::max_segment_size) {
             // seg full, create a new segment of type AS_SEQUENCE (5.1.2.b.1)
             addSeg(asn);
             return true;
@@ -1233,36 +1378,20 @@ ssize_t BgpPathAttribAs4Path::write(uint8_t *to, size_t buffer_sz) const {
     // skip length field for now
     buffer++;
 
-    uint8_t written_len = 0;
-
-    for (const BgpAsPathSegment &seg4 : as4_paths) {
-        size_t asn_count = seg4.value.size();
+    ssize_t written_len = writeAsSegments<uint32_t>(as4_paths, buffer, buffer_sz - 3, false);
 
-        if (asn_count > 127) {
-            logger->log(ERROR, "BgpPathAttribAs4Path::write: segment size too big: %d\n", asn_count);
+    switch (written_len) {
+        case -1: 
+            logger->log(ERROR, "BgpPathAttribAs4Path::write: segment size too big.\n");
             return -1;
-        }
-
-        // asn list + seg type & asn count
-        size_t bytes_need = asn_count * sizeof(uint32_t) + 2;
-
-        if (written_len + bytes_need > buffer_sz) {
+        case -2:
             logger->log(ERROR, "BgpPathAttribAs4Path::write: destination buffer size too small.\n");
             return -1;
-        }
-
-        // put type
-        putValue<uint8_t>(&buffer, seg4.type);
-
-        // put asn count
-        putValue<uint8_t>(&buffer, asn_count);
-
-        // put asns
-        for (uint32_t asn : seg4.value) {
-            putValue<uint32_t>(&buffer, htonl(asn));
-        }
+    }
 
-        written_len += bytes_need;
+    if (written_len > 0xff) {
+        logger->log(ERROR, "BgpPathAttribAs4Path::write: as4_path too long (%zd bytes).\n", written_len);
+        return -1;
     }
 
     // fill in the length.
@@ -1275,7 +1404,7 @@ ssize_t BgpPathAttribAs4Path::write(uint8_t *to, size_t buffer_sz) const {
 BgpPathAttrib* BgpPathAttribAs4Aggregator::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribAs4Aggregator::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribAs4Aggregator(*this);
 }
@@ -1311,7 +1440,8 @@ ssize_t BgpPathAttribAs4Aggregator::parse(const uint8_t *from, size_t length) {
 
     if (type_code != AS4_AGGREGATOR) {
         logger->log(FATAL, "BgpPathAttribAs4Aggregator::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -1395,7 +1525,7 @@ ssize_t BgpPathAttribCommunity::doPrint(size_t indent, uint8_t **to, size_t *buf
 BgpPathAttrib* BgpPathAttribCommunity::clone() const {
     if(hasError()) {
         logger->log(FATAL, "BgpPathAttribCommunity::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribCommunity(*this);
 }
@@ -1406,7 +1536,8 @@ ssize_t BgpPathAttribCommunity::parse(const uint8_t *from, size_t length) {
 
     if (type_code != COMMUNITY) {
         logger->log(FATAL, "BgpPathAttribCommunity::parse: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + 3;
@@ -1438,7 +1569,8 @@ ssize_t BgpPathAttribCommunity::parse(const uint8_t *from, size_t length) {
 
     if (read_len != value_len) {
         logger->log(FATAL, " BgpPathAttribCommunity::parse: parse ends with read_len != value_len.\n");
-        throw "bad_parse";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     return value_len + 3;
@@ -1473,8 +1605,9 @@ BgpPathAttribMpNlriBase::BgpPathAttribMpNlriBase(BgpLogHandler *logger) : BgpPat
 }
 
 int16_t BgpPathAttribMpNlriBase::GetAfiFromBuffer(const uint8_t *buffer, size_t length) {
-    if (length < 3) return -1;
-    const uint8_t *ptr = buffer + 3;
+    size_t afi_offset = (buffer[0] & 0x10) ? 4 : 3; // extended length
+    if (length < afi_offset + 2) return -1;
+    const uint8_t *ptr = buffer + afi_offset;
     return ntohs(getValue<uint16_t>(&ptr));
 }
 
@@ -1483,18 +1616,19 @@ ssize_t BgpPathAttribMpNlriBase::parseHeader(const uint8_t *from, size_t length)
 
     if (hdr_len < 0) return -1;
 
-    if (!optional || transitive || extended || extended) {
-        logger->log(ERROR, "BgpPathAttribMpNlriBase::parse: bad flag bits, must be optional, !extended, !partial, !transitive.\n");
+    if (!optional || transitive || partial) {
+        logger->log(ERROR, "BgpPathAttribMpNlriBase::parse: bad flag bits, must be optional, !partial, !transitive.\n");
         setError(E_UPDATE, E_ATTR_FLAG, from , value_len + hdr_len);
         return -1;
     }
 
     if (type_code != MP_REACH_NLRI && type_code != MP_UNREACH_NLRI) {
         logger->log(FATAL, "BgpPathAttribMpNlriBase::parseHeader: type in header mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
-    if (value_len < 5) {
+    if (value_len < 3) {
         logger->log(ERROR, "BgpPathAttribMpNlriBase::parseHeader: incompete attribute.\n");
         setError(E_UPDATE, E_OPT_ATTR, NULL, 0);
         return -1;
@@ -1507,6 +1641,50 @@ ssize_t BgpPathAttribMpNlriBase::parseHeader(const uint8_t *from, size_t length)
     return hdr_len + 3;
 }
 
+/**
+ * @brief Write attribute header to buffer. (Flag, Type, Length)
+ * 
+ * Unlike BgpPathAttrib::writeHeader, the length is written too. The extended
+ * length bit is set if the value does not fit in one byte.
+ * 
+ * @param to Destnation buffer.
+ * @param buffer_sz Max write size.
+ * @param val_len Length of attribute value.
+ * @return ssize_t Bytes written.
+ * @retval -1 Failed to write buffer. error may be written to stderr with log
+ * handler.
+ * @retval >=0 Bytes written.
+ */
+ssize_t BgpPathAttribMpNlriBase::writeHeader(uint8_t *to, size_t buffer_sz, size_t val_len) const {
+    bool ext = extended || val_len > 0xff;
+    size_t header_len = ext ? 4 : 3;
+
+    if (val_len > 0xffff || buffer_sz < header_len + val_len) {
+        logger->log(ERROR, "BgpPathAttribMpNlriBase::writeHeader: dst buffer too small or value too long: %d\n", val_len);
+        return -1;
+    }
+
+    uint8_t *buffer = to;
+    uint8_t flags = (optional << 7) | (transitive << 6)| (partial << 5) | (ext << 4);
+    putValue<uint8_t>(&buffer, flags);
+    putValue<uint8_t>(&buffer, type_code);
+    if (ext) putValue<uint16_t>(&buffer, htons(val_len));
+    else putValue<uint8_t>(&buffer, val_len);
+
+    return header_len;
+}
+
+/**
+ * @brief Get the length of an attribute with given value length, including
+ * the header.
+ * 
+ * @param val_len Length of attribute value.
+ * @return size_t Length of the attribute.
+ */
+size_t BgpPathAttribMpNlriBase::attribLength(size_t val_len) const {
+    return (extended || val_len > 0xff ? 4 : 3) + val_len;
+}
+
 BgpPathAttribMpReachNlriIpv6::BgpPathAttribMpReachNlriIpv6(BgpLogHandler *logger) : BgpPathAttribMpNlriBase(logger) {
     type_code = MP_REACH_NLRI;
     afi = IPV6;
@@ -1515,7 +1693,7 @@ BgpPathAttribMpReachNlriIpv6::BgpPathAttribMpReachNlriIpv6(BgpLogHandler *logger
 BgpPathAttrib* BgpPathAttribMpReachNlriIpv6::clone() const {
     if (hasError()) {
         logger->log(ERROR, "BgpPathAttribMpReachNlriIpv6::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
     return new BgpPathAttribMpReachNlriIpv6(*this);
 }
@@ -1527,7 +1705,14 @@ ssize_t BgpPathAttribMpReachNlriIpv6::parse(const uint8_t *from, size_t length)
 
     if (afi != IPV6) {
         logger->log(FATAL, "BgpPathAttribMpReachNlriIpv6::parse: afi mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
+    }
+
+    if (value_len < 4) {
+        logger->log(ERROR, "BgpPathAttribMpReachNlriIpv6::parse: incompete attribute.\n");
+        setError(E_UPDATE, E_OPT_ATTR, NULL, 0);
+        return -1;
     }
 
     const uint8_t *buffer = from + hdr_len;
@@ -1539,7 +1724,7 @@ ssize_t BgpPathAttribMpReachNlriIpv6::parse(const uint8_t *from, size_t length)
         return -1;
     }
 
-    ssize_t buf_left = value_len - hdr_len - 1 + 3; // 3: attr headers
+    ssize_t buf_left = value_len - 3 - 1; // 3: afi/safi, 1: nexthop_length
 
     if (buf_left < (ssize_t) nexthop_length) {
         logger->log(ERROR, "BgpPathAttribMpReachNlriIpv6::parse: nexthop overflows buffer.\n");
@@ -1584,39 +1769,36 @@ ssize_t BgpPathAttribMpReachNlriIpv6::parse(const uint8_t *from, size_t length)
 
     if (buf_left != 0) {
         logger->log(FATAL, "BgpPathAttribMpReachNlriIpv6::parse: parsed end with non-zero buf_left (%d).\n", buf_left);
-        throw "bad_parse";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     return value_len + hdr_len - 3; // 3: afi/safi, already part of "value_len"
 }
 
 ssize_t BgpPathAttribMpReachNlriIpv6::write(uint8_t *to, size_t buffer_sz) const {
-    ssize_t header_len = writeHeader(to, buffer_sz);
+    bool has_linklocak = !v6addr_is_zero(nexthop_linklocal);
 
-    if (header_len < 0) return -1;
-    uint8_t *attr_len_field = to + header_len;
-    uint8_t *buffer = attr_len_field + 1;
+    // 5: afi, safi, nh_len, res
+    size_t val_len = 5 + (has_linklocak ? 32 : 16);
+    for (const Prefix6 &route : nlri) {
+        val_len += (1 + (route.getLength() + 7) / 8);
+    }
 
-    if (buffer_sz - header_len < 5) {
+    ssize_t header_len = writeHeader(to, buffer_sz, val_len);
+    if (header_len < 0) {
         logger->log(ERROR, "BgpPathAttribMpReachNlriIpv6::write: dst buffer too small.\n");
         return -1;
     }
 
-    size_t written_len = header_len + 1;
+    uint8_t *buffer = to + header_len;
+    size_t written_len = header_len;
 
     putValue<uint16_t>(&buffer, htons(afi));
     putValue<uint8_t>(&buffer, safi);
-
-    bool has_linklocak = !v6addr_is_zero(nexthop_linklocal);
-
     putValue<uint8_t>(&buffer, has_linklocak ? 32 : 16);
     written_len += 4;
     
-    if ((has_linklocak && buffer_sz - written_len < 32) || (!has_linklocak && buffer_sz - written_len < 16)) {
-        logger->log(ERROR, "BgpPathAttribMpReachNlriIpv6::write: dst buffer too small.\n");
-        return -1;
-    }
-    
     memcpy(buffer, nexthop_global, 16); buffer += 16; written_len += 16;
     if (has_linklocak) {
         memcpy(buffer, nexthop_linklocal, 16); buffer += 16; written_len += 16;
@@ -1635,9 +1817,7 @@ ssize_t BgpPathAttribMpReachNlriIpv6::write(uint8_t *to, size_t buffer_sz) const
         buffer += rou_wrt_len;
     }
 
-    putValue<uint8_t>(&attr_len_field, written_len - 3);
-
-    if (written_len != (size_t) (buffer - to)) {
+    if (written_len != header_len + val_len || written_len != (size_t) (buffer - to)) {
         logger->log(FATAL, "BgpPathAttribMpReachNlriIpv6::write: inconsistent written size (len=%d, diff=%d)\n", written_len, buffer - to);
         return -1;
     }
@@ -1689,16 +1869,17 @@ ssize_t BgpPathAttribMpReachNlriIpv6::doPrint(size_t indent, uint8_t **to, size_
 }
 
 ssize_t BgpPathAttribMpReachNlriIpv6::length() const {
-    size_t len = 3 + 5; // 3: attribute headers, 5: afi, safi, nh_len, res
+    size_t len = 5; // 5: afi, safi, nh_len, res
     bool has_linklocak = !v6addr_is_zero(nexthop_linklocal);
     len += (has_linklocak ? 32 : 16);
     for (const Prefix6 &route : nlri) {
         len += (1 + (route.getLength() + 7) / 8);
     }
-    return len;
+    return attribLength(len);
 }
 
 BgpPathAttribMpReachNlriUnknow::BgpPathAttribMpReachNlriUnknow(BgpLogHandler *logger) : BgpPathAttribMpNlriBase(logger) {
+    type_code = MP_REACH_NLRI;
     nexthop = NULL;
     nexthop_len = 0;
     nlri = NULL;
@@ -1706,6 +1887,8 @@ BgpPathAttribMpReachNlriUnknow::BgpPathAttribMpReachNlriUnknow(BgpLogHandler *lo
 }
 
 BgpPathAttribMpReachNlriUnknow::BgpPathAttribMpReachNlriUnknow(BgpLogHandler *logger, const uint8_t *nexthop, size_t nexthop_len, const uint8_t *nlri, size_t nlri_len) : BgpPathAttribMpNlriBase(logger) {
+    type_code = MP_REACH_NLRI;
+    this->nexthop = this->nlri = NULL;
     if (nexthop_len > 0) {
         this->nexthop = (uint8_t *) malloc(nexthop_len);
         memcpy(this->nexthop, nexthop, nexthop_len);
@@ -1727,11 +1910,13 @@ BgpPathAttribMpReachNlriUnknow::~BgpPathAttribMpReachNlriUnknow() {
 BgpPathAttrib* BgpPathAttribMpReachNlriUnknow::clone() const {
     if (hasError()) {
         logger->log(FATAL, "BgpPathAttribMpReachNlriUnknow::clone: can't clone an attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
 
-    if (nexthop_len == 0 && nlri_len == 0) return new BgpPathAttribMpReachNlriUnknow(logger);
-    return new BgpPathAttribMpReachNlriUnknow(logger, nexthop, nexthop_len, nlri, nlri_len);
+    BgpPathAttribMpReachNlriUnknow *attr = new BgpPathAttribMpReachNlriUnknow(logger, nexthop, nexthop_len, nlri, nlri_len);
+    attr->afi = afi;
+    attr->safi = safi;
+    return attr;
 }
 
 ssize_t BgpPathAttribMpReachNlriUnknow::parse(const uint8_t *from, size_t length) {
@@ -1739,21 +1924,37 @@ ssize_t BgpPathAttribMpReachNlriUnknow::parse(const uint8_t *from, size_t length
     if (hdr_len < 0) return -1;
 
     if (nexthop_len != 0) free(nexthop);
+    if (nlri_len != 0) free(nlri);
+    nexthop = nlri = NULL;
+    nexthop_len = nlri_len = 0;
+
+    // hdr_len - 3: attr header (afi/safi are part of value_len)
+    size_t attr_len = value_len + hdr_len - 3;
+
+    if (attr_len < (size_t) hdr_len + 1) {
+        logger->log(ERROR, "BgpPathAttribMpReachNlriUnknow::parse: unexpected end of attribute.\n");
+        setError(E_UPDATE, E_OPT_ATTR, NULL, 0);
+        return -1;
+    }
 
     const uint8_t *buffer = from + hdr_len;
-    nexthop_len = getValue<uint8_t>(&buffer);
+    size_t nh_len = getValue<uint8_t>(&buffer);
     size_t parsed_len = hdr_len + 1;
 
-    if (length < parsed_len + nexthop_len) {
-        logger->log(FATAL, "BgpPathAttribMpReachNlriUnknow::parse: unexpected end of attribute.\n");
+    // +1: reserved
+    if (attr_len < parsed_len + nh_len + 1) {
+        logger->log(ERROR, "BgpPathAttribMpReachNlriUnknow::parse: unexpected end of attribute.\n");
         setError(E_UPDATE, E_OPT_ATTR, NULL, 0);
         return -1;
     }
 
-    parsed_len += nexthop_len;
-    nexthop = (uint8_t *) malloc(nexthop_len);
-    memcpy(nexthop, buffer, nexthop_len);
-    buffer += nexthop_len;
+    parsed_len += nh_len;
+    if (nh_len > 0) {
+        nexthop = (uint8_t *) malloc(nh_len);
+        memcpy(nexthop, buffer, nh_len);
+        nexthop_len = nh_len;
+    }
+    buffer += nh_len;
 
     uint8_t res = getValue<uint8_t>(&buffer);
     parsed_len++;
@@ -1762,35 +1963,37 @@ ssize_t BgpPathAttribMpReachNlriUnknow::parse(const uint8_t *from, size_t length
         logger->log(WARN, "BgpPathAttribMpReachNlriIpv6::parse: reserved bits != 0\n");
     }
 
-    if (nlri_len != 0) free(nlri);
-
-    nlri_len = value_len - parsed_len - 3; // 3: attr header
-    parsed_len += nlri_len;
-    nlri = (uint8_t *) malloc(nlri_len);
-    memcpy(nlri, buffer, nlri_len);
+    size_t rest_len = attr_len - parsed_len;
+    parsed_len += rest_len;
+    if (rest_len > 0) {
+        nlri = (uint8_t *) malloc(rest_len);
+        memcpy(nlri, buffer, rest_len);
+        nlri_len = rest_len;
+    }
 
     return parsed_len;
 }
 
 ssize_t BgpPathAttribMpReachNlriUnknow::write(uint8_t *to, size_t buffer_sz) const {
-    size_t expected_len = 3 + 5 + nexthop_len + nlri_len;
+    size_t expected_len = attribLength(5 + nexthop_len + nlri_len);
 
-    if (buffer_sz < expected_len) {
+    if (buffer_sz < expected_len || nexthop_len > 0xff) {
         logger->log(ERROR, "BgpPathAttribMpReachNlriUnknow::write: dst buffer too small.\n");
         return -1;
     }
 
-    ssize_t hdr_len = writeHeader(to, buffer_sz);
+    ssize_t hdr_len = writeHeader(to, buffer_sz, 5 + nexthop_len + nlri_len);
     if (hdr_len < 0) return -1;
     uint8_t *buffer = to + hdr_len;
     
-    putValue<uint8_t>(&buffer, expected_len - 3);
     putValue<uint16_t>(&buffer, htons(afi));
     putValue<uint8_t>(&buffer, safi);
     putValue<uint8_t>(&buffer, nexthop_len);
-    memcpy(buffer, nexthop, nexthop_len); buffer += nexthop_len;
+    if (nexthop_len > 0) memcpy(buffer, nexthop, nexthop_len);
+    buffer += nexthop_len;
     putValue<uint8_t>(&buffer, 0);
-    memcpy(buffer, nlri, nlri_len);
+    if (nlri_len > 0) memcpy(buffer, nlri, nlri_len);
+    buffer += nlri_len;
 
     if ((size_t) (buffer - to) != expected_len) {
         logger->log(ERROR, "BgpPathAttribMpReachNlriUnknow::write: unexpected written length.\n");
@@ -1813,7 +2016,7 @@ ssize_t BgpPathAttribMpReachNlriUnknow::doPrint(size_t indent, uint8_t **to, siz
 }
 
 ssize_t BgpPathAttribMpReachNlriUnknow::length() const {
-    return 3 + 5 + nexthop_len + nlri_len;
+    return attribLength(5 + nexthop_len + nlri_len);
 }
 
 const uint8_t* BgpPathAttribMpReachNlriUnknow::getNexthop() const {
@@ -1840,7 +2043,7 @@ BgpPathAttribMpUnreachNlriIpv6::BgpPathAttribMpUnreachNlriIpv6(BgpLogHandler *lo
 BgpPathAttrib* BgpPathAttribMpUnreachNlriIpv6::clone() const {
     if (hasError()) {
         logger->log(FATAL, "BgpPathAttribMpUnreachNlriIpv6::clone: can clone attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
 
     return new BgpPathAttribMpUnreachNlriIpv6(*this);
@@ -1852,10 +2055,11 @@ ssize_t BgpPathAttribMpUnreachNlriIpv6::parse(const uint8_t *from, size_t length
 
     if (afi != IPV6) {
         logger->log(FATAL, "BgpPathAttribMpUnreachNlriIpv6::parse: afi mismatch.\n");
-        throw "bad_type";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
-    size_t buf_left = value_len - hdr_len + 3; // 3: attrib headers
+    size_t buf_left = value_len - 3; // 3: afi/safi
     const uint8_t *buffer = from + hdr_len;
 
     while (buf_left > 0) {
@@ -1875,30 +2079,33 @@ ssize_t BgpPathAttribMpUnreachNlriIpv6::parse(const uint8_t *from, size_t length
 
     if (buf_left != 0) {
         logger->log(FATAL, "BgpPathAttribMpUnreachNlriIpv6::parse: parsed end with non-zero buf_left (%d).\n", buf_left);
-        throw "bad_parse";
+        setError(E_UPDATE, E_UNSPEC_UPDATE, NULL, 0);
+        return -1;
     }
 
     return hdr_len + value_len - 3; // 3: afi/safi, already part of "value_len"
 }
 
 ssize_t BgpPathAttribMpUnreachNlriIpv6::write(uint8_t *to, size_t buffer_sz) const {
-    if (buffer_sz < 3 + 3) {
+    size_t val_len = 3; // 3: afi, safi
+    for (const Prefix6 &route : withdrawn_routes) {
+        val_len += (1 + (route.getLength() + 7) / 8);
+    }
+
+    ssize_t hdr_len = writeHeader(to, buffer_sz, val_len);
+    if (hdr_len < 0) {
         logger->log(ERROR, "BgpPathAttribMpUnreachNlriIpv6::write: dst buffer too small.\n");
         return -1;
     }
 
-    ssize_t hdr_len = writeHeader(to, buffer_sz);
-    if (hdr_len < 0) return -1;
-
-    uint8_t *len_field = to + hdr_len;
-    uint8_t *buffer = len_field + 1; 
+    uint8_t *buffer = to + hdr_len;
 
     putValue<uint16_t>(&buffer, htons(afi));
     putValue<uint8_t>(&buffer, safi);
     size_t written_val_len = 3;
 
     for (const Prefix6 &route : withdrawn_routes) {
-        ssize_t pfx_wrt_ret = route.write(buffer, buffer_sz - 3 - written_val_len);
+        ssize_t pfx_wrt_ret = route.write(buffer, buffer_sz - hdr_len - written_val_len);
         if (pfx_wrt_ret < 0) {
             logger->log(ERROR, "BgpPathAttribMpUnreachNlriIpv6::write: error writing withdrawn routes.\n");
             return -1;
@@ -1908,7 +2115,12 @@ ssize_t BgpPathAttribMpUnreachNlriIpv6::write(uint8_t *to, size_t buffer_sz) con
         written_val_len += pfx_wrt_ret;
     }
 
-    return 3 + written_val_len;
+    if (written_val_len != val_len) {
+        logger->log(FATAL, "BgpPathAttribMpUnreachNlriIpv6::write: inconsistent written size (len=%d, expected=%d)\n", written_val_len, val_len);
+        return -1;
+    }
+
+    return hdr_len + written_val_len;
 }
 
 ssize_t BgpPathAttribMpUnreachNlriIpv6::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
@@ -1940,20 +2152,23 @@ ssize_t BgpPathAttribMpUnreachNlriIpv6::doPrint(size_t indent, uint8_t **to, siz
 }
 
 ssize_t BgpPathAttribMpUnreachNlriIpv6::length() const {
-    size_t len = 3 + 3; // 3: attribute headers, 3: afi, safi
+    size_t len = 3; // 3: afi, safi
     for (const Prefix6 &route : withdrawn_routes) {
         len += (1 + (route.getLength() + 7) / 8);
     }
-    return len;
+    return attribLength(len);
 }
 
 BgpPathAttribMpUnreachNlriUnknow::BgpPathAttribMpUnreachNlriUnknow(BgpLogHandler *logger) : BgpPathAttribMpNlriBase(logger) {
+    type_code = MP_UNREACH_NLRI;
     withdrawn_routes_len = 0;
     withdrawn_routes = NULL;
 }
 
 BgpPathAttribMpUnreachNlriUnknow::BgpPathAttribMpUnreachNlriUnknow(BgpLogHandler *logger, const uint8_t *withdrawn, size_t len) : BgpPathAttribMpNlriBase(logger) {
+    type_code = MP_UNREACH_NLRI;
     withdrawn_routes_len = len;
+    withdrawn_routes = NULL;
 
     if (len > 0) {
         withdrawn_routes = (uint8_t *) malloc(len);
@@ -1968,11 +2183,13 @@ BgpPathAttribMpUnreachNlriUnknow::~BgpPathAttribMpUnreachNlriUnknow() {
 BgpPathAttrib* BgpPathAttribMpUnreachNlriUnknow::clone() const {
     if (hasError()) {
         logger->log(FATAL, "BgpPathAttribMpUnreachNlriUnknow::clone: can clone attribute with error.\n");
-        throw "has_error";
+        return NULL;
     }
 
-    if (withdrawn_routes_len == 0) return new BgpPathAttribMpUnreachNlriUnknow(logger);
-    return new BgpPathAttribMpUnreachNlriUnknow(logger, withdrawn_routes, withdrawn_routes_len);
+    BgpPathAttribMpUnreachNlriUnknow *attr = new BgpPathAttribMpUnreachNlriUnknow(logger, withdrawn_routes, withdrawn_routes_len);
+    attr->afi = afi;
+    attr->safi = safi;
+    return attr;
 }
 
 ssize_t BgpPathAttribMpUnreachNlriUnknow::parse(const uint8_t *from, size_t length) {
@@ -1980,31 +2197,33 @@ ssize_t BgpPathAttribMpUnreachNlriUnknow::parse(const uint8_t *from, size_t leng
     if (hdr_len < 0) return -1;
 
     if (withdrawn_routes_len > 0) free(withdrawn_routes);
+    withdrawn_routes = NULL;
 
-    withdrawn_routes_len = value_len - hdr_len;
+    withdrawn_routes_len = value_len - 3; // 3: afi/safi
     const uint8_t *buffer = from + hdr_len;
 
-    withdrawn_routes = (uint8_t *) malloc(withdrawn_routes_len);
-    memcpy(withdrawn_routes, buffer, withdrawn_routes_len);
+    if (withdrawn_routes_len > 0) {
+        withdrawn_routes = (uint8_t *) malloc(withdrawn_routes_len);
+        memcpy(withdrawn_routes, buffer, withdrawn_routes_len);
+    }
 
     return hdr_len + value_len - 3;  // 3: afi/safi, already part of "value_len"
 }
 
 ssize_t BgpPathAttribMpUnreachNlriUnknow::write(uint8_t *to, size_t buffer_sz) const {
-    size_t expected_len = 3 + 3 + withdrawn_routes_len;
+    size_t expected_len = attribLength(3 + withdrawn_routes_len);
     if (buffer_sz < expected_len) {
         logger->log(ERROR, "BgpPathAttribMpUnreachNlriUnknow::write: dst buffer too small.\n");
         return -1;
     }
 
-    ssize_t hdr_len = writeHeader(to, buffer_sz);
+    ssize_t hdr_len = writeHeader(to, buffer_sz, 3 + withdrawn_routes_len);
     if (hdr_len < 0) return -1;
 
     uint8_t *buffer = to + hdr_len;
-    putValue<uint8_t>(&buffer, expected_len - 3);
     putValue<uint16_t>(&buffer, htons(afi));
     putValue<uint8_t>(&buffer, safi);
-    memcpy(buffer, withdrawn_routes, withdrawn_routes_len);
+    if (withdrawn_routes_len > 0) memcpy(buffer, withdrawn_routes, withdrawn_routes_len);
 
     return expected_len;
 }
@@ -2022,7 +2241,7 @@ ssize_t BgpPathAttribMpUnreachNlriUnknow::doPrint(size_t indent, uint8_t **to, s
 }
 
 ssize_t BgpPathAttribMpUnreachNlriUnknow::length() const {
-    return 3 + 3 + withdrawn_routes_len;
+    return attribLength(3 + withdrawn_routes_len);
 }
 
 const uint8_t* BgpPathAttribMpUnreachNlriUnknow::getWithdrawnRoutes() const {
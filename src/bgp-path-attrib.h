@@ -16,6 +16,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <vector>
+#include <memory>
 
 namespace libbgp {
 
@@ -43,6 +44,17 @@ enum BgpPathAttribType {
 /**
  * @brief The BgpPathAttrib class.
  * 
+ * This class itself is the container for attributes of unknown type. The
+ * type_code of an attribute decides its class: attributes with a type code 
+ * known to libbgp must be the matching subclass (e.g. NEXT_HOP must be 
+ * BgpPathAttribNexthop). The parser and clone() keep it this way, and the FSM,
+ * RIB and filters rely on it to cast attributes without RTTI.
+ * 
+ * Attributes from BgpUpdateMessage::parse() keep their wire bytes, and are
+ * written back with a single memcpy while unmodified, so routes passing 
+ * through are not re-encoded. The mutating utility functions (prepend, 
+ * restoreAsPath, etc.) drop the bytes; code changing the fields directly must
+ * call markDirty().
  */
 class BgpPathAttrib : public Serializable {
 public:
@@ -93,11 +105,9 @@ public:
      * @param from Pointer to message body buffer.
      * @param msg_sz Size of message.
      * @return ssize_t Bytes read.
-     * @retval -1 Deserialization error. Error may be logged.
+     * @retval -1 Deserialization error, or the type of message/field member in
+     * buffer does not match the type of container. Error may be logged.
      * @retval >=0 Bytes read.
-     * @throws "bad_parse" Internal deserialization error.
-     * @throws "bad_type" The type of message/field member in buffer does not 
-     * match the attribute type of container.
      */
     virtual ssize_t parse(const uint8_t *from, size_t msg_sz);
 
@@ -119,8 +129,8 @@ public:
      * 
      * @param new_logger New logger to use.
      * @return BgpPathAttrib* Pointer to the cloned attribute.
-     * @throws "has_error" There's error in the attribute and the attribute can
-     * not be clone.
+     * @retval NULL There's error in the attribute and the attribute can not be
+     * cloned.
      */
     BgpPathAttrib* clone(BgpLogHandler *new_logger) const;
 
@@ -128,11 +138,28 @@ public:
      * @brief Clone the attribute.
      * 
      * @return BgpPathAttrib* Pointer to the cloned attribute.
-     * @throws "has_error" There's error in the attribute and the attribute can
-     * not be clone.
+     * @retval NULL There's error in the attribute and the attribute can not be
+     * cloned.
      */
     virtual BgpPathAttrib* clone() const;
 
+    // keep the wire bytes of the attribute (header included). raw must point
+    // into block, which is shared by clones of the attribute.
+    void setRaw(const std::shared_ptr<const std::vector<uint8_t>> &block, const uint8_t *raw, uint16_t raw_len);
+
+    // forget the wire bytes. must be called after changing fields of a parsed
+    // attribute directly (the utility functions call it for you).
+    void markDirty();
+
+    // test if the attribute still has its wire bytes.
+    bool hasRaw() const;
+
+    // write the wire bytes if the attribute is unmodified, write() otherwise.
+    ssize_t writeWire(uint8_t *to, size_t buf_sz) const;
+
+    // length of what writeWire() writes.
+    ssize_t wireLength() const;
+
     virtual ~BgpPathAttrib();
 
 protected:
@@ -156,6 +183,12 @@ protected:
 
 private:
     uint8_t* value_ptr;
+
+    // the received attribute block, and the bytes of this attribute in it.
+    // NULL if the attribute is not from parse() or is modified.
+    std::shared_ptr<const std::vector<uint8_t>> raw_block;
+    const uint8_t *raw;
+    uint16_t raw_len;
 };
 
 /**
@@ -465,6 +498,8 @@ public:
 
 protected:
     ssize_t parseHeader(const uint8_t *buffer, size_t length);
+    ssize_t writeHeader(uint8_t *to, size_t buffer_sz, size_t val_len) const;
+    size_t attribLength(size_t val_len) const;
 };
 
 /**
@@ -489,6 +524,7 @@ public:
 /**
  * @brief MP-BGP ReachNlri container for unknow AFI/SAFI.
  * 
+ * AFI must not be IPV6, use BgpPathAttribMpReachNlriIpv6 for that.
  */
 class BgpPathAttribMpReachNlriUnknow : public BgpPathAttribMpNlriBase {
 public:
@@ -534,6 +570,7 @@ public:
 /**
  * @brief MP-BGP UnreachNlri container for unknow AFI/SAFI.
  * 
+ * AFI must not be IPV6, use BgpPathAttribMpUnreachNlriIpv6 for that.
  */
 class BgpPathAttribMpUnreachNlriUnknow : public BgpPathAttribMpNlriBase {
 public:
@@ -27,6 +27,86 @@ enum BgpRouteStatus {
     RS_ACTIVE = 1
 };
 
+/**
+ * @brief Path attributes used in best path selection.
+ * 
+ * Taken from a set of path attributes once, so RIBs that compare the same
+ * attribute set many times can keep them around instead of searching the
+ * attributes for every comparison.
+ */
+struct BgpRibPathMetrics {
+    /**
+     * @brief Construct metrics of an empty attribute set.
+     * 
+     */
+    BgpRibPathMetrics() : med(0), orig_as(0), local_pref(100), origin(0), as_path_len(0) {}
+
+    /**
+     * @brief Construct metrics from a set of path attributes.
+     * 
+     * @param attribs The path attributes.
+     */
+    explicit BgpRibPathMetrics(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) : BgpRibPathMetrics() {
+        for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
+            if (attr->type_code == MULTI_EXIT_DISC) {
+                const BgpPathAttribMed &med = static_cast<const BgpPathAttribMed &>(*attr);
+                this->med = med.med;
+                continue;
+            }
+
+            if (attr->type_code == ORIGIN) {
+                const BgpPathAttribOrigin &orig = static_cast<const BgpPathAttribOrigin &>(*attr);
+                origin = orig.origin;
+                continue;
+            }
+
+            if (attr->type_code == AS_PATH) {
+                const BgpPathAttribAsPath &as_path = static_cast<const BgpPathAttribAsPath &>(*attr);
+                for (const BgpAsPathSegment &seg : as_path.as_paths) {
+                    if (seg.type == AS_SEQUENCE) {
+                        as_path_len = seg.value.size();
+                        orig_as = seg.value.back();
+                    }
+                }
+                continue;
+            }
+
+            if (attr->type_code == LOCAL_PREF) {
+                const BgpPathAttribLocalPref &pref = static_cast<const BgpPathAttribLocalPref &>(*attr);
+                local_pref = pref.local_pref;
+                continue;
+            }
+        }
+    }
+
+    /**
+     * @brief Compare with the metrics of another path: local preference, 
+     * AS_PATH length, origin, then MED if both paths are from the same AS.
+     * 
+     * @param other The other metrics.
+     * @return int 1 if this path is preferred, -1 if the other path is
+     * preferred, 0 if they are equal.
+     */
+    int compare(const BgpRibPathMetrics &other) const {
+        /**/ if (local_pref > other.local_pref) return 1;
+        else if (local_pref < other.local_pref) return -1;
+        else if (other.as_path_len > as_path_len) return 1;
+        else if (other.as_path_len < as_path_len) return -1;
+        else if (other.origin > origin) return 1;
+        else if (other.origin < origin) return -1;
+        else if (other.orig_as == orig_as && other.med > med) return 1;
+        else if (other.orig_as == orig_as && other.med < med) return -1;
+
+        return 0;
+    }
+
+    uint32_t med;
+    uint32_t orig_as;
+    uint32_t local_pref;
+    uint8_t origin;
+    uint8_t as_path_len;
+};
+
 /**
  * @brief The base of BGP RIB entry.
  * 
@@ -78,7 +158,7 @@ public:
      * 
      * If the route is from an IBGP peer, the nexthop might not be reachable
      * directly. You may need recursive nexthop or info from other routing
-     * protocols.
+     * protocols. (see BgpNexthopTracker)
      */
     BgpRouteSource src;
 
@@ -116,97 +196,123 @@ public:
         if (this->weight > other.weight) return true;
         if (this->weight < other.weight) return false;
 
-        uint32_t other_med = 0;
-        uint32_t this_med = 0;
+        int cmp = BgpRibPathMetrics(attribs).compare(BgpRibPathMetrics(other.attribs));
+        if (cmp != 0) return cmp > 0;
 
-        uint32_t other_orig_as = 0;
-        uint32_t this_orig_as = 0;
+        /**/ if (other.update_id > update_id) return true;
+        else if (other.update_id < update_id) return false;
+        else if (htonl(other.src_router_id) > htonl(src_router_id)) return true;
 
-        uint8_t other_origin = 0;
-        uint8_t this_origin = 0;
+        return false;
+    }
 
-        uint8_t other_as_path_len = 0;
-        uint8_t this_as_path_len = 0;
+};
 
-        uint32_t other_local_pref = 100;
-        uint32_t this_local_pref = 100;
+/**
+ * @brief attrib_set of a BgpRibOp that withdraws the route.
+ * 
+ */
+#define BGP_RIB_WITHDRAW UINT32_MAX
 
-        // grab attributes
-        for (const std::shared_ptr<BgpPathAttrib> &attr : other.attribs) {
-            if (attr->type_code == MULTI_EXIT_DISC) {
-                const BgpPathAttribMed &med = dynamic_cast<const BgpPathAttribMed &>(*attr);
-                other_med = med.med;
-            }
+/**
+ * @brief An operation in a RIB batch.
+ * 
+ * @tparam P Type of prefix.
+ */
+template<typename P> struct BgpRibOp {
+    /**
+     * @brief The route.
+     * 
+     */
+    P route;
 
-            if (attr->type_code == ORIGIN) {
-                const BgpPathAttribOrigin &orig = dynamic_cast<const BgpPathAttribOrigin &>(*attr);
-                other_origin = orig.origin;
-                continue;
-            }
+    /**
+     * @brief Index of the attribute set in the batch to insert the route with,
+     * or BGP_RIB_WITHDRAW to withdraw the route.
+     * 
+     */
+    uint32_t attrib_set;
+};
 
-            if (attr->type_code == AS_PATH) {
-                const BgpPathAttribAsPath &as_path = dynamic_cast<const BgpPathAttribAsPath &>(*attr);
-                for (const BgpAsPathSegment &seg : as_path.as_paths) {
-                    if (seg.type == AS_SEQUENCE) {
-                        other_as_path_len = seg.value.size();
-                        other_orig_as = seg.value.back();
-                    }
-                }
-                continue;
-            }
+/**
+ * @brief Type of a best route change in a RIB.
+ * 
+ */
+enum BgpRibChangeType {
+    /**
+     * @brief The inserted route is the new best route.
+     * 
+     */
+    RC_NEW_BEST = 0,
 
-            if (attr->type_code == LOCAL_PREF) {
-                const BgpPathAttribLocalPref &pref = dynamic_cast<const BgpPathAttribLocalPref &>(*attr);
-                other_local_pref = pref.local_pref;
-                continue;
-            }
-        }
+    /**
+     * @brief Another entry became the best route. (a pointer to the entry is
+     * in BgpRibChanges::entries)
+     * 
+     */
+    RC_BEST_CHANGED = 1,
 
-        for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
-            if (attr->type_code == MULTI_EXIT_DISC) {
-                const BgpPathAttribMed &med = dynamic_cast<const BgpPathAttribMed &>(*attr);
-                this_med = med.med;
-            }
+    /**
+     * @brief The withdrawn route is no longer reachable.
+     * 
+     */
+    RC_UNREACHABLE = 2
+};
 
-            if (attr->type_code == ORIGIN) {
-                const BgpPathAttribOrigin &orig = dynamic_cast<const BgpPathAttribOrigin &>(*attr);
-                this_origin = orig.origin;
-                continue;
-            }
+/**
+ * @brief A best route change caused by an operation in a RIB batch.
+ * 
+ */
+struct BgpRibChange {
+    /**
+     * @brief Type of change.
+     * 
+     */
+    BgpRibChangeType type;
 
-            if (attr->type_code == AS_PATH) {
-                const BgpPathAttribAsPath &as_path = dynamic_cast<const BgpPathAttribAsPath &>(*attr);
-                for (const BgpAsPathSegment &seg : as_path.as_paths) {
-                    if (seg.type == AS_SEQUENCE) {
-                        this_as_path_len = seg.value.size();
-                        this_orig_as = seg.value.back();
-                    }
-                }
-                continue;
-            }
+    /**
+     * @brief Index of the operation in the batch. The route and attribute set
+     * can be found there.
+     * 
+     */
+    uint32_t op;
 
-            if (attr->type_code == LOCAL_PREF) {
-                const BgpPathAttribLocalPref &pref = dynamic_cast<const BgpPathAttribLocalPref &>(*attr);
-                this_local_pref = pref.local_pref;
-                continue;
-            }
-        }
+    /**
+     * @brief Index of the new best entry in BgpRibChanges::entries. (Valid iff
+     * type == RC_BEST_CHANGED)
+     * 
+     */
+    uint32_t entry;
+};
 
-        /**/ if (this_local_pref > other_local_pref) return true;
-        else if (this_local_pref < other_local_pref) return false;
-        else if (other_as_path_len > this_as_path_len) return true;
-        else if (other_as_path_len < this_as_path_len) return false;
-        else if (other_origin > this_origin) return true;
-        else if (other_origin < this_origin) return false;
-        else if (other_orig_as == this_orig_as && other_med > this_med) return true;
-        else if (other_orig_as == this_orig_as && other_med < this_med) return false;
-        else if (other.update_id > update_id) return true;
-        else if (other.update_id < update_id) return false;
-        else if (htonl(other.src_router_id) > htonl(src_router_id)) return true;
+/**
+ * @brief Best route changes caused by a RIB batch, in the order of the
+ * operations in the batch.
+ * 
+ * @tparam T Type of BgpRibEntry.
+ */
+template<typename T> struct BgpRibChanges {
+    /**
+     * @brief The changes.
+     * 
+     */
+    std::vector<BgpRibChange> changes;
 
-        return false;
-    }
+    /**
+     * @brief The entries that became best routes. They point into the RIB and
+     * are valid until the RIB is modified.
+     * 
+     */
+    std::vector<const T*> entries;
 
+    /**
+     * @brief Remove all changes.
+     * 
+     */
+    void clear() {
+        changes.clear();
+        entries.clear();
+    }
 };
 
 #ifdef SWIG
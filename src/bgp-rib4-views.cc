@@ -0,0 +1,507 @@
+/**
+ * @file bgp-rib4-views.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Per-client IPv4 RIB views for route servers.
+ * @version 0.1
+ * @date 2019-09-06
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-rib4-views.h"
+#include "bgp-throw.h"
+#include <arpa/inet.h>
+
+namespace libbgp {
+
+/**
+ * @brief Construct a new BgpRib4Views with no views.
+ *
+ * @param logger Log handler to use.
+ * @param thread_safe Lock the RIB on access. Set to false if the RIB is only
+ * ever used from one thread. (see BgpLock)
+ */
+BgpRib4Views::BgpRib4Views(BgpLogHandler *logger, bool thread_safe) : mutex(thread_safe) {
+    this->logger = logger;
+    update_id = 0;
+    paths = 0;
+}
+
+/**
+ * @brief Add a view for a client.
+ *
+ * The best paths of the routes already in the RIB are selected for the new
+ * view. No changes are reported for them; use forEach() to send the initial
+ * table to the client.
+ *
+ * @param client_router_id BGP ID of the client. (network bytes order) Paths
+ * from the client are not selected in its view.
+ * @param export_filters Filters to apply to paths before selecting them for
+ * the client.
+ * @return uint32_t ID of the view.
+ */
+uint32_t BgpRib4Views::addView(uint32_t client_router_id, const BgpFilterRules &export_filters) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    View view;
+    view.client_router_id = client_router_id;
+    view.filters = export_filters;
+    view.active = true;
+    views.push_back(view);
+
+    View &added = views.back();
+    added.selected.assign(slots.size(), BGP_RIB4_VIEWS_NONE);
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].paths.size() == 0) continue;
+        rank(slots[i]);
+        added.selected[i] = select(added, slots[i]);
+    }
+
+    return views.size() - 1;
+}
+
+/**
+ * @brief Remove a view. No changes are reported, and the view ID is not
+ * reused.
+ *
+ * @param view ID of the view.
+ * @return true View removed.
+ * @return false No such view.
+ */
+bool BgpRib4Views::removeView(uint32_t view) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (view >= views.size() || !views[view].active) return false;
+
+    views[view].active = false;
+    views[view].filters = BgpFilterRules();
+    std::vector<uint8_t>().swap(views[view].selected);
+
+    return true;
+}
+
+/**
+ * @brief Insert routes with common path attributes.
+ *
+ * A path from the same client replaces the client's old path of the route.
+ *
+ * @param src_router_id The originating BGP speaker's ID. (network bytes order)
+ * @param routes The routes.
+ * @param attribs The path attributes.
+ * @param weight Weight of the paths.
+ * @param ibgp_asn ASN of the IBGP peer, 0 if the routes are from an EBGP peer.
+ * @param changes Best path changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4Views::insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, int32_t weight, uint32_t ibgp_asn, std::vector<BgpRib4ViewChange> &changes) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (routes.size() == 0) return 0;
+
+    size_t n_changes = 0;
+    uint32_t set = addAttribSet(attribs);
+    update_id++;
+
+    BgpRib4ViewPath path;
+    path.src_router_id = src_router_id;
+    path.attrib_set = set;
+    path.update_id = update_id;
+    path.weight = weight;
+    path.ibgp_peer_asn = ibgp_asn;
+    path.src = ibgp_asn == 0 ? SRC_EBGP : SRC_IBGP;
+
+    for (const Prefix4 &route : routes) {
+        uint32_t slot_id = getSlot(route);
+        std::vector<BgpRib4ViewPath> &slot_paths = slots[slot_id].paths;
+
+        size_t i = 0;
+        for (; i < slot_paths.size(); i++) {
+            if (slot_paths[i].src_router_id == src_router_id) break;
+        }
+
+        if (i == slot_paths.size() && slot_paths.size() >= BGP_RIB4_VIEWS_MAX_PATHS) {
+            logger->log(ERROR, "BgpRib4Views::insert: too many paths for route, dropping path from %08x.\n", ntohl(src_router_id));
+            continue;
+        }
+
+        old_paths = slot_paths;
+        attrib_sets[set].refs++;
+
+        if (i == slot_paths.size()) {
+            slot_paths.push_back(path);
+            paths++;
+        } else {
+            releaseAttribSet(slot_paths[i].attrib_set);
+            slot_paths[i] = path;
+        }
+
+        n_changes += reselect(slot_id, changes);
+    }
+
+    if (attrib_sets[set].refs == 0) {
+        attrib_sets[set].refs = 1;
+        releaseAttribSet(set);
+    }
+
+    return n_changes;
+}
+
+/**
+ * @brief Withdraw routes.
+ *
+ * @param src_router_id The originating BGP speaker's ID. (network bytes order)
+ * @param routes The routes.
+ * @param changes Best path changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4Views::withdraw(uint32_t src_router_id, const std::vector<Prefix4> &routes, std::vector<BgpRib4ViewChange> &changes) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    size_t n_changes = 0;
+
+    for (const Prefix4 &route : routes) {
+        auto it = index.find(BgpRib4EntryKey(route));
+        if (it == index.end()) continue;
+
+        uint32_t slot_id = it->second;
+        const std::vector<BgpRib4ViewPath> &slot_paths = slots[slot_id].paths;
+
+        for (size_t i = 0; i < slot_paths.size(); i++) {
+            if (slot_paths[i].src_router_id != src_router_id) continue;
+            n_changes += removePath(slot_id, i, changes);
+            break;
+        }
+    }
+
+    return n_changes;
+}
+
+/**
+ * @brief Remove all routes from a client.
+ *
+ * @param src_router_id The originating BGP speaker's ID. (network bytes order)
+ * @param changes Best path changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4Views::discard(uint32_t src_router_id, std::vector<BgpRib4ViewChange> &changes) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    size_t n_changes = 0;
+
+    for (size_t slot_id = 0; slot_id < slots.size(); slot_id++) {
+        const std::vector<BgpRib4ViewPath> &slot_paths = slots[slot_id].paths;
+
+        for (size_t i = 0; i < slot_paths.size(); i++) {
+            if (slot_paths[i].src_router_id != src_router_id) continue;
+            n_changes += removePath(slot_id, i, changes);
+            break;
+        }
+    }
+
+    return n_changes;
+}
+
+/**
+ * @brief Get the best path of a route in a view.
+ *
+ * @param view ID of the view.
+ * @param route The route.
+ * @return const BgpRib4ViewPath* The best path. NULL if the route is not
+ * reachable in the view. Hold the RIB lock (getMutex()) to keep the pointer
+ * valid.
+ */
+const BgpRib4ViewPath* BgpRib4Views::lookup(uint32_t view, const Prefix4 &route) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (view >= views.size() || !views[view].active) return NULL;
+
+    auto it = index.find(BgpRib4EntryKey(route));
+    if (it == index.end()) return NULL;
+
+    uint8_t selected = views[view].selected[it->second];
+    if (selected == BGP_RIB4_VIEWS_NONE) return NULL;
+
+    return &slots[it->second].paths[selected];
+}
+
+/**
+ * @brief Get path attributes of a path.
+ *
+ * @param path The path.
+ * @return const std::vector<std::shared_ptr<BgpPathAttrib>>& The path
+ * attributes.
+ * @throws "bad_attrib_set" the path does not belong to this RIB.
+ */
+const std::vector<std::shared_ptr<BgpPathAttrib>>& BgpRib4Views::getAttribs(const BgpRib4ViewPath &path) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (path.attrib_set >= attrib_sets.size()) LIBBGP_THROW("bad_attrib_set");
+    return attrib_sets[path.attrib_set].attribs;
+}
+
+/**
+ * @brief Call a function with every route and its best path in a view.
+ *
+ * The RIB is locked while fn runs, fn must not modify the RIB.
+ *
+ * @param view ID of the view.
+ * @param fn The function.
+ */
+void BgpRib4Views::forEach(uint32_t view, const std::function<void (const Prefix4 &route, const BgpRib4ViewPath &path)> &fn) const {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    if (view >= views.size() || !views[view].active) return;
+    const std::vector<uint8_t> &selected = views[view].selected;
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (selected[i] == BGP_RIB4_VIEWS_NONE) continue;
+        fn(slots[i].route, slots[i].paths[selected[i]]);
+    }
+}
+
+/**
+ * @brief Get number of views, including removed ones.
+ *
+ * @return size_t Number of views.
+ */
+size_t BgpRib4Views::getViewCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return views.size();
+}
+
+/**
+ * @brief Get number of prefixes in the RIB.
+ *
+ * @return size_t Number of prefixes.
+ */
+size_t BgpRib4Views::getPrefixCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return index.size();
+}
+
+/**
+ * @brief Get number of paths in the RIB.
+ *
+ * @return size_t Number of paths.
+ */
+size_t BgpRib4Views::getPathCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return paths;
+}
+
+/**
+ * @brief Get the RIB lock.
+ *
+ * @return BgpLock& The lock.
+ */
+BgpLock& BgpRib4Views::getMutex() {
+    return mutex;
+}
+
+/**
+ * @brief Find the slot of a route, or create one.
+ *
+ * @param route The route.
+ * @return uint32_t The slot.
+ */
+uint32_t BgpRib4Views::getSlot(const Prefix4 &route) {
+    BgpRib4EntryKey key(route);
+    auto it = index.find(key);
+    if (it != index.end()) return it->second;
+
+    uint32_t slot_id;
+
+    if (free_slots.size() > 0) {
+        slot_id = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot_id = slots.size();
+        slots.push_back(Slot());
+
+        for (View &view : views) {
+            if (view.active) view.selected.push_back(BGP_RIB4_VIEWS_NONE);
+        }
+    }
+
+    slots[slot_id].route = route;
+    index[key] = slot_id;
+
+    return slot_id;
+}
+
+/**
+ * @brief Free a slot with no paths.
+ *
+ * @param slot The slot.
+ */
+void BgpRib4Views::freeSlot(uint32_t slot) {
+    index.erase(BgpRib4EntryKey(slots[slot].route));
+    std::vector<BgpRib4ViewPath>().swap(slots[slot].paths);
+    free_slots.push_back(slot);
+}
+
+/**
+ * @brief Add a set of path attributes to the attribute store.
+ *
+ * @param attribs The path attributes.
+ * @return uint32_t Index of the set, with no references.
+ */
+uint32_t BgpRib4Views::addAttribSet(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) {
+    uint32_t set;
+
+    if (free_attrib_sets.size() > 0) {
+        set = free_attrib_sets.back();
+        free_attrib_sets.pop_back();
+    } else {
+        set = attrib_sets.size();
+        attrib_sets.push_back(AttribSet());
+    }
+
+    attrib_sets[set].attribs = attribs;
+    attrib_sets[set].metrics = BgpRibPathMetrics(attribs);
+    attrib_sets[set].refs = 0;
+
+    return set;
+}
+
+/**
+ * @brief Drop a reference to a set of path attributes, free the set if it has
+ * no references left.
+ *
+ * @param set Index of the set.
+ */
+void BgpRib4Views::releaseAttribSet(uint32_t set) {
+    if (--attrib_sets[set].refs > 0) return;
+
+    attrib_sets[set].attribs.clear();
+    free_attrib_sets.push_back(set);
+}
+
+/**
+ * @brief Test if path a is preferred over path b, same as BgpRibEntry's
+ * operator>.
+ *
+ * @param a Path A.
+ * @param b Path B.
+ * @return true A is preferred.
+ * @return false B is preferred or they are equal.
+ */
+bool BgpRib4Views::better(const BgpRib4ViewPath &a, const BgpRib4ViewPath &b) const {
+    // perfer ebgp
+    if (a.src > b.src) return false;
+
+    // prefer higher weight
+    if (a.weight > b.weight) return true;
+    if (a.weight < b.weight) return false;
+
+    int cmp = attrib_sets[a.attrib_set].metrics.compare(attrib_sets[b.attrib_set].metrics);
+    if (cmp != 0) return cmp > 0;
+
+    /**/ if (b.update_id > a.update_id) return true;
+    else if (b.update_id < a.update_id) return false;
+    else if (htonl(b.src_router_id) > htonl(a.src_router_id)) return true;
+
+    return false;
+}
+
+/**
+ * @brief Rank the paths of a slot, best first, into ranked.
+ *
+ * @param slot The slot.
+ */
+void BgpRib4Views::rank(const Slot &slot) {
+    ranked.clear();
+
+    // paths per prefix are few, insertion sort.
+    for (size_t i = 0; i < slot.paths.size(); i++) {
+        size_t pos = 0;
+        while (pos < ranked.size() && !better(slot.paths[i], slot.paths[ranked[pos]])) pos++;
+        ranked.insert(ranked.begin() + pos, (uint8_t) i);
+    }
+}
+
+/**
+ * @brief Select the best path of a slot for a view. The paths must be ranked
+ * with rank().
+ *
+ * @param view The view.
+ * @param slot The slot.
+ * @return uint8_t Index of the path, or BGP_RIB4_VIEWS_NONE.
+ */
+uint8_t BgpRib4Views::select(View &view, const Slot &slot) {
+    for (uint8_t i : ranked) {
+        const BgpRib4ViewPath &path = slot.paths[i];
+        if (path.src_router_id == view.client_router_id) continue;
+        if (view.filters.apply(slot.route, attrib_sets[path.attrib_set].attribs) != ACCEPT) continue;
+        return i;
+    }
+
+    return BGP_RIB4_VIEWS_NONE;
+}
+
+/**
+ * @brief Select the best paths of a modified slot for all views, and report
+ * the changes. old_paths must hold the paths of the slot before the
+ * modification. Frees the slot if it has no paths left.
+ *
+ * @param slot_id The slot.
+ * @param changes Best path changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4Views::reselect(uint32_t slot_id, std::vector<BgpRib4ViewChange> &changes) {
+    const Slot &slot = slots[slot_id];
+    size_t n_changes = 0;
+
+    rank(slot);
+
+    for (size_t view_id = 0; view_id < views.size(); view_id++) {
+        View &view = views[view_id];
+        if (!view.active) continue;
+
+        uint8_t old_sel = view.selected[slot_id];
+        uint8_t new_sel = select(view, slot);
+        view.selected[slot_id] = new_sel;
+
+        if (old_sel == BGP_RIB4_VIEWS_NONE && new_sel == BGP_RIB4_VIEWS_NONE) continue;
+
+        if (old_sel != BGP_RIB4_VIEWS_NONE && new_sel != BGP_RIB4_VIEWS_NONE) {
+            const BgpRib4ViewPath &old_path = old_paths[old_sel];
+            const BgpRib4ViewPath &new_path = slot.paths[new_sel];
+            if (old_path.src_router_id == new_path.src_router_id && old_path.update_id == new_path.update_id) continue;
+        }
+
+        BgpRib4ViewChange change;
+        change.view = view_id;
+        change.route = slot.route;
+        change.reachable = new_sel != BGP_RIB4_VIEWS_NONE;
+        change.path = change.reachable ? slot.paths[new_sel] : BgpRib4ViewPath();
+        changes.push_back(change);
+        n_changes++;
+    }
+
+    if (slot.paths.size() == 0) freeSlot(slot_id);
+
+    return n_changes;
+}
+
+/**
+ * @brief Remove a path from a slot and report the changes.
+ *
+ * @param slot_id The slot.
+ * @param path Index of the path in the slot.
+ * @param changes Best path changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4Views::removePath(uint32_t slot_id, size_t path, std::vector<BgpRib4ViewChange> &changes) {
+    std::vector<BgpRib4ViewPath> &slot_paths = slots[slot_id].paths;
+
+    old_paths = slot_paths;
+    releaseAttribSet(slot_paths[path].attrib_set);
+    slot_paths.erase(slot_paths.begin() + path);
+    paths--;
+
+    return reselect(slot_id, changes);
+}
+
+}
@@ -0,0 +1,220 @@
+/**
+ * @file bgp-rib4-views.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Per-client IPv4 RIB views for route servers.
+ * @version 0.1
+ * @date 2019-09-06
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_RIB4_VIEWS_H_
+#define BGP_RIB4_VIEWS_H_
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include "bgp-lock.h"
+#include "bgp-rib.h"
+#include "bgp-rib4.h"
+#include "bgp-filter.h"
+#include "prefix4.h"
+
+// max number of paths (i.e., peers announcing it) kept for one prefix.
+#define BGP_RIB4_VIEWS_MAX_PATHS 255
+
+// selector of a view with no path selected for the prefix.
+#define BGP_RIB4_VIEWS_NONE 0xff
+
+namespace libbgp {
+
+/**
+ * @brief A path in BgpRib4Views. Paths are shared by all views.
+ *
+ */
+struct BgpRib4ViewPath {
+    /**
+     * @brief The originating BGP speaker's ID of this path. (network bytes
+     * order)
+     *
+     */
+    uint32_t src_router_id;
+
+    /**
+     * @brief Index of the path attributes in the attribute store. Use
+     * BgpRib4Views::getAttribs() to get the attributes.
+     *
+     */
+    uint32_t attrib_set;
+
+    /**
+     * @brief The update ID. Paths inserted with the same insert() call share
+     * the update ID and the attribute set.
+     *
+     */
+    uint64_t update_id;
+
+    /**
+     * @brief Weight of this path.
+     *
+     */
+    int32_t weight;
+
+    /**
+     * @brief ASN of the IBGP peer. (Valid iff src == SRC_IBGP)
+     *
+     */
+    uint32_t ibgp_peer_asn;
+
+    /**
+     * @brief Source of this path.
+     *
+     */
+    BgpRouteSource src;
+};
+
+/**
+ * @brief A best path change in a view.
+ *
+ */
+struct BgpRib4ViewChange {
+    /**
+     * @brief The view.
+     *
+     */
+    uint32_t view;
+
+    /**
+     * @brief The route.
+     *
+     */
+    Prefix4 route;
+
+    /**
+     * @brief The route is reachable in the view. If false, the route should be
+     * withdrawn from the client.
+     *
+     */
+    bool reachable;
+
+    /**
+     * @brief The new best path. (Valid iff reachable) The attribute set stays
+     * valid until the next call modifying the RIB.
+     *
+     */
+    BgpRib4ViewPath path;
+};
+
+/**
+ * @brief The BgpRib4Views class.
+ *
+ * An IPv4 RIB for route servers (RFC 7947) with one Loc-RIB view per client.
+ * Each view picks its own best path for every prefix: paths from the client
+ * itself are never picked, and the client's export filters are applied before
+ * the decision, so a path rejected for a client doesn't hide the next best
+ * path from it.
+ *
+ * All views share one prefix index, one path list per prefix and one
+ * attribute store. A view only keeps one byte per prefix, the index of its
+ * best path in the path list, so hundreds of views take about as much memory
+ * as a few full tables instead of one full table each.
+ *
+ * Best path selection is the same as BgpRib4. The paths of a prefix are
+ * ranked once per change, and each view takes the first path it is allowed to
+ * see. Changes are reported per view, for the caller to send to the clients.
+ *
+ * Up to BGP_RIB4_VIEWS_MAX_PATHS paths are kept per prefix.
+ */
+class BgpRib4Views {
+public:
+    BgpRib4Views(BgpLogHandler *logger, bool thread_safe = true);
+
+    // add a view for a client. returns the view ID.
+    uint32_t addView(uint32_t client_router_id, const BgpFilterRules &export_filters = BgpFilterRules());
+
+    // remove a view.
+    bool removeView(uint32_t view);
+
+    // insert routes w/ common attribs from a client, append best path changes
+    // to changes. returns number of changes appended.
+    size_t insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, int32_t weight, uint32_t ibgp_asn, std::vector<BgpRib4ViewChange> &changes);
+
+    // withdraw routes from a client, append best path changes to changes.
+    // returns number of changes appended.
+    size_t withdraw(uint32_t src_router_id, const std::vector<Prefix4> &routes, std::vector<BgpRib4ViewChange> &changes);
+
+    // remove all routes from a client, append best path changes to changes.
+    // returns number of changes appended.
+    size_t discard(uint32_t src_router_id, std::vector<BgpRib4ViewChange> &changes);
+
+    // get the best path of a route in a view, return null if not found.
+    const BgpRib4ViewPath* lookup(uint32_t view, const Prefix4 &route) const;
+
+    // get path attributes of a path.
+    const std::vector<std::shared_ptr<BgpPathAttrib>>& getAttribs(const BgpRib4ViewPath &path) const;
+
+    // call fn with every route and its best path in a view.
+    void forEach(uint32_t view, const std::function<void (const Prefix4 &route, const BgpRib4ViewPath &path)> &fn) const;
+
+    // get number of views.
+    size_t getViewCount() const;
+
+    // get number of prefixes.
+    size_t getPrefixCount() const;
+
+    // get number of paths.
+    size_t getPathCount() const;
+
+    // get the RIB lock. hold it to keep path pointers from the RIB valid.
+    BgpLock& getMutex();
+
+private:
+    BgpRib4Views(const BgpRib4Views &);
+    BgpRib4Views& operator= (const BgpRib4Views &);
+
+    struct Slot {
+        Prefix4 route;
+        std::vector<BgpRib4ViewPath> paths;
+    };
+
+    struct AttribSet {
+        std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
+        BgpRibPathMetrics metrics;
+        uint32_t refs;
+    };
+
+    struct View {
+        uint32_t client_router_id;
+        BgpFilterRules filters;
+        bool active;
+        std::vector<uint8_t> selected;
+    };
+
+    uint32_t getSlot(const Prefix4 &route);
+    void freeSlot(uint32_t slot);
+    uint32_t addAttribSet(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs);
+    void releaseAttribSet(uint32_t set);
+    bool better(const BgpRib4ViewPath &a, const BgpRib4ViewPath &b) const;
+    void rank(const Slot &slot);
+    uint8_t select(View &view, const Slot &slot);
+    size_t reselect(uint32_t slot, std::vector<BgpRib4ViewChange> &changes);
+    size_t removePath(uint32_t slot, size_t path, std::vector<BgpRib4ViewChange> &changes);
+
+    std::unordered_map<BgpRib4EntryKey, uint32_t, BgpRib4EntryHash> index;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<AttribSet> attrib_sets;
+    std::vector<uint32_t> free_attrib_sets;
+    std::vector<View> views;
+    std::vector<uint8_t> ranked;
+    std::vector<BgpRib4ViewPath> old_paths;
+    mutable BgpLock mutex;
+    BgpLogHandler *logger;
+    uint64_t update_id;
+    size_t paths;
+};
+
+}
+
+#endif // BGP_RIB4_VIEWS_H_
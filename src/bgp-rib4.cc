@@ -9,6 +9,9 @@
  * 
  */
 #include "bgp-rib4.h"
+#include "bgp-throw.h"
+#include "route-event-bus.h"
+#include "bgp-nexthop-tracker.h"
 #include <arpa/inet.h>
 #define MAKE_ENTRY4(r, e) std::make_pair(BgpRib4EntryKey(r), e)
 
@@ -25,7 +28,7 @@ BgpRib4Entry::BgpRib4Entry() {
  * @param src Originating BGP speaker's ID in network bytes order.
  * @param as Path attributes for this entry.
  */
-BgpRib4Entry::BgpRib4Entry(Prefix4 r, uint32_t src, const std::vector<std::shared_ptr<BgpPathAttrib>> as) : route(r) {
+BgpRib4Entry::BgpRib4Entry(Prefix4 r, uint32_t src, const std::vector<std::shared_ptr<BgpPathAttrib>> &as) : route(r) {
     src_router_id = src;
     attribs = as;
 }
@@ -39,22 +42,104 @@ BgpRib4Entry::BgpRib4Entry(Prefix4 r, uint32_t src, const std::vector<std::share
 uint32_t BgpRib4Entry::getNexthop() const {
     for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
         if (attr->type_code == NEXT_HOP) {
-            const BgpPathAttribNexthop &nh = dynamic_cast<const BgpPathAttribNexthop &>(*attr);
+            const BgpPathAttribNexthop &nh = static_cast<const BgpPathAttribNexthop &>(*attr);
             return nh.next_hop;
         }
     }
 
-    throw "no_nexthop";
+    LIBBGP_THROW("no_nexthop");
+}
+
+/**
+ * @brief Construct a new, empty BgpRib4Batch.
+ * 
+ */
+BgpRib4Batch::BgpRib4Batch() {
+    inserts = 0;
+}
+
+/**
+ * @brief Add a set of path attributes to the batch.
+ * 
+ * @param attribs The path attributes.
+ * @return uint32_t Index of the set, to be passed to insert().
+ */
+uint32_t BgpRib4Batch::addAttribs(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs) {
+    this->attribs.push_back(attribs);
+    return this->attribs.size() - 1;
+}
+
+/**
+ * @brief Insert a route with an attribute set.
+ * 
+ * @param route The route.
+ * @param attrib_set Index of the attribute set, from addAttribs().
+ */
+void BgpRib4Batch::insert(const Prefix4 &route, uint32_t attrib_set) {
+    if (attrib_set >= attribs.size()) LIBBGP_THROW("bad_attrib_set");
+
+    BgpRibOp<Prefix4> op;
+    op.route = route;
+    op.attrib_set = attrib_set;
+    ops.push_back(op);
+    inserts++;
+}
+
+/**
+ * @brief Insert routes with an attribute set.
+ * 
+ * @param routes The routes.
+ * @param attrib_set Index of the attribute set, from addAttribs().
+ */
+void BgpRib4Batch::insert(const std::vector<Prefix4> &routes, uint32_t attrib_set) {
+    ops.reserve(ops.size() + routes.size());
+    for (const Prefix4 &route : routes) insert(route, attrib_set);
+}
+
+/**
+ * @brief Withdraw a route.
+ * 
+ * @param route The route.
+ */
+void BgpRib4Batch::withdraw(const Prefix4 &route) {
+    BgpRibOp<Prefix4> op;
+    op.route = route;
+    op.attrib_set = BGP_RIB_WITHDRAW;
+    ops.push_back(op);
+}
+
+/**
+ * @brief Withdraw routes.
+ * 
+ * @param routes The routes.
+ */
+void BgpRib4Batch::withdraw(const std::vector<Prefix4> &routes) {
+    ops.reserve(ops.size() + routes.size());
+    for (const Prefix4 &route : routes) withdraw(route);
+}
+
+/**
+ * @brief Remove all operations and attribute sets.
+ * 
+ */
+void BgpRib4Batch::clear() {
+    ops.clear();
+    attribs.clear();
+    inserts = 0;
 }
 
 /**
  * @brief Construct a new BgpRib4 object with logging.
  * 
  * @param logger Log handler to use.
+ * @param thread_safe Lock the RIB on access. If the RIB is only ever used from
+ * one thread, set to false to skip the locking. (see BgpLock)
  */
-BgpRib4::BgpRib4(BgpLogHandler *logger) {
+BgpRib4::BgpRib4(BgpLogHandler *logger, bool thread_safe) : mutex(thread_safe) {
     this->logger = logger;
+    stats.setSingleWriter(!thread_safe);
     update_id = 0;    
+    nexthop_tracker = NULL;
 }
 
 rib4_t::iterator BgpRib4::find_best (const Prefix4 &prefix) {
@@ -100,6 +185,7 @@ rib4_t::iterator BgpRib4::find_entry (const Prefix4 &prefix, uint32_t src) {
  * @param attrib route attributes.
  * @param weight route weight.
  * @param ibgp_asn remote ASN, if IBGP.
+ * @param group update ID of the entry.
  * @return <const BgpRib4Entry*, bool> inserted info: <new_best_route, 
  * inserted_is_best>
  * @retval <const BgpRib4Entry*, true> inserted route is the new best route. 
@@ -110,12 +196,10 @@ rib4_t::iterator BgpRib4::find_entry (const Prefix4 &prefix, uint32_t src) {
  * @retval <NULL, false> inserted route is not the new best, and current best
  * has not changed.
  */
-std::pair<const BgpRib4Entry*, bool> BgpRib4::insertPriv(uint32_t src_router_id, const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight, uint32_t ibgp_asn) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-
+std::pair<const BgpRib4Entry*, bool> BgpRib4::insertPriv(uint32_t src_router_id, const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight, uint32_t ibgp_asn, uint64_t group) {
     /* construct the new entry object */
     BgpRib4Entry new_entry(route, src_router_id, attrib);
-    new_entry.update_id = update_id;
+    new_entry.update_id = group;
     new_entry.weight = weight;
     new_entry.src = ibgp_asn > 0 ? SRC_IBGP : SRC_EBGP;
     new_entry.ibgp_peer_asn = ibgp_asn;
@@ -165,10 +249,12 @@ std::pair<const BgpRib4Entry*, bool> BgpRib4::insertPriv(uint32_t src_router_id,
             }
             // we need to replace a route
             op = "update";
+            trackNexthop(to_replace->second, false);
             rib.erase(to_replace);
         }
 
-        rib4_t::iterator inserted = rib.insert(MAKE_ENTRY4(route, new_entry));
+        rib4_t::iterator inserted = rib.insert(MAKE_ENTRY4(route, std::move(new_entry)));
+        trackNexthop(inserted->second, true);
 
         if (best_changed) {
             newly_inserted_is_best = candidate == &new_entry;
@@ -177,36 +263,68 @@ std::pair<const BgpRib4Entry*, bool> BgpRib4::insertPriv(uint32_t src_router_id,
 
     } else { // no older route, new one is best
         best_changed = newly_inserted_is_best = true;
-        rib4_t::iterator inserted = rib.insert(MAKE_ENTRY4(route, new_entry));
+        rib4_t::iterator inserted = rib.insert(MAKE_ENTRY4(route, std::move(new_entry)));
+        trackNexthop(inserted->second, true);
         new_best = &(inserted->second);
     }
 
     if (new_best != NULL) new_best->status = RS_ACTIVE;
+
+    stats.inserts.inc();
+    if (best_changed) stats.best_changes.inc();
     
     LIBBGP_LOG(logger, DEBUG) {
         uint32_t prefix = route.getPrefix();
         char src_router_id_str[INET_ADDRSTRLEN], prefix_str[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &src_router_id, src_router_id_str, INET_ADDRSTRLEN);
         inet_ntop(AF_INET, &prefix, prefix_str, INET_ADDRSTRLEN);
-        logger->log(DEBUG, "BgpRib4::insertPriv: (%s/%s) group %d, scope %s, route %s/%d\n", op, act, new_entry.update_id, src_router_id_str, prefix_str, route.getLength());
+        logger->log(DEBUG, "BgpRib4::insertPriv: (%s/%s) group %d, scope %s, route %s/%d\n", op, act, group, src_router_id_str, prefix_str, route.getLength());
     }
 
     return std::make_pair(new_best, newly_inserted_is_best);
 }
 
+/**
+ * @brief Get the local route group for a nexthop, create one if not exist.
+ * 
+ * @param logger Pointer to logger for the created path attributes to use.
+ * @param nexthop The nexthop.
+ * @return BgpRib4LocalGroup& The group.
+ */
+BgpRib4LocalGroup& BgpRib4::getLocalGroup(BgpLogHandler *logger, uint32_t nexthop) {
+    std::unordered_map<uint32_t, BgpRib4LocalGroup>::iterator it = local_groups.find(nexthop);
+    if (it != local_groups.end()) return it->second;
+
+    BgpRib4LocalGroup &group = local_groups[nexthop];
+    BgpPathAttribOrigin *origin = new BgpPathAttribOrigin(logger);
+    BgpPathAttribNexthop *nexhop_attr = new BgpPathAttribNexthop(logger);
+    BgpPathAttribAsPath *as_path = new BgpPathAttribAsPath(logger, true);
+    nexhop_attr->next_hop = nexthop;
+    origin->origin = IGP;
+
+    group.attribs.push_back(std::shared_ptr<BgpPathAttrib>(origin));
+    group.attribs.push_back(std::shared_ptr<BgpPathAttrib>(nexhop_attr));
+    group.attribs.push_back(std::shared_ptr<BgpPathAttrib>(as_path));
+    group.update_id = ++update_id;
+
+    return group;
+}
+
 /**
  * @brief Insert a local route into RIB.
  * 
  * Local routes are routes inserted to the RIB by user. The scope (src_router_id)
  * of local routes are 0. This method will create necessary path attribues
- * before inserting entry to RIB (AS_PATH, ORIGIN, NEXT_HOP). 
+ * before inserting entry to RIB (AS_PATH, ORIGIN, NEXT_HOP). Local routes with
+ * the same nexthop share the path attributes and the update ID.
  * 
  * The logger pointer passed in is for attribues. (so if a attribute failed to 
  * deserialize, it will print to the provided logger).
  * 
  * To remove an entry inserted with this method, use 0 as `src_router_id`.
  * 
- * This SHOULD NOT be called when the any of the upper FSM is running.
+ * Peers are not notified of the new route. To insert routes while the upper 
+ * FSMs are running, use originate().
  * 
  * @param logger Pointer to logger for the created path attributes to use. 
  * @param route Prefix4.
@@ -216,42 +334,19 @@ std::pair<const BgpRib4Entry*, bool> BgpRib4::insertPriv(uint32_t src_router_id,
  * @retval !=NULL Inserted route.
  */
 const BgpRib4Entry* BgpRib4::insert(BgpLogHandler *logger, const Prefix4 &route, uint32_t nexthop, int32_t weight) {
-    std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
-    BgpPathAttribOrigin *origin = new BgpPathAttribOrigin(logger);
-    BgpPathAttribNexthop *nexhop_attr = new BgpPathAttribNexthop(logger);
-    BgpPathAttribAsPath *as_path = new BgpPathAttribAsPath(logger, true);
-    nexhop_attr->next_hop = nexthop;
-    origin->origin = IGP;
+    std::lock_guard<BgpLock> lock(mutex);
 
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(origin));
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(nexhop_attr));
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(as_path));
-
-    uint64_t use_update_id = update_id;
-
-    for (const auto &entry : rib) {
-        if (entry.second.src_router_id == 0 && entry.second.route == route) {
-            this->logger->log(ERROR, "BgpRib4::insert: route exists.\n");
-            return NULL;
-        }
-
-        // see if we can group this entry to other local entries
-        if (entry.second.src_router_id == 0) {
-            for (const std::shared_ptr<BgpPathAttrib> &attr : entry.second.attribs) {
-                if (attr->type_code == NEXT_HOP) {
-                    const BgpPathAttribNexthop &nh = dynamic_cast<const BgpPathAttribNexthop &>(*attr);
-                    if (nh.next_hop == nexthop) use_update_id = entry.second.update_id;
-                }
-            }
-        }
+    if (find_entry(route, 0) != rib.end()) {
+        this->logger->log(ERROR, "BgpRib4::insert: route exists.\n");
+        return NULL;
     }
 
-    BgpRib4Entry new_entry(route, 0, attribs);
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    new_entry.update_id = use_update_id;
+    const BgpRib4LocalGroup &group = getLocalGroup(logger, nexthop);
+    BgpRib4Entry new_entry(route, 0, group.attribs);
+    new_entry.update_id = group.update_id;
     new_entry.weight = weight;
-    if (use_update_id == update_id) update_id++;
-    rib4_t::const_iterator it = rib.insert(MAKE_ENTRY4(route, new_entry));
+    rib4_t::const_iterator it = rib.insert(MAKE_ENTRY4(route, std::move(new_entry)));
+    stats.inserts.inc();
 
     return &(it->second);
 }
@@ -259,42 +354,36 @@ const BgpRib4Entry* BgpRib4::insert(BgpLogHandler *logger, const Prefix4 &route,
 /**
  * @brief Insert local routes into RIB.
  * 
- * ame as the other local insert, but this one insert mutiple routes.
+ * Same as the other local insert, but this one insert mutiple routes. Routes
+ * already in the RIB are skipped.
  * 
- * This SHOULD NOT be called when the any of the upper FSM is running. 
+ * Peers are not notified of the new routes. To insert routes while the upper
+ * FSMs are running, use originate().
  * 
  * @param logger Pointer to logger for the created path attributes to use. 
  * @param routes Routes.
  * @param nexthop Nexthop for the route.
  * @param weight weight of this entry.
- * @return const std::vector<const BgpRib4Entry*> Inserted routes.
+ * @return std::vector<const BgpRib4Entry*> Inserted routes.
  */
-const std::vector<BgpRib4Entry> BgpRib4::insert(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight) {
-    std::vector<BgpRib4Entry> inserted;
-    std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
-    BgpPathAttribOrigin *origin = new BgpPathAttribOrigin(logger);
-    BgpPathAttribNexthop *nexhop_attr = new BgpPathAttribNexthop(logger);
-    BgpPathAttribAsPath *as_path = new BgpPathAttribAsPath(logger, true);
-    nexhop_attr->next_hop = nexthop;
-    origin->origin = IGP;
-
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(origin));
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(nexhop_attr));
-    attribs.push_back(std::shared_ptr<BgpPathAttrib>(as_path));
+std::vector<const BgpRib4Entry*> BgpRib4::insert(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight) {
+    std::lock_guard<BgpLock> lock(mutex);
+    std::vector<const BgpRib4Entry*> inserted;
+    const BgpRib4LocalGroup &group = getLocalGroup(logger, nexthop);
 
     for (const Prefix4 &route : routes) {
         rib4_t::const_iterator it = find_entry(route, 0);
 
         if (it != rib.end()) continue;
 
-        BgpRib4Entry new_entry (route, 0, attribs);
-        new_entry.update_id = update_id;
+        BgpRib4Entry new_entry (route, 0, group.attribs);
+        new_entry.update_id = group.update_id;
         new_entry.weight = weight;
-        rib4_t::const_iterator isrt_it = rib.insert(MAKE_ENTRY4(route, new_entry));
-        inserted.push_back(isrt_it->second);
+        rib4_t::const_iterator isrt_it = rib.insert(MAKE_ENTRY4(route, std::move(new_entry)));
+        inserted.push_back(&(isrt_it->second));
+        stats.inserts.inc();
     }
 
-    update_id++;
     return inserted;
 }
 
@@ -309,8 +398,10 @@ const std::vector<BgpRib4Entry> BgpRib4::insert(BgpLogHandler *logger, const std
  * @return <const BgpRib4Entry*, bool> entry that should be send to peer. (NULL-able)
  */
 std::pair<const BgpRib4Entry*, bool> BgpRib4::insert(uint32_t src_router_id, const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight, uint32_t ibgp_asn) {
+    BgpStatsTimer timer(stats.insert_time);
+    std::lock_guard<BgpLock> lock(mutex);
     update_id++;
-    return insertPriv(src_router_id, route, attrib, weight, ibgp_asn);
+    return insertPriv(src_router_id, route, attrib, weight, ibgp_asn, update_id);
 }
 
 /**
@@ -321,17 +412,19 @@ std::pair<const BgpRib4Entry*, bool> BgpRib4::insert(uint32_t src_router_id, con
  * @param attrib Path attribs.
  * @param weight weight of this entry.
  * @param ibgp_asn ASN of the peer if the route is from an IBGP peer. 0 if not.
- * @return std::pair<std::vector<BgpRib4Entry>, std::vector<Prefix4>> pair of
+ * @return std::pair<std::vector<const BgpRib4Entry*>, std::vector<Prefix4>> pair of
  * vectors. <updated_entries, unchanged_entries>.
  */
-std::pair<std::vector<BgpRib4Entry>, std::vector<Prefix4>> BgpRib4::insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight,  uint32_t ibgp_asn) {
+std::pair<std::vector<const BgpRib4Entry*>, std::vector<Prefix4>> BgpRib4::insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight,  uint32_t ibgp_asn) {
+    BgpStatsTimer timer(stats.insert_time);
+    std::lock_guard<BgpLock> lock(mutex);
     update_id++;
-    std::vector<BgpRib4Entry> updated;
+    std::vector<const BgpRib4Entry*> updated;
     std::vector<Prefix4> unchanged;
     for (const Prefix4 &route : routes) {
-        std::pair<const BgpRib4Entry*, bool> rslt = insertPriv(src_router_id, route, attrib, weight, ibgp_asn);
+        std::pair<const BgpRib4Entry*, bool> rslt = insertPriv(src_router_id, route, attrib, weight, ibgp_asn, update_id);
         if (rslt.first != NULL) {
-            if (!rslt.second) updated.push_back(*(rslt.first));
+            if (!rslt.second) updated.push_back(rslt.first);
             else unchanged.push_back(route);
         }
     }
@@ -352,7 +445,19 @@ std::pair<std::vector<BgpRib4Entry>, std::vector<Prefix4>> BgpRib4::insert(uint3
  * the current best route.
  */
 std::pair<bool, const void*> BgpRib4::withdraw(uint32_t src_router_id, const Prefix4 &route) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    BgpStatsTimer timer(stats.withdraw_time);
+    std::lock_guard<BgpLock> lock(mutex);
+    return withdrawPriv(src_router_id, route);
+}
+
+/**
+ * @brief The actual withdraw implementation.
+ * 
+ * @param src_router_id source router ID.
+ * @param route route to withdraw.
+ * @return <bool, const void*> withdrawn information, see withdraw().
+ */
+std::pair<bool, const void*> BgpRib4::withdrawPriv(uint32_t src_router_id, const Prefix4 &route) {
     std::pair<rib4_t::iterator, rib4_t::iterator> old_entries = 
         rib.equal_range(BgpRib4EntryKey(route));
 
@@ -398,9 +503,13 @@ std::pair<bool, const void*> BgpRib4::withdraw(uint32_t src_router_id, const Pre
         op = "dropped/unreachabled";
     }
 
+    trackNexthop(to_remove->second, false);
     rib.erase(to_remove);
     if (replacement != NULL) replacement->status = RS_ACTIVE;
 
+    stats.withdraws.inc();
+    if (replacement != NULL) stats.best_changes.inc();
+
     LIBBGP_LOG(logger, DEBUG) {
         uint32_t prefix = route.getPrefix();
         char src_router_id_str[INET_ADDRSTRLEN], prefix_str[INET_ADDRSTRLEN];
@@ -412,17 +521,289 @@ std::pair<bool, const void*> BgpRib4::withdraw(uint32_t src_router_id, const Pre
     return std::pair<bool, const void*>(reachabled, replacement);
 }
 
+/**
+ * @brief Apply a batch of withdrawals and insertions.
+ * 
+ * Same as calling withdraw() and insert() for each operation in the batch, in
+ * order, but the RIB is locked once and its capacity reserved once for the
+ * whole batch, and no per-call result vectors are built. Each attribute set in
+ * the batch gets its own update ID.
+ * 
+ * Best route changes are appended to `changes`, in the order of the operations.
+ * Entries in the changes point into the RIB, see getMutex().
+ * 
+ * 
+ * - RC_NEW_BEST: an inserted route is the new best route. (`new_routes` of
+ * Route4AddEvent)
+ * - RC_BEST_CHANGED: an insert or withdraw made an entry from another BGP 
+ * speaker the best route. (`replaced_entries` of Route4AddEvent)
+ * - RC_UNREACHABLE: a withdrawn route is no longer reachable. (`routes` of 
+ * Route4WithdrawEvent)
+ * 
+ * @param src_router_id Originating BGP speaker's ID in network bytes order.
+ * @param batch The batch.
+ * @param weight weight of the inserted entries.
+ * @param ibgp_asn ASN of the peer if the routes are from an IBGP peer. 0 if 
+ * not.
+ * @param changes Where to append the best route changes to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4::apply(uint32_t src_router_id, const BgpRib4Batch &batch, int32_t weight, uint32_t ibgp_asn, BgpRibChanges<BgpRib4Entry> &changes) {
+    BgpStatsTimer timer(stats.insert_time);
+    std::lock_guard<BgpLock> lock(mutex);
+
+    size_t changes_before = changes.changes.size();
+    uint64_t first_group = update_id + 1;
+    update_id += batch.attribs.size();
+
+    // grow geometrically, so small batches don't rehash every time.
+    size_t want = rib.size() + batch.inserts;
+    if (want > rib.bucket_count() * rib.max_load_factor()) rib.reserve(want > rib.size() * 2 ? want : rib.size() * 2);
+
+    for (size_t i = 0; i < batch.ops.size(); i++) {
+        const BgpRibOp<Prefix4> &op = batch.ops[i];
+        BgpRibChange change;
+        change.op = i;
+        change.entry = 0;
+
+        if (op.attrib_set == BGP_RIB_WITHDRAW) {
+            std::pair<bool, const void*> w_ret = withdrawPriv(src_router_id, op.route);
+            if (!w_ret.first) {
+                if (w_ret.second != NULL) continue;
+                change.type = RC_UNREACHABLE;
+            } else {
+                if (w_ret.second == NULL) continue;
+                change.type = RC_BEST_CHANGED;
+                change.entry = changes.entries.size();
+                changes.entries.push_back((const BgpRib4Entry *) w_ret.second);
+            }
+        } else {
+            std::pair<const BgpRib4Entry*, bool> rslt = insertPriv(src_router_id, op.route, batch.attribs[op.attrib_set], weight, ibgp_asn, first_group + op.attrib_set);
+            if (rslt.first == NULL) continue;
+            if (rslt.second) change.type = RC_NEW_BEST;
+            else {
+                change.type = RC_BEST_CHANGED;
+                change.entry = changes.entries.size();
+                changes.entries.push_back(rslt.first);
+            }
+        }
+
+        changes.changes.push_back(change);
+    }
+
+    return changes.changes.size() - changes_before;
+}
+
+/**
+ * @brief Originate local routes.
+ * 
+ * Insert routes with nexthop as local routes (scope 0, see the local insert())
+ * and run best route selection for them, so this can be called while the 
+ * upper FSMs are running. Routes already originated with the same nexthop are
+ * skipped, routes originated with another nexthop are moved to this one.
+ * 
+ * Best route changes are appended to `changes`, with `op` being the index of
+ * the route in `routes`. See apply() for the types of changes.
+ * 
+ * @param logger Pointer to logger for the created path attributes to use. 
+ * @param routes Routes.
+ * @param nexthop Nexthop for the routes.
+ * @param weight weight of the entries.
+ * @param changes Where to append the best route changes to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4::originate(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight, BgpRibChanges<BgpRib4Entry> &changes) {
+    BgpStatsTimer timer(stats.insert_time);
+    std::lock_guard<BgpLock> lock(mutex);
+
+    size_t changes_before = changes.changes.size();
+    const BgpRib4LocalGroup &group = getLocalGroup(logger, nexthop);
+
+    // grow geometrically, so small batches don't rehash every time.
+    size_t want = rib.size() + routes.size();
+    if (want > rib.bucket_count() * rib.max_load_factor()) rib.reserve(want > rib.size() * 2 ? want : rib.size() * 2);
+
+    for (size_t i = 0; i < routes.size(); i++) {
+        const Prefix4 &route = routes[i];
+        rib4_t::const_iterator it = find_entry(route, 0);
+        if (it != rib.end() && it->second.update_id == group.update_id) continue;
+
+        std::pair<const BgpRib4Entry*, bool> rslt = insertPriv(0, route, group.attribs, weight, 0, group.update_id);
+        if (rslt.first == NULL) continue;
+
+        BgpRibChange change;
+        change.op = i;
+        change.entry = 0;
+
+        if (rslt.second) change.type = RC_NEW_BEST;
+        else {
+            change.type = RC_BEST_CHANGED;
+            change.entry = changes.entries.size();
+            changes.entries.push_back(rslt.first);
+        }
+
+        changes.changes.push_back(change);
+    }
+
+    return changes.changes.size() - changes_before;
+}
+
+/**
+ * @brief Originate local routes and announce them.
+ * 
+ * Same as the other originate(), but publish the best route changes on the
+ * event bus, in as few events as possible: one Route4AddEvent for all the 
+ * routes that became best routes and the entries that replaced them. The
+ * event is published after the RIB is unlocked.
+ * 
+ * @param logger Pointer to logger for the created path attributes to use. 
+ * @param routes Routes.
+ * @param nexthop Nexthop for the routes.
+ * @param weight weight of the entries.
+ * @param bus The event bus.
+ * @param publisher The publisher (won't receive the events), or NULL if not 
+ * subscribed to the event bus.
+ * @return size_t Number of changes published.
+ */
+size_t BgpRib4::originate(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight, RouteEventBus *bus, RouteEventReceiver *publisher) {
+    BgpRibChanges<BgpRib4Entry> changes;
+    std::vector<Route4Replacement> replaced;
+    std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
+    size_t n;
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        n = originate(logger, routes, nexthop, weight, changes);
+        attribs = local_groups[nexthop].attribs;
+        copyReplacements(changes.entries, replaced);
+    }
+
+    publish(bus, publisher, routes, &attribs, changes.changes, replaced);
+
+    return n;
+}
+
+/**
+ * @brief Retract local routes.
+ * 
+ * Withdraw local routes (scope 0) from the RIB. Routes not originated are 
+ * skipped. This can be called while the upper FSMs are running.
+ * 
+ * Best route changes are appended to `changes`, with `op` being the index of
+ * the route in `routes`. See apply() for the types of changes.
+ * 
+ * @param routes Routes.
+ * @param changes Where to append the best route changes to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRib4::retract(const std::vector<Prefix4> &routes, BgpRibChanges<BgpRib4Entry> &changes) {
+    BgpStatsTimer timer(stats.withdraw_time);
+    std::lock_guard<BgpLock> lock(mutex);
+
+    size_t changes_before = changes.changes.size();
+
+    for (size_t i = 0; i < routes.size(); i++) {
+        std::pair<bool, const void*> w_ret = withdrawPriv(0, routes[i]);
+
+        BgpRibChange change;
+        change.op = i;
+        change.entry = 0;
+
+        if (!w_ret.first) {
+            if (w_ret.second != NULL) continue;
+            change.type = RC_UNREACHABLE;
+        } else {
+            if (w_ret.second == NULL) continue;
+            change.type = RC_BEST_CHANGED;
+            change.entry = changes.entries.size();
+            changes.entries.push_back((const BgpRib4Entry *) w_ret.second);
+        }
+
+        changes.changes.push_back(change);
+    }
+
+    return changes.changes.size() - changes_before;
+}
+
+/**
+ * @brief Retract local routes and announce the withdrawals.
+ * 
+ * Same as the other retract(), but publish the best route changes on the 
+ * event bus, in as few events as possible: one Route4WithdrawEvent for the 
+ * routes no longer reachable and one Route4AddEvent for the entries that 
+ * replaced retracted routes. The events are published after the RIB is
+ * unlocked.
+ * 
+ * @param routes Routes.
+ * @param bus The event bus.
+ * @param publisher The publisher (won't receive the events), or NULL if not 
+ * subscribed to the event bus.
+ * @return size_t Number of changes published.
+ */
+size_t BgpRib4::retract(const std::vector<Prefix4> &routes, RouteEventBus *bus, RouteEventReceiver *publisher) {
+    BgpRibChanges<BgpRib4Entry> changes;
+    std::vector<Route4Replacement> replaced;
+    size_t n;
+
+    {
+        std::lock_guard<BgpLock> lock(mutex);
+        n = retract(routes, changes);
+        copyReplacements(changes.entries, replaced);
+    }
+
+    publish(bus, publisher, routes, NULL, changes.changes, replaced);
+
+    return n;
+}
+
+/**
+ * @brief Publish best route changes of local routes on an event bus.
+ * 
+ * @param bus The event bus.
+ * @param publisher The publisher.
+ * @param routes The routes, `op` of the changes index into it.
+ * @param attribs Path attributes of the new best routes.
+ * @param changes The changes.
+ * @param replaced Copies of the entries of the changes.
+ */
+void BgpRib4::publish(RouteEventBus *bus, RouteEventReceiver *publisher, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> *attribs, const std::vector<BgpRibChange> &changes, const std::vector<Route4Replacement> &replaced) {
+    std::vector<Prefix4> new_routes;
+    std::vector<Prefix4> unreachable_routes;
+
+    for (const BgpRibChange &change : changes) {
+        if (change.type == RC_NEW_BEST) new_routes.push_back(routes[change.op]);
+        else if (change.type == RC_UNREACHABLE) unreachable_routes.push_back(routes[change.op]);
+    }
+
+    if (unreachable_routes.size() > 0) {
+        Route4WithdrawEvent withdraw_ev;
+        withdraw_ev.routes = &unreachable_routes;
+        bus->publish(publisher, withdraw_ev);
+    }
+
+    if (new_routes.size() > 0 || replaced.size() > 0) {
+        Route4AddEvent add_ev;
+        if (new_routes.size() > 0) {
+            add_ev.shared_attribs = attribs;
+            add_ev.new_routes = &new_routes;
+        }
+        if (replaced.size() > 0) add_ev.replaced_entries = &replaced;
+        bus->publish(publisher, add_ev);
+    }
+}
+
 /**
  * @brief Drop all routes from RIB that originated from a BGP speaker.
  * 
  * @param src_router_id src_router_id Originating BGP speaker's ID in network bytes order.
- * @return std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> 
+ * @return std::pair<std::vector<Prefix4>, std::vector<const BgpRib4Entry*>> 
  * <dropped_routes, updated_routes> pair. dropped_routes should be send as
  * withdrawn to peers, updated_routes should be send as update to peer.
  * 
  */
-std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> BgpRib4::discard(uint32_t src_router_id) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+std::pair<std::vector<Prefix4>, std::vector<const BgpRib4Entry*>> BgpRib4::discard(uint32_t src_router_id) {
+    BgpStatsTimer timer(stats.discard_time);
+    std::lock_guard<BgpLock> lock(mutex);
     std::vector<Prefix4> reevaluate_routes;
     std::vector<Prefix4> dropped_routes;
 
@@ -443,10 +824,12 @@ std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> BgpRib4::discard(uint
             inet_ntop(AF_INET, &prefix, prefix_str, INET_ADDRSTRLEN);
             logger->log(DEBUG, "BgpRib4::discard: (%s) scope %s, route %s/%d\n", op, src_router_id_str, prefix_str, it->second.route.getLength());
         }
+        trackNexthop(it->second, false);
         it = rib.erase(it);
+        stats.discards.inc();
     }
 
-    std::vector<BgpRib4Entry> replacements;
+    std::vector<const BgpRib4Entry*> replacements;
 
     for (std::vector<Prefix4>::const_iterator it = reevaluate_routes.begin(); it != reevaluate_routes.end(); it++) {
         const char *op = "replacement found";
@@ -457,7 +840,8 @@ std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> BgpRib4::discard(uint
             op = "no available replacement";
         } else {
             replacement->second.status = RS_ACTIVE;
-            replacements.push_back(replacement->second);
+            replacements.push_back(&(replacement->second));
+            stats.best_changes.inc();
         }
 
         LIBBGP_LOG(logger, DEBUG) {
@@ -527,4 +911,105 @@ const rib4_t& BgpRib4::get() const {
     return rib;
 }
 
-}
\ No newline at end of file
+/**
+ * @brief Get the RIB lock.
+ * 
+ * Entry pointers returned by the RIB point into the RIB, and are valid until
+ * the RIB is modified. Hold this lock to keep them valid, e.g., from modifying
+ * the RIB until the entries are copied with copyReplacements(). Don't hold it
+ * while publishing route events: the receivers write to their peers.
+ * 
+ * @return BgpLock& The lock.
+ */
+BgpLock& BgpRib4::getMutex() {
+    return mutex;
+}
+
+/**
+ * @brief Copy entries out of the RIB for a route event.
+ * 
+ * The copies stay valid after the RIB is unlocked. Entries with the same
+ * update ID have the same path attributes, their copies share one copy of
+ * the attributes.
+ * 
+ * @param entries The entries. The RIB must be locked. (getMutex())
+ * @param replacements Where to append the copies to.
+ */
+void BgpRib4::copyReplacements(const std::vector<const BgpRib4Entry*> &entries, std::vector<Route4Replacement> &replacements) {
+    std::unordered_map<uint64_t, std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>>> attribs;
+    replacements.reserve(replacements.size() + entries.size());
+
+    for (const BgpRib4Entry *entry : entries) {
+        Route4Replacement replacement;
+        replacement.route = entry->route;
+        replacement.src_router_id = entry->src_router_id;
+        replacement.update_id = entry->update_id;
+        replacement.src = entry->src;
+        replacement.ibgp_peer_asn = entry->ibgp_peer_asn;
+
+        std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> &shared = attribs[entry->update_id];
+        if (!shared) shared = std::make_shared<const std::vector<std::shared_ptr<BgpPathAttrib>>>(entry->attribs);
+        replacement.attribs = shared;
+
+        replacements.push_back(replacement);
+    }
+}
+
+/**
+ * @brief Get the RIB statistics.
+ * 
+ * @return const BgpRibStats& The statistics.
+ */
+const BgpRibStats& BgpRib4::getStats() const {
+    return stats;
+}
+
+/**
+ * @brief Take a snapshot of the RIB statistics.
+ * 
+ * @param snap Where to write the snapshot to.
+ */
+void BgpRib4::getStatsSnapshot(BgpRibStatsSnapshot &snap) {
+    stats.snapshot(snap);
+    std::lock_guard<BgpLock> lock(mutex);
+    snap.entries = rib.size();
+}
+
+/**
+ * @brief Track nexthops of IBGP routes with a nexthop tracker.
+ * 
+ * IBGP routes already in the RIB are tracked right away, and routes are
+ * tracked / untracked as they are inserted, replaced, withdrawn or discarded.
+ * Routes are untracked from the old tracker, if any.
+ * 
+ * @param tracker The tracker. NULL to stop tracking.
+ */
+void BgpRib4::setNexthopTracker(BgpNexthopTracker *tracker) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    for (const auto &entry : rib) trackNexthop(entry.second, false);
+    nexthop_tracker = tracker;
+    for (const auto &entry : rib) trackNexthop(entry.second, true);
+}
+
+/**
+ * @brief Track or untrack the nexthop of an entry with the nexthop tracker,
+ * if the entry is from an IBGP peer.
+ * 
+ * @param entry The entry.
+ * @param track Track if true, untrack if false.
+ */
+void BgpRib4::trackNexthop(const BgpRib4Entry &entry, bool track) {
+    if (nexthop_tracker == NULL || entry.src != SRC_IBGP) return;
+
+    for (const std::shared_ptr<BgpPathAttrib> &attr : entry.attribs) {
+        if (attr->type_code != NEXT_HOP) continue;
+
+        const BgpPathAttribNexthop &nh = static_cast<const BgpPathAttribNexthop &>(*attr);
+        if (track) nexthop_tracker->track(nh.next_hop, entry.route, entry.src_router_id);
+        else nexthop_tracker->untrack(nh.next_hop, entry.route, entry.src_router_id);
+        return;
+    }
+}
+
+}
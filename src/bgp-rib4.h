@@ -15,13 +15,20 @@
 #include <unordered_map>
 #include <tuple>
 #include <memory>
-#include <mutex>
+#include "bgp-lock.h"
 #include "bgp-rib.h"
 #include "prefix4.h"
 #include "bgp-path-attrib.h"
+#include "bgp-stats.h"
+#include "route-event.h"
 
 namespace libbgp {
 
+/* forward */
+class RouteEventBus;
+class RouteEventReceiver;
+class BgpNexthopTracker;
+
 /**
  * @brief Key for the Rib4 entry map.
  * 
@@ -66,7 +73,7 @@ struct BgpRib4EntryHash {
 class BgpRib4Entry : public BgpRibEntry<BgpRib4Entry> {
 public:
     BgpRib4Entry ();
-    BgpRib4Entry (Prefix4 r, uint32_t src, const std::vector<std::shared_ptr<BgpPathAttrib>> attribs);
+    BgpRib4Entry (Prefix4 r, uint32_t src, const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs);
 
     /**
      * @brief The prefix of this entry.
@@ -80,17 +87,85 @@ public:
 
 typedef std::unordered_multimap<BgpRib4EntryKey, BgpRib4Entry, BgpRib4EntryHash> rib4_t;
 
+/**
+ * @brief The BgpRib4Batch class.
+ * 
+ * A batch of withdrawals and insertions from one BGP speaker, to be applied
+ * to BgpRib4 with a single BgpRib4::apply() call. A batch can hold any number
+ * of UPDATE messages' worth of routes. Routes inserted with the same attribute
+ * set are in the same update group, like the routes inserted with one 
+ * BgpRib4::insert() call.
+ * 
+ * Operations are applied in the order they were added.
+ */
+class BgpRib4Batch {
+public:
+    BgpRib4Batch();
+
+    // add a set of path attributes, returns index of the set for insert().
+    uint32_t addAttribs(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs);
+
+    // insert route(s) with an attribute set.
+    void insert(const Prefix4 &route, uint32_t attrib_set);
+    void insert(const std::vector<Prefix4> &routes, uint32_t attrib_set);
+
+    // withdraw route(s).
+    void withdraw(const Prefix4 &route);
+    void withdraw(const std::vector<Prefix4> &routes);
+
+    // remove all operations and attribute sets.
+    void clear();
+
+    /**
+     * @brief The operations.
+     * 
+     */
+    std::vector<BgpRibOp<Prefix4>> ops;
+
+    /**
+     * @brief The attribute sets.
+     * 
+     */
+    std::vector<std::vector<std::shared_ptr<BgpPathAttrib>>> attribs;
+
+    /**
+     * @brief Number of insert operations in ops.
+     * 
+     */
+    size_t inserts;
+};
+
+/**
+ * @brief A group of local routes with the same nexthop.
+ * 
+ * Local routes with the same nexthop share the update ID and the path
+ * attributes, so they can be sent to peers in the same UPDATE messages.
+ */
+struct BgpRib4LocalGroup {
+    /**
+     * @brief Update ID of the routes in the group.
+     * 
+     */
+    uint64_t update_id;
+
+    /**
+     * @brief Path attributes of the routes in the group.
+     * 
+     */
+    std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
+};
+
 /**
  * @brief The BgpRib4 (IPv4 BGP Routing Information Base) class.
  * 
  */
 class BgpRib4 : private BgpRib<BgpRib4Entry> {
 public:
-    BgpRib4(BgpLogHandler *logger);
+    BgpRib4(BgpLogHandler *logger, bool thread_safe = true);
 
-    // insert a route as local routing information base. This MUST NOT be called when FSM is running.
+    // insert a route as local routing information base. Peers are not notified, see originate().
     const BgpRib4Entry* insert(BgpLogHandler *logger, const Prefix4 &route, uint32_t nexthop, int32_t weight = 0);
-    const std::vector<BgpRib4Entry> insert(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight = 0);
+    std::vector<const BgpRib4Entry*> insert(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight = 0);
 
     // insert a new route into RIB, return BgpRib4Entry that should be send to other peers.
     // <NULL, false> if a better route is already exist
@@ -101,13 +176,33 @@ public:
     // insert new routes w/ common attribs.
     // returns a pair: <updated_routes, new_best_routes> where updated_routes is a vector
     // containing routes with different attribute then provided.
-    std::pair<std::vector<BgpRib4Entry>, std::vector<Prefix4>> insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight,  uint32_t ibgp_asn);
+    std::pair<std::vector<const BgpRib4Entry*>, std::vector<Prefix4>> insert(uint32_t src_router_id, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight,  uint32_t ibgp_asn);
 
     // remove a route from RIB
     std::pair<bool, const void*> withdraw(uint32_t src_router_id, const Prefix4 &route);
 
+    // apply a batch of withdrawals and insertions, append best route changes
+    // to changes. returns number of changes appended.
+    size_t apply(uint32_t src_router_id, const BgpRib4Batch &batch, int32_t weight, uint32_t ibgp_asn, BgpRibChanges<BgpRib4Entry> &changes);
+
+    // originate local routes w/ a nexthop, append best route changes to 
+    // changes. returns number of changes appended.
+    size_t originate(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight, BgpRibChanges<BgpRib4Entry> &changes);
+
+    // originate local routes w/ a nexthop and publish best route changes on 
+    // the event bus. returns number of changes published.
+    size_t originate(BgpLogHandler *logger, const std::vector<Prefix4> &routes, uint32_t nexthop, int32_t weight, RouteEventBus *bus, RouteEventReceiver *publisher = NULL);
+
+    // retract local routes, append best route changes to changes. returns 
+    // number of changes appended.
+    size_t retract(const std::vector<Prefix4> &routes, BgpRibChanges<BgpRib4Entry> &changes);
+
+    // retract local routes and publish best route changes on the event bus.
+    // returns number of changes published.
+    size_t retract(const std::vector<Prefix4> &routes, RouteEventBus *bus, RouteEventReceiver *publisher = NULL);
+
     // remove all routes from a peer, return <unreachabled routes, updated_routes>.
-    std::pair<std::vector<Prefix4>, std::vector<BgpRib4Entry>> discard(uint32_t src_router_id);
+    std::pair<std::vector<Prefix4>, std::vector<const BgpRib4Entry*>> discard(uint32_t src_router_id);
 
     // lookup in rib, return null if not found
     const BgpRib4Entry* lookup(uint32_t dest) const;
@@ -117,14 +212,36 @@ public:
 
     // get RIB
     const rib4_t &get() const;
+
+    // get the RIB lock. hold it to keep entry pointers from the RIB valid.
+    BgpLock& getMutex();
+
+    // copy entries out of the RIB for a route event. (with the RIB locked)
+    static void copyReplacements(const std::vector<const BgpRib4Entry*> &entries, std::vector<Route4Replacement> &replacements);
+
+    // get RIB statistics.
+    const BgpRibStats& getStats() const;
+
+    // track nexthops of IBGP routes with a nexthop tracker. NULL to stop.
+    void setNexthopTracker(BgpNexthopTracker *tracker);
+
+    // take a snapshot of RIB statistics.
+    void getStatsSnapshot(BgpRibStatsSnapshot &snap);
 private:
     rib4_t::iterator find_best (const Prefix4 &prefix);
     rib4_t::iterator find_entry (const Prefix4 &prefix, uint32_t src);
-    std::pair<const BgpRib4Entry*, bool> insertPriv(uint32_t src_router_id, const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight, uint32_t ibgp_asn);
+    std::pair<const BgpRib4Entry*, bool> insertPriv(uint32_t src_router_id, const Prefix4 &route, const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight, uint32_t ibgp_asn, uint64_t group);
+    std::pair<bool, const void*> withdrawPriv(uint32_t src_router_id, const Prefix4 &route);
+    BgpRib4LocalGroup& getLocalGroup(BgpLogHandler *logger, uint32_t nexthop);
+    void publish(RouteEventBus *bus, RouteEventReceiver *publisher, const std::vector<Prefix4> &routes, const std::vector<std::shared_ptr<BgpPathAttrib>> *attribs, const std::vector<BgpRibChange> &changes, const std::vector<Route4Replacement> &replaced);
+    void trackNexthop(const BgpRib4Entry &entry, bool track);
     rib4_t rib;
-    std::recursive_mutex mutex;
+    std::unordered_map<uint32_t, BgpRib4LocalGroup> local_groups;
+    BgpLock mutex;
     BgpLogHandler *logger;
     uint64_t update_id;
+    BgpRibStats stats;
+    BgpNexthopTracker *nexthop_tracker;
 };
 
 /**
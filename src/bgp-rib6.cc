@@ -39,9 +39,12 @@ BgpRib6Entry::BgpRib6Entry (Prefix6 r, uint32_t src, const uint8_t nexthop_globa
  * @brief Construct a new BgpRib6 object with logging.
  * 
  * @param logger Log handler to use.
+ * @param thread_safe Lock the RIB on access. If the RIB is only ever used from
+ * one thread, set to false to skip the locking. (see BgpLock)
  */
-BgpRib6::BgpRib6(BgpLogHandler *logger) {
+BgpRib6::BgpRib6(BgpLogHandler *logger, bool thread_safe) : mutex(thread_safe) {
     this->logger = logger;
+    stats.setSingleWriter(!thread_safe);
     update_id = 0;
 }
 
@@ -85,7 +88,7 @@ std::pair<const BgpRib6Entry*, bool> BgpRib6::insertPriv(uint32_t src_router_id,
     const uint8_t nexthop_global[16], const uint8_t nexthop_linklocal[16], 
     const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, 
     int32_t weight, uint32_t ibgp_asn) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    std::lock_guard<BgpLock> lock(mutex);
     BgpRib6Entry new_entry(route, src_router_id, nexthop_global, nexthop_linklocal, attribs);
     new_entry.update_id = update_id;
     new_entry.weight = weight;
@@ -152,6 +155,9 @@ std::pair<const BgpRib6Entry*, bool> BgpRib6::insertPriv(uint32_t src_router_id,
     }
 
     if (new_best != NULL) new_best->status = RS_ACTIVE;
+
+    stats.inserts.inc();
+    if (best_changed) stats.best_changes.inc();
     
     LIBBGP_LOG(logger, INFO) {
         uint8_t prefix_arr[16];
@@ -217,10 +223,11 @@ const BgpRib6Entry* BgpRib6::insert(BgpLogHandler *logger, const Prefix6 &route,
         }
     }
 
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    std::lock_guard<BgpLock> lock(mutex);
     new_entry.update_id = use_update_id;
     if (use_update_id == update_id) update_id++;
     rib6_t::const_iterator it = rib.insert(MAKE_ENTRY6(route, new_entry));
+    stats.inserts.inc();
 
     return &(it->second);
 }
@@ -237,12 +244,12 @@ const BgpRib6Entry* BgpRib6::insert(BgpLogHandler *logger, const Prefix6 &route,
  * @param nexthop_global Global IPv6 address of nexthop.
  * @param nexthop_linklocal Link local IPv6 address of nexthop. (if none, use NULL)
  * @param weight weight of this entry.
- * @return const std::vector<BgpRib6Entry*> Insert routes.
+ * @return std::vector<const BgpRib6Entry*> Insert routes.
  */
-const std::vector<BgpRib6Entry> BgpRib6::insert(BgpLogHandler *logger, 
+std::vector<const BgpRib6Entry*> BgpRib6::insert(BgpLogHandler *logger, 
         const std::vector<Prefix6> &routes, const uint8_t nexthop_global[16], 
         const uint8_t nexthop_linklocal[16], int32_t weight) {
-    std::vector<BgpRib6Entry> inserted;
+    std::vector<const BgpRib6Entry*> inserted;
     std::vector<std::shared_ptr<BgpPathAttrib>> attribs;
     BgpPathAttribOrigin *origin = new BgpPathAttribOrigin(logger);
     BgpPathAttribAsPath *as_path = new BgpPathAttribAsPath(logger, true);
@@ -260,7 +267,8 @@ const std::vector<BgpRib6Entry> BgpRib6::insert(BgpLogHandler *logger,
         new_entry.update_id = update_id;
         new_entry.weight = weight;
         rib6_t::const_iterator isrt_it = rib.insert(MAKE_ENTRY6(route, new_entry));
-        inserted.push_back(isrt_it->second);
+        inserted.push_back(&(isrt_it->second));
+        stats.inserts.inc();
     }
 
     update_id++;
@@ -293,6 +301,7 @@ std::pair<const BgpRib6Entry*, bool> BgpRib6::insert(uint32_t src_router_id,
     const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, int32_t weight,
     uint32_t ibgp_asn) {
 
+    BgpStatsTimer timer(stats.insert_time);
     update_id++;
     return insertPriv(src_router_id, route, nexthop_global, nexthop_linklocal, attribs, weight, ibgp_asn);
 }
@@ -309,17 +318,18 @@ std::pair<const BgpRib6Entry*, bool> BgpRib6::insert(uint32_t src_router_id,
  * @param ibgp_asn ASN of the peer if the route is from an IBGP peer. 0 if not.
  * @return <updated_routes, new_best_routes>
  */
-std::pair<std::vector<BgpRib6Entry>, std::vector<Prefix6>> BgpRib6::insert(
+std::pair<std::vector<const BgpRib6Entry*>, std::vector<Prefix6>> BgpRib6::insert(
     uint32_t src_router_id, const std::vector<Prefix6> &routes, 
     const uint8_t nexthop_global[16], const uint8_t nexthop_linklocal[16], 
     const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, int32_t weight, uint32_t ibgp_asn) {
+    BgpStatsTimer timer(stats.insert_time);
     update_id++;
-    std::vector<BgpRib6Entry> updated;
+    std::vector<const BgpRib6Entry*> updated;
     std::vector<Prefix6> unchanged;
     for (const Prefix6 &route : routes) {
         std::pair<const BgpRib6Entry*, bool> rslt = insertPriv(src_router_id, route, nexthop_global, nexthop_linklocal, attribs, weight, ibgp_asn);
         if (rslt.first != NULL) {
-            if (!rslt.second) updated.push_back(*(rslt.first));
+            if (!rslt.second) updated.push_back(rslt.first);
             else unchanged.push_back(route);
         }
     }
@@ -340,7 +350,8 @@ std::pair<std::vector<BgpRib6Entry>, std::vector<Prefix6>> BgpRib6::insert(
  * the current best route.
  */
 std::pair<bool, const void*> BgpRib6::withdraw(uint32_t src_router_id, const Prefix6 &route) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    BgpStatsTimer timer(stats.withdraw_time);
+    std::lock_guard<BgpLock> lock(mutex);
 
     std::pair<rib6_t::iterator, rib6_t::iterator> old_entries = 
         rib.equal_range(BgpRib6EntryKey(route));
@@ -381,6 +392,9 @@ std::pair<bool, const void*> BgpRib6::withdraw(uint32_t src_router_id, const Pre
     rib.erase(to_remove);
     if (replacement != NULL) replacement->status = RS_ACTIVE;
 
+    stats.withdraws.inc();
+    if (replacement != NULL) stats.best_changes.inc();
+
     LIBBGP_LOG(logger, INFO) {
         uint8_t prefix_arr[16];
         route.getPrefix(prefix_arr);
@@ -397,12 +411,13 @@ std::pair<bool, const void*> BgpRib6::withdraw(uint32_t src_router_id, const Pre
  * @brief Drop all routes from RIB that originated from a BGP speaker.
  * 
  * @param src_router_id src_router_id Originating BGP speaker's ID in network bytes order.
- * @return std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> 
+ * @return std::pair<std::vector<Prefix6>, std::vector<const BgpRib6Entry*>> 
  * <dropped_routes, updated_routes> pair. dropped_routes should be send as
  * withdrawn to peers, updated_routes should be send as update to peer.
  */
-std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> BgpRib6::discard(uint32_t src_router_id) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+std::pair<std::vector<Prefix6>, std::vector<const BgpRib6Entry*>> BgpRib6::discard(uint32_t src_router_id) {
+    BgpStatsTimer timer(stats.discard_time);
+    std::lock_guard<BgpLock> lock(mutex);
     /*std::vector<Prefix6> dropped_routes;
 
     for (rib6_t::const_iterator it = rib.begin(); it != rib.end();) {
@@ -442,9 +457,10 @@ std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> BgpRib6::discard(uint
             logger->log(INFO, "BgpRib6::discard: (%s) scope %s, route %s/%d\n", op, src_router_id_str, prefix_str, it->second.route.getLength());
         }
         it = rib.erase(it);
+        stats.discards.inc();
     }
 
-    std::vector<BgpRib6Entry> replacements;
+    std::vector<const BgpRib6Entry*> replacements;
 
     for (std::vector<Prefix6>::const_iterator it = reevaluate_routes.begin(); it != reevaluate_routes.end(); it++) {
         const char *op = "replacement found";
@@ -455,7 +471,8 @@ std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> BgpRib6::discard(uint
             op = "no available replacement";
         } else {
             replacement->second.status = RS_ACTIVE;
-            replacements.push_back(replacement->second);
+            replacements.push_back(&(replacement->second));
+            stats.best_changes.inc();
         }
 
         LIBBGP_LOG(logger, INFO) {
@@ -529,4 +546,70 @@ const rib6_t& BgpRib6::get() const {
     return rib;
 }
 
+/**
+ * @brief Get the RIB lock.
+ * 
+ * Entry pointers returned by the RIB point into the RIB, and are valid until
+ * the RIB is modified. Hold this lock to keep them valid, e.g., from modifying
+ * the RIB until the entries are copied with copyReplacements(). Don't hold it
+ * while publishing route events: the receivers write to their peers.
+ * 
+ * @return BgpLock& The lock.
+ */
+BgpLock& BgpRib6::getMutex() {
+    return mutex;
+}
+
+/**
+ * @brief Copy entries out of the RIB for a route event.
+ * 
+ * The copies stay valid after the RIB is unlocked. Entries with the same
+ * update ID have the same path attributes, their copies share one copy of
+ * the attributes.
+ * 
+ * @param entries The entries. The RIB must be locked. (getMutex())
+ * @param replacements Where to append the copies to.
+ */
+void BgpRib6::copyReplacements(const std::vector<const BgpRib6Entry*> &entries, std::vector<Route6Replacement> &replacements) {
+    std::unordered_map<uint64_t, std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>>> attribs;
+    replacements.reserve(replacements.size() + entries.size());
+
+    for (const BgpRib6Entry *entry : entries) {
+        Route6Replacement replacement;
+        replacement.route = entry->route;
+        replacement.src_router_id = entry->src_router_id;
+        replacement.update_id = entry->update_id;
+        replacement.src = entry->src;
+        replacement.ibgp_peer_asn = entry->ibgp_peer_asn;
+        memcpy(replacement.nexthop_global, entry->nexthop_global, 16);
+        memcpy(replacement.nexthop_linklocal, entry->nexthop_linklocal, 16);
+
+        std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> &shared = attribs[entry->update_id];
+        if (!shared) shared = std::make_shared<const std::vector<std::shared_ptr<BgpPathAttrib>>>(entry->attribs);
+        replacement.attribs = shared;
+
+        replacements.push_back(replacement);
+    }
+}
+
+/**
+ * @brief Get the RIB statistics.
+ * 
+ * @return const BgpRibStats& The statistics.
+ */
+const BgpRibStats& BgpRib6::getStats() const {
+    return stats;
+}
+
+/**
+ * @brief Take a snapshot of the RIB statistics.
+ * 
+ * @param snap Where to write the snapshot to.
+ */
+void BgpRib6::getStatsSnapshot(BgpRibStatsSnapshot &snap) {
+    stats.snapshot(snap);
+    std::lock_guard<BgpLock> lock(mutex);
+    snap.entries = rib.size();
+}
+
 }
\ No newline at end of file
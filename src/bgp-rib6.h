@@ -15,10 +15,11 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
-#include <mutex>
+#include "bgp-lock.h"
 #include "bgp-rib.h"
 #include "prefix6.h"
 #include "bgp-path-attrib.h"
+#include "bgp-stats.h"
 #include "route-event-bus.h"
 
 namespace libbgp {
@@ -97,14 +98,14 @@ typedef std::unordered_multimap<BgpRib6EntryKey, BgpRib6Entry, BgpRib6EntryHash>
  */
 class BgpRib6 : private BgpRib<BgpRib6Entry> {
 public:
-    BgpRib6(BgpLogHandler *logger);
+    BgpRib6(BgpLogHandler *logger, bool thread_safe = true);
 
     // insert a route as local routing information
     const BgpRib6Entry* insert(BgpLogHandler *logger, 
         const Prefix6 &route, const uint8_t nexthop_global[16], 
         const uint8_t nexthop_linklocal[16], int32_t weight = 0);
 
-    const std::vector<BgpRib6Entry> insert(BgpLogHandler *logger, 
+    std::vector<const BgpRib6Entry*> insert(BgpLogHandler *logger, 
         const std::vector<Prefix6> &routes, const uint8_t nexthop_global[16], 
         const uint8_t nexthop_linklocal[16], int32_t weight = 0);
 
@@ -121,7 +122,7 @@ public:
     // insert new routes w/ common attribs.
     // returns a pair: <updated_routes, new_best_routes> where updated_routes is a vector
     // containing routes with different attribute then provided.
-    std::pair<std::vector<BgpRib6Entry>, std::vector<Prefix6>> insert(
+    std::pair<std::vector<const BgpRib6Entry*>, std::vector<Prefix6>> insert(
         uint32_t src_router_id, const std::vector<Prefix6> &routes, 
         const uint8_t nexthop_global[16], const uint8_t nexthop_linklocal[16], 
         const std::vector<std::shared_ptr<BgpPathAttrib>> &attrib, int32_t weight,
@@ -131,7 +132,7 @@ public:
     std::pair<bool, const void*> withdraw(uint32_t src_router_id, const Prefix6 &route);
 
     // remove all routes from a peer, return <unreachabled routes, updated_routes>.
-    std::pair<std::vector<Prefix6>, std::vector<BgpRib6Entry>> discard(uint32_t src_router_id);
+    std::pair<std::vector<Prefix6>, std::vector<const BgpRib6Entry*>> discard(uint32_t src_router_id);
 
     // lookup in rib, return null if not found
     const BgpRib6Entry* lookup(const uint8_t dest[16]) const;
@@ -141,6 +142,18 @@ public:
 
     // get RIB
     const rib6_t &get() const;
+
+    // get the RIB lock. hold it to keep entry pointers from the RIB valid.
+    BgpLock& getMutex();
+
+    // copy entries out of the RIB for a route event. (with the RIB locked)
+    static void copyReplacements(const std::vector<const BgpRib6Entry*> &entries, std::vector<Route6Replacement> &replacements);
+
+    // get RIB statistics.
+    const BgpRibStats& getStats() const;
+
+    // take a snapshot of RIB statistics.
+    void getStatsSnapshot(BgpRibStatsSnapshot &snap);
 private:
     rib6_t::iterator find_best (const Prefix6 &prefix);
     rib6_t::iterator find_entry (const Prefix6 &prefix, uint32_t src);
@@ -152,9 +165,10 @@ private:
         int32_t weight, uint32_t ibgp_asn);
 
     rib6_t rib;
-    std::recursive_mutex mutex;
+    BgpLock mutex;
     BgpLogHandler *logger;
     uint64_t update_id;
+    BgpRibStats stats;
 };
 
 }
@@ -0,0 +1,640 @@
+/**
+ * @file bgp-rpki.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief RPKI route origin validation. (RFC 6811)
+ * @version 0.1
+ * @date 2019-09-09
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-rpki.h"
+#include "bgp-asn-codec.h"
+#include <algorithm>
+#include <arpa/inet.h>
+
+namespace libbgp {
+
+// no node / no entry.
+static const uint32_t none = 0xffffffff;
+
+// netmask of a prefix length, in host bytes order.
+static inline uint32_t hostMask(uint8_t length) {
+    return length == 0 ? 0 : 0xffffffff << (32 - length);
+}
+
+// number of leading bits a and b have in common, up to max.
+static inline uint8_t commonLength(uint32_t a, uint32_t b, uint8_t max) {
+    uint32_t diff = a ^ b;
+    uint8_t common = diff == 0 ? 32 : __builtin_clz(diff);
+    return common < max ? common : max;
+}
+
+// bit of addr right after the first pos bits. (pos < 32)
+static inline int bitAt(uint32_t addr, uint8_t pos) {
+    return (addr >> (31 - pos)) & 1;
+}
+
+struct VrpKey {
+    bool operator== (const VrpKey &other) const {
+        return prefix == other.prefix && asn == other.asn;
+    }
+
+    uint64_t prefix;
+    uint32_t asn;
+};
+
+struct VrpKeyHash {
+    std::size_t operator()(const VrpKey &key) const {
+        return key.prefix ^ ((uint64_t) key.asn << 24);
+    }
+};
+
+static inline VrpKey vrpKey(uint32_t addr, uint8_t length, uint8_t max_length, uint32_t asn) {
+    VrpKey key;
+    key.prefix = (uint64_t) addr << 16 | length << 8 | max_length;
+    key.asn = asn;
+    return key;
+}
+
+/**
+ * @brief Construct a new, empty BgpRpkiValidator.
+ *
+ * @param thread_safe Lock the validator on access. (see BgpLock)
+ */
+BgpRpkiValidator::BgpRpkiValidator(bool thread_safe) : mutex(thread_safe) {
+    n_vrps = 0;
+    n_routes = 0;
+    newNode(0, 0);
+}
+
+/**
+ * @brief Add and remove VRPs.
+ *
+ * Tracked routes under the changed VRPs are validated again. Routes whose
+ * state changed are queued for their peers, see takeChanges().
+ *
+ * @param announced VRPs to add. VRPs already present are ignored.
+ * @param withdrawn VRPs to remove. VRPs not present are ignored.
+ * @return size_t Number of tracked routes whose state changed.
+ */
+size_t BgpRpkiValidator::apply(const std::vector<BgpVrp> &announced, const std::vector<BgpVrp> &withdrawn) {
+    std::lock_guard<BgpLock> lock(mutex);
+    return applyPriv(announced, withdrawn);
+}
+
+/**
+ * @brief Replace all VRPs, e.g., after a full sync with the RPKI cache.
+ *
+ * The VRPs are compared with the current ones, so only the tracked routes
+ * under VRPs actually added or removed are validated again.
+ *
+ * @param vrps The new VRPs.
+ * @return size_t Number of tracked routes whose state changed.
+ */
+size_t BgpRpkiValidator::replace(const std::vector<BgpVrp> &vrps) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    std::unordered_set<VrpKey, VrpKeyHash> current;
+    current.reserve(n_vrps);
+
+    std::vector<BgpVrp> announced, withdrawn;
+
+    for (const BgpVrp &vrp : vrps) {
+        uint8_t length = vrp.prefix.getLength();
+        current.insert(vrpKey(ntohl(vrp.prefix.getPrefix()) & hostMask(length), length, vrp.max_length, vrp.asn));
+    }
+
+    // current VRPs not in the new set are withdrawn, the rest is kept.
+    std::unordered_set<VrpKey, VrpKeyHash> kept;
+    stack.clear();
+    stack.push_back(0);
+
+    while (stack.size() > 0) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+
+        const Node &n = nodes[node];
+        for (uint32_t v = n.vrps; v != none; v = vrps_pool[v].next) {
+            VrpKey key = vrpKey(n.addr, n.length, vrps_pool[v].max_length, vrps_pool[v].asn);
+            if (current.count(key) > 0) {
+                kept.insert(key);
+                continue;
+            }
+
+            BgpVrp vrp;
+            vrp.prefix = Prefix4(htonl(n.addr), n.length);
+            vrp.max_length = vrps_pool[v].max_length;
+            vrp.asn = vrps_pool[v].asn;
+            withdrawn.push_back(vrp);
+        }
+
+        if (n.child[0] != none) stack.push_back(n.child[0]);
+        if (n.child[1] != none) stack.push_back(n.child[1]);
+    }
+
+    for (const BgpVrp &vrp : vrps) {
+        uint8_t length = vrp.prefix.getLength();
+        if (kept.count(vrpKey(ntohl(vrp.prefix.getPrefix()) & hostMask(length), length, vrp.max_length, vrp.asn)) == 0) {
+            announced.push_back(vrp);
+        }
+    }
+
+    return applyPriv(announced, withdrawn);
+}
+
+/**
+ * @brief Validate a route.
+ *
+ * @param route The route.
+ * @param origin_as Origin AS of the route, see getOriginAs().
+ * @return BgpRpkiState The validation state.
+ */
+BgpRpkiState BgpRpkiValidator::validate(const Prefix4 &route, uint32_t origin_as) const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return validatePriv(ntohl(route.getPrefix()), route.getLength(), origin_as);
+}
+
+/**
+ * @brief Validate a route from a peer and track it.
+ *
+ * The route is validated again when VRPs covering it change. Tracking a
+ * route from the same peer again updates its origin AS.
+ *
+ * @param src_router_id The peer's BGP ID. (network bytes order)
+ * @param route The route.
+ * @param origin_as Origin AS of the route, see getOriginAs().
+ * @return BgpRpkiState The validation state.
+ */
+BgpRpkiState BgpRpkiValidator::track(uint32_t src_router_id, const Prefix4 &route, uint32_t origin_as) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint32_t addr = ntohl(route.getPrefix());
+    uint8_t length = route.getLength();
+    BgpRpkiState state = validatePriv(addr, length, origin_as);
+
+    uint32_t node = findNode(addr, length, true);
+
+    for (uint32_t r = nodes[node].routes; r != none; r = routes[r].next) {
+        if (routes[r].src_router_id != src_router_id) continue;
+        routes[r].origin_as = origin_as;
+        routes[r].state = state;
+        return state;
+    }
+
+    uint32_t entry;
+    if (free_routes.size() > 0) {
+        entry = free_routes.back();
+        free_routes.pop_back();
+    } else {
+        entry = routes.size();
+        routes.push_back(RouteEntry());
+    }
+
+    routes[entry].src_router_id = src_router_id;
+    routes[entry].origin_as = origin_as;
+    routes[entry].state = state;
+    routes[entry].next = nodes[node].routes;
+    nodes[node].routes = entry;
+    n_routes++;
+
+    return state;
+}
+
+/**
+ * @brief Stop tracking a route from a peer.
+ *
+ * @param src_router_id The peer's BGP ID. (network bytes order)
+ * @param route The route.
+ * @return true Route removed.
+ * @return false Route not tracked.
+ */
+bool BgpRpkiValidator::untrack(uint32_t src_router_id, const Prefix4 &route) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint32_t addr = ntohl(route.getPrefix());
+    uint8_t length = route.getLength();
+    uint32_t node = findNode(addr, length, false);
+    if (node == none) return false;
+
+    uint32_t *link = &(nodes[node].routes);
+    for (uint32_t r = *link; r != none; link = &(routes[r].next), r = *link) {
+        if (routes[r].src_router_id != src_router_id) continue;
+
+        *link = routes[r].next;
+        free_routes.push_back(r);
+        n_routes--;
+        pruneNode(addr, length);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Stop tracking all routes from a peer, e.g., when the session goes
+ * down. Changes queued for the peer are dropped.
+ *
+ * @param src_router_id The peer's BGP ID. (network bytes order)
+ * @return size_t Number of routes removed.
+ */
+size_t BgpRpkiValidator::untrackAll(uint32_t src_router_id) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    pending.erase(src_router_id);
+
+    std::vector<std::pair<uint32_t, uint8_t>> emptied;
+    size_t removed = 0;
+
+    stack.clear();
+    stack.push_back(0);
+
+    while (stack.size() > 0) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+
+        Node &n = nodes[node];
+        bool had_routes = n.routes != none;
+        uint32_t *link = &(n.routes);
+        for (uint32_t r = *link; r != none; r = *link) {
+            if (routes[r].src_router_id != src_router_id) {
+                link = &(routes[r].next);
+                continue;
+            }
+
+            *link = routes[r].next;
+            free_routes.push_back(r);
+            removed++;
+        }
+
+        if (had_routes && n.routes == none && n.vrps == none) emptied.push_back(std::make_pair(n.addr, n.length));
+
+        if (n.child[0] != none) stack.push_back(n.child[0]);
+        if (n.child[1] != none) stack.push_back(n.child[1]);
+    }
+
+    n_routes -= removed;
+    for (const std::pair<uint32_t, uint8_t> &prefix : emptied) pruneNode(prefix.first, prefix.second);
+
+    return removed;
+}
+
+/**
+ * @brief Get the tracked routes from a peer whose validation state changed.
+ *
+ * Changes are reported with the current state, once per route, no matter how
+ * many times the state changed since the last call.
+ *
+ * @param src_router_id The peer's BGP ID. (network bytes order)
+ * @param changes Changes to append to.
+ * @return size_t Number of changes appended.
+ */
+size_t BgpRpkiValidator::takeChanges(uint32_t src_router_id, std::vector<BgpRpkiChange> &changes) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    auto it = pending.find(src_router_id);
+    if (it == pending.end()) return 0;
+
+    size_t n_changes = 0;
+
+    for (const BgpRib4EntryKey &key : it->second) {
+        uint32_t node = findNode(ntohl(key.prefix), key.length, false);
+        if (node == none) continue;
+
+        for (uint32_t r = nodes[node].routes; r != none; r = routes[r].next) {
+            if (routes[r].src_router_id != src_router_id) continue;
+
+            BgpRpkiChange change;
+            change.route = Prefix4(key.prefix, key.length);
+            change.state = (BgpRpkiState) routes[r].state;
+            changes.push_back(change);
+            n_changes++;
+            break;
+        }
+    }
+
+    pending.erase(it);
+
+    return n_changes;
+}
+
+/**
+ * @brief Test if changes are queued for a peer.
+ *
+ * @param src_router_id The peer's BGP ID. (network bytes order)
+ * @return true Changes queued, call takeChanges().
+ * @return false No changes queued.
+ */
+bool BgpRpkiValidator::hasChanges(uint32_t src_router_id) const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return pending.count(src_router_id) > 0;
+}
+
+/**
+ * @brief Get number of VRPs.
+ *
+ * @return size_t Number of VRPs.
+ */
+size_t BgpRpkiValidator::getVrpCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return n_vrps;
+}
+
+/**
+ * @brief Get number of tracked routes.
+ *
+ * @return size_t Number of routes.
+ */
+size_t BgpRpkiValidator::getRouteCount() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return n_routes;
+}
+
+/**
+ * @brief Get the origin AS of a path. (RFC 6811)
+ *
+ * The origin AS is the last ASN of AS_PATH if the last segment is an
+ * AS_SEQUENCE. AS_TRANS is recovered from AS4_PATH.
+ *
+ * @param attribs The path attributes.
+ * @param local_asn ASN to use if AS_PATH is empty. (local route)
+ * @return uint32_t The origin AS, 0 (NONE) if the last segment is an AS_SET.
+ */
+uint32_t BgpRpkiValidator::getOriginAs(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, uint32_t local_asn) {
+    const BgpPathAttribAsPath *path = NULL;
+    const BgpPathAttribAs4Path *path4 = NULL;
+
+    for (const std::shared_ptr<BgpPathAttrib> &attr : attribs) {
+        if (attr->type_code == AS_PATH) path = static_cast<const BgpPathAttribAsPath *>(attr.get());
+        else if (attr->type_code == AS4_PATH) path4 = static_cast<const BgpPathAttribAs4Path *>(attr.get());
+    }
+
+    if (path == NULL || path->as_paths.size() == 0) return local_asn;
+
+    const BgpAsPathSegment &last = path->as_paths.back();
+    if (last.type != AS_SEQUENCE || last.value.size() == 0) return 0;
+
+    uint32_t origin = last.value.back();
+
+    if (!path->is_4b && origin == BGP_AS_TRANS && path4 != NULL && path4->as4_paths.size() > 0) {
+        const BgpAsPathSegment &last4 = path4->as4_paths.back();
+        if (last4.type != AS_SEQUENCE || last4.value.size() == 0) return 0;
+        origin = last4.value.back();
+    }
+
+    return origin;
+}
+
+// allocate a node.
+uint32_t BgpRpkiValidator::newNode(uint32_t addr, uint8_t length) {
+    uint32_t node;
+
+    if (free_nodes.size() > 0) {
+        node = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        node = nodes.size();
+        nodes.push_back(Node());
+    }
+
+    Node &n = nodes[node];
+    n.addr = addr & hostMask(length);
+    n.length = length;
+    n.child[0] = n.child[1] = none;
+    n.vrps = n.routes = none;
+
+    return node;
+}
+
+// find the node of a prefix, create it (and the glue node if needed) if
+// create is set. returns none if not found.
+uint32_t BgpRpkiValidator::findNode(uint32_t addr, uint8_t length, bool create) {
+    addr &= hostMask(length);
+    uint32_t cur = 0;
+
+    while (true) {
+        if (nodes[cur].length == length) return cur;
+
+        int bit = bitAt(addr, nodes[cur].length);
+        uint32_t next = nodes[cur].child[bit];
+
+        if (next == none) {
+            if (!create) return none;
+            uint32_t leaf = newNode(addr, length);
+            nodes[cur].child[bit] = leaf;
+            return leaf;
+        }
+
+        uint32_t next_addr = nodes[next].addr;
+        uint8_t next_length = nodes[next].length;
+        uint8_t common = commonLength(addr, next_addr, std::min(length, next_length));
+
+        if (common == next_length) {
+            cur = next;
+            continue;
+        }
+
+        if (!create) return none;
+
+        // the prefix sits between cur and next.
+        if (common == length) {
+            uint32_t mid = newNode(addr, length);
+            nodes[mid].child[bitAt(next_addr, length)] = next;
+            nodes[cur].child[bit] = mid;
+            return mid;
+        }
+
+        // the prefix and next diverge, join them with a glue node.
+        uint32_t glue = newNode(addr, common);
+        uint32_t leaf = newNode(addr, length);
+        nodes[glue].child[bitAt(addr, common)] = leaf;
+        nodes[glue].child[bitAt(next_addr, common)] = next;
+        nodes[cur].child[bit] = glue;
+        return leaf;
+    }
+}
+
+// remove the node of a prefix if it holds nothing, and the glue node above it
+// if no longer needed.
+void BgpRpkiValidator::pruneNode(uint32_t addr, uint8_t length) {
+    addr &= hostMask(length);
+
+    uint32_t path[34];
+    size_t depth = 0;
+    uint32_t cur = 0;
+    path[depth++] = cur;
+
+    while (nodes[cur].length != length) {
+        uint32_t next = nodes[cur].child[bitAt(addr, nodes[cur].length)];
+        if (next == none || nodes[next].length > length) return;
+        if (commonLength(addr, nodes[next].addr, nodes[next].length) < nodes[next].length) return;
+        cur = next;
+        path[depth++] = cur;
+    }
+
+    // never remove the root; remove nodes holding nothing with at most one
+    // child, going up while that leaves a glue node with one child.
+    while (depth > 1) {
+        uint32_t node = path[depth - 1];
+        uint32_t parent = path[depth - 2];
+        Node &n = nodes[node];
+
+        if (n.vrps != none || n.routes != none) return;
+        if (n.child[0] != none && n.child[1] != none) return;
+
+        uint32_t only = n.child[0] != none ? n.child[0] : n.child[1];
+        Node &p = nodes[parent];
+        if (p.child[0] == node) p.child[0] = only;
+        else p.child[1] = only;
+
+        free_nodes.push_back(node);
+        depth--;
+    }
+}
+
+// validate a route. (addr in host bytes order)
+BgpRpkiState BgpRpkiValidator::validatePriv(uint32_t addr, uint8_t length, uint32_t origin_as) const {
+    addr &= hostMask(length);
+
+    bool covered = false;
+    uint32_t cur = 0;
+
+    while (true) {
+        const Node &n = nodes[cur];
+
+        for (uint32_t v = n.vrps; v != none; v = vrps_pool[v].next) {
+            covered = true;
+            // AS 0 VRPs never match. (RFC 6483)
+            if (origin_as != 0 && vrps_pool[v].asn == origin_as && length <= vrps_pool[v].max_length) return RPKI_VALID;
+        }
+
+        if (n.length >= length) break;
+
+        uint32_t next = n.child[bitAt(addr, n.length)];
+        if (next == none) break;
+
+        const Node &c = nodes[next];
+        if (c.length > length || commonLength(addr, c.addr, c.length) < c.length) break;
+
+        cur = next;
+    }
+
+    return covered ? RPKI_INVALID : RPKI_NOT_FOUND;
+}
+
+// add a VRP. returns false if invalid or already present.
+bool BgpRpkiValidator::addVrp(const BgpVrp &vrp) {
+    uint8_t length = vrp.prefix.getLength();
+    if (length > 32 || vrp.max_length < length || vrp.max_length > 32) return false;
+
+    uint32_t node = findNode(ntohl(vrp.prefix.getPrefix()), length, true);
+
+    for (uint32_t v = nodes[node].vrps; v != none; v = vrps_pool[v].next) {
+        if (vrps_pool[v].asn == vrp.asn && vrps_pool[v].max_length == vrp.max_length) return false;
+    }
+
+    uint32_t entry;
+    if (free_vrps.size() > 0) {
+        entry = free_vrps.back();
+        free_vrps.pop_back();
+    } else {
+        entry = vrps_pool.size();
+        vrps_pool.push_back(VrpEntry());
+    }
+
+    vrps_pool[entry].asn = vrp.asn;
+    vrps_pool[entry].max_length = vrp.max_length;
+    vrps_pool[entry].next = nodes[node].vrps;
+    nodes[node].vrps = entry;
+    n_vrps++;
+
+    return true;
+}
+
+// remove a VRP. returns false if not present.
+bool BgpRpkiValidator::removeVrp(const BgpVrp &vrp) {
+    uint32_t addr = ntohl(vrp.prefix.getPrefix());
+    uint8_t length = vrp.prefix.getLength();
+    uint32_t node = findNode(addr, length, false);
+    if (node == none) return false;
+
+    uint32_t *link = &(nodes[node].vrps);
+    for (uint32_t v = *link; v != none; link = &(vrps_pool[v].next), v = *link) {
+        if (vrps_pool[v].asn != vrp.asn || vrps_pool[v].max_length != vrp.max_length) continue;
+
+        *link = vrps_pool[v].next;
+        free_vrps.push_back(v);
+        n_vrps--;
+        pruneNode(addr, length);
+        return true;
+    }
+
+    return false;
+}
+
+// add and remove VRPs, validate the routes under them again.
+size_t BgpRpkiValidator::applyPriv(const std::vector<BgpVrp> &announced, const std::vector<BgpVrp> &withdrawn) {
+    std::vector<std::pair<uint32_t, uint8_t>> changed;
+
+    for (const BgpVrp &vrp : withdrawn) {
+        if (!removeVrp(vrp)) continue;
+        uint8_t length = vrp.prefix.getLength();
+        changed.push_back(std::make_pair(ntohl(vrp.prefix.getPrefix()) & hostMask(length), length));
+    }
+
+    for (const BgpVrp &vrp : announced) {
+        if (!addVrp(vrp)) continue;
+        uint8_t length = vrp.prefix.getLength();
+        changed.push_back(std::make_pair(ntohl(vrp.prefix.getPrefix()) & hostMask(length), length));
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    size_t n_changes = 0;
+    for (const std::pair<uint32_t, uint8_t> &prefix : changed) n_changes += revalidate(prefix.first, prefix.second);
+
+    return n_changes;
+}
+
+// validate tracked routes under a prefix again, queue the changed ones.
+size_t BgpRpkiValidator::revalidate(uint32_t addr, uint8_t length) {
+    uint32_t cur = 0;
+
+    // find the top node inside the prefix.
+    while (nodes[cur].length < length) {
+        uint32_t next = nodes[cur].child[bitAt(addr, nodes[cur].length)];
+        if (next == none) return 0;
+
+        uint8_t max = std::min(length, nodes[next].length);
+        if (commonLength(addr, nodes[next].addr, max) < max) return 0;
+
+        cur = next;
+    }
+
+    size_t n_changes = 0;
+    stack.clear();
+    stack.push_back(cur);
+
+    while (stack.size() > 0) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+
+        for (uint32_t r = nodes[node].routes; r != none; r = routes[r].next) {
+            RouteEntry &route = routes[r];
+            uint8_t state = validatePriv(nodes[node].addr, nodes[node].length, route.origin_as);
+            if (state == route.state) continue;
+
+            route.state = state;
+            pending[route.src_router_id].insert(BgpRib4EntryKey(htonl(nodes[node].addr), nodes[node].length));
+            n_changes++;
+        }
+
+        if (nodes[node].child[0] != none) stack.push_back(nodes[node].child[0]);
+        if (nodes[node].child[1] != none) stack.push_back(nodes[node].child[1]);
+    }
+
+    return n_changes;
+}
+
+}
@@ -0,0 +1,201 @@
+/**
+ * @file bgp-rpki.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief RPKI route origin validation. (RFC 6811)
+ * @version 0.1
+ * @date 2019-09-09
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_RPKI_H_
+#define BGP_RPKI_H_
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "bgp-lock.h"
+#include "bgp-rib4.h"
+#include "bgp-path-attrib.h"
+#include "prefix4.h"
+
+namespace libbgp {
+
+/**
+ * @brief Route origin validation state. (RFC 6811)
+ *
+ */
+enum BgpRpkiState {
+    /**
+     * @brief No VRP covers the route.
+     *
+     */
+    RPKI_NOT_FOUND = 0,
+
+    /**
+     * @brief A VRP covering the route matches its origin AS and length.
+     *
+     */
+    RPKI_VALID = 1,
+
+    /**
+     * @brief VRPs cover the route, but none of them matches.
+     *
+     */
+    RPKI_INVALID = 2
+};
+
+/**
+ * @brief A validated ROA payload.
+ *
+ */
+struct BgpVrp {
+    /**
+     * @brief The prefix.
+     *
+     */
+    Prefix4 prefix;
+
+    /**
+     * @brief Max length of routes the VRP matches.
+     *
+     */
+    uint8_t max_length;
+
+    /**
+     * @brief The origin AS.
+     *
+     */
+    uint32_t asn;
+};
+
+/**
+ * @brief A route whose validation state changed.
+ *
+ */
+struct BgpRpkiChange {
+    /**
+     * @brief The route.
+     *
+     */
+    Prefix4 route;
+
+    /**
+     * @brief The new state.
+     *
+     */
+    BgpRpkiState state;
+};
+
+/**
+ * @brief The BgpRpkiValidator class.
+ *
+ * Holds IPv4 VRPs in a path-compressed binary trie. A route is validated by
+ * walking down the trie once, visiting only the VRPs covering it.
+ *
+ * The validator also keeps the validated routes of every peer in the same
+ * trie, with their origin AS and state. When VRPs change with apply() or
+ * replace(), only the routes under the changed VRP prefixes are validated
+ * again, and routes whose state changed are queued for the peer they came
+ * from. Call takeChanges() to get them.
+ *
+ * BgpFsm does all this when BgpConfig::rpki is set. BgpRtrClient keeps the
+ * VRPs in sync with an RPKI cache.
+ */
+class BgpRpkiValidator {
+public:
+    BgpRpkiValidator(bool thread_safe = true);
+
+    // add and remove VRPs, queue changes for the tracked routes affected.
+    // returns number of tracked routes whose state changed.
+    size_t apply(const std::vector<BgpVrp> &announced, const std::vector<BgpVrp> &withdrawn);
+
+    // replace all VRPs, queue changes for the tracked routes affected. returns
+    // number of tracked routes whose state changed.
+    size_t replace(const std::vector<BgpVrp> &vrps);
+
+    // validate a route.
+    BgpRpkiState validate(const Prefix4 &route, uint32_t origin_as) const;
+
+    // validate and track a route from a peer, returns the state.
+    BgpRpkiState track(uint32_t src_router_id, const Prefix4 &route, uint32_t origin_as);
+
+    // stop tracking a route from a peer.
+    bool untrack(uint32_t src_router_id, const Prefix4 &route);
+
+    // stop tracking all routes from a peer, drop its queued changes.
+    size_t untrackAll(uint32_t src_router_id);
+
+    // get queued changes of routes from a peer, append them to changes.
+    // returns number of changes appended.
+    size_t takeChanges(uint32_t src_router_id, std::vector<BgpRpkiChange> &changes);
+
+    // any changes queued for the peer?
+    bool hasChanges(uint32_t src_router_id) const;
+
+    // get number of VRPs.
+    size_t getVrpCount() const;
+
+    // get number of tracked routes.
+    size_t getRouteCount() const;
+
+    // get the origin AS of a path. (local_asn for empty path, 0 for NONE)
+    static uint32_t getOriginAs(const std::vector<std::shared_ptr<BgpPathAttrib>> &attribs, uint32_t local_asn);
+
+private:
+    BgpRpkiValidator(const BgpRpkiValidator &);
+    BgpRpkiValidator& operator= (const BgpRpkiValidator &);
+
+    struct Node {
+        uint32_t addr;
+        uint32_t child[2];
+        uint32_t vrps;
+        uint32_t routes;
+        uint8_t length;
+    };
+
+    struct VrpEntry {
+        uint32_t asn;
+        uint32_t next;
+        uint8_t max_length;
+    };
+
+    struct RouteEntry {
+        uint32_t src_router_id;
+        uint32_t origin_as;
+        uint32_t next;
+        uint8_t state;
+    };
+
+    uint32_t newNode(uint32_t addr, uint8_t length);
+    uint32_t findNode(uint32_t addr, uint8_t length, bool create);
+    void pruneNode(uint32_t addr, uint8_t length);
+    BgpRpkiState validatePriv(uint32_t addr, uint8_t length, uint32_t origin_as) const;
+    bool addVrp(const BgpVrp &vrp);
+    bool removeVrp(const BgpVrp &vrp);
+    size_t applyPriv(const std::vector<BgpVrp> &announced, const std::vector<BgpVrp> &withdrawn);
+    size_t revalidate(uint32_t addr, uint8_t length);
+
+    // trie, node 0 is 0.0.0.0/0. addresses are in host bytes order.
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::vector<VrpEntry> vrps_pool;
+    std::vector<uint32_t> free_vrps;
+    std::vector<RouteEntry> routes;
+    std::vector<uint32_t> free_routes;
+    size_t n_vrps;
+    size_t n_routes;
+
+    // routes with changed state, per peer.
+    std::unordered_map<uint32_t, std::unordered_set<BgpRib4EntryKey, BgpRib4EntryHash>> pending;
+
+    // scratch for revalidate().
+    std::vector<uint32_t> stack;
+
+    mutable BgpLock mutex;
+};
+
+}
+
+#endif // BGP_RPKI_H_
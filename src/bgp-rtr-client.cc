@@ -0,0 +1,519 @@
+/**
+ * @file bgp-rtr-client.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief The RPKI to Router protocol client. (RFC 8210)
+ * @version 0.1
+ * @date 2019-09-09
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-rtr-client.h"
+#include "realtime-clock.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+namespace libbgp {
+
+// read a 16/32 bits value in network bytes order.
+static inline uint16_t readShort(const uint8_t *buffer) {
+    uint16_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohs(value);
+}
+
+static inline uint32_t readLong(const uint8_t *buffer) {
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohl(value);
+}
+
+// write a PDU header, returns pointer past it.
+static inline uint8_t* writeHeader(uint8_t *buffer, uint8_t version, uint8_t type, uint16_t field, uint32_t length) {
+    buffer[0] = version;
+    buffer[1] = type;
+    uint16_t field_n = htons(field);
+    uint32_t length_n = htonl(length);
+    memcpy(buffer + 2, &field_n, sizeof(field_n));
+    memcpy(buffer + 4, &length_n, sizeof(length_n));
+    return buffer + 8;
+}
+
+/**
+ * @brief Construct a new BgpRtrClient.
+ *
+ * @param validator The validator to keep VRPs in.
+ * @param out_handler Handler to write PDUs to the cache with.
+ * @param clock Clock for the timers. (NULL to use a RealtimeClock)
+ * @param logger Log handler. (NULL to log to stderr)
+ */
+BgpRtrClient::BgpRtrClient(BgpRpkiValidator *validator, BgpOutHandler *out_handler, Clock *clock, BgpLogHandler *logger) {
+    this->validator = validator;
+    this->out_handler = out_handler;
+
+    if (clock == NULL) {
+        this->clock = new RealtimeClock();
+        clock_local = true;
+    } else {
+        this->clock = clock;
+        clock_local = false;
+    }
+
+    if (logger == NULL) {
+        this->logger = new BgpLogHandler();
+        log_local = true;
+    } else {
+        this->logger = logger;
+        log_local = false;
+    }
+
+    state = RTR_IDLE;
+    version = 1;
+    version_agreed = false;
+    has_data = false;
+    resetting = false;
+    session_id = 0;
+    serial = 0;
+
+    // defaults of RFC 8210, section 6.
+    refresh_interval = 3600;
+    retry_interval = 600;
+    expire_interval = 7200;
+
+    next_query = UINT64_MAX;
+    expire_at = UINT64_MAX;
+}
+
+BgpRtrClient::~BgpRtrClient() {
+    if (clock_local) delete clock;
+    if (log_local) delete logger;
+}
+
+/**
+ * @brief Start a session with the cache.
+ *
+ * Call this once connected. A Serial Query is sent if VRPs from an earlier
+ * session are still valid, otherwise a Reset Query.
+ *
+ * @return int Result.
+ * @retval -1 Failed to write to the out handler.
+ * @retval 1 Query sent.
+ */
+int BgpRtrClient::start() {
+    resetHard();
+    return sendQuery(!has_data);
+}
+
+/**
+ * @brief Pass bytes received from the cache to the client.
+ *
+ * PDUs may be split across calls. VRP changes are applied to the validator
+ * when End of Data is received.
+ *
+ * @param buffer Bytes received.
+ * @param length Number of bytes.
+ * @return int Result.
+ * @retval -1 Fatal error: the cache sent an error, or a bad PDU (an Error
+ * Report has been sent). Close the connection.
+ * @retval 0 The cache wants an older protocol version. Reconnect and call
+ * start() again.
+ * @retval 1 Success.
+ */
+int BgpRtrClient::run(const uint8_t *buffer, size_t length) {
+    const uint8_t *data = buffer;
+    size_t data_left = length;
+
+    // finish partial PDU first.
+    if (in_buffer.size() > 0) {
+        in_buffer.insert(in_buffer.end(), buffer, buffer + length);
+        data = in_buffer.data();
+        data_left = in_buffer.size();
+    }
+
+    while (data_left >= 8) {
+        uint32_t pdu_length = readLong(data + 4);
+
+        if (pdu_length < 8 || pdu_length > BGP_RTR_MAX_PDU_SIZE) {
+            logger->log(ERROR, "BgpRtrClient::run: bad PDU length %u.\n", pdu_length);
+            sendError(RTR_E_CORRUPT_DATA, data, 8, "bad PDU length");
+            resetHard();
+            return -1;
+        }
+
+        if (data_left < pdu_length) break;
+
+        int ret = handlePdu(data, pdu_length);
+        if (ret <= 0) {
+            resetHard();
+            return ret;
+        }
+
+        data += pdu_length;
+        data_left -= pdu_length;
+    }
+
+    if (data_left == 0) {
+        in_buffer.clear();
+        return 1;
+    }
+
+    // keep the partial PDU.
+    if (in_buffer.size() > 0) in_buffer.erase(in_buffer.begin(), in_buffer.end() - data_left);
+    else in_buffer.assign(data, data + data_left);
+
+    return 1;
+}
+
+/**
+ * @brief Send queries when the refresh / retry timer expires, and drop the
+ * VRPs if no sync happened before the expire timer.
+ *
+ * @return int Result.
+ * @retval -1 Failed to write to the out handler.
+ * @retval 1 Success.
+ */
+int BgpRtrClient::tick() {
+    uint64_t now = clock->getTimeMs();
+
+    if (has_data && now >= expire_at) {
+        logger->log(WARN, "BgpRtrClient::tick: VRPs expired, dropping them.\n");
+        validator->replace(std::vector<BgpVrp>());
+        has_data = false;
+        expire_at = UINT64_MAX;
+    }
+
+    if (state == RTR_SYNCED && now >= next_query) return sendQuery(!has_data);
+
+    return 1;
+}
+
+/**
+ * @brief Get the time tick() should be called next.
+ *
+ * @return uint64_t Time in milliseconds, UINT64_MAX if there is nothing to do.
+ */
+uint64_t BgpRtrClient::getNextTick() const {
+    uint64_t next = UINT64_MAX;
+
+    if (has_data) next = expire_at;
+    if (state == RTR_SYNCED && next_query < next) next = next_query;
+
+    return next;
+}
+
+/**
+ * @brief Connection to the cache lost. Partial PDUs and updates are dropped.
+ * The VRPs are kept in the validator until they expire.
+ *
+ */
+void BgpRtrClient::resetHard() {
+    state = RTR_IDLE;
+    version_agreed = false;
+    resetting = false;
+    next_query = UINT64_MAX;
+    in_buffer.clear();
+    std::vector<BgpVrp>().swap(announced);
+    std::vector<BgpVrp>().swap(withdrawn);
+}
+
+/**
+ * @brief Get client state.
+ *
+ * @return BgpRtrState The state.
+ */
+BgpRtrState BgpRtrClient::getState() const {
+    return state;
+}
+
+/**
+ * @brief Get protocol version in use.
+ *
+ * @return uint8_t The version.
+ */
+uint8_t BgpRtrClient::getVersion() const {
+    return version;
+}
+
+/**
+ * @brief Get session ID of the cache.
+ *
+ * @return uint16_t The session ID.
+ */
+uint16_t BgpRtrClient::getSessionId() const {
+    return session_id;
+}
+
+/**
+ * @brief Get serial number of the VRPs.
+ *
+ * @return uint32_t The serial number.
+ */
+uint32_t BgpRtrClient::getSerial() const {
+    return serial;
+}
+
+/**
+ * @brief Test if there are VRPs from the cache, not yet expired.
+ *
+ * @return true VRPs synced.
+ * @return false No VRPs.
+ */
+bool BgpRtrClient::hasData() const {
+    return has_data;
+}
+
+// handle a complete PDU. returns -1 on fatal error, 0 to reconnect, 1
+// otherwise.
+int BgpRtrClient::handlePdu(const uint8_t *pdu, size_t length) {
+    uint8_t pdu_version = pdu[0];
+    uint8_t type = pdu[1];
+    uint16_t field = readShort(pdu + 2);
+
+    if (type == RTR_ERROR_REPORT) return handleError(pdu, length);
+
+    if (pdu_version != version) {
+        // a cache of an older version answers with its version.
+        if (!version_agreed && pdu_version < version && state == RTR_QUERY_SENT) {
+            logger->log(INFO, "BgpRtrClient::handlePdu: cache uses version %d.\n", pdu_version);
+            version = pdu_version;
+        } else {
+            logger->log(ERROR, "BgpRtrClient::handlePdu: unexpected version %d (using %d).\n", pdu_version, version);
+            sendError(RTR_E_UNEXPECTED_VERSION, pdu, length, "unexpected protocol version");
+            return -1;
+        }
+    }
+
+    version_agreed = true;
+
+    switch (type) {
+        case RTR_SERIAL_NOTIFY: {
+            if (length != 12) break;
+
+            // cache restarted, or has new data.
+            if (state != RTR_SYNCED) return 1;
+            if (!has_data || field != session_id) return sendQuery(true);
+            if (readLong(pdu + 8) != serial) return sendQuery(false);
+
+            return 1;
+        }
+        case RTR_CACHE_RESPONSE: {
+            if (length != 8) break;
+
+            if (state != RTR_QUERY_SENT) {
+                logger->log(ERROR, "BgpRtrClient::handlePdu: unexpected Cache Response.\n");
+                sendError(RTR_E_CORRUPT_DATA, pdu, length, "unexpected cache response");
+                return -1;
+            }
+
+            if (!resetting && field != session_id) {
+                logger->log(ERROR, "BgpRtrClient::handlePdu: session ID changed (%d to %d).\n", session_id, field);
+                sendError(RTR_E_CORRUPT_DATA, pdu, length, "session id changed");
+                return -1;
+            }
+
+            session_id = field;
+            state = RTR_RECEIVING;
+            announced.clear();
+            withdrawn.clear();
+
+            return 1;
+        }
+        case RTR_IPV4_PREFIX: {
+            if (length != 20) break;
+            if (state != RTR_RECEIVING) break;
+
+            uint8_t flags = pdu[8];
+            uint8_t prefix_length = pdu[9];
+            uint8_t max_length = pdu[10];
+
+            if (prefix_length > 32 || max_length > 32 || max_length < prefix_length) {
+                logger->log(ERROR, "BgpRtrClient::handlePdu: bad IPv4 prefix length %d, max length %d.\n", prefix_length, max_length);
+                sendError(RTR_E_CORRUPT_DATA, pdu, length, "bad prefix length");
+                return -1;
+            }
+
+            uint32_t prefix;
+            memcpy(&prefix, pdu + 12, sizeof(prefix));
+
+            BgpVrp vrp;
+            vrp.prefix = Prefix4(prefix, prefix_length);
+            vrp.max_length = max_length;
+            vrp.asn = readLong(pdu + 16);
+
+            // a reset starts from nothing, withdrawals make no sense there.
+            if (flags & 0x01) announced.push_back(vrp);
+            else if (!resetting) withdrawn.push_back(vrp);
+
+            return 1;
+        }
+        case RTR_IPV6_PREFIX: {
+            if (length != 32) break;
+            if (state != RTR_RECEIVING) break;
+
+            // not used.
+            return 1;
+        }
+        case RTR_END_OF_DATA:
+            return handleEndOfData(pdu, length);
+        case RTR_CACHE_RESET: {
+            if (length != 8) break;
+
+            // cache can't do incremental update.
+            if (state != RTR_QUERY_SENT) break;
+            logger->log(INFO, "BgpRtrClient::handlePdu: cache reset, sending reset query.\n");
+            return sendQuery(true);
+        }
+        case RTR_ROUTER_KEY: {
+            if (version == 0) {
+                logger->log(ERROR, "BgpRtrClient::handlePdu: Router Key in version 0.\n");
+                sendError(RTR_E_UNSUPPORTED_PDU, pdu, length, "router key in version 0");
+                return -1;
+            }
+
+            if (state != RTR_RECEIVING) break;
+
+            // not used.
+            return 1;
+        }
+        default:
+            logger->log(ERROR, "BgpRtrClient::handlePdu: unsupported PDU type %d.\n", type);
+            sendError(RTR_E_UNSUPPORTED_PDU, pdu, length, "unsupported pdu type");
+            return -1;
+    }
+
+    logger->log(ERROR, "BgpRtrClient::handlePdu: bad PDU (type %d, length %zu, state %d).\n", type, length, state);
+    sendError(RTR_E_CORRUPT_DATA, pdu, length, "bad pdu");
+    return -1;
+}
+
+// handle End of Data: apply the VRPs received to the validator.
+int BgpRtrClient::handleEndOfData(const uint8_t *pdu, size_t length) {
+    if (length != (version == 0 ? 12u : 24u) || state != RTR_RECEIVING || readShort(pdu + 2) != session_id) {
+        logger->log(ERROR, "BgpRtrClient::handleEndOfData: bad End of Data (length %zu, state %d).\n", length, state);
+        sendError(RTR_E_CORRUPT_DATA, pdu, length, "bad end of data");
+        return -1;
+    }
+
+    serial = readLong(pdu + 8);
+
+    if (version > 0) {
+        // ranges of RFC 8210, section 6.
+        uint32_t refresh = readLong(pdu + 12);
+        uint32_t retry = readLong(pdu + 16);
+        uint32_t expire = readLong(pdu + 20);
+
+        if (refresh >= 1 && refresh <= 86400) refresh_interval = refresh;
+        if (retry >= 1 && retry <= 7200) retry_interval = retry;
+        if (expire >= 600 && expire <= 172800) expire_interval = expire;
+    }
+
+    size_t changed;
+    if (resetting) changed = validator->replace(announced);
+    else changed = validator->apply(announced, withdrawn);
+
+    logger->log(INFO, "BgpRtrClient::handleEndOfData: serial %u: %zu announced, %zu withdrawn, %zu routes changed state.\n", serial, announced.size(), withdrawn.size(), changed);
+
+    // a reset may have been big.
+    std::vector<BgpVrp>().swap(announced);
+    std::vector<BgpVrp>().swap(withdrawn);
+
+    uint64_t now = clock->getTimeMs();
+    has_data = true;
+    resetting = false;
+    state = RTR_SYNCED;
+    next_query = now + (uint64_t) refresh_interval * 1000;
+    expire_at = now + (uint64_t) expire_interval * 1000;
+
+    return 1;
+}
+
+// handle Error Report from the cache. never answered with an Error Report.
+int BgpRtrClient::handleError(const uint8_t *pdu, size_t length) {
+    uint16_t code = readShort(pdu + 2);
+
+    // the text is only for the log.
+    char text[256] = "";
+    if (length >= 16) {
+        uint32_t pdu_length = readLong(pdu + 8);
+        if (pdu_length <= length - 16) {
+            uint32_t text_length = readLong(pdu + 12 + pdu_length);
+            if (text_length <= length - 16 - pdu_length) {
+                size_t copy = text_length < sizeof(text) - 1 ? text_length : sizeof(text) - 1;
+                memcpy(text, pdu + 16 + pdu_length, copy);
+                text[copy] = 0;
+            }
+        }
+    }
+
+    if (code == RTR_E_UNSUPPORTED_VERSION && !version_agreed && version > 0) {
+        logger->log(WARN, "BgpRtrClient::handleError: cache does not support version %d, downgrading.\n", version);
+        version--;
+        return 0;
+    }
+
+    if (code == RTR_E_NO_DATA) {
+        logger->log(WARN, "BgpRtrClient::handleError: cache has no data, retry in %u seconds.\n", retry_interval);
+        version_agreed = true;
+        resetting = false;
+        state = RTR_SYNCED;
+        next_query = clock->getTimeMs() + (uint64_t) retry_interval * 1000;
+        return 1;
+    }
+
+    logger->log(ERROR, "BgpRtrClient::handleError: error %d from cache: %s\n", code, text);
+    return -1;
+}
+
+// send a Reset Query, or a Serial Query with the current session and serial.
+int BgpRtrClient::sendQuery(bool reset) {
+    uint8_t pdu[12];
+    size_t length;
+
+    if (reset) {
+        writeHeader(pdu, version, RTR_RESET_QUERY, 0, 8);
+        length = 8;
+    } else {
+        uint8_t *ptr = writeHeader(pdu, version, RTR_SERIAL_QUERY, session_id, 12);
+        uint32_t serial_n = htonl(serial);
+        memcpy(ptr, &serial_n, sizeof(serial_n));
+        length = 12;
+    }
+
+    resetting = reset;
+    state = RTR_QUERY_SENT;
+    next_query = UINT64_MAX;
+
+    logger->log(DEBUG, "BgpRtrClient::sendQuery: sending %s query.\n", reset ? "reset" : "serial");
+    return writePdu(pdu, length) ? 1 : -1;
+}
+
+// send an Error Report with the erroneous PDU. returns -1 if failed to write,
+// 1 otherwise.
+int BgpRtrClient::sendError(BgpRtrErrorCode code, const uint8_t *pdu, size_t pdu_length, const char *text) {
+    size_t text_length = strlen(text);
+    std::vector<uint8_t> buffer(16 + pdu_length + text_length);
+
+    uint8_t *ptr = writeHeader(buffer.data(), version, RTR_ERROR_REPORT, code, buffer.size());
+    uint32_t length_n = htonl(pdu_length);
+    memcpy(ptr, &length_n, sizeof(length_n));
+    ptr += sizeof(length_n);
+    memcpy(ptr, pdu, pdu_length);
+    ptr += pdu_length;
+    length_n = htonl(text_length);
+    memcpy(ptr, &length_n, sizeof(length_n));
+    ptr += sizeof(length_n);
+    memcpy(ptr, text, text_length);
+
+    return writePdu(buffer.data(), buffer.size()) ? 1 : -1;
+}
+
+bool BgpRtrClient::writePdu(const uint8_t *pdu, size_t length) {
+    if (!out_handler->handleOut(pdu, length)) {
+        logger->log(ERROR, "BgpRtrClient::writePdu: out handler failed.\n");
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,192 @@
+/**
+ * @file bgp-rtr-client.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief The RPKI to Router protocol client. (RFC 8210)
+ * @version 0.1
+ * @date 2019-09-09
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_RTR_CLIENT_H_
+#define BGP_RTR_CLIENT_H_
+
+// max length of a PDU accepted from the cache.
+#define BGP_RTR_MAX_PDU_SIZE 65536
+
+#include <stdint.h>
+#include <vector>
+#include "clock.h"
+#include "bgp-rpki.h"
+#include "bgp-out-handler.h"
+#include "bgp-log-handler.h"
+
+namespace libbgp {
+
+/**
+ * @brief RTR PDU types.
+ *
+ */
+enum BgpRtrPduType {
+    RTR_SERIAL_NOTIFY = 0,
+    RTR_SERIAL_QUERY = 1,
+    RTR_RESET_QUERY = 2,
+    RTR_CACHE_RESPONSE = 3,
+    RTR_IPV4_PREFIX = 4,
+    RTR_IPV6_PREFIX = 6,
+    RTR_END_OF_DATA = 7,
+    RTR_CACHE_RESET = 8,
+    RTR_ROUTER_KEY = 9,
+    RTR_ERROR_REPORT = 10
+};
+
+/**
+ * @brief RTR error codes.
+ *
+ */
+enum BgpRtrErrorCode {
+    RTR_E_CORRUPT_DATA = 0,
+    RTR_E_INTERNAL = 1,
+    RTR_E_NO_DATA = 2,
+    RTR_E_INVALID_REQUEST = 3,
+    RTR_E_UNSUPPORTED_VERSION = 4,
+    RTR_E_UNSUPPORTED_PDU = 5,
+    RTR_E_UNKNOWN_WITHDRAWAL = 6,
+    RTR_E_DUPLICATE_ANNOUNCEMENT = 7,
+    RTR_E_UNEXPECTED_VERSION = 8
+};
+
+/**
+ * @brief RTR client status.
+ *
+ */
+enum BgpRtrState {
+    /**
+     * @brief Not connected, or start() not called yet.
+     *
+     */
+    RTR_IDLE,
+
+    /**
+     * @brief Reset / Serial Query sent, waiting for Cache Response.
+     *
+     */
+    RTR_QUERY_SENT,
+
+    /**
+     * @brief Cache Response received, receiving payloads until End of Data.
+     *
+     */
+    RTR_RECEIVING,
+
+    /**
+     * @brief In sync with the cache, waiting for refresh or Serial Notify.
+     *
+     */
+    RTR_SYNCED
+};
+
+/**
+ * @brief The BgpRtrClient class.
+ *
+ * Keeps the VRPs of a BgpRpkiValidator in sync with an RPKI cache. The
+ * client does not do any IO: like BgpFsm, bytes received from the cache are
+ * passed to run(), and PDUs to send are written to the BgpOutHandler.
+ *
+ * The first sync after start() is a full reset, which replaces all VRPs in
+ * the validator. Later syncs are incremental: the announced and withdrawn
+ * VRPs are collected until End of Data, and applied to the validator at once,
+ * so only the routes affected by the delta are validated again.
+ *
+ * Only IPv4 prefixes are used. IPv6 prefixes and router keys are skipped.
+ * Protocol version 1 is tried first, and version 0 is used if the cache
+ * doesn't support it.
+ *
+ * The client is not thread safe; call it from one thread.
+ */
+class BgpRtrClient {
+public:
+    BgpRtrClient(BgpRpkiValidator *validator, BgpOutHandler *out_handler, Clock *clock = NULL, BgpLogHandler *logger = NULL);
+    ~BgpRtrClient();
+
+    // connected to the cache, send the first query. returns -1 if failed to
+    // write, 1 otherwise.
+    int start();
+
+    // pass bytes received from the cache to the client.
+    // returns -1 on fatal error (an Error Report may have been sent, close the
+    // connection), 0 if the connection should be closed, and start() called
+    // again after reconnect, 1 otherwise.
+    int run(const uint8_t *buffer, size_t length);
+
+    // send queries on timers, drop VRPs once expired. returns -1 if failed to
+    // write, 1 otherwise.
+    int tick();
+
+    // get the time tick() has something to do, in milliseconds.
+    uint64_t getNextTick() const;
+
+    // connection lost. VRPs are kept until they expire.
+    void resetHard();
+
+    // get client state.
+    BgpRtrState getState() const;
+
+    // get protocol version in use.
+    uint8_t getVersion() const;
+
+    // get session ID of the cache.
+    uint16_t getSessionId() const;
+
+    // get serial number of the VRPs.
+    uint32_t getSerial() const;
+
+    // any VRPs from the cache, not yet expired?
+    bool hasData() const;
+
+private:
+    BgpRtrClient(const BgpRtrClient &);
+    BgpRtrClient& operator= (const BgpRtrClient &);
+
+    int handlePdu(const uint8_t *pdu, size_t length);
+    int handleEndOfData(const uint8_t *pdu, size_t length);
+    int handleError(const uint8_t *pdu, size_t length);
+    int sendQuery(bool reset);
+    int sendError(BgpRtrErrorCode code, const uint8_t *pdu, size_t pdu_length, const char *text);
+    bool writePdu(const uint8_t *pdu, size_t length);
+
+    BgpRpkiValidator *validator;
+    BgpOutHandler *out_handler;
+    Clock *clock;
+    BgpLogHandler *logger;
+    bool clock_local;
+    bool log_local;
+
+    BgpRtrState state;
+    uint8_t version;
+    bool version_agreed;
+    bool has_data;
+    bool resetting;
+    uint16_t session_id;
+    uint32_t serial;
+
+    // timers, in seconds, from End of Data (version 1).
+    uint32_t refresh_interval;
+    uint32_t retry_interval;
+    uint32_t expire_interval;
+
+    // times in milliseconds.
+    uint64_t next_query;
+    uint64_t expire_at;
+
+    // bytes of a partial PDU.
+    std::vector<uint8_t> in_buffer;
+
+    // VRPs received since Cache Response.
+    std::vector<BgpVrp> announced;
+    std::vector<BgpVrp> withdrawn;
+};
+
+}
+
+#endif // BGP_RTR_CLIENT_H_
@@ -0,0 +1,111 @@
+/**
+ * @file bgp-session-registry.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Registry of BGP sessions by peer BGP ID.
+ * @version 0.1
+ * @date 2019-09-05
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-session-registry.h"
+
+namespace libbgp {
+
+/**
+ * @brief Construct a new BgpSessionRegistry.
+ *
+ */
+BgpSessionRegistry::BgpSessionRegistry() {}
+
+/**
+ * @brief Add a session.
+ *
+ * @param peer_bgp_id BGP ID of the peer, in network byte order.
+ * @param fsm The session.
+ */
+void BgpSessionRegistry::add(uint32_t peer_bgp_id, BgpFsm *fsm) {
+    std::lock_guard<BgpLock> lock(mutex);
+    sessions.insert(std::make_pair(peer_bgp_id, fsm));
+}
+
+/**
+ * @brief Remove a session.
+ *
+ * @param peer_bgp_id BGP ID of the peer, as passed to add().
+ * @param fsm The session.
+ * @return true Removed.
+ * @return false Session not in registry.
+ */
+bool BgpSessionRegistry::remove(uint32_t peer_bgp_id, BgpFsm *fsm) {
+    std::lock_guard<BgpLock> lock(mutex);
+    auto range = sessions.equal_range(peer_bgp_id);
+
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == fsm) {
+            sessions.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Get sessions with a peer BGP ID.
+ *
+ * @param peer_bgp_id BGP ID of the peer, in network byte order.
+ * @param sessions Vector to append the sessions to.
+ * @return size_t Number of sessions found.
+ */
+size_t BgpSessionRegistry::find(uint32_t peer_bgp_id, std::vector<BgpFsm *> &sessions) const {
+    std::lock_guard<BgpLock> lock(mutex);
+    auto range = this->sessions.equal_range(peer_bgp_id);
+    size_t n = 0;
+
+    for (auto it = range.first; it != range.second; it++, n++) {
+        sessions.push_back(it->second);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Call a function for every session with a peer BGP ID.
+ *
+ * The registry stays locked while fn runs, so sessions can't be removed (and
+ * destroyed) under it. fn may add or remove sessions from the same thread.
+ *
+ * @param peer_bgp_id BGP ID of the peer, in network byte order.
+ * @param skip Session to skip. (e.g., the caller) Can be NULL.
+ * @param fn The function.
+ * @return int Number of calls returned true.
+ */
+int BgpSessionRegistry::forEach(uint32_t peer_bgp_id, const BgpFsm *skip, const std::function<bool (BgpFsm *)> &fn) {
+    std::lock_guard<BgpLock> lock(mutex);
+    std::vector<BgpFsm *> found;
+    auto range = sessions.equal_range(peer_bgp_id);
+
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second != skip) found.push_back(it->second);
+    }
+
+    int n = 0;
+    for (BgpFsm *fsm : found) {
+        if (fn(fsm)) n++;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Get number of sessions in registry.
+ *
+ * @return size_t Number of sessions.
+ */
+size_t BgpSessionRegistry::size() const {
+    std::lock_guard<BgpLock> lock(mutex);
+    return sessions.size();
+}
+
+}
@@ -0,0 +1,69 @@
+/**
+ * @file bgp-session-registry.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Registry of BGP sessions by peer BGP ID.
+ * @version 0.1
+ * @date 2019-09-05
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_SESSION_REGISTRY_H_
+#define BGP_SESSION_REGISTRY_H_
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include "bgp-lock.h"
+
+namespace libbgp {
+
+class BgpFsm;
+
+/**
+ * @brief The BgpSessionRegistry class.
+ *
+ * Index of BgpFsm by peer BGP ID. An FSM with BgpConfig::session_registry set
+ * adds itself once it has accepted the peer's OPEN message, and removes itself
+ * when it goes back to IDLE or is destroyed. Collision detection looks up the
+ * sessions with the same peer BGP ID here, instead of asking every FSM on the
+ * route event bus, so an OPEN costs O(1) no matter how many sessions there
+ * are.
+ *
+ * One registry is shared by all FSMs that should detect collisions with each
+ * other, and is safe to use from multiple threads. The registry must outlive
+ * the FSMs using it.
+ */
+class BgpSessionRegistry {
+public:
+    BgpSessionRegistry();
+
+    // add a session with the given peer BGP ID.
+    void add(uint32_t peer_bgp_id, BgpFsm *fsm);
+
+    // remove a session added with add(). false if not found.
+    bool remove(uint32_t peer_bgp_id, BgpFsm *fsm);
+
+    // get sessions with the given peer BGP ID. returns number of sessions
+    // found.
+    size_t find(uint32_t peer_bgp_id, std::vector<BgpFsm *> &sessions) const;
+
+    // call fn for every session with the given peer BGP ID except skip, with
+    // the registry locked. returns number of calls returned true.
+    int forEach(uint32_t peer_bgp_id, const BgpFsm *skip, const std::function<bool (BgpFsm *)> &fn);
+
+    // get number of sessions in registry.
+    size_t size() const;
+
+private:
+    BgpSessionRegistry(const BgpSessionRegistry &);
+    BgpSessionRegistry& operator= (const BgpSessionRegistry &);
+
+    std::unordered_multimap<uint32_t, BgpFsm *> sessions;
+    mutable BgpLock mutex;
+};
+
+}
+
+#endif // BGP_SESSION_REGISTRY_H_
@@ -9,24 +9,51 @@
  * 
  */
 #include "bgp-sink.h"
+#include "value-op.h"
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
-#define BGP_SINK_DEFAULT_BUFSZ 65536
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace libbgp {
 
+/**
+ * @brief Check the 16 bytes BGP marker (all ones).
+ * 
+ * @param cur Pointer to the marker.
+ * @return true Marker valid.
+ * @return false Marker invalid.
+ */
+static inline bool validMarker(const uint8_t *cur) {
+#ifdef __SSE2__
+    __m128i marker = _mm_loadu_si128((const __m128i *) cur);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(marker, _mm_set1_epi8((char) 0xff))) == 0xffff;
+#else
+    uint64_t hi, lo;
+    memcpy(&hi, cur, sizeof(uint64_t));
+    memcpy(&lo, cur + sizeof(uint64_t), sizeof(uint64_t));
+    return (hi & lo) == UINT64_MAX;
+#endif
+}
+
 /**
  * @brief Construct a new Bgp Sink:: Bgp Sink object
  * 
  * @param use_4b_asn Enable four octets ASN support.
+ * @param pool Pool to get buffers from. (NULL to use malloc())
+ * @param thread_safe Lock the sink on access. Set to false if the sink is only
+ * ever used from one thread.
  */
-BgpSink::BgpSink(bool use_4b_asn) {
-    this->buffer_size = BGP_SINK_DEFAULT_BUFSZ;
-    this->buffer = (uint8_t *) malloc(buffer_size);
+BgpSink::BgpSink(bool use_4b_asn, BgpBufferPool *pool, bool thread_safe) : mutex(thread_safe) {
+    this->buffer_size = 0;
+    this->buffer = NULL;
     this->use_4b_asn = use_4b_asn;
     this->logger = NULL;
+    this->pool = pool;
     offset_start = offset_end = 0;
+    generation = 0;
 }
 
 /**
@@ -34,7 +61,7 @@ BgpSink::BgpSink(bool use_4b_asn) {
  * 
  */
 BgpSink::~BgpSink() {
-    free(buffer);
+    resize(0);
 }
 
 /**
@@ -48,16 +75,16 @@ BgpSink::~BgpSink() {
  * @retval >=0 Bytes consumed.
  */
 ssize_t BgpSink::fill(const uint8_t *buffer, size_t len) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    std::lock_guard<BgpLock> lock(mutex);
+    generation++;
 
-    // expand if too small
-    while (len > buffer_size) expand();
+    if (len == 0) return 0;
 
     // first try settle
     if (offset_end + len > buffer_size) settle();
 
     // if still too small, expand
-    while (offset_end + len > buffer_size) expand();
+    if (offset_end + len > buffer_size) expand(offset_end + len);
 
     memcpy(this->buffer + offset_end, buffer, len);
     offset_end += len;
@@ -65,6 +92,113 @@ ssize_t BgpSink::fill(const uint8_t *buffer, size_t len) {
     return len;
 }
 
+/**
+ * @brief Pour the next packet out from sink without parsing it.
+ * 
+ * Get the wire bytes of the next packet (header included) and remove the
+ * packet from sink. Use this to hand packets to another thread for parsing.
+ * 
+ * @param frame Set to point to the packet. The pointer points into the sink and
+ * is valid until the next fill().
+ * @return ssize_t Bytes poured.
+ * @retval -2 Failed to pour packet. error may be written to stderr with log
+ * handler.
+ * @retval 0 No complete packet in sink.
+ * @retval >0 Bytes poured.
+ */
+ssize_t BgpSink::pourFrame(const uint8_t **frame) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    uint8_t *cur = this->buffer + offset_start;
+
+    ssize_t field_len = checkHeader(cur, getBytesInSink(), true);
+    if (field_len <= 0) return field_len;
+
+    offset_start += field_len;
+    *frame = cur;
+
+    return field_len;
+}
+
+/**
+ * @brief Find all complete packets in sink.
+ * 
+ * Scan the data in sink once and append a descriptor (offset, length and
+ * type) for every complete packet to frames. Nothing is removed from the
+ * sink: get the packets with peek() and remove them with consume(), in order.
+ * This takes the lock once for the whole buffer instead of once per packet.
+ * 
+ * @param frames Vector to append descriptors to. Offsets are relative to the
+ * first byte in sink (peek()).
+ * @return ssize_t Number of packets found.
+ * @retval -2 The first packet in sink is invalid. error may be written to
+ * stderr with log handler.
+ * @retval 0 No complete packet in sink.
+ * @retval >0 Number of packets found. If an invalid packet follows them, it is
+ * reported by the next call, once the packets before it are consumed.
+ */
+ssize_t BgpSink::frame(std::vector<BgpFrame> &frames) {
+    std::lock_guard<BgpLock> lock(mutex);
+
+    const uint8_t *base = this->buffer + offset_start;
+    size_t avail = getBytesInSink();
+    size_t offset = 0;
+    ssize_t found = 0;
+
+    while (offset < avail) {
+        ssize_t field_len = checkHeader(base + offset, avail - offset, found == 0);
+        if (field_len == 0) break;
+        if (field_len < 0) {
+            if (found == 0) return -2;
+            break;
+        }
+
+        BgpFrame frame;
+        frame.offset = offset;
+        frame.length = (uint16_t) field_len;
+        frame.type = base[offset + 18];
+        frames.push_back(frame);
+
+        offset += field_len;
+        found++;
+    }
+
+    return found;
+}
+
+/**
+ * @brief Get a pointer to the first byte in sink.
+ * 
+ * @return const uint8_t* Pointer to data in sink. Valid until next fill() or
+ * consume().
+ */
+const uint8_t* BgpSink::peek() const {
+    return buffer + offset_start;
+}
+
+/**
+ * @brief Remove bytes from the front of the sink.
+ * 
+ * @param len Bytes to remove. Should be the length of packets from frame().
+ */
+void BgpSink::consume(size_t len) {
+    std::lock_guard<BgpLock> lock(mutex);
+    size_t bytes = getBytesInSink();
+    offset_start += len < bytes ? len : bytes;
+}
+
+/**
+ * @brief Get number of fill() and drain() calls so far.
+ * 
+ * Descriptors from frame() are only valid if the sink has not been filled or
+ * drained since. (e.g., BgpFsm::run() called again from an out handler)
+ * 
+ * @return uint64_t The generation.
+ */
+uint64_t BgpSink::getGeneration() const {
+    return generation;
+}
+
 /**
  * @brief Pour BGP packet out from sink.
  * 
@@ -78,61 +212,115 @@ ssize_t BgpSink::fill(const uint8_t *buffer, size_t len) {
  * stderr with log handler, notification message data that needs to be sent to
  * peer may be avaliable.
  * @retval >=0 Bytes poured.
- * @throws "bad_packet" Parsed packet length mismatch.
  */
 ssize_t BgpSink::pour(BgpPacket **pkt) {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-
-    uint8_t *cur = this->buffer + offset_start;
+    std::lock_guard<BgpLock> lock(mutex);
 
-    if (offset_end - offset_start < 19) return 0;
-    if (memcmp(cur, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", 16) != 0) {
-        if (logger) logger->log(ERROR, "BgpSink::pour: invalid BGP marker.\n");
-        return -2;
-    }
+    const uint8_t *cur = NULL;
+    ssize_t field_len = pourFrame(&cur);
+    if (field_len <= 0) return field_len;
 
-    uint16_t field_len = ntohs(*(uint16_t *) (cur + 16));
+    BgpPacket *new_pkt = new BgpPacket(logger, use_4b_asn);
+    ssize_t par_ret = new_pkt->parse(cur, field_len);
 
-    if (field_len < 19 || field_len > 4096) {
-        if (logger) logger->log(ERROR, "BgpSink::pourPtr: invalid BGP packet length (%d).\n", field_len);
+    if (par_ret >= 0 && par_ret != field_len) {
+        if (logger) logger->log(FATAL, "BgpSink::pour: parsed packet length mismatch (%d, want %d).\n", par_ret, field_len);
+        delete new_pkt;
         return -2;
     }
 
-    ssize_t bytes = getBytesInSink();
-    if (field_len > bytes) return 0; // incomplete packet, wait for more.
+    *pkt = new_pkt;
 
-    offset_start += field_len;
+    if (par_ret < 0) return -1;
 
-    BgpPacket *new_pkt = new BgpPacket(logger, use_4b_asn);
-    ssize_t par_ret = new_pkt->parse(cur, field_len);
+    return par_ret;
+}
 
-    *pkt = new_pkt;
+ssize_t BgpSink::checkHeader(const uint8_t *cur, size_t avail, bool log) const {
+    if (avail < 19) return 0;
+    if (!validMarker(cur)) {
+        if (log && logger) logger->log(ERROR, "BgpSink::checkHeader: invalid BGP marker.\n");
+        return -2;
+    }
 
-    if (par_ret < 0) return -1;
+    const uint8_t *len_ptr = cur + 16;
+    uint16_t field_len = ntohs(getValue<uint16_t>(&len_ptr));
+
+    if (field_len < 19 || field_len > 4096) {
+        if (log && logger) logger->log(ERROR, "BgpSink::checkHeader: invalid BGP packet length (%d).\n", field_len);
+        return -2;
+    }
 
-    if (par_ret != field_len) throw "bad_packet";
+    if (field_len > avail) return 0; // incomplete packet, wait for more.
 
-    return par_ret;
+    return field_len;
 }
 
 void BgpSink::settle() {
     if (offset_start > 0) {
         if (offset_start == offset_end) offset_start = offset_end = 0;
-        else memmove(buffer, buffer + offset_start, offset_end - offset_start);
+        else {
+            memmove(buffer, buffer + offset_start, offset_end - offset_start);
+            offset_end -= offset_start;
+            offset_start = 0;
+        }
     }
 }
 
-void BgpSink::expand() {
-    size_t new_buf_sz = buffer_size * 2;
+void BgpSink::expand(size_t size) {
+    size_t new_buf_sz = buffer_size > 0 ? buffer_size : BGP_BUFFER_POOL_MIN_SIZE;
+    while (new_buf_sz < size) new_buf_sz *= 2;
+    resize(new_buf_sz);
+    if (logger) logger->log(DEBUG, "BgpSink::expand: expanded size to %zu\n", buffer_size);
+}
+
+void BgpSink::resize(size_t size) {
     size_t content_sz = getBytesInSink();
-    uint8_t *new_buffer = (uint8_t *) malloc(new_buf_sz);
-    memcpy(new_buffer, buffer + offset_start, content_sz);
-    free(buffer);
+    uint8_t *new_buffer = NULL;
+
+    if (size > 0) {
+        if (pool != NULL) new_buffer = pool->alloc(size);
+        else new_buffer = (uint8_t *) malloc(size);
+        if (content_sz > 0) memcpy(new_buffer, buffer + offset_start, content_sz);
+    }
+
+    if (pool != NULL) pool->release(buffer, buffer_size);
+    else free(buffer);
+
     buffer = new_buffer;
-    buffer_size = new_buf_sz;
+    buffer_size = size;
     offset_start = 0;
     offset_end = content_sz;
-    if (logger) logger->log(DEBUG, "BgpSink::expand: expanded size to %zu\n", buffer_size);
+}
+
+/**
+ * @brief Shrink the sink buffer.
+ * 
+ * Move data in sink to the smallest buffer that holds it, or free the buffer
+ * if the sink is empty. The buffer grows again on fill(). Call this when the
+ * session goes idle so idle sessions don't hold on to large buffers.
+ * 
+ */
+void BgpSink::shrink() {
+    std::lock_guard<BgpLock> lock(mutex);
+    size_t content_sz = getBytesInSink();
+
+    if (content_sz == 0) {
+        if (buffer_size > 0) resize(0);
+        return;
+    }
+
+    size_t new_buf_sz = BgpBufferPool::roundSize(content_sz);
+    if (new_buf_sz < buffer_size) resize(new_buf_sz);
+}
+
+/**
+ * @brief Get size of the sink buffer.
+ * 
+ * @return size_t Buffer size in bytes.
+ */
+size_t BgpSink::getBufferSize() const {
+    return buffer_size;
 }
 
 /**
@@ -140,7 +328,8 @@ void BgpSink::expand() {
  * 
  */
 void BgpSink::drain() {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
+    std::lock_guard<BgpLock> lock(mutex);
+    generation++;
     offset_end = offset_start = 0;
 }
 
@@ -10,14 +10,41 @@
  */
 #ifndef BGP_SINK_H_
 #define BGP_SINK_H_
-#include <mutex>
 #include <stdint.h>
 #include <unistd.h>
+#include <vector>
 #include "bgp-packet.h"
 #include "bgp-log-handler.h"
+#include "bgp-buffer-pool.h"
+#include "bgp-lock.h"
 
 namespace libbgp {
 
+/**
+ * @brief Location of a complete BGP packet in the sink, as found by
+ * BgpSink::frame().
+ *
+ */
+struct BgpFrame {
+    /**
+     * @brief Offset of the packet from the first byte in sink.
+     *
+     */
+    size_t offset;
+
+    /**
+     * @brief Length of the packet, header included.
+     *
+     */
+    uint16_t length;
+
+    /**
+     * @brief Message type.
+     *
+     */
+    uint8_t type;
+};
+
 /**
  * @brief The BgpSink class.
  * 
@@ -25,11 +52,17 @@ namespace libbgp {
  * fill the sink (buffer) and allows users to get full BGP packet from the sink
  * (buffer). This is useful since BGP uses TCP, and TCP streams the data. (so we
  * might not get a full BGP packet in buffer every time)
+ * 
+ * The sink buffer is allocated on the first fill(), starts at 
+ * BGP_BUFFER_POOL_MIN_SIZE (one max size BGP packet), and grows as needed.
+ * Call shrink() to give the memory back when the session goes idle. If a 
+ * BgpBufferPool is set, buffers come from and go back to the pool.
  */
 class BgpSink {
 public:
-    // create a new sink
-    BgpSink(bool use_4b_asn);
+    // create a new sink, pool: optional pool to get buffers from. 
+    // thread_safe: false if only ever used from one thread.
+    BgpSink(bool use_4b_asn, BgpBufferPool *pool = NULL, bool thread_safe = true);
 
     // feed stream of packets into sink
     ssize_t fill(const uint8_t *buffer, size_t len);
@@ -51,15 +84,44 @@ public:
     // returned. (> 0)
     ssize_t pour(BgpPacket **pkt);
 
+    // get a packet from sink without parsing it, and remove that packet from
+    // sink. frame is set to point to the packet (valid until next fill()).
+    // returns bytes drained, 0 if no packet avaliable, -2 if error.
+    ssize_t pourFrame(const uint8_t **frame);
+
+    // find all complete packets in sink in one pass, without removing them.
+    // one descriptor per packet is appended to frames. returns number of
+    // packets found, -2 if the first packet in sink is invalid. (an invalid
+    // packet after that ends the scan, and is reported by the next call)
+    ssize_t frame(std::vector<BgpFrame> &frames);
+
+    // get a pointer to the first byte in sink (valid until next fill() or
+    // consume())
+    const uint8_t* peek() const;
+
+    // remove len bytes from the front of the sink
+    void consume(size_t len);
+
+    // get number of fill() and drain() calls so far. use this to tell if the
+    // sink was changed while working on frames from frame().
+    uint64_t getGeneration() const;
+
     // get and remove all packets from sink (max size = sink buffer size)
     //ssize_t pourAll(uint8_t *buffer, size_t len);
 
     // get number of bytes currently in sink
     size_t getBytesInSink() const;
 
+    // get size of the sink buffer
+    size_t getBufferSize() const;
+
     // discard packets in sink
     void drain();
 
+    // shrink the sink buffer to the smallest size holding the data in sink.
+    // the buffer is freed if the sink is empty.
+    void shrink();
+
     void setLogger(BgpLogHandler *logger);
 
     ~BgpSink();
@@ -68,16 +130,25 @@ private:
     // settle the sink
     void settle();
 
-    // exapnd the sink
-    void expand();
+    // check the header of the packet at cur. returns packet length, 0 if
+    // header incomplete, -2 if invalid (logged if log is set)
+    ssize_t checkHeader(const uint8_t *cur, size_t avail, bool log) const;
+
+    // exapnd the sink to hold at least size bytes
+    void expand(size_t size);
+
+    // move data in sink to a new buffer of size bytes
+    void resize(size_t size);
 
     uint8_t *buffer;
     size_t buffer_size;
     size_t offset_start;
     size_t offset_end;
+    uint64_t generation;
     bool use_4b_asn;
-    std::recursive_mutex mutex;
+    BgpLock mutex;
     BgpLogHandler *logger;
+    BgpBufferPool *pool;
 };
 
 }
@@ -0,0 +1,454 @@
+/**
+ * @file bgp-stats.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Lock-free statistic counters for BGP FSM and RIB.
+ * @version 0.1
+ * @date 2019-08-20
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-stats.h"
+#include "bgp-message.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+namespace libbgp {
+
+static const char *bgp_stats_msg_type_str[] = {
+    "other",
+    "open",
+    "update",
+    "notification",
+    "keepalive"
+};
+
+static const double bgp_stats_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ * @brief Get a monotonic timestamp in nanoseconds for statistic use.
+ *
+ * @return uint64_t timestamp.
+ */
+uint64_t bgpStatsNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+BgpLatencyHistogramSnapshot::BgpLatencyHistogramSnapshot() {
+    memset(buckets, 0, sizeof(buckets));
+    count = sum = max = 0;
+}
+
+/**
+ * @brief Get an approximated value at the given percentile.
+ *
+ * @param p Percentile. (0 - 100)
+ * @return uint64_t Upper bound of the bucket that contains the percentile, in
+ * nanoseconds. Never larger than the largest sample.
+ */
+uint64_t BgpLatencyHistogramSnapshot::percentile(double p) const {
+    if (count == 0) return 0;
+    if (p < 0) p = 0;
+    if (p > 100) p = 100;
+
+    uint64_t target = (uint64_t) (p / 100.0 * count + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BGP_STATS_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            uint64_t bound = BgpLatencyHistogram::bucketUpperBound(i);
+            return bound > max ? max : bound;
+        }
+    }
+
+    return max;
+}
+
+/**
+ * @brief Get the mean value.
+ *
+ * @return uint64_t mean value, in nanoseconds.
+ */
+uint64_t BgpLatencyHistogramSnapshot::mean() const {
+    return count == 0 ? 0 : sum / count;
+}
+
+BgpLatencyHistogram::BgpLatencyHistogram() {
+    for (size_t i = 0; i < BGP_STATS_HIST_BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+    single_writer = false;
+}
+
+/**
+ * @brief Set whether the histogram is only ever recorded to from one thread.
+ *
+ * With a single writer, samples are recorded with plain loads and stores
+ * instead of atomic read-modify-write operations. Snapshots can still be
+ * taken from any thread.
+ *
+ * @param single_writer Single writer mode.
+ */
+void BgpLatencyHistogram::setSingleWriter(bool single_writer) {
+    this->single_writer = single_writer;
+}
+
+/**
+ * @brief Get the bucket index of a value.
+ *
+ * Values smaller than BGP_STATS_HIST_SUB_COUNT get a bucket of their own. For
+ * larger values, the position of the most significant bit selects the
+ * power-of-two range, and the next BGP_STATS_HIST_SUB_BITS bits select the
+ * sub-bucket in that range.
+ *
+ * @param value The value.
+ * @return size_t Bucket index.
+ */
+size_t BgpLatencyHistogram::bucketOf(uint64_t value) {
+    if (value < BGP_STATS_HIST_SUB_COUNT) return value;
+
+    size_t msb = 63 - __builtin_clzll(value);
+    size_t pow = msb - BGP_STATS_HIST_SUB_BITS + 1;
+    if (pow > BGP_STATS_HIST_MAX_POW) return BGP_STATS_HIST_BUCKETS - 1;
+
+    size_t sub = (value >> (msb - BGP_STATS_HIST_SUB_BITS)) & (BGP_STATS_HIST_SUB_COUNT - 1);
+    return pow * BGP_STATS_HIST_SUB_COUNT + sub;
+}
+
+/**
+ * @brief Get the largest value that falls into the given bucket.
+ *
+ * @param bucket Bucket index.
+ * @return uint64_t The largest value.
+ */
+uint64_t BgpLatencyHistogram::bucketUpperBound(size_t bucket) {
+    size_t pow = bucket / BGP_STATS_HIST_SUB_COUNT;
+    size_t sub = bucket % BGP_STATS_HIST_SUB_COUNT;
+
+    if (pow == 0) return sub;
+
+    uint64_t lower = ((uint64_t) (BGP_STATS_HIST_SUB_COUNT + sub)) << (pow - 1);
+    return lower + (1ULL << (pow - 1)) - 1;
+}
+
+/**
+ * @brief Record a sample.
+ *
+ * @param value_ns The sample, in nanoseconds.
+ */
+void BgpLatencyHistogram::record(uint64_t value_ns) {
+    if (single_writer) {
+        std::atomic<uint64_t> &bucket = buckets[bucketOf(value_ns)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value_ns, std::memory_order_relaxed);
+        if (value_ns > max.load(std::memory_order_relaxed)) max.store(value_ns, std::memory_order_relaxed);
+        return;
+    }
+
+    buckets[bucketOf(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value_ns, std::memory_order_relaxed);
+
+    uint64_t cur_max = max.load(std::memory_order_relaxed);
+    while (value_ns > cur_max && !max.compare_exchange_weak(cur_max, value_ns, std::memory_order_relaxed));
+}
+
+/**
+ * @brief Take a snapshot of the histogram.
+ *
+ * Writers are not blocked while the snapshot is taken, so a snapshot taken
+ * while samples are being recorded may be off by the in-flight samples.
+ *
+ * @param snap Where to write the snapshot to.
+ */
+void BgpLatencyHistogram::snapshot(BgpLatencyHistogramSnapshot &snap) const {
+    for (size_t i = 0; i < BGP_STATS_HIST_BUCKETS; i++) {
+        snap.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+
+    snap.count = count.load(std::memory_order_relaxed);
+    snap.sum = sum.load(std::memory_order_relaxed);
+    snap.max = max.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Print helper for the exposition functions.
+ *
+ * @param to Pointer to pointer to the buffer. Will be incremented.
+ * @param buf_left Pointer to size of buffer left. Will be decremented.
+ * @param err Set to true if the buffer is too small.
+ * @param format The printf format string.
+ * @param ... The printf format values.
+ */
+static void statsPrint(uint8_t **to, size_t *buf_left, bool *err, const char *format, ...) {
+    if (*err) return;
+
+    va_list args;
+    va_start(args, format);
+    int sz = vsnprintf((char *) *to, *buf_left, format, args);
+    va_end(args);
+
+    if (sz < 0 || (size_t) sz >= *buf_left) {
+        *err = true;
+        return;
+    }
+
+    *to += sz;
+    *buf_left -= sz;
+}
+
+static void statsPrintHeader(uint8_t **to, size_t *buf_left, bool *err, bool headers, const char *name, const char *type, const char *help) {
+    if (!headers) return;
+    statsPrint(to, buf_left, err, "# HELP %s %s\n", name, help);
+    statsPrint(to, buf_left, err, "# TYPE %s %s\n", name, type);
+}
+
+static void statsPrintCounter(uint8_t **to, size_t *buf_left, bool *err, bool headers, const char *labels, const char *name, const char *type, const char *help, uint64_t value) {
+    statsPrintHeader(to, buf_left, err, headers, name, type, help);
+    if (labels[0] == 0) statsPrint(to, buf_left, err, "%s %llu\n", name, (unsigned long long) value);
+    else statsPrint(to, buf_left, err, "%s{%s} %llu\n", name, labels, (unsigned long long) value);
+}
+
+static void statsPrintByType(uint8_t **to, size_t *buf_left, bool *err, bool headers, const char *labels, const char *name, const char *help, const uint64_t *values) {
+    statsPrintHeader(to, buf_left, err, headers, name, "counter", help);
+    for (size_t i = 0; i < BGP_STATS_MSG_TYPES; i++) {
+        statsPrint(to, buf_left, err, "%s{%s%stype=\"%s\"} %llu\n", name, labels, labels[0] == 0 ? "" : ",",
+            bgp_stats_msg_type_str[i], (unsigned long long) values[i]);
+    }
+}
+
+static void statsPrintSummary(uint8_t **to, size_t *buf_left, bool *err, bool headers, const char *labels, const char *name, const char *help, const BgpLatencyHistogramSnapshot &hist) {
+    const char *sep = labels[0] == 0 ? "" : ",";
+    statsPrintHeader(to, buf_left, err, headers, name, "summary", help);
+    for (double q : bgp_stats_quantiles) {
+        statsPrint(to, buf_left, err, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, sep, q, hist.percentile(q * 100) / 1e9);
+    }
+    if (labels[0] == 0) {
+        statsPrint(to, buf_left, err, "%s_sum %.9f\n", name, hist.sum / 1e9);
+        statsPrint(to, buf_left, err, "%s_count %llu\n", name, (unsigned long long) hist.count);
+    } else {
+        statsPrint(to, buf_left, err, "%s_sum{%s} %.9f\n", name, labels, hist.sum / 1e9);
+        statsPrint(to, buf_left, err, "%s_count{%s} %llu\n", name, labels, (unsigned long long) hist.count);
+    }
+}
+
+BgpFsmStatsSnapshot::BgpFsmStatsSnapshot() {
+    timestamp = 0;
+    memset(msgs_in, 0, sizeof(msgs_in));
+    memset(msgs_out, 0, sizeof(msgs_out));
+    bytes_in = bytes_out = 0;
+    prefixes_added = prefixes_withdrawn = 0;
+    prefixes_filtered_in = prefixes_filtered_out = 0;
+    prefixes_dampened = prefixes_suppressed = prefixes_reused = 0;
+    prefixes_rpki_invalid = 0;
+    parse_errors = state_changes = sink_bytes = buffer_bytes = 0;
+}
+
+/**
+ * @brief Get number of UPDATE messages received per second between two
+ * snapshots.
+ *
+ * @param prev The earlier snapshot.
+ * @return double UPDATE messages per second.
+ */
+double BgpFsmStatsSnapshot::updatesPerSecond(const BgpFsmStatsSnapshot &prev) const {
+    if (timestamp <= prev.timestamp) return 0;
+    uint64_t updates = msgs_in[UPDATE] - prev.msgs_in[UPDATE];
+    return updates / ((timestamp - prev.timestamp) / 1e9);
+}
+
+/**
+ * @brief Write the snapshot in Prometheus text exposition format.
+ *
+ * @param labels Labels to attach to all metrics, without braces. (e.g.
+ * peer="192.0.2.1",asn="65001") Use empty string for none.
+ * @param to Buffer to write to.
+ * @param buf_sz Size of the buffer.
+ * @param headers Write the HELP and TYPE lines. Set to false when printing
+ * metrics of multiple FSMs to the same buffer.
+ * @return ssize_t Bytes written.
+ * @retval -1 Buffer too small.
+ * @retval >=0 Bytes written.
+ */
+ssize_t BgpFsmStatsSnapshot::print(const char *labels, uint8_t *to, size_t buf_sz, bool headers) const {
+    uint8_t *buffer = to;
+    size_t buf_left = buf_sz;
+    bool err = false;
+
+    if (labels == NULL) labels = "";
+
+    statsPrintByType(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_messages_in_total", "BGP messages received.", msgs_in);
+    statsPrintByType(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_messages_out_total", "BGP messages sent.", msgs_out);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_bytes_in_total", "counter", "Bytes received.", bytes_in);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_bytes_out_total", "counter", "Bytes sent.", bytes_out);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_added_total", "counter", "Prefixes received in UPDATE messages.", prefixes_added);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_withdrawn_total", "counter", "Withdrawn prefixes received in UPDATE messages.", prefixes_withdrawn);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_filtered_in_total", "counter", "Prefixes rejected by ingress filters.", prefixes_filtered_in);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_filtered_out_total", "counter", "Prefixes rejected by egress filters.", prefixes_filtered_out);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_dampened_total", "counter", "Announcements and withdrawals held back by flap dampening.", prefixes_dampened);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_suppressed_total", "counter", "Prefixes suppressed by flap dampening.", prefixes_suppressed);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_reused_total", "counter", "Suppressed prefixes reused.", prefixes_reused);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_prefixes_rpki_invalid_total", "counter", "RPKI-invalid prefixes held back.", prefixes_rpki_invalid);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_parse_errors_total", "counter", "Messages failed to parse.", parse_errors);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_state_changes_total", "counter", "FSM state changes.", state_changes);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_sink_bytes", "gauge", "Bytes buffered in the sink.", sink_bytes);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_buffer_bytes", "gauge", "Size of the input and output buffers held.", buffer_bytes);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_run_seconds", "Time spent in run().", run_time);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_established_seconds", "Time spent evaluating messages in ESTABLISHED state.", established_time);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_fsm_write_seconds", "Time spent in the out handler.", write_time);
+
+    if (err) return -1;
+    return buf_sz - buf_left;
+}
+
+/**
+ * @brief Set all counters and histograms to single writer mode.
+ *
+ * See BgpStatsCounter::setSingleWriter().
+ *
+ * @param single_writer Single writer mode.
+ */
+void BgpFsmStats::setSingleWriter(bool single_writer) {
+    for (size_t i = 0; i < BGP_STATS_MSG_TYPES; i++) {
+        msgs_in[i].setSingleWriter(single_writer);
+        msgs_out[i].setSingleWriter(single_writer);
+    }
+
+    bytes_in.setSingleWriter(single_writer);
+    bytes_out.setSingleWriter(single_writer);
+    prefixes_added.setSingleWriter(single_writer);
+    prefixes_withdrawn.setSingleWriter(single_writer);
+    prefixes_filtered_in.setSingleWriter(single_writer);
+    prefixes_filtered_out.setSingleWriter(single_writer);
+    prefixes_dampened.setSingleWriter(single_writer);
+    prefixes_suppressed.setSingleWriter(single_writer);
+    prefixes_reused.setSingleWriter(single_writer);
+    prefixes_rpki_invalid.setSingleWriter(single_writer);
+    parse_errors.setSingleWriter(single_writer);
+    state_changes.setSingleWriter(single_writer);
+    run_time.setSingleWriter(single_writer);
+    established_time.setSingleWriter(single_writer);
+    write_time.setSingleWriter(single_writer);
+}
+
+/**
+ * @brief Take a snapshot.
+ *
+ * sink_bytes and buffer_bytes are not known to the stats block and are left
+ * as zero. Use BgpFsm::getStatsSnapshot() to get a snapshot with them filled.
+ *
+ * @param snap Where to write the snapshot to.
+ */
+void BgpFsmStats::snapshot(BgpFsmStatsSnapshot &snap) const {
+    snap.timestamp = bgpStatsNow();
+    for (size_t i = 0; i < BGP_STATS_MSG_TYPES; i++) {
+        snap.msgs_in[i] = msgs_in[i].get();
+        snap.msgs_out[i] = msgs_out[i].get();
+    }
+    snap.bytes_in = bytes_in.get();
+    snap.bytes_out = bytes_out.get();
+    snap.prefixes_added = prefixes_added.get();
+    snap.prefixes_withdrawn = prefixes_withdrawn.get();
+    snap.prefixes_filtered_in = prefixes_filtered_in.get();
+    snap.prefixes_filtered_out = prefixes_filtered_out.get();
+    snap.prefixes_dampened = prefixes_dampened.get();
+    snap.prefixes_suppressed = prefixes_suppressed.get();
+    snap.prefixes_reused = prefixes_reused.get();
+    snap.prefixes_rpki_invalid = prefixes_rpki_invalid.get();
+    snap.parse_errors = parse_errors.get();
+    snap.state_changes = state_changes.get();
+    snap.sink_bytes = 0;
+    snap.buffer_bytes = 0;
+    run_time.snapshot(snap.run_time);
+    established_time.snapshot(snap.established_time);
+    write_time.snapshot(snap.write_time);
+}
+
+BgpRibStatsSnapshot::BgpRibStatsSnapshot() {
+    timestamp = 0;
+    inserts = withdraws = discards = best_changes = entries = 0;
+}
+
+/**
+ * @brief Write the snapshot in Prometheus text exposition format.
+ *
+ * @param labels Labels to attach to all metrics, without braces. (e.g.
+ * rib="ipv4") Use empty string for none.
+ * @param to Buffer to write to.
+ * @param buf_sz Size of the buffer.
+ * @param headers Write the HELP and TYPE lines. Set to false when printing
+ * metrics of multiple RIBs to the same buffer.
+ * @return ssize_t Bytes written.
+ * @retval -1 Buffer too small.
+ * @retval >=0 Bytes written.
+ */
+ssize_t BgpRibStatsSnapshot::print(const char *labels, uint8_t *to, size_t buf_sz, bool headers) const {
+    uint8_t *buffer = to;
+    size_t buf_left = buf_sz;
+    bool err = false;
+
+    if (labels == NULL) labels = "";
+
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_inserts_total", "counter", "Entries inserted or replaced.", inserts);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_withdraws_total", "counter", "Entries withdrawn.", withdraws);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_discards_total", "counter", "Entries dropped when a peer goes down.", discards);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_best_changes_total", "counter", "Best path changes.", best_changes);
+    statsPrintCounter(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_entries", "gauge", "Entries in RIB.", entries);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_insert_seconds", "Time spent in insert().", insert_time);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_withdraw_seconds", "Time spent in withdraw().", withdraw_time);
+    statsPrintSummary(&buffer, &buf_left, &err, headers, labels, "libbgp_rib_discard_seconds", "Time spent in discard().", discard_time);
+
+    if (err) return -1;
+    return buf_sz - buf_left;
+}
+
+/**
+ * @brief Set all counters and histograms to single writer mode.
+ *
+ * See BgpStatsCounter::setSingleWriter().
+ *
+ * @param single_writer Single writer mode.
+ */
+void BgpRibStats::setSingleWriter(bool single_writer) {
+    inserts.setSingleWriter(single_writer);
+    withdraws.setSingleWriter(single_writer);
+    discards.setSingleWriter(single_writer);
+    best_changes.setSingleWriter(single_writer);
+    insert_time.setSingleWriter(single_writer);
+    withdraw_time.setSingleWriter(single_writer);
+    discard_time.setSingleWriter(single_writer);
+}
+
+/**
+ * @brief Take a snapshot.
+ *
+ * entries is not known to the stats block and is left as zero. Use
+ * BgpRib4::getStatsSnapshot() or BgpRib6::getStatsSnapshot() to get a
+ * snapshot with entries filled.
+ *
+ * @param snap Where to write the snapshot to.
+ */
+void BgpRibStats::snapshot(BgpRibStatsSnapshot &snap) const {
+    snap.timestamp = bgpStatsNow();
+    snap.inserts = inserts.get();
+    snap.withdraws = withdraws.get();
+    snap.discards = discards.get();
+    snap.best_changes = best_changes.get();
+    snap.entries = 0;
+    insert_time.snapshot(snap.insert_time);
+    withdraw_time.snapshot(snap.withdraw_time);
+    discard_time.snapshot(snap.discard_time);
+}
+
+}
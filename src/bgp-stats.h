@@ -0,0 +1,311 @@
+/**
+ * @file bgp-stats.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Lock-free statistic counters for BGP FSM and RIB.
+ * @version 0.1
+ * @date 2019-08-20
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_STATS_H_
+#define BGP_STATS_H_
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+
+// number of linear sub-buckets in each power-of-two range of the histogram.
+#define BGP_STATS_HIST_SUB_BITS 2
+#define BGP_STATS_HIST_SUB_COUNT (1 << BGP_STATS_HIST_SUB_BITS)
+
+// number of power-of-two ranges tracked by the histogram. (values up to 2^38
+// ns, ~275 seconds)
+#define BGP_STATS_HIST_MAX_POW 36
+
+#define BGP_STATS_HIST_BUCKETS ((BGP_STATS_HIST_MAX_POW + 1) * BGP_STATS_HIST_SUB_COUNT)
+
+// index 0 of per-message-type counters is used for unknown types.
+#define BGP_STATS_MSG_TYPES 5
+
+namespace libbgp {
+
+/**
+ * @brief Get a monotonic timestamp in nanoseconds for statistic use.
+ *
+ * @return uint64_t timestamp.
+ */
+uint64_t bgpStatsNow();
+
+/**
+ * @brief A single lock-free counter.
+ *
+ * Counters are updated with relaxed atomic operations, so they can be updated
+ * from any thread without locking and read at any time. A counter with a 
+ * single writer thread can be set to update with plain loads and stores
+ * instead, which avoids the atomic read-modify-write. It can still be read 
+ * from any thread.
+ */
+class BgpStatsCounter {
+public:
+    BgpStatsCounter() : value(0), single_writer(false) {}
+
+    // add n to the counter.
+    void inc(uint64_t n = 1) { 
+        if (single_writer) value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        else value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // only ever updated from one thread? (default: false)
+    void setSingleWriter(bool single_writer) { this->single_writer = single_writer; }
+
+    // set the counter to n (for gauges).
+    void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+
+    // get the value of the counter.
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    BgpStatsCounter(const BgpStatsCounter &);
+    BgpStatsCounter& operator= (const BgpStatsCounter &);
+
+    std::atomic<uint64_t> value;
+    bool single_writer;
+};
+
+/**
+ * @brief Snapshot of a latency histogram.
+ *
+ */
+struct BgpLatencyHistogramSnapshot {
+    BgpLatencyHistogramSnapshot();
+
+    // get an approximated value at the given percentile (0 - 100).
+    uint64_t percentile(double p) const;
+
+    // get the mean value.
+    uint64_t mean() const;
+
+    /**
+     * @brief Number of samples in each bucket.
+     *
+     */
+    uint64_t buckets[BGP_STATS_HIST_BUCKETS];
+
+    /**
+     * @brief Number of samples.
+     *
+     */
+    uint64_t count;
+
+    /**
+     * @brief Sum of all samples, in nanoseconds.
+     *
+     */
+    uint64_t sum;
+
+    /**
+     * @brief Largest sample, in nanoseconds.
+     *
+     */
+    uint64_t max;
+};
+
+/**
+ * @brief Lock-free latency histogram.
+ *
+ * Samples are kept in log-linear buckets (HDR style): every power-of-two range
+ * is split into BGP_STATS_HIST_SUB_COUNT linear sub-buckets, so the relative
+ * error of a recorded value is bounded by 1 / BGP_STATS_HIST_SUB_COUNT while
+ * the histogram stays small and fixed in size.
+ */
+class BgpLatencyHistogram {
+public:
+    BgpLatencyHistogram();
+
+    // record a sample, in nanoseconds.
+    void record(uint64_t value_ns);
+
+    // only ever recorded to from one thread? (default: false)
+    void setSingleWriter(bool single_writer);
+
+    // take a snapshot of the histogram.
+    void snapshot(BgpLatencyHistogramSnapshot &snap) const;
+
+    // get the bucket index of a value.
+    static size_t bucketOf(uint64_t value);
+
+    // get the largest value that falls into the given bucket.
+    static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+    BgpLatencyHistogram(const BgpLatencyHistogram &);
+    BgpLatencyHistogram& operator= (const BgpLatencyHistogram &);
+
+    std::atomic<uint64_t> buckets[BGP_STATS_HIST_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+    bool single_writer;
+};
+
+/**
+ * @brief Scoped timer: record time elapsed between construction and
+ * destruction to a histogram.
+ *
+ */
+class BgpStatsTimer {
+public:
+    BgpStatsTimer(BgpLatencyHistogram &hist) : hist(hist), start(bgpStatsNow()) {}
+    ~BgpStatsTimer() { hist.record(bgpStatsNow() - start); }
+
+private:
+    BgpStatsTimer(const BgpStatsTimer &);
+    BgpStatsTimer& operator= (const BgpStatsTimer &);
+
+    BgpLatencyHistogram &hist;
+    uint64_t start;
+};
+
+/**
+ * @brief Snapshot of BGP FSM statistics.
+ *
+ */
+struct BgpFsmStatsSnapshot {
+    BgpFsmStatsSnapshot();
+
+    /**
+     * @brief Time the snapshot was taken (from bgpStatsNow()), can be used to
+     * calculate rates between two snapshots.
+     *
+     */
+    uint64_t timestamp;
+
+    /**
+     * @brief Messages received, indexed by message type.
+     *
+     */
+    uint64_t msgs_in[BGP_STATS_MSG_TYPES];
+
+    /**
+     * @brief Messages sent, indexed by message type.
+     *
+     */
+    uint64_t msgs_out[BGP_STATS_MSG_TYPES];
+
+    uint64_t bytes_in; /*!< Bytes passed to run(). */
+    uint64_t bytes_out; /*!< Bytes written to the out handler. */
+    uint64_t prefixes_added; /*!< Prefixes received in UPDATE messages. */
+    uint64_t prefixes_withdrawn; /*!< Withdrawn prefixes received in UPDATE messages. */
+    uint64_t prefixes_filtered_in; /*!< Prefixes rejected by ingress filters. */
+    uint64_t prefixes_filtered_out; /*!< Prefixes rejected by egress filters. */
+    uint64_t prefixes_dampened; /*!< Announcements and withdrawals held back by flap dampening. */
+    uint64_t prefixes_suppressed; /*!< Prefixes suppressed by flap dampening. */
+    uint64_t prefixes_reused; /*!< Suppressed prefixes reused. */
+    uint64_t prefixes_rpki_invalid; /*!< RPKI-invalid prefixes held back. */
+    uint64_t parse_errors; /*!< Messages failed to parse. */
+    uint64_t state_changes; /*!< Number of FSM state changes. */
+    uint64_t sink_bytes; /*!< Bytes currently buffered in the sink. */
+    uint64_t buffer_bytes; /*!< Size of the input and output buffers held. */
+
+    BgpLatencyHistogramSnapshot run_time; /*!< Time spent in run(). */
+    BgpLatencyHistogramSnapshot established_time; /*!< Time spent in fsmEvalEstablished(). */
+    BgpLatencyHistogramSnapshot write_time; /*!< Time spent in the out handler. */
+
+    // get number of UPDATE messages per second between two snapshots.
+    double updatesPerSecond(const BgpFsmStatsSnapshot &prev) const;
+
+    // write the snapshot in Prometheus text exposition format.
+    ssize_t print(const char *labels, uint8_t *to, size_t buf_sz, bool headers = true) const;
+};
+
+/**
+ * @brief Statistics of a BGP FSM.
+ *
+ */
+class BgpFsmStats {
+public:
+    BgpFsmStats() {}
+
+    // take a snapshot. (sink_bytes and buffer_bytes are filled by BgpFsm)
+    void snapshot(BgpFsmStatsSnapshot &snap) const;
+
+    // set all counters and histograms to single writer mode.
+    void setSingleWriter(bool single_writer);
+
+    BgpStatsCounter msgs_in[BGP_STATS_MSG_TYPES];
+    BgpStatsCounter msgs_out[BGP_STATS_MSG_TYPES];
+    BgpStatsCounter bytes_in;
+    BgpStatsCounter bytes_out;
+    BgpStatsCounter prefixes_added;
+    BgpStatsCounter prefixes_withdrawn;
+    BgpStatsCounter prefixes_filtered_in;
+    BgpStatsCounter prefixes_filtered_out;
+    BgpStatsCounter prefixes_dampened;
+    BgpStatsCounter prefixes_suppressed;
+    BgpStatsCounter prefixes_reused;
+    BgpStatsCounter prefixes_rpki_invalid;
+    BgpStatsCounter parse_errors;
+    BgpStatsCounter state_changes;
+
+    BgpLatencyHistogram run_time;
+    BgpLatencyHistogram established_time;
+    BgpLatencyHistogram write_time;
+
+private:
+    BgpFsmStats(const BgpFsmStats &);
+    BgpFsmStats& operator= (const BgpFsmStats &);
+};
+
+/**
+ * @brief Snapshot of BGP RIB statistics.
+ *
+ */
+struct BgpRibStatsSnapshot {
+    BgpRibStatsSnapshot();
+
+    uint64_t timestamp; /*!< Time the snapshot was taken (from bgpStatsNow()). */
+    uint64_t inserts; /*!< Entries inserted or replaced. */
+    uint64_t withdraws; /*!< Entries withdrawn. */
+    uint64_t discards; /*!< Entries dropped by discard(). */
+    uint64_t best_changes; /*!< Number of times best path of a prefix changed. */
+    uint64_t entries; /*!< Entries currently in RIB. */
+
+    BgpLatencyHistogramSnapshot insert_time; /*!< Time spent in insert(). */
+    BgpLatencyHistogramSnapshot withdraw_time; /*!< Time spent in withdraw(). */
+    BgpLatencyHistogramSnapshot discard_time; /*!< Time spent in discard(). */
+
+    // write the snapshot in Prometheus text exposition format.
+    ssize_t print(const char *labels, uint8_t *to, size_t buf_sz, bool headers = true) const;
+};
+
+/**
+ * @brief Statistics of a BGP RIB.
+ *
+ */
+class BgpRibStats {
+public:
+    BgpRibStats() {}
+
+    // take a snapshot. (entries is filled by RIB)
+    void snapshot(BgpRibStatsSnapshot &snap) const;
+
+    // set all counters and histograms to single writer mode.
+    void setSingleWriter(bool single_writer);
+
+    BgpStatsCounter inserts;
+    BgpStatsCounter withdraws;
+    BgpStatsCounter discards;
+    BgpStatsCounter best_changes;
+
+    BgpLatencyHistogram insert_time;
+    BgpLatencyHistogram withdraw_time;
+    BgpLatencyHistogram discard_time;
+
+private:
+    BgpRibStats(const BgpRibStats &);
+    BgpRibStats& operator= (const BgpRibStats &);
+};
+
+}
+
+#endif // BGP_STATS_H_
@@ -0,0 +1,32 @@
+/**
+ * @file bgp-throw.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Report API misuse, with or without exceptions.
+ * @version 0.1
+ * @date 2019-08-30
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_THROW_H_
+#define BGP_THROW_H_
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Report misuse of the API (e.g. a prefix with /33 netmask).
+ *
+ * Malformed input never gets here, parsers report those with return value
+ * and Serializable::setError. When built with -fno-exceptions, print the
+ * error and abort instead of throwing.
+ */
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define LIBBGP_THROW(what) throw what
+#else
+#define LIBBGP_THROW(what) do { \
+    fprintf(stderr, "libbgp: %s (%s:%d).\n", what, __FILE__, __LINE__); \
+    abort(); \
+} while (0)
+#endif
+
+#endif // BGP_THROW_H_
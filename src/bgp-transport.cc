@@ -0,0 +1,1014 @@
+/**
+ * @file bgp-transport.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Event loop transport for many BgpFsm sessions. (io_uring or epoll)
+ * @version 0.1
+ * @date 2019-09-12
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#include "bgp-transport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// multishot receive and provided buffer rings are needed, io_uring is not
+// used with older kernel headers. (IORING_RECV_MULTISHOT is from 6.0, buffer
+// rings from 5.19)
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define BGP_TRANSPORT_URING
+#endif
+
+// user_data of io_uring operations: session pointer | operation. 0 is a
+// cancel.
+#define URING_OP_RECV 1
+#define URING_OP_WRITE 2
+#define URING_OP_MASK 3
+
+// provided buffer group of the receive buffers.
+#define URING_BUF_GROUP 0
+
+namespace libbgp {
+
+/**
+ * @brief The io_uring instance: mapped rings, and the provided buffer ring.
+ *
+ */
+struct BgpTransport::Uring {
+#ifdef BGP_TRANSPORT_URING
+    Uring() : fd(-1), ring(MAP_FAILED), ring_size(0), sqes((struct io_uring_sqe *) MAP_FAILED), sqes_size(0), sqe_tail(0), sqe_pending(0), buf_ring((struct io_uring_buf_ring *) MAP_FAILED), buf_ring_size(0), buf_tail(0), fixed_registered(false) {}
+
+    // get a free SQE, submitting the queue if it is full. NULL if failed.
+    struct io_uring_sqe* getSqe(uint64_t &syscalls) {
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            if (enter(0, 0, syscalls) < 0) return NULL;
+            if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return NULL;
+        }
+
+        struct io_uring_sqe *sqe = &sqes[sqe_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe_tail++;
+        sqe_pending++;
+        return sqe;
+    }
+
+    // submit SQEs queued, wait for min_complete completions up to timeout_ms
+    // (-1: forever). returns number of SQEs submitted, -1 if failed.
+    int enter(unsigned min_complete, int timeout_ms, uint64_t &syscalls) {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+
+        unsigned flags = IORING_ENTER_GETEVENTS;
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        void *argp = NULL;
+        size_t arg_size = 0;
+
+        if (min_complete > 0) {
+            memset(&arg, 0, sizeof(arg));
+            arg.sigmask_sz = _NSIG / 8;
+            if (timeout_ms >= 0) {
+                ts.tv_sec = timeout_ms / 1000;
+                ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+                arg.ts = (uint64_t) (uintptr_t) &ts;
+            }
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            arg_size = sizeof(arg);
+        } else if (sqe_pending == 0 && !(__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_TASKRUN)) {
+            // nothing to submit, and no completions to be posted.
+            return 0;
+        }
+
+        syscalls++;
+        int ret = (int) syscall(__NR_io_uring_enter, fd, sqe_pending, min_complete, flags, argp, arg_size);
+        if (ret < 0) {
+            // timed out, interrupted, or busy with completions not reaped.
+            if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) return 0;
+            return -1;
+        }
+
+        sqe_pending -= ret;
+        return ret;
+    }
+
+    int fd;
+
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    unsigned sqe_pending;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint16_t buf_tail;
+
+    bool fixed_registered;
+#endif
+};
+
+BgpTransport::Session::Session(BgpTransport *transport, int fd) {
+    this->transport = transport;
+    this->fd = fd;
+    fsm = NULL;
+    fixed[0] = fixed[1] = NULL;
+    fixed_slot = -1;
+    fixed_length = 0;
+    fixed_fill = 0;
+    out = NULL;
+    out_length = 0;
+    out_done = 0;
+    out_fixed = false;
+    out_fixed_send = false;
+    writing = false;
+    receiving = false;
+    want_out = false;
+    epoll_events = 0;
+    dirty = false;
+    closed = false;
+    removed = false;
+    own_fd = false;
+    inflight = 0;
+}
+
+/**
+ * @brief Queue data to be written to the session's socket.
+ *
+ * @param buffer Data.
+ * @param length Length of data.
+ * @return true Queued.
+ * @return false Session removed.
+ */
+bool BgpTransport::Session::handleOut(const uint8_t *buffer, size_t length) {
+    std::lock_guard<std::mutex> lock(transport->out_mutex);
+    if (removed) return false;
+
+    if (fixed[0] != NULL && pending.empty() && fixed_length + length <= transport->fixed_buffer_size) {
+        memcpy(fixed[fixed_fill] + fixed_length, buffer, length);
+        fixed_length += length;
+    } else {
+        // does not fit: keep the order, move what is in the registered buffer
+        // out first.
+        if (fixed_length > 0) {
+            pending.insert(pending.end(), fixed[fixed_fill], fixed[fixed_fill] + fixed_length);
+            fixed_length = 0;
+        }
+        pending.insert(pending.end(), buffer, buffer + length);
+    }
+
+    if (!dirty) {
+        dirty = true;
+        transport->dirty.push_back(this);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Construct a new BgpTransport.
+ *
+ * @param backend Backend to use. With TRANSPORT_AUTO, io_uring is used if the
+ * kernel supports it, epoll otherwise.
+ * @param fixed_buffers Number of sessions to give registered send buffers
+ * (io_uring only, 0 to not register buffers). Sessions added after that many
+ * use regular buffers. Needs 2 * fixed_buffers * fixed_buffer_size bytes of
+ * locked memory (RLIMIT_MEMLOCK). Where the kernel can't send from
+ * registered buffers, they are sent from as regular memory.
+ * @param fixed_buffer_size Size of a registered send buffer. Data queued that
+ * doesn't fit is written from a regular buffer.
+ * @param logger Log handler. (NULL to log to stderr)
+ */
+BgpTransport::BgpTransport(BgpTransportBackend backend, size_t fixed_buffers, size_t fixed_buffer_size, BgpLogHandler *logger) {
+    this->backend = backend;
+    this->fixed_buffers = fixed_buffers;
+    this->fixed_buffer_size = fixed_buffer_size;
+    started = false;
+    fixed_region = NULL;
+    recv_buffers = NULL;
+    uring = NULL;
+    multishot = true;
+    fixed_send = true;
+    epoll_fd = -1;
+    syscalls = 0;
+
+    if (logger == NULL) {
+        this->logger = new BgpLogHandler();
+        log_local = true;
+    } else {
+        this->logger = logger;
+        log_local = false;
+    }
+}
+
+BgpTransport::~BgpTransport() {
+    // closing the ring cancels everything in flight.
+    stopUring();
+    if (epoll_fd >= 0) close(epoll_fd);
+
+    for (auto &session : sessions) delete session.second;
+    for (Session *session : dying) {
+        if (session->own_fd) close(session->fd);
+        delete session;
+    }
+
+    if (recv_buffers != NULL) delete[] recv_buffers;
+    if (log_local) delete logger;
+}
+
+/**
+ * @brief Set up the backend.
+ *
+ * @return true Started.
+ * @return false Failed, or io_uring requested and not available.
+ */
+bool BgpTransport::start() {
+    if (started) return true;
+
+    recv_buffers = new uint8_t[BGP_TRANSPORT_RECV_BUFFERS * BGP_TRANSPORT_RECV_BUFFER_SIZE];
+
+    if (backend != TRANSPORT_EPOLL) {
+        if (startUring()) {
+            backend = TRANSPORT_IO_URING;
+            started = true;
+            return true;
+        }
+
+        stopUring();
+        if (backend == TRANSPORT_IO_URING) return false;
+        logger->log(INFO, "BgpTransport::start: io_uring not available, using epoll.\n");
+    }
+
+    if (!startEpoll()) return false;
+
+    backend = TRANSPORT_EPOLL;
+    started = true;
+    return true;
+}
+
+/**
+ * @brief Get the backend in use.
+ *
+ * @return BgpTransportBackend Backend. (TRANSPORT_AUTO if not started)
+ */
+BgpTransportBackend BgpTransport::getBackend() const {
+    return started ? backend : TRANSPORT_AUTO;
+}
+
+/**
+ * @brief Set the handler called when the transport stops receiving on a
+ * session.
+ *
+ * The handler is called from poll(), and may remove the session.
+ *
+ * @param handler The handler.
+ */
+void BgpTransport::setCloseHandler(const BgpTransportCloseHandler &handler) {
+    close_handler = handler;
+}
+
+/**
+ * @brief Add a connected socket.
+ *
+ * Nothing is received until an FSM is attached with attach().
+ *
+ * @param fd The socket.
+ * @return BgpOutHandler* Out handler to use in the BgpConfig of the FSM of
+ * the session. Owned by the transport, valid until remove(). NULL if not
+ * started, or the socket was added already.
+ */
+BgpOutHandler* BgpTransport::add(int fd) {
+    if (!started) {
+        logger->log(ERROR, "BgpTransport::add: transport not started.\n");
+        return NULL;
+    }
+
+    if (sessions.count(fd) > 0) {
+        logger->log(ERROR, "BgpTransport::add: fd %d added already.\n", fd);
+        return NULL;
+    }
+
+    if (backend == TRANSPORT_EPOLL) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            logger->log(ERROR, "BgpTransport::add: fcntl(): %s.\n", strerror(errno));
+            return NULL;
+        }
+    }
+
+    Session *session = new Session(this, fd);
+
+    if (fixed_region != NULL && !fixed_free.empty()) {
+        size_t slot = fixed_free.back();
+        fixed_free.pop_back();
+        session->fixed_slot = (int) slot;
+        session->fixed[0] = fixed_region + slot * 2 * fixed_buffer_size;
+        session->fixed[1] = session->fixed[0] + fixed_buffer_size;
+    }
+
+    sessions[fd] = session;
+    return session;
+}
+
+/**
+ * @brief Start feeding data received on a socket to an FSM.
+ *
+ * @param fd The socket, added with add().
+ * @param fsm The FSM. Must outlive the session.
+ * @return true Receiving.
+ * @return false Socket not added, or failed.
+ */
+bool BgpTransport::attach(int fd, BgpFsm *fsm) {
+    auto it = sessions.find(fd);
+    if (it == sessions.end()) {
+        logger->log(ERROR, "BgpTransport::attach: fd %d not added.\n", fd);
+        return false;
+    }
+
+    Session *session = it->second;
+    if (session->fsm != NULL) {
+        logger->log(ERROR, "BgpTransport::attach: fd %d attached already.\n", fd);
+        return false;
+    }
+
+    session->fsm = fsm;
+    if (backend == TRANSPORT_IO_URING) return uringArmRecv(session);
+    return epollUpdate(session);
+}
+
+/**
+ * @brief Remove a session.
+ *
+ * Receiving stops right away. Data queued is still written: the socket is
+ * dup()'d if needed, so it can be closed by the caller after this. With
+ * io_uring, the requests queued on the socket are submitted before this
+ * returns, as they name the socket by number, which may be reused once the
+ * caller closes it. Must be called from the thread calling poll().
+ *
+ * @param fd The socket.
+ * @return true Removed.
+ * @return false Socket not added.
+ */
+bool BgpTransport::remove(int fd) {
+    auto it = sessions.find(fd);
+    if (it == sessions.end()) return false;
+
+    Session *session = it->second;
+    sessions.erase(it);
+
+    bool has_data;
+    {
+        std::lock_guard<std::mutex> lock(out_mutex);
+        session->removed = true;
+        has_data = !session->pending.empty() || session->fixed_length > 0;
+    }
+    session->closed = true;
+
+    if (backend == TRANSPORT_IO_URING) {
+        if (session->receiving) uringCancel(session);
+    } else if (session->epoll_events != 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        session->epoll_events = 0;
+    }
+
+    if (has_data || session->writing) {
+        int new_fd = dup(fd);
+        if (new_fd < 0) {
+            logger->log(ERROR, "BgpTransport::remove: dup(): %s, data queued dropped.\n", strerror(errno));
+            std::lock_guard<std::mutex> lock(out_mutex);
+            session->pending.clear();
+            session->fixed_length = 0;
+            if (backend == TRANSPORT_EPOLL) session->writing = false;
+        } else {
+            session->fd = new_fd;
+            session->own_fd = true;
+            if (backend == TRANSPORT_EPOLL) epollUpdate(session);
+            if (has_data) markDirty(session);
+        }
+    }
+
+#ifdef BGP_TRANSPORT_URING
+    if (backend == TRANSPORT_IO_URING && uring->enter(0, 0, syscalls) < 0) {
+        logger->log(ERROR, "BgpTransport::remove: io_uring_enter(): %s.\n", strerror(errno));
+    }
+#endif
+
+    dying.push_back(session);
+    return true;
+}
+
+/**
+ * @brief Write queued data, wait for events and handle them.
+ *
+ * FSMs attached are run on the data received from this thread, and the close
+ * handler is called from here.
+ *
+ * @param timeout_ms Time to wait for an event at most, in milliseconds. 0 to
+ * not wait, -1 to wait forever.
+ * @return int Number of events handled (data or completions), -1 if failed.
+ */
+int BgpTransport::poll(int timeout_ms) {
+    if (!started) {
+        logger->log(ERROR, "BgpTransport::poll: transport not started.\n");
+        return -1;
+    }
+
+    if (backend == TRANSPORT_IO_URING) return uringPoll(timeout_ms);
+    return epollPoll(timeout_ms);
+}
+
+/**
+ * @brief Write queued data now, without waiting for events.
+ *
+ * @return true Written, or submitted.
+ * @return false Failed.
+ */
+bool BgpTransport::flush() {
+    if (!started) return false;
+    if (!flushDirty()) return false;
+
+#ifdef BGP_TRANSPORT_URING
+    if (backend == TRANSPORT_IO_URING) return uring->enter(0, 0, syscalls) >= 0;
+#endif
+
+    return true;
+}
+
+/**
+ * @brief Get number of sessions.
+ *
+ * @return size_t Number of sessions, not counting the removed ones still
+ * writing.
+ */
+size_t BgpTransport::size() const {
+    return sessions.size();
+}
+
+/**
+ * @brief Get number of system calls made to receive, send and wait.
+ *
+ * @return uint64_t Number of system calls.
+ */
+uint64_t BgpTransport::getSyscallCount() const {
+    return syscalls;
+}
+
+void BgpTransport::markDirty(Session *session) {
+    std::lock_guard<std::mutex> lock(out_mutex);
+    if (session->dirty) return;
+    session->dirty = true;
+    dirty.push_back(session);
+}
+
+// start writing data queued on sessions not writing already.
+bool BgpTransport::flushDirty() {
+    std::vector<Session *> sessions_dirty;
+
+    {
+        std::lock_guard<std::mutex> lock(out_mutex);
+        if (dirty.empty()) return true;
+        sessions_dirty.swap(dirty);
+        for (Session *session : sessions_dirty) session->dirty = false;
+    }
+
+    for (Session *session : sessions_dirty) {
+        // picked up when the write in progress completes.
+        if (session->writing) continue;
+        if (!startWrite(session)) return false;
+    }
+
+    return true;
+}
+
+// take the data queued and start writing it.
+bool BgpTransport::startWrite(Session *session) {
+    {
+        std::lock_guard<std::mutex> lock(out_mutex);
+
+        if (session->fixed_length > 0) {
+            session->out = session->fixed[session->fixed_fill];
+            session->out_length = session->fixed_length;
+            session->out_fixed = true;
+            session->fixed_fill ^= 1;
+            session->fixed_length = 0;
+        } else if (!session->pending.empty()) {
+            session->sending.swap(session->pending);
+            session->pending.clear();
+            session->out = session->sending.data();
+            session->out_length = session->sending.size();
+            session->out_fixed = false;
+        } else return true;
+    }
+
+    session->out_done = 0;
+
+    if (backend == TRANSPORT_IO_URING) return uringSubmitWrite(session);
+    return epollWrite(session);
+}
+
+void BgpTransport::closeSession(Session *session, BgpTransportCloseReason reason, int err) {
+    if (session->closed) return;
+    session->closed = true;
+
+    if (reason == TRANSPORT_CLOSED_ERROR) logger->log(ERROR, "BgpTransport::closeSession: fd %d: %s.\n", session->fd, strerror(err));
+    else logger->log(DEBUG, "BgpTransport::closeSession: fd %d closed (%s).\n", session->fd, reason == TRANSPORT_CLOSED_EOF ? "eof" : "fsm");
+
+    if (backend == TRANSPORT_IO_URING) {
+        if (session->receiving) uringCancel(session);
+#ifdef BGP_TRANSPORT_URING
+        // the handler may close the socket: submit what is queued on it
+        // while the number still refers to it.
+        if (uring->enter(0, 0, syscalls) < 0) {
+            logger->log(ERROR, "BgpTransport::closeSession: io_uring_enter(): %s.\n", strerror(errno));
+        }
+#endif
+    } else epollUpdate(session);
+
+    if (close_handler) close_handler(session->fd, session->fsm, reason);
+}
+
+// free removed sessions with nothing left in flight.
+void BgpTransport::reap() {
+    if (dying.empty()) return;
+
+    std::lock_guard<std::mutex> lock(out_mutex);
+    for (size_t i = 0; i < dying.size();) {
+        Session *session = dying[i];
+        if (session->inflight > 0 || session->writing || session->dirty) {
+            i++;
+            continue;
+        }
+
+        if (session->epoll_events != 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        if (session->own_fd) close(session->fd);
+        if (session->fixed_slot >= 0) fixed_free.push_back(session->fixed_slot);
+        delete session;
+
+        dying[i] = dying.back();
+        dying.pop_back();
+    }
+}
+
+// run the FSM on data received. false if the session got closed.
+bool BgpTransport::handleData(Session *session, const uint8_t *buffer, size_t length) {
+    int ret = session->fsm->run(buffer, length);
+
+    // 0: NOTIFICATION sent, 2: NOTIFICATION received, -1: FSM broken.
+    if (ret <= 0 || ret == 2) {
+        closeSession(session, TRANSPORT_CLOSED_FSM, 0);
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef BGP_TRANSPORT_URING
+
+bool BgpTransport::startUring() {
+    uring = new Uring();
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    params.cq_entries = BGP_TRANSPORT_SQ_ENTRIES * 4;
+
+    uring->fd = (int) syscall(__NR_io_uring_setup, BGP_TRANSPORT_SQ_ENTRIES, &params);
+    if (uring->fd < 0 && errno == EINVAL) {
+        // no COOP_TASKRUN (< 5.19).
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = BGP_TRANSPORT_SQ_ENTRIES * 4;
+        uring->fd = (int) syscall(__NR_io_uring_setup, BGP_TRANSPORT_SQ_ENTRIES, &params);
+    }
+
+    if (uring->fd < 0) {
+        logger->log(INFO, "BgpTransport::startUring: io_uring_setup(): %s.\n", strerror(errno));
+        return false;
+    }
+
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) {
+        logger->log(INFO, "BgpTransport::startUring: io_uring features missing.\n");
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    uring->ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = (struct io_uring_sqe *) mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+
+    if (uring->ring == MAP_FAILED || uring->sqes == MAP_FAILED) {
+        logger->log(ERROR, "BgpTransport::startUring: mmap(): %s.\n", strerror(errno));
+        return false;
+    }
+
+    uint8_t *ring = (uint8_t *) uring->ring;
+    uring->sq_head = (unsigned *) (ring + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (ring + params.sq_off.tail);
+    uring->sq_flags = (unsigned *) (ring + params.sq_off.flags);
+    uring->sq_mask = *(unsigned *) (ring + params.sq_off.ring_mask);
+    uring->sq_entries = params.sq_entries;
+    uring->sqe_tail = *uring->sq_tail;
+    uring->cq_head = (unsigned *) (ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (ring + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *) (ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+
+    // SQEs are used in order.
+    unsigned *sq_array = (unsigned *) (ring + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) sq_array[i] = i;
+
+    // receive buffers, picked by the kernel.
+    uring->buf_ring_size = BGP_TRANSPORT_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    uring->buf_ring = (struct io_uring_buf_ring *) mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->buf_ring == MAP_FAILED) {
+        logger->log(ERROR, "BgpTransport::startUring: mmap(): %s.\n", strerror(errno));
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) uring->buf_ring;
+    reg.ring_entries = BGP_TRANSPORT_RECV_BUFFERS;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        logger->log(INFO, "BgpTransport::startUring: provided buffer ring: %s.\n", strerror(errno));
+        return false;
+    }
+
+    for (uint16_t bid = 0; bid < BGP_TRANSPORT_RECV_BUFFERS; bid++) uringRecycle(bid);
+
+    if (fixed_buffers > 0) {
+        size_t size = fixed_buffers * 2 * fixed_buffer_size;
+        void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        struct iovec iov;
+        iov.iov_base = region;
+        iov.iov_len = size;
+
+        if (region == MAP_FAILED || syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+            logger->log(WARN, "BgpTransport::startUring: failed to register send buffers: %s, using regular buffers.\n", strerror(errno));
+            if (region != MAP_FAILED) munmap(region, size);
+        } else {
+            fixed_region = (uint8_t *) region;
+            uring->fixed_registered = true;
+            for (size_t i = fixed_buffers; i > 0; i--) fixed_free.push_back(i - 1);
+        }
+    }
+
+    return true;
+}
+
+void BgpTransport::stopUring() {
+    if (uring == NULL) return;
+
+    if (uring->fd >= 0) close(uring->fd);
+    if (uring->ring != MAP_FAILED) munmap(uring->ring, uring->ring_size);
+    if (uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_size);
+    if (uring->buf_ring != MAP_FAILED) munmap(uring->buf_ring, uring->buf_ring_size);
+    if (fixed_region != NULL) munmap(fixed_region, fixed_buffers * 2 * fixed_buffer_size);
+
+    fixed_region = NULL;
+    fixed_free.clear();
+
+    delete uring;
+    uring = NULL;
+}
+
+// give a receive buffer (back) to the kernel.
+void BgpTransport::uringRecycle(uint16_t bid) {
+    // not buf_ring->bufs: the entries start at the ring, but the header's
+    // flexible array puts bufs at offset 8 in C++.
+    struct io_uring_buf *buf = (struct io_uring_buf *) uring->buf_ring + (uring->buf_tail & (BGP_TRANSPORT_RECV_BUFFERS - 1));
+    buf->addr = (uint64_t) (uintptr_t) (recv_buffers + (size_t) bid * BGP_TRANSPORT_RECV_BUFFER_SIZE);
+    buf->len = BGP_TRANSPORT_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    uring->buf_tail++;
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+bool BgpTransport::uringArmRecv(Session *session) {
+    struct io_uring_sqe *sqe = uring->getSqe(syscalls);
+    if (sqe == NULL) {
+        logger->log(ERROR, "BgpTransport::uringArmRecv: submission queue full.\n");
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = session->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->ioprio = multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = (uint64_t) (uintptr_t) session | URING_OP_RECV;
+
+    session->receiving = true;
+    session->inflight++;
+    return true;
+}
+
+bool BgpTransport::uringCancel(Session *session) {
+    struct io_uring_sqe *sqe = uring->getSqe(syscalls);
+    if (sqe == NULL) {
+        logger->log(ERROR, "BgpTransport::uringCancel: submission queue full.\n");
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) session | URING_OP_RECV;
+    sqe->user_data = 0;
+    return true;
+}
+
+bool BgpTransport::uringSubmitWrite(Session *session) {
+    struct io_uring_sqe *sqe = uring->getSqe(syscalls);
+    if (sqe == NULL) {
+        logger->log(ERROR, "BgpTransport::uringSubmitWrite: submission queue full.\n");
+        return false;
+    }
+
+    // a send, not a write: a write to a socket reset by the peer raises
+    // SIGPIPE.
+    sqe->opcode = IORING_OP_SEND;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    session->out_fixed_send = false;
+
+#ifdef IORING_RECVSEND_FIXED_BUF
+    if (session->out_fixed && fixed_send) {
+        sqe->ioprio |= IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = 0;
+        session->out_fixed_send = true;
+    }
+#endif
+
+    sqe->fd = session->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (session->out + session->out_done);
+    sqe->len = session->out_length - session->out_done;
+    sqe->user_data = (uint64_t) (uintptr_t) session | URING_OP_WRITE;
+
+    session->writing = true;
+    session->inflight++;
+    return true;
+}
+
+void BgpTransport::uringComplete(uint64_t user_data, int32_t res, uint32_t flags) {
+    Session *session = (Session *) (uintptr_t) (user_data & ~(uint64_t) URING_OP_MASK);
+
+    if ((user_data & URING_OP_MASK) == URING_OP_RECV) {
+        bool more = flags & IORING_CQE_F_MORE;
+        if (!more) {
+            session->receiving = false;
+            session->inflight--;
+        }
+
+        if (res > 0) {
+            uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (!session->closed) handleData(session, recv_buffers + (size_t) bid * BGP_TRANSPORT_RECV_BUFFER_SIZE, res);
+            uringRecycle(bid);
+            if (!more && !session->closed) uringArmRecv(session);
+        } else if (res == 0) {
+            closeSession(session, TRANSPORT_CLOSED_EOF, 0);
+        } else if (res == -ENOBUFS) {
+            // out of receive buffers: re-arm after the completions queued,
+            // which return buffers, are handled.
+            if (!session->closed) rearm.push_back(session);
+        } else if (res == -EINVAL && multishot) {
+            logger->log(INFO, "BgpTransport::uringComplete: multishot receive not supported, using single shot.\n");
+            multishot = false;
+            if (!session->closed) uringArmRecv(session);
+        } else if (res != -ECANCELED) {
+            closeSession(session, TRANSPORT_CLOSED_ERROR, -res);
+        }
+
+        return;
+    }
+
+    session->inflight--;
+    session->writing = false;
+
+    if (res == -EINVAL && session->out_fixed_send) {
+        logger->log(INFO, "BgpTransport::uringComplete: send from registered buffers not supported, using regular send.\n");
+        fixed_send = false;
+        if (uringSubmitWrite(session)) return;
+        res = -EAGAIN;
+    }
+
+    if (res >= 0) {
+        session->out_done += res;
+        if (session->out_done < session->out_length) {
+            if (uringSubmitWrite(session)) return;
+            res = -EAGAIN;
+        }
+    }
+
+    if (res < 0) {
+        {
+            std::lock_guard<std::mutex> lock(out_mutex);
+            session->pending.clear();
+            session->fixed_length = 0;
+        }
+        session->sending.clear();
+        closeSession(session, TRANSPORT_CLOSED_ERROR, -res);
+        return;
+    }
+
+    session->sending.clear();
+
+    bool has_data;
+    {
+        std::lock_guard<std::mutex> lock(out_mutex);
+        has_data = !session->pending.empty() || session->fixed_length > 0;
+    }
+    if (has_data) markDirty(session);
+}
+
+int BgpTransport::uringPoll(int timeout_ms) {
+    if (!flushDirty()) return -1;
+
+    unsigned head = *uring->cq_head;
+    bool ready = head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    // submit, and wait for completions if there are none.
+    if (uring->enter(ready || timeout_ms == 0 ? 0 : 1, timeout_ms, syscalls) < 0) {
+        logger->log(ERROR, "BgpTransport::uringPoll: io_uring_enter(): %s.\n", strerror(errno));
+        return -1;
+    }
+
+    int handled = 0;
+    while (true) {
+        unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int32_t res = cqe->res;
+            uint32_t flags = cqe->flags;
+
+            if (user_data == 0) continue;
+            uringComplete(user_data, res, flags);
+            handled++;
+        }
+
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (Session *session : rearm) {
+        if (!session->closed && !session->receiving) uringArmRecv(session);
+    }
+    rearm.clear();
+
+    reap();
+    return handled;
+}
+
+#else
+
+bool BgpTransport::startUring() {
+    logger->log(INFO, "BgpTransport::startUring: built without io_uring support.\n");
+    return false;
+}
+
+void BgpTransport::stopUring() {}
+void BgpTransport::uringRecycle(uint16_t) {}
+bool BgpTransport::uringArmRecv(Session *) { return false; }
+bool BgpTransport::uringCancel(Session *) { return false; }
+bool BgpTransport::uringSubmitWrite(Session *) { return false; }
+void BgpTransport::uringComplete(uint64_t, int32_t, uint32_t) {}
+int BgpTransport::uringPoll(int) { return -1; }
+
+#endif
+
+bool BgpTransport::startEpoll() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        logger->log(ERROR, "BgpTransport::startEpoll: epoll_create1(): %s.\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// register the events the session waits for.
+bool BgpTransport::epollUpdate(Session *session) {
+    uint32_t events = (!session->closed && session->fsm != NULL ? (uint32_t) EPOLLIN : 0) | (session->want_out ? (uint32_t) EPOLLOUT : 0);
+    if (events == session->epoll_events) return true;
+
+    if (events == 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        session->epoll_events = 0;
+        return true;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = session;
+
+    if (epoll_ctl(epoll_fd, session->epoll_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, session->fd, &ev) < 0) {
+        logger->log(ERROR, "BgpTransport::epollUpdate: epoll_ctl(): %s.\n", strerror(errno));
+        return false;
+    }
+
+    session->epoll_events = events;
+    return true;
+}
+
+// write until done or the socket is full. false only if epoll failed.
+bool BgpTransport::epollWrite(Session *session) {
+    session->writing = true;
+
+    while (session->out_done < session->out_length) {
+        syscalls++;
+        ssize_t ret = send(session->fd, session->out + session->out_done, session->out_length - session->out_done, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                session->want_out = true;
+                return epollUpdate(session);
+            }
+
+            int err = errno;
+            {
+                std::lock_guard<std::mutex> lock(out_mutex);
+                session->pending.clear();
+            }
+            session->sending.clear();
+            session->writing = false;
+            session->want_out = false;
+            closeSession(session, TRANSPORT_CLOSED_ERROR, err);
+            return epollUpdate(session);
+        }
+
+        session->out_done += ret;
+    }
+
+    session->sending.clear();
+    session->writing = false;
+    session->want_out = false;
+    return epollUpdate(session);
+}
+
+int BgpTransport::epollPoll(int timeout_ms) {
+    if (!flushDirty()) return -1;
+
+    struct epoll_event events[BGP_TRANSPORT_EPOLL_EVENTS];
+
+    syscalls++;
+    int n = epoll_wait(epoll_fd, events, BGP_TRANSPORT_EPOLL_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        logger->log(ERROR, "BgpTransport::epollPoll: epoll_wait(): %s.\n", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        Session *session = (Session *) events[i].data.ptr;
+        uint32_t ev = events[i].events;
+
+        if ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && session->writing) {
+            if (!epollWrite(session)) return -1;
+            if (!session->writing && !startWrite(session)) return -1;
+        }
+
+        if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !session->closed && session->fsm != NULL) {
+            syscalls++;
+            ssize_t len = recv(session->fd, recv_buffers, BGP_TRANSPORT_RECV_BUFFER_SIZE, MSG_DONTWAIT);
+
+            if (len > 0) handleData(session, recv_buffers, len);
+            else if (len == 0) closeSession(session, TRANSPORT_CLOSED_EOF, 0);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closeSession(session, TRANSPORT_CLOSED_ERROR, errno);
+        }
+    }
+
+    reap();
+    return n;
+}
+
+}
@@ -0,0 +1,255 @@
+/**
+ * @file bgp-transport.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Event loop transport for many BgpFsm sessions. (io_uring or epoll)
+ * @version 0.1
+ * @date 2019-09-12
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+#ifndef BGP_TRANSPORT_H_
+#define BGP_TRANSPORT_H_
+
+// number of receive buffers shared by all sessions (power of 2).
+#define BGP_TRANSPORT_RECV_BUFFERS 512
+
+// size of a receive buffer.
+#define BGP_TRANSPORT_RECV_BUFFER_SIZE 16384
+
+// io_uring submission queue entries.
+#define BGP_TRANSPORT_SQ_ENTRIES 1024
+
+// default size of the registered send buffers of a session. (two per session)
+#define BGP_TRANSPORT_FIXED_BUFFER_SIZE 16384
+
+// epoll events handled per epoll_wait() call, at most.
+#define BGP_TRANSPORT_EPOLL_EVENTS 256
+
+#include <stdint.h>
+#include <unistd.h>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "bgp-fsm.h"
+#include "bgp-log-handler.h"
+#include "bgp-out-handler.h"
+
+namespace libbgp {
+
+/**
+ * @brief Transport backends.
+ *
+ */
+enum BgpTransportBackend {
+    // io_uring if the kernel supports it, else epoll.
+    TRANSPORT_AUTO,
+    TRANSPORT_IO_URING,
+    TRANSPORT_EPOLL
+};
+
+/**
+ * @brief Why the transport stopped receiving on a session.
+ *
+ */
+enum BgpTransportCloseReason {
+    // peer closed the connection.
+    TRANSPORT_CLOSED_EOF,
+
+    // read or write failed.
+    TRANSPORT_CLOSED_ERROR,
+
+    // BgpFsm::run() returned an error, or a NOTIFICATION was sent or
+    // received.
+    TRANSPORT_CLOSED_FSM
+};
+
+/**
+ * @brief Called when the transport stops receiving on a session.
+ *
+ * Parameters are the socket, the FSM attached, and the reason. The handler
+ * usually resets the FSM and removes the session.
+ */
+typedef std::function<void (int, BgpFsm *, BgpTransportCloseReason)> BgpTransportCloseHandler;
+
+/**
+ * @brief The BgpTransport class.
+ *
+ * Serves many sessions from one thread: waits for data on all sessions'
+ * sockets, feeds it to the FSMs, and writes what the FSMs send out.
+ *
+ * With the io_uring backend, each socket has one multishot receive in
+ * flight. Data lands in receive buffers shared by all sessions (a provided
+ * buffer ring), and is passed to BgpFsm::run() right from there, then the
+ * buffer goes back to the ring. Messages an FSM sends are appended to a
+ * buffer of the session and written out with a single send when poll() is
+ * next called, and the sends of all sessions are submitted with the wait for
+ * completions, in one system call. Optionally, the send buffers of the
+ * sessions are registered with the kernel once, so they are not mapped for
+ * every write. The epoll backend, used where io_uring is not available, does
+ * one read per readable socket and one write per session with data to send
+ * per poll().
+ *
+ * The FSMs attached should be run and ticked only by the thread calling
+ * poll(). The out handlers can be called from any thread, data queued is
+ * written on the next poll() or flush().
+ */
+class BgpTransport {
+public:
+    BgpTransport(BgpTransportBackend backend = TRANSPORT_AUTO, size_t fixed_buffers = 0, size_t fixed_buffer_size = BGP_TRANSPORT_FIXED_BUFFER_SIZE, BgpLogHandler *logger = NULL);
+    ~BgpTransport();
+
+    // set up the backend. returns false if failed.
+    bool start();
+
+    // backend in use. (after start())
+    BgpTransportBackend getBackend() const;
+
+    // set the handler called when the transport stops receiving on a session.
+    void setCloseHandler(const BgpTransportCloseHandler &handler);
+
+    // add a connected socket. returns the out handler to use in the
+    // BgpConfig of the session's FSM, NULL if failed.
+    BgpOutHandler* add(int fd);
+
+    // start feeding data received on the socket to fsm.
+    bool attach(int fd, BgpFsm *fsm);
+
+    // remove a session. data queued is still written. the socket is not
+    // closed, but may be closed right after this. the out handler must not
+    // be used after this.
+    bool remove(int fd);
+
+    // write queued data, wait up to timeout_ms (-1: forever) for events and
+    // handle them. returns number of events handled, -1 if failed.
+    int poll(int timeout_ms);
+
+    // write queued data now. returns false if failed.
+    bool flush();
+
+    // get number of sessions.
+    size_t size() const;
+
+    // get number of system calls made to receive, send and wait.
+    uint64_t getSyscallCount() const;
+
+private:
+    BgpTransport(const BgpTransport &);
+    BgpTransport& operator= (const BgpTransport &);
+
+    class Session : public BgpOutHandler {
+    public:
+        Session(BgpTransport *transport, int fd);
+        bool handleOut(const uint8_t *buffer, size_t length);
+
+        BgpTransport *transport;
+        int fd;
+        BgpFsm *fsm;
+
+        // data queued by handleOut(), guarded by out_mutex.
+        std::vector<uint8_t> pending;
+
+        // registered send buffers (NULL if none): one filled by handleOut(),
+        // guarded by out_mutex, the other being written.
+        uint8_t *fixed[2];
+        int fixed_slot;
+        size_t fixed_length;
+        int fixed_fill;
+
+        // data being written.
+        std::vector<uint8_t> sending;
+        const uint8_t *out;
+        size_t out_length;
+        size_t out_done;
+        bool out_fixed;
+
+        // write in flight sends from the registered buffers.
+        bool out_fixed_send;
+
+        bool writing;
+        bool receiving;
+        bool want_out;
+
+        // events registered with epoll, 0 if not registered.
+        uint32_t epoll_events;
+
+        // in dirty list, guarded by out_mutex.
+        bool dirty;
+
+        bool closed;
+        bool removed;
+
+        // fd is a dup() owned by the session, to finish writing after
+        // remove().
+        bool own_fd;
+
+        // io_uring operations in flight.
+        int inflight;
+    };
+
+    struct Uring;
+
+    bool startUring();
+    bool startEpoll();
+    void stopUring();
+
+    void markDirty(Session *session);
+    bool flushDirty();
+    bool startWrite(Session *session);
+    void closeSession(Session *session, BgpTransportCloseReason reason, int err);
+    void reap();
+    bool handleData(Session *session, const uint8_t *buffer, size_t length);
+
+    bool uringArmRecv(Session *session);
+    bool uringCancel(Session *session);
+    bool uringSubmitWrite(Session *session);
+    void uringComplete(uint64_t user_data, int32_t res, uint32_t flags);
+    int uringPoll(int timeout_ms);
+    void uringRecycle(uint16_t bid);
+
+    bool epollUpdate(Session *session);
+    bool epollWrite(Session *session);
+    int epollPoll(int timeout_ms);
+
+    BgpTransportBackend backend;
+    BgpLogHandler *logger;
+    bool log_local;
+    bool started;
+    BgpTransportCloseHandler close_handler;
+
+    std::unordered_map<int, Session *> sessions;
+
+    // removed sessions, freed once idle.
+    std::vector<Session *> dying;
+
+    // sessions with data queued, guarded by out_mutex.
+    std::vector<Session *> dirty;
+    std::mutex out_mutex;
+
+    // registered send buffers.
+    size_t fixed_buffers;
+    size_t fixed_buffer_size;
+    uint8_t *fixed_region;
+    std::vector<size_t> fixed_free;
+
+    // receive buffers.
+    uint8_t *recv_buffers;
+
+    Uring *uring;
+    bool multishot;
+
+    // sends from registered buffers supported.
+    bool fixed_send;
+
+    // sessions to receive on again, ran out of receive buffers.
+    std::vector<Session *> rearm;
+
+    int epoll_fd;
+
+    uint64_t syscalls;
+};
+
+}
+
+#endif // BGP_TRANSPORT_H_
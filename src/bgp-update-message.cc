@@ -12,10 +12,18 @@
 #include "bgp-errcode.h"
 #include "bgp-afi.h"
 #include "value-op.h"
+#include "bgp-asn-codec.h"
 #include <arpa/inet.h>
 
 namespace libbgp {
 
+// parse an attribute with parse() of its concrete class, and store it to *to.
+template <typename T>
+static ssize_t parseAs(T *attrib, BgpPathAttrib **to, const uint8_t *from, size_t length) {
+    *to = attrib;
+    return attrib->T::parse(from, length);
+}
+
 /**
  * @brief Construct a new Bgp Update Message:: Bgp Update Message object
  * 
@@ -28,33 +36,33 @@ BgpUpdateMessage::BgpUpdateMessage(BgpLogHandler *logger, bool use_4b_asn) : Bgp
 }
 
 /**
- * @brief Get mutable reference to attribute by typecode.
+ * @brief Get mutable pointer to attribute by typecode.
  * 
  * @param type Attribute typecode.
- * @return BgpPathAttrib& The attribute.
- * @throws "no such attribute" if attribute does not exist.
+ * @return BgpPathAttrib* The attribute.
+ * @retval NULL Attribute does not exist.
  */
-BgpPathAttrib& BgpUpdateMessage::getAttrib(uint8_t type) {
-    for (std::shared_ptr<BgpPathAttrib> attrib : path_attribute) {
-        if (attrib->type_code == type) return *attrib;
+BgpPathAttrib* BgpUpdateMessage::getAttrib(uint8_t type) {
+    for (const std::shared_ptr<BgpPathAttrib> &attrib : path_attribute) {
+        if (attrib->type_code == type) return attrib.get();
     }
 
-    throw "no such attribute";
+    return NULL;
 }
 
 /**
- * @brief Get const reference to attribute by typecode.
+ * @brief Get const pointer to attribute by typecode.
  * 
  * @param type Attribute typecode.
- * @return const BgpPathAttrib& The attribute.
- * @throws "no such attribute" if attribute does not exist.
+ * @return const BgpPathAttrib* The attribute.
+ * @retval NULL Attribute does not exist.
  */
-const BgpPathAttrib& BgpUpdateMessage::getAttrib(uint8_t type) const {
+const BgpPathAttrib* BgpUpdateMessage::getAttrib(uint8_t type) const {
     for (const std::shared_ptr<BgpPathAttrib> &attrib : path_attribute) {
-        if (attrib->type_code == type) return *attrib;
+        if (attrib->type_code == type) return attrib.get();
     }
 
-    throw "no such attribute";
+    return NULL;
 }
 
 /**
@@ -65,11 +73,7 @@ const BgpPathAttrib& BgpUpdateMessage::getAttrib(uint8_t type) const {
  * @return false Attribute not avaliable.
  */
 bool BgpUpdateMessage::hasAttrib(uint8_t type) const {
-    for (const std::shared_ptr<BgpPathAttrib> &attrib : path_attribute) {
-        if (attrib->type_code == type) return true;
-    }
-
-    return false;
+    return getAttrib(type) != NULL;
 }
 
 /**
@@ -78,12 +82,15 @@ bool BgpUpdateMessage::hasAttrib(uint8_t type) const {
  * @param attrib The attribute.
  * @return true Attribute added.
  * @return false Failed to add attribute. Likely because another attribute with
- * same type code already exists.
+ * same type code already exists, or the attribute has error.
  */
 bool BgpUpdateMessage::addAttrib(const BgpPathAttrib &attrib) {
     if (hasAttrib(attrib.type_code)) return false;
 
-    path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(attrib.clone(logger)));
+    BgpPathAttrib *cloned = attrib.clone(logger);
+    if (cloned == NULL) return false;
+
+    path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(cloned));
     return true;
 }
 
@@ -92,14 +99,20 @@ bool BgpUpdateMessage::addAttrib(const BgpPathAttrib &attrib) {
  * 
  * @param attrs List of attributes.
  * @return true List replaced.
- * @return false Failed to replace list.
+ * @return false Failed to replace list. Attributes with error are not copied.
  */
 bool BgpUpdateMessage::setAttribs(const std::vector<std::shared_ptr<BgpPathAttrib>> &attrs) {
+    bool ok = true;
     path_attribute.clear();
     for (const std::shared_ptr<BgpPathAttrib> &attrib : attrs) {
-        path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(attrib->clone(logger)));
+        BgpPathAttrib *cloned = attrib->clone(logger);
+        if (cloned == NULL) {
+            ok = false;
+            continue;
+        }
+        path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(cloned));
     }
-    return true;
+    return ok;
 }
 
 /**
@@ -188,46 +201,46 @@ bool BgpUpdateMessage::prepend(uint32_t asn) {
             return false;
         }
 
-        if (!hasAttrib(AS_PATH)) {
+        BgpPathAttrib *attr = getAttrib(AS_PATH);
+        if (attr == NULL) {
             BgpPathAttribAsPath *path = new BgpPathAttribAsPath(logger, use_4b_asn);
             path->prepend(asn);
             path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(path));
             return true;
         }
 
-        BgpPathAttribAsPath &path = dynamic_cast<BgpPathAttribAsPath &>(getAttrib(AS_PATH));
-        if (!path.is_4b) {
+        BgpPathAttribAsPath *path = static_cast<BgpPathAttribAsPath *>(attr);
+        if (!path->is_4b) {
             logger->log(ERROR, "BgpUpdateMessage::prepend: existing AS_PATH is 2b but we are running in 4b mode. " 
                        "consider restoreAsPath().\n");
             return false;
         }
 
-        return path.prepend(asn);
+        return path->prepend(asn);
     } else {
         // in 2b-mode, prepend 2b asn to AS_PATH and update AS4_PATH.
         // (yes, you don't update AS4_PATH as a 2b-speaker, but simplicity we do that for now)
         // FIXME: don't change as4_path if both side disabled 4b support
 
-        uint16_t prep_asn = asn >= 0xffff ? 23456 : asn;
+        uint16_t prep_asn = BgpAsnCodec<uint16_t>::toWire(asn);
 
-        if (!hasAttrib(AS_PATH)) {
+        BgpPathAttrib *attr = getAttrib(AS_PATH);
+        if (attr == NULL) {
             BgpPathAttribAsPath *path = new BgpPathAttribAsPath(logger, use_4b_asn);
             path->prepend(prep_asn);
             path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(path));
         } else {
-            BgpPathAttribAsPath &path = dynamic_cast<BgpPathAttribAsPath &>(getAttrib(AS_PATH));
-            if (path.is_4b) {
+            BgpPathAttribAsPath *path = static_cast<BgpPathAttribAsPath *>(attr);
+            if (path->is_4b) {
                 logger->log(ERROR, "BgpUpdateMessage::prepend: existing AS_PATH is 4b but we are running in 2b mode. " 
                            "consider downgradeAsPath().\n");
                 return false;
             }
-            if(!path.prepend(prep_asn)) return false;
+            if(!path->prepend(prep_asn)) return false;
         }
 
-        if (hasAttrib(AS4_PATH)) {
-            BgpPathAttribAs4Path &path4 = dynamic_cast<BgpPathAttribAs4Path &>(getAttrib(AS4_PATH));
-            if(!path4.prepend(prep_asn)) return false;
-        }
+        BgpPathAttribAs4Path *path4 = static_cast<BgpPathAttribAs4Path *>(getAttrib(AS4_PATH));
+        if (path4 != NULL && !path4->prepend(prep_asn)) return false;
 
         return true;
     }
@@ -243,41 +256,41 @@ bool BgpUpdateMessage::prepend(uint32_t asn) {
  * handler.
  */
 bool BgpUpdateMessage::restoreAsPath() {
-    if (!hasAttrib(AS_PATH)) return true;
+    BgpPathAttribAsPath *path_ptr = static_cast<BgpPathAttribAsPath *>(getAttrib(AS_PATH));
+    if (path_ptr == NULL) return true;
 
-    BgpPathAttribAsPath &path = dynamic_cast<BgpPathAttribAsPath &>(getAttrib(AS_PATH));
+    BgpPathAttribAsPath &path = *path_ptr;
     if (path.is_4b) return true;
 
-    // no AS4_PATH, just make AS_PATH 4b
-    if (!hasAttrib(AS4_PATH)) {
-        std::vector<BgpAsPathSegment> new_segs;
+    const BgpPathAttribAs4Path *as4_path = static_cast<const BgpPathAttribAs4Path *>(getAttrib(AS4_PATH));
 
-        for (const BgpAsPathSegment &seg2 : path.as_paths) {
-            if (seg2.is_4b) {
-                logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: 4b seg found in 2b attrib.\n");
-                return false;
-            }
+    for (const BgpAsPathSegment &seg2 : path.as_paths) {
+        if (seg2.is_4b) {
+            logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: 4b seg found in 2b attrib.\n");
+            return false;
+        }
+    }
 
-            BgpAsPathSegment new_seg (true, seg2.type);
-            for (uint16_t asn : seg2.value) {
-                if (asn == 23456) {
+    // no AS4_PATH, just make AS_PATH 4b. (ASNs are stored as 4b already)
+    if (as4_path == NULL) {
+        for (BgpAsPathSegment &seg2 : path.as_paths) {
+            for (uint32_t asn : seg2.value) {
+                if (asn == BGP_AS_TRANS) {
                     logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: warning: AS_TRANS found but no AS4_PATH.\n");
                 }
-                new_seg.value.push_back(asn);
             }
 
-            new_segs.push_back(new_seg);
+            seg2.is_4b = true;
         }
 
-        path.as_paths = new_segs;
         path.is_4b = true;
+        path.markDirty();
         return true;
     }
 
     // we have AS4_PATH recorver AS_TRANS.
     std::vector<uint32_t> full_as_path;
-    const BgpPathAttribAs4Path &as4_path = dynamic_cast<const BgpPathAttribAs4Path &>(getAttrib(AS4_PATH));
-    for (const BgpAsPathSegment &seg4 : as4_path.as4_paths) {
+    for (const BgpAsPathSegment &seg4 : as4_path->as4_paths) {
         if (!seg4.is_4b) {
             logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: bad as4_path: found 2b seg.\n");
             return false;
@@ -302,47 +315,35 @@ bool BgpUpdateMessage::restoreAsPath() {
         if (*iter_4b > 0xffff) break;
     }
 
-    std::vector<BgpAsPathSegment> new_segs;
-
-    for (const BgpAsPathSegment &seg2 : path.as_paths) {
+    for (BgpAsPathSegment &seg2 : path.as_paths) {
         std::vector<uint32_t>::const_iterator local_iter = iter_4b;
-        if (seg2.is_4b) {
-            logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: 4b seg found in 2b attrib.\n");
-            return false;
-        }
-
-        BgpAsPathSegment new_seg (true, seg2.type);
 
         // increment the local_iter iterator?
         bool incr_iter = false;
-        for (uint16_t asn : seg2.value) {
-            uint32_t new_asn = asn;
-
+        for (uint32_t &asn : seg2.value) {
             // AS4_PATH avaliale & not ended?
             if (has_4b && local_iter != full_as_path.end()) {
 
                 // we found AS_TRANS, we need to replace it with last asn in AS_TRANS
-                if (new_asn == 23456) {
+                if (asn == BGP_AS_TRANS) {
 
                     // we have hit our first AS_TRANS. from now on, we need to move the AS4_PATH
                     // iterator too.
                     incr_iter = true;
-                    new_asn = *local_iter;
-                } else if (new_asn != *local_iter) {
+                    asn = *local_iter;
+                } else if (asn != *local_iter) {
                     logger->log(ERROR, "BgpUpdateMessage::restoreAsPath: warning: AS_PATH and AS4_PATH does not match.\n");
                 }
 
                 if (incr_iter) local_iter++;
             }
-            
-            new_seg.value.push_back(new_asn);
         }
 
-        new_segs.push_back(new_seg);
+        seg2.is_4b = true;
     }
 
     path.is_4b = true;
-    path.as_paths = new_segs;
+    path.markDirty();
     return true;
     
 }
@@ -357,33 +358,30 @@ bool BgpUpdateMessage::restoreAsPath() {
  * with log handler.
  */
 bool BgpUpdateMessage::downgradeAsPath() {
-    if (!hasAttrib(AS_PATH)) return true;
+    BgpPathAttribAsPath *path_ptr = static_cast<BgpPathAttribAsPath *>(getAttrib(AS_PATH));
+    if (path_ptr == NULL) return true;
 
-    BgpPathAttribAsPath &path = dynamic_cast<BgpPathAttribAsPath &>(getAttrib(AS_PATH));
+    BgpPathAttribAsPath &path = *path_ptr;
     if (!path.is_4b) return true;
 
-    std::vector<BgpAsPathSegment> new_segs;
-    BgpPathAttribAs4Path path4 = BgpPathAttribAs4Path(logger);
-
     for (const BgpAsPathSegment &seg4 : path.as_paths) {
         if (!seg4.is_4b) {
             logger->log(ERROR, "BgpUpdateMessage::downgradeAsPath: 2b seg found in 4b attrib.\n");
             return false;
         }
+    }
 
-        BgpAsPathSegment new_seg (false, seg4.type);
-        for (uint32_t asn : seg4.value) {
-            uint16_t new_as = asn >= 0xffff ? 23456 : asn;
-            new_seg.value.push_back(new_as);
-        }
+    BgpPathAttribAs4Path path4 = BgpPathAttribAs4Path(logger);
+    path4.as4_paths = path.as_paths;
 
-        path4.as4_paths.push_back(seg4);
-        new_segs.push_back(new_seg);
+    for (BgpAsPathSegment &seg : path.as_paths) {
+        for (uint32_t &asn : seg.value) asn = BgpAsnCodec<uint16_t>::toWire(asn);
+        seg.is_4b = false;
     }
     
     updateAttribute(path4);
     path.is_4b = false;
-    path.as_paths = new_segs;
+    path.markDirty();
     return true;
 }
 
@@ -394,16 +392,18 @@ bool BgpUpdateMessage::downgradeAsPath() {
  * @return false Failed to restore aggregator.
  */
 bool BgpUpdateMessage::restoreAggregator() {
-    if (!hasAttrib(AGGREATOR)) return true;
+    BgpPathAttribAggregator *aggr = static_cast<BgpPathAttribAggregator *>(getAttrib(AGGREATOR));
+    if (aggr == NULL) return true;
 
-    BgpPathAttribAggregator &aggr = dynamic_cast<BgpPathAttribAggregator &>(getAttrib(AGGREATOR));
-    aggr.is_4b = true;
+    if (!aggr->is_4b) aggr->markDirty();
+    aggr->is_4b = true;
 
-    if (!hasAttrib(AS4_AGGREGATOR)) return true;
-    
-    const BgpPathAttribAs4Aggregator &aggr4 = dynamic_cast<const BgpPathAttribAs4Aggregator &>(getAttrib(AS4_AGGREGATOR));
-    aggr.aggregator = aggr4.aggregator;
-    aggr.aggregator_asn = aggr4.aggregator_asn4;
+    const BgpPathAttribAs4Aggregator *aggr4 = static_cast<const BgpPathAttribAs4Aggregator *>(getAttrib(AS4_AGGREGATOR));
+    if (aggr4 == NULL) return true;
+
+    aggr->markDirty();
+    aggr->aggregator = aggr4->aggregator;
+    aggr->aggregator_asn = aggr4->aggregator_asn4;
 
     return true;
 }
@@ -415,9 +415,11 @@ bool BgpUpdateMessage::restoreAggregator() {
  * @return false Failed to downgrade aggregator.
  */
 bool BgpUpdateMessage::downgradeAggregator() {
-    if (!hasAttrib(AGGREATOR)) return true;
-    
-    BgpPathAttribAggregator &aggr = dynamic_cast<BgpPathAttribAggregator &>(getAttrib(AGGREATOR));
+    BgpPathAttribAggregator *aggr_ptr = static_cast<BgpPathAttribAggregator *>(getAttrib(AGGREATOR));
+    if (aggr_ptr == NULL) return true;
+
+    BgpPathAttribAggregator &aggr = *aggr_ptr;
+    if (aggr.is_4b) aggr.markDirty();
     aggr.is_4b = false;
 
     BgpPathAttribAs4Aggregator aggr4 = BgpPathAttribAs4Aggregator(logger);
@@ -425,7 +427,7 @@ bool BgpUpdateMessage::downgradeAggregator() {
     aggr4.aggregator_asn4 = aggr.aggregator_asn;
     updateAttribute(aggr4);
 
-    if (aggr.aggregator_asn >= 0xffff) aggr.aggregator_asn = 23456;
+    aggr.aggregator_asn = BgpAsnCodec<uint16_t>::toWire(aggr.aggregator_asn);
 
     return true;
 }
@@ -511,7 +513,8 @@ bool BgpUpdateMessage::validateAttribs() {
     bool has_nexthop = false;
     bool has_as_path = false;
 
-    uint32_t typecode_bitsmap = 0;
+    // one bit for each of the 256 possible type codes.
+    uint64_t typecode_bitsmap[4] = { 0, 0, 0, 0 };
 
     for (std::vector<std::shared_ptr<BgpPathAttrib>>::const_iterator attr_iter = path_attribute.begin(); 
         attr_iter != path_attribute.end(); attr_iter++) {
@@ -521,13 +524,13 @@ bool BgpUpdateMessage::validateAttribs() {
         else if (type_code == NEXT_HOP) has_nexthop = true;
         else if (type_code == ORIGIN) has_origin = true;
 
-        if ((typecode_bitsmap >> type_code) & 1U) {
+        if ((typecode_bitsmap[type_code >> 6] >> (type_code & 63)) & 1U) {
             logger->log(ERROR, "BgpUpdateMessage::validateAttribs:: duplicated attribute type in list: %d\n", type_code);
             setError(E_UPDATE, E_ATTR_LIST, NULL, 0);
             return false;
         }
 
-        typecode_bitsmap &= ~(1UL << type_code);
+        typecode_bitsmap[type_code >> 6] |= 1ULL << (type_code & 63);
     }
 
     if (!(has_as_path && has_nexthop && has_origin)) {
@@ -601,7 +604,11 @@ ssize_t BgpUpdateMessage::parse(const uint8_t *from, size_t msg_sz) {
         withdrawn_routes.push_back(route);
     }
 
-    if (parsed_withdrawn_len != withdrawn_len) throw "bad_parse";
+    if (parsed_withdrawn_len != withdrawn_len) {
+        logger->log(FATAL, "BgpUpdateMessage::parse: parsed withdrawn routes length mismatch but no error reported.\n");
+        setError(E_UPDATE, E_UNSPEC, NULL, 0);
+        return -1;
+    }
 
     uint16_t attribute_len = ntohs(getValue<uint16_t>(&buffer)); // len: 2
     if ((size_t) (attribute_len + withdrawn_len + 4) > msg_sz) {
@@ -612,6 +619,12 @@ ssize_t BgpUpdateMessage::parse(const uint8_t *from, size_t msg_sz) {
 
     uint16_t parsed_attribute_len = 0;
 
+    // keep a copy of the attribute list, so attributes passing through
+    // unmodified can be written back as-is.
+    std::shared_ptr<const std::vector<uint8_t>> raw_block;
+    const uint8_t *raw_base = buffer;
+    if (attribute_len > 0) raw_block = std::make_shared<const std::vector<uint8_t>>(buffer, buffer + attribute_len);
+
     while (parsed_attribute_len < attribute_len) {
         if (attribute_len - parsed_attribute_len < 3) {
             logger->log(ERROR, "BgpUpdateMessage::parse: unexpected end of attribute list.\n");
@@ -628,21 +641,24 @@ ssize_t BgpUpdateMessage::parse(const uint8_t *from, size_t msg_sz) {
         }
 
         BgpPathAttrib *attrib = NULL;
+        size_t attrib_buf_len = attribute_len - parsed_attribute_len;
+        ssize_t attrib_parsed = -1;
 
+        // parse with the concrete class, no virtual dispatch here.
         switch(attr_type) {
-            case ORIGIN: attrib = new BgpPathAttribOrigin(logger); break;
-            case AS_PATH: attrib = new BgpPathAttribAsPath(logger, use_4b_asn); break;
-            case NEXT_HOP: attrib = new BgpPathAttribNexthop(logger); break;
-            case MULTI_EXIT_DISC: attrib = new BgpPathAttribMed(logger); break;
-            case LOCAL_PREF: attrib = new BgpPathAttribLocalPref(logger); break;
-            case ATOMIC_AGGREGATE: attrib =  new BgpPathAttribAtomicAggregate(logger); break;
-            case AGGREATOR: attrib = new BgpPathAttribAggregator(logger, use_4b_asn); break;
-            case COMMUNITY: attrib = new BgpPathAttribCommunity(logger); break;
-            case AS4_PATH: attrib = new BgpPathAttribAs4Path(logger); break;
-            case AS4_AGGREGATOR: attrib = new BgpPathAttribAs4Aggregator(logger); break;
+            case ORIGIN: attrib_parsed = parseAs(new BgpPathAttribOrigin(logger), &attrib, buffer, attrib_buf_len); break;
+            case AS_PATH: attrib_parsed = parseAs(new BgpPathAttribAsPath(logger, use_4b_asn), &attrib, buffer, attrib_buf_len); break;
+            case NEXT_HOP: attrib_parsed = parseAs(new BgpPathAttribNexthop(logger), &attrib, buffer, attrib_buf_len); break;
+            case MULTI_EXIT_DISC: attrib_parsed = parseAs(new BgpPathAttribMed(logger), &attrib, buffer, attrib_buf_len); break;
+            case LOCAL_PREF: attrib_parsed = parseAs(new BgpPathAttribLocalPref(logger), &attrib, buffer, attrib_buf_len); break;
+            case ATOMIC_AGGREGATE: attrib_parsed = parseAs(new BgpPathAttribAtomicAggregate(logger), &attrib, buffer, attrib_buf_len); break;
+            case AGGREATOR: attrib_parsed = parseAs(new BgpPathAttribAggregator(logger, use_4b_asn), &attrib, buffer, attrib_buf_len); break;
+            case COMMUNITY: attrib_parsed = parseAs(new BgpPathAttribCommunity(logger), &attrib, buffer, attrib_buf_len); break;
+            case AS4_PATH: attrib_parsed = parseAs(new BgpPathAttribAs4Path(logger), &attrib, buffer, attrib_buf_len); break;
+            case AS4_AGGREGATOR: attrib_parsed = parseAs(new BgpPathAttribAs4Aggregator(logger), &attrib, buffer, attrib_buf_len); break;
             case MP_REACH_NLRI: 
             case MP_UNREACH_NLRI: {
-                int16_t afi = BgpPathAttribMpNlriBase::GetAfiFromBuffer(buffer, attribute_len - parsed_attribute_len);
+                int16_t afi = BgpPathAttribMpNlriBase::GetAfiFromBuffer(buffer, attrib_buf_len);
                 if (afi < 0) {
                     logger->log(ERROR, "BgpUpdateMessage::parse: failed to parse mp-bgp afi.\n");
                     setError(E_UPDATE, E_UNSPEC, NULL, 0);
@@ -650,39 +666,40 @@ ssize_t BgpUpdateMessage::parse(const uint8_t *from, size_t msg_sz) {
                 }
 
                 if (afi == IPV6 && attr_type == MP_REACH_NLRI) {
-                    attrib = new BgpPathAttribMpReachNlriIpv6(logger);
+                    attrib_parsed = parseAs(new BgpPathAttribMpReachNlriIpv6(logger), &attrib, buffer, attrib_buf_len);
                     break;
                 }
                 
                 if (afi == IPV6 && attr_type == MP_UNREACH_NLRI) {
-                    attrib = new BgpPathAttribMpUnreachNlriIpv6(logger);
+                    attrib_parsed = parseAs(new BgpPathAttribMpUnreachNlriIpv6(logger), &attrib, buffer, attrib_buf_len);
                     break;
                 }
 
-                if (attr_type == MP_REACH_NLRI) attrib = new BgpPathAttribMpReachNlriUnknow(logger);
-                else attrib = new BgpPathAttribMpUnreachNlriUnknow(logger);
+                if (attr_type == MP_REACH_NLRI) attrib_parsed = parseAs(new BgpPathAttribMpReachNlriUnknow(logger), &attrib, buffer, attrib_buf_len);
+                else attrib_parsed = parseAs(new BgpPathAttribMpUnreachNlriUnknow(logger), &attrib, buffer, attrib_buf_len);
                 
                 break;
             }
-            default: attrib = new BgpPathAttrib(logger); break;
+            default: attrib_parsed = parseAs(new BgpPathAttrib(logger), &attrib, buffer, attrib_buf_len); break;
         }
 
-        if (attrib == NULL) throw "bad_parse";
-
-        ssize_t attrib_parsed = attrib->parse(buffer, attribute_len - parsed_attribute_len);
-
         if (attrib_parsed < 0) {
             forwardParseError(*attrib);
             delete attrib;
             return -1;
         }
 
+        attrib->setRaw(raw_block, raw_block->data() + (buffer - raw_base), attrib_parsed);
         buffer += attrib_parsed;
         parsed_attribute_len += attrib_parsed;
         path_attribute.push_back(std::shared_ptr<BgpPathAttrib>(attrib));
     }
 
-    if (parsed_attribute_len != attribute_len) throw "bad_parse";
+    if (parsed_attribute_len != attribute_len) {
+        logger->log(FATAL, "BgpUpdateMessage::parse: parsed attribute list length mismatch but no error reported.\n");
+        setError(E_UPDATE, E_UNSPEC, NULL, 0);
+        return -1;
+    }
 
     // 4: len fields (withdrawn len & attrib len)
     size_t nlri_len = msg_sz - 4 - parsed_attribute_len - parsed_withdrawn_len;
@@ -709,7 +726,9 @@ ssize_t BgpUpdateMessage::parse(const uint8_t *from, size_t msg_sz) {
     }
 
     if (parsed_nlri_len + parsed_attribute_len + parsed_withdrawn_len + 4 != msg_sz) {
-        throw "bad_parse";
+        logger->log(FATAL, "BgpUpdateMessage::parse: parsed message length mismatch but no error reported.\n");
+        setError(E_UPDATE, E_UNSPEC, NULL, 0);
+        return -1;
     }
 
     if (nlri.size() > 0 && !validateAttribs()) return -1;
@@ -733,7 +752,7 @@ ssize_t BgpUpdateMessage::write(uint8_t *to, size_t buf_sz) const {
     size_t written_withdrawn_length = 0;
 
     for (const Prefix4 &route : withdrawn_routes) {
-        size_t buf_avali = buf_sz - (written_withdrawn_length + tot_written);
+        size_t buf_avali = buf_sz - 2 - (written_withdrawn_length + tot_written); // 2: the length field
         ssize_t route_write_ret = route.write(buffer, buf_avali);
 
         if (route_write_ret < 0) {
@@ -757,13 +776,13 @@ ssize_t BgpUpdateMessage::write(uint8_t *to, size_t buf_sz) const {
     size_t written_attrib_length = 0;
 
     for (const std::shared_ptr<BgpPathAttrib> &attr : path_attribute) {
-        ssize_t buf_left = buf_sz - written_attrib_length - tot_written;
+        ssize_t buf_left = buf_sz - 2 - written_attrib_length - tot_written; // 2: the length field
         if (buf_left < 0) {
             logger->log(ERROR, "BgpUpdateMessage::write: unexpected end of buffer.\n");
             return -1;
         }
 
-        ssize_t write_ret = attr->write(buffer, buf_left);
+        ssize_t write_ret = attr->writeWire(buffer, buf_left);
 
         if (write_ret < 0) return -1;
         buffer += write_ret;
@@ -795,6 +814,27 @@ ssize_t BgpUpdateMessage::write(uint8_t *to, size_t buf_sz) const {
     return tot_written;
 }
 
+ssize_t BgpUpdateMessage::length() const {
+    // 4: withdrawn routes length & path attributes length fields
+    ssize_t len = 4;
+
+    for (const Prefix4 &route : withdrawn_routes) {
+        len += 1 + (route.getLength() + 7) / 8;
+    }
+
+    for (const std::shared_ptr<BgpPathAttrib> &attr : path_attribute) {
+        ssize_t attr_len = attr->wireLength();
+        if (attr_len < 0) return attr_len;
+        len += attr_len;
+    }
+
+    for (const Prefix4 &route : nlri) {
+        len += 1 + (route.getLength() + 7) / 8;
+    }
+
+    return len;
+}
+
 ssize_t BgpUpdateMessage::doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const {
     size_t written = 0;
     written += _print(indent, to, buf_sz, "UpdateMessage {\n");
@@ -33,13 +33,11 @@ public:
 
     BgpUpdateMessage(BgpLogHandler *logger, bool use_4b_asn);
 
-    // get attribute by type, if attrib of that type does not exist, exception
-    // will be thrown
-    BgpPathAttrib &getAttrib(uint8_t type);
+    // get attribute by type, NULL if attrib of that type does not exist
+    BgpPathAttrib* getAttrib(uint8_t type);
 
-    // get const attribute by type, if attrib of that type does not exist, 
-    // exception will be thrown
-    const BgpPathAttrib &getAttrib(uint8_t type) const; 
+    // get const attribute by type, NULL if attrib of that type does not exist
+    const BgpPathAttrib* getAttrib(uint8_t type) const;
 
     // return true if this type of attribute is in the message
     bool hasAttrib(uint8_t type) const;
@@ -106,6 +104,7 @@ public:
     ssize_t doPrint(size_t indent, uint8_t **to, size_t *buf_sz) const;
     ssize_t parse(const uint8_t *from, size_t msg_sz);
     ssize_t write(uint8_t *to, size_t buf_sz) const;
+    ssize_t length() const;
 
 private:
     // utility function to check if attributes are valid (i.e. no dulipicated, 
@@ -37,6 +37,16 @@ public:
      * @return uint64_t current time in second.
      */
     virtual uint64_t getTime() const = 0;
+
+    /**
+     * @brief Get the current time in millisecond.
+     * 
+     * BgpFsm uses this for timers. The default implementation has a
+     * resolution of one second; override it if the clock can do better.
+     * 
+     * @return uint64_t current time in millisecond.
+     */
+    virtual uint64_t getTimeMs() const { return getTime() * 1000; }
     virtual ~Clock() {}
 };
 
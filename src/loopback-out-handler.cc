@@ -0,0 +1,263 @@
+/**
+ * @file loopback-out-handler.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief In-memory out handler connecting two BgpFsm.
+ * @version 0.1
+ * @date 2019-08-27
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "loopback-out-handler.h"
+#include "bgp-fsm.h"
+#include <algorithm>
+#include <list>
+#include <string.h>
+#include <utility>
+
+namespace libbgp {
+
+typedef std::pair<LoopbackOutHandler *, std::vector<uint8_t>> LoopbackDeferred;
+
+// FSMs busy on this thread (writing, or being delivered to), in direct mode.
+static thread_local std::vector<const BgpFsm *> loopback_busy;
+
+// direct mode writes to busy FSMs on this thread.
+static thread_local std::list<LoopbackDeferred> loopback_deferred;
+
+static bool loopbackIsBusy(const BgpFsm *fsm) {
+    return std::find(loopback_busy.begin(), loopback_busy.end(), fsm) != loopback_busy.end();
+}
+
+/**
+ * @brief Construct a new LoopbackOutHandler in direct mode.
+ * 
+ */
+LoopbackOutHandler::LoopbackOutHandler() : now(0), pending_bytes(0), last_result(1) {
+    peer = local = NULL;
+    queue = NULL;
+    bandwidth = latency = 0;
+    link_free_at = 0;
+}
+
+/**
+ * @brief Construct a new LoopbackOutHandler in queued mode.
+ * 
+ * @param queue_size Maximum number of messages in flight.
+ * @param bandwidth Link bandwidth in bits per second. 0 for unlimited.
+ * @param latency Link latency in microseconds.
+ */
+LoopbackOutHandler::LoopbackOutHandler(size_t queue_size, uint64_t bandwidth, uint64_t latency) : now(0), pending_bytes(0), last_result(1) {
+    peer = local = NULL;
+    queue = new SpscQueue<LoopbackSegment>(queue_size);
+    this->bandwidth = bandwidth;
+    this->latency = latency;
+    link_free_at = 0;
+}
+
+LoopbackOutHandler::~LoopbackOutHandler() {
+    if (queue != NULL) delete queue;
+}
+
+/**
+ * @brief Set the FSM to deliver data to.
+ * 
+ * @param peer The peer FSM.
+ * @param local The FSM using this handler as out handler. In direct mode, data
+ * written by the peer while the local FSM is writing is deferred instead of
+ * re-entering the local FSM. (optional, but recommended)
+ */
+void LoopbackOutHandler::setPeer(BgpFsm *peer, BgpFsm *local) {
+    this->peer = peer;
+    this->local = local;
+}
+
+int LoopbackOutHandler::deliver(const uint8_t *buffer, size_t length) {
+    int ret;
+
+    if (queue == NULL) {
+        loopback_busy.push_back(peer);
+        ret = peer->run(buffer, length);
+        loopback_busy.pop_back();
+    } else ret = peer->run(buffer, length);
+
+    last_result.store(ret, std::memory_order_relaxed);
+    return ret;
+}
+
+/**
+ * @brief Deliver data deferred on this thread. (direct mode)
+ * 
+ * Data written to a busy FSM is deferred. Most of it is delivered as soon as
+ * the FSM is no longer busy, but data for the FSM that started the exchange
+ * (e.g., the one start() or run() was called on) can only be delivered after
+ * that call returns. Call flush() after calling into an FSM to deliver it.
+ * 
+ * @return size_t Bytes delivered.
+ */
+size_t LoopbackOutHandler::flush() {
+    size_t delivered = 0;
+
+    for (std::list<LoopbackDeferred>::iterator it = loopback_deferred.begin(); it != loopback_deferred.end();) {
+        if (loopbackIsBusy(it->first->peer)) {
+            it++;
+            continue;
+        }
+
+        LoopbackDeferred deferred = std::move(*it);
+        loopback_deferred.erase(it);
+        deferred.first->pending_bytes.fetch_sub(deferred.second.size(), std::memory_order_relaxed);
+        deferred.first->deliver(deferred.second.data(), deferred.second.size());
+        delivered += deferred.second.size();
+
+        // delivery may have deferred more data, start over.
+        it = loopback_deferred.begin();
+    }
+
+    return delivered;
+}
+
+/**
+ * @brief Reserve a ring slot for an outgoing message. (queued mode)
+ * 
+ * @param length Length of the message.
+ * @return uint8_t* Pointer to the slot's data.
+ * @retval NULL Direct mode, no peer, or ring full.
+ */
+uint8_t* LoopbackOutHandler::reserveOut(size_t length) {
+    if (queue == NULL || peer == NULL) return NULL;
+
+    LoopbackSegment *segment = queue->back();
+    if (segment == NULL) return NULL;
+
+    segment->data.resize(length);
+    return segment->data.data();
+}
+
+/**
+ * @brief Put the message written into the reserved slot on the link. (queued
+ * mode)
+ * 
+ * @param buffer Pointer returned by reserveOut().
+ * @param length Length of the message. 0 to drop the reservation.
+ * @return true Message queued.
+ * @return false Reservation dropped.
+ */
+bool LoopbackOutHandler::commitOut(__attribute__((unused)) uint8_t *buffer, size_t length) {
+    if (length == 0) return false;
+
+    LoopbackSegment *segment = queue->back();
+    uint64_t t = now.load(std::memory_order_relaxed);
+    uint64_t start = link_free_at > t ? link_free_at : t;
+    uint64_t tx_time = bandwidth > 0 ? length * 8 * 1000000 / bandwidth : 0;
+
+    segment->ready_at = start + tx_time + latency;
+    queue->commit();
+
+    link_free_at = start + tx_time;
+    pending_bytes.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool LoopbackOutHandler::handleOut(const uint8_t *buffer, size_t length) {
+    if (peer == NULL) return false;
+
+    if (queue != NULL) {
+        uint8_t *slot = reserveOut(length);
+        if (slot == NULL) return false;
+        memcpy(slot, buffer, length);
+        return commitOut(slot, length);
+    }
+
+    // peer busy, or has data deferred (to keep the order): defer.
+    if (loopbackIsBusy(peer) || pending_bytes.load(std::memory_order_relaxed) > 0) {
+        loopback_deferred.push_back(LoopbackDeferred(this, std::vector<uint8_t>(buffer, buffer + length)));
+        pending_bytes.fetch_add(length, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (local != NULL) loopback_busy.push_back(local);
+    bool ok = deliver(buffer, length) >= 0;
+    flush();
+    if (local != NULL) loopback_busy.pop_back();
+
+    return ok;
+}
+
+/**
+ * @brief Set current simulated time, without delivering anything. (queued
+ * mode)
+ * 
+ * When several handlers are pumped in turn, set the time on all of them
+ * first, so data written during a delivery is sent at the right time.
+ * 
+ * @param now Current simulated time, in microseconds.
+ */
+void LoopbackOutHandler::setTime(uint64_t now) {
+    this->now.store(now, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Deliver data that has arrived. (queued mode)
+ * 
+ * In direct mode, this is the same as flush().
+ * 
+ * @param now Current simulated time, in microseconds. Should never go
+ * backward.
+ * @return ssize_t Bytes delivered.
+ * @retval -1 Peer's run() failed.
+ * @retval >=0 Bytes delivered.
+ */
+ssize_t LoopbackOutHandler::pump(uint64_t now) {
+    if (queue == NULL) return flush();
+    if (peer == NULL) return -1;
+
+    this->now.store(now, std::memory_order_relaxed);
+
+    ssize_t delivered = 0;
+    const LoopbackSegment *front;
+    while ((front = queue->front()) != NULL && front->ready_at <= now) {
+        size_t length = front->data.size();
+        int ret = deliver(front->data.data(), length);
+
+        // leave the data in the slot, so the sender can reuse its storage.
+        queue->drop();
+        pending_bytes.fetch_sub(length, std::memory_order_relaxed);
+        if (ret < 0) return -1;
+        delivered += length;
+    }
+
+    return delivered;
+}
+
+/**
+ * @brief Get time the next segment arrives. (queued mode)
+ * 
+ * @return uint64_t Time in microseconds.
+ * @retval UINT64_MAX Nothing in flight.
+ */
+uint64_t LoopbackOutHandler::getNextDelivery() const {
+    if (queue == NULL) return UINT64_MAX;
+    const LoopbackSegment *front = queue->front();
+    return front == NULL ? UINT64_MAX : front->ready_at;
+}
+
+/**
+ * @brief Get number of bytes written but not yet delivered.
+ * 
+ * @return size_t Bytes.
+ */
+size_t LoopbackOutHandler::getPendingBytes() const {
+    return pending_bytes.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the last value returned by the peer's run().
+ * 
+ * @return int The value. See BgpFsm::run().
+ */
+int LoopbackOutHandler::getLastResult() const {
+    return last_result.load(std::memory_order_relaxed);
+}
+
+}
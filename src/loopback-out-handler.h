@@ -0,0 +1,132 @@
+/**
+ * @file loopback-out-handler.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief In-memory out handler connecting two BgpFsm.
+ * @version 0.1
+ * @date 2019-08-27
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#ifndef LOOPBACK_OUT_HANDLER_H_
+#define LOOPBACK_OUT_HANDLER_H_
+#include "bgp-out-handler.h"
+#include "spsc-queue.h"
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#define LOOPBACK_DEFAULT_QUEUE_SIZE 65536
+
+namespace libbgp {
+
+class BgpFsm;
+
+/**
+ * @brief A chunk of data in flight on a queued loopback link.
+ * 
+ */
+struct LoopbackSegment {
+    /**
+     * @brief The data.
+     * 
+     */
+    std::vector<uint8_t> data;
+
+    /**
+     * @brief Simulated time (in microseconds) at which the last byte of the 
+     * data arrives at the peer.
+     * 
+     */
+    uint64_t ready_at;
+};
+
+/**
+ * @brief The LoopbackOutHandler class.
+ * 
+ * LoopbackOutHandler passes output of a BgpFsm to the run() of another BgpFsm
+ * in the same process, so FSM pairs can be driven without sockets. Create one
+ * handler for each direction.
+ * 
+ * In direct mode, data is passed to the peer's run() right away, unless the
+ * peer is busy on this thread (it is the sending FSM of an outer write, or it
+ * is being delivered to). Data for a busy FSM is deferred, and delivered once
+ * that FSM is no longer busy, or by flush(). This way an FSM is never
+ * re-entered from its own run(), and replies are never reordered. Set the
+ * local FSM with setPeer() so the handler knows which FSM is writing.
+ * 
+ * In queued mode, data is put in a bounded SPSC ring, and delivered to the
+ * peer by pump(). A link model with bandwidth and latency decides when each
+ * message arrives. The ring allows the sending FSM and pump() to run on
+ * different threads. If the ring is full, handleOut() fails and the sending
+ * FSM goes BROKEN, like a write on a socket with a full buffer that can't
+ * block; size the ring for the largest burst expected. The sending FSM 
+ * serializes messages straight into the ring slots (see reserveOut()), and
+ * the slots keep their storage after delivery, so a warmed up link does not
+ * allocate.
+ */
+class LoopbackOutHandler : public BgpOutHandler {
+public:
+    LoopbackOutHandler();
+    LoopbackOutHandler(size_t queue_size, uint64_t bandwidth, uint64_t latency);
+    ~LoopbackOutHandler();
+
+    // set the FSM to deliver data to, and the FSM writing to this handler.
+    void setPeer(BgpFsm *peer, BgpFsm *local = NULL);
+
+    bool handleOut(const uint8_t *buffer, size_t length);
+
+    // queued mode: messages are written straight into the ring.
+    uint8_t* reserveOut(size_t length);
+    bool commitOut(uint8_t *buffer, size_t length);
+
+    // queued mode: set current simulated time (in microseconds), without
+    // delivering anything.
+    void setTime(uint64_t now);
+
+    // queued mode: set current simulated time (in microseconds), and deliver
+    // all data that has arrived by then.
+    ssize_t pump(uint64_t now);
+
+    // direct mode: deliver data deferred on this thread, return bytes
+    // delivered.
+    static size_t flush();
+
+    // queued mode: get time the next segment arrives. UINT64_MAX if none.
+    uint64_t getNextDelivery() const;
+
+    // get number of bytes written but not yet delivered.
+    size_t getPendingBytes() const;
+
+    // get the last value returned by the peer's run().
+    int getLastResult() const;
+
+private:
+    LoopbackOutHandler(const LoopbackOutHandler &);
+    LoopbackOutHandler& operator= (const LoopbackOutHandler &);
+
+    int deliver(const uint8_t *buffer, size_t length);
+
+    BgpFsm *peer;
+    BgpFsm *local;
+    SpscQueue<LoopbackSegment> *queue;
+
+    // link bandwidth in bits per second, 0 for unlimited.
+    uint64_t bandwidth;
+
+    // link latency in microseconds.
+    uint64_t latency;
+
+    // current simulated time, set by pump().
+    std::atomic<uint64_t> now;
+
+    // time the link finishes sending the last queued segment. (producer only)
+    uint64_t link_free_at;
+
+    std::atomic<size_t> pending_bytes;
+    std::atomic<int> last_result;
+};
+
+}
+
+#endif // LOOPBACK_OUT_HANDLER_H_
@@ -0,0 +1,66 @@
+/**
+ * @file manual-clock.cc
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief A Clock implementation controlled by the user.
+ * @version 0.1
+ * @date 2019-08-27
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "manual-clock.h"
+
+namespace libbgp {
+
+/**
+ * @brief Construct a new ManualClock.
+ * 
+ * @param time Initial time, in seconds.
+ */
+ManualClock::ManualClock(uint64_t time) : now_ms(time * 1000) {}
+
+uint64_t ManualClock::getTime() const {
+    return now_ms.load(std::memory_order_relaxed) / 1000;
+}
+
+uint64_t ManualClock::getTimeMs() const {
+    return now_ms.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Set the current time.
+ * 
+ * @param time The time, in seconds.
+ */
+void ManualClock::setTime(uint64_t time) {
+    now_ms.store(time * 1000, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Set the current time.
+ * 
+ * @param time_ms The time, in milliseconds.
+ */
+void ManualClock::setTimeMs(uint64_t time_ms) {
+    now_ms.store(time_ms, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Move the clock forward.
+ * 
+ * @param seconds Seconds to move.
+ */
+void ManualClock::advance(uint64_t seconds) {
+    now_ms.fetch_add(seconds * 1000, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Move the clock forward.
+ * 
+ * @param ms Milliseconds to move.
+ */
+void ManualClock::advanceMs(uint64_t ms) {
+    now_ms.fetch_add(ms, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,52 @@
+/**
+ * @file manual-clock.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief A Clock implementation controlled by the user.
+ * @version 0.1
+ * @date 2019-08-27
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#ifndef MANUAL_CLOCK_H_
+#define MANUAL_CLOCK_H_
+#include "clock.h"
+#include <atomic>
+
+namespace libbgp {
+
+/**
+ * @brief The ManualClock class.
+ * 
+ * A Clock implementation that only moves when told to. Useful for tests and
+ * benchmarks that need timers to behave deterministically. The clock has a
+ * resolution of one millisecond, and can be moved forward by any amount at
+ * once, so hours of timer activity can be simulated in seconds. (see
+ * BgpFsm::getNextTick())
+ */
+class ManualClock : public Clock {
+public:
+    ManualClock(uint64_t time = 0);
+    uint64_t getTime() const;
+    uint64_t getTimeMs() const;
+
+    // set the current time, in seconds.
+    void setTime(uint64_t time);
+
+    // set the current time, in milliseconds.
+    void setTimeMs(uint64_t time_ms);
+
+    // move the clock forward, in seconds.
+    void advance(uint64_t seconds);
+
+    // move the clock forward, in milliseconds.
+    void advanceMs(uint64_t ms);
+
+private:
+    // current time in milliseconds.
+    std::atomic<uint64_t> now_ms;
+};
+
+}
+
+#endif // MANUAL_CLOCK_H_
@@ -10,6 +10,7 @@
  */
 #include "prefix4.h"
 #include "value-op.h"
+#include "bgp-throw.h"
 #include <arpa/inet.h>
 
 namespace libbgp {
@@ -31,7 +32,7 @@ const uint32_t CIDR_MASK_MAP[33] = {
  * @throws "bad_route_length" Netmask invalid.
  */
 uint32_t cidr_to_mask(uint8_t cidr) {
-    if (cidr > 32) throw "bad_route_length";
+    if (cidr > 32) LIBBGP_THROW("bad_route_length");
     return CIDR_MASK_MAP[cidr];
 }
 
@@ -52,7 +53,7 @@ Prefix4::Prefix4() {
  * @throws "bad_route_length" Netmask invalid.
  */
 Prefix4::Prefix4(uint32_t prefix, uint8_t length) {
-    if (length > 32) throw "bad_route_length";
+    if (length > 32) LIBBGP_THROW("bad_route_length");
     afi = IPV4;
     this->prefix = prefix;
     this->length = length;
@@ -66,7 +67,7 @@ Prefix4::Prefix4(uint32_t prefix, uint8_t length) {
  * @throws "bad_route_length" Netmask invalid.
  */
 Prefix4::Prefix4(const char* prefix, uint8_t length) {
-    if (length > 32) throw "bad_route_length";
+    if (length > 32) LIBBGP_THROW("bad_route_length");
     afi = IPV4;
     this->length = length;
     inet_pton(AF_INET, prefix, &(this->prefix));
@@ -84,6 +85,7 @@ Prefix4::Prefix4(const char* prefix, uint8_t length) {
 ssize_t Prefix4::parse(const uint8_t *buffer, size_t buf_sz) {
     if (buf_sz < 1) return -1;
     length = getValue<uint8_t>(&buffer);
+    if (length > 32) return -1;
     size_t prefix_buf_len = (length + 7) / 8;
     if (prefix_buf_len + 1 > buf_sz) return -1;
     prefix = 0;
@@ -185,7 +187,7 @@ bool Prefix4::includes (uint32_t prefix, uint8_t length) const {
  */
 bool Prefix4::includes (const Prefix &other) const {
     if (other.afi != IPV4) return false;
-    const Prefix4 &other_4 = dynamic_cast<const Prefix4 &>(other);
+    const Prefix4 &other_4 = static_cast<const Prefix4 &>(other);
     return includes (other_4.prefix, other_4.length);
 }
 
@@ -212,19 +214,19 @@ bool Prefix4::includes (const char* prefix, uint8_t length) const {
  */
 bool Prefix4::operator== (const Prefix &other) const {
     if (other.afi != IPV4) return false;
-    const Prefix4 &other_4 = dynamic_cast<const Prefix4 &>(other);
+    const Prefix4 &other_4 = static_cast<const Prefix4 &>(other);
     return other_4.prefix == prefix && other_4.length == length;
 }
 
 bool Prefix4::operator> (const Prefix &other) const {
     if (other.afi != IPV4) return false;
-    const Prefix4 &other_4 = dynamic_cast<const Prefix4 &>(other);
+    const Prefix4 &other_4 = static_cast<const Prefix4 &>(other);
     return length < other_4.length;
 }
 
 bool Prefix4::operator< (const Prefix &other) const {
     if (other.afi != IPV4) return false;
-    const Prefix4 &other_4 = dynamic_cast<const Prefix4 &>(other);
+    const Prefix4 &other_4 = static_cast<const Prefix4 &>(other);
     return length > other_4.length;
 }
 
@@ -305,7 +307,7 @@ uint8_t Prefix4::getLength() const {
  * @throws "bad_route_length" Netmask invalid.
  */
 uint32_t Prefix4::getMask() const {
-    if (length > 32) throw "bad_route_length";
+    if (length > 32) LIBBGP_THROW("bad_route_length");
     return CIDR_MASK_MAP[length];
 }
 
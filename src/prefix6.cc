@@ -12,6 +12,7 @@
 #include <arpa/inet.h>
 #include "prefix6.h"
 #include "value-op.h"
+#include "bgp-throw.h"
 
 namespace libbgp {
 
@@ -338,7 +339,7 @@ bool Prefix6::includes (const char* address) const {
  */
 bool Prefix6::includes (const Prefix &other) const {
     if (other.afi != IPV6) return false;
-    const Prefix6 &other_6 = dynamic_cast<const Prefix6 &>(other);
+    const Prefix6 &other_6 = static_cast<const Prefix6 &>(other);
     return includes(other_6.prefix, other_6.length);
 }
 
@@ -377,19 +378,19 @@ bool Prefix6::includes (const char* prefix, uint8_t length) const {
  */
 bool Prefix6::operator== (const Prefix &other) const {
     if (other.afi != IPV6) return false;
-    const Prefix6 &other_6 = dynamic_cast<const Prefix6 &>(other);
+    const Prefix6 &other_6 = static_cast<const Prefix6 &>(other);
     return memcmp(prefix, other_6.prefix, 16) == 0 && other_6.length == length;
 }
 
 bool Prefix6::operator> (const Prefix &other) const {
     if (other.afi != IPV6) return false;
-    const Prefix6 &other_6 = dynamic_cast<const Prefix6 &>(other);
+    const Prefix6 &other_6 = static_cast<const Prefix6 &>(other);
     return length < other_6.length;
 }
 
 bool Prefix6::operator< (const Prefix &other) const {
     if (other.afi != IPV6) return false;
-    const Prefix6 &other_6 = dynamic_cast<const Prefix6 &>(other);
+    const Prefix6 &other_6 = static_cast<const Prefix6 &>(other);
     return length > other_6.length;
 }
 
@@ -467,7 +468,7 @@ uint8_t Prefix6::getLength() const {
  * @throws "bad_route_length" Netmask invalid.
  */
 void Prefix6::getMask(uint8_t mask[16]) const {
-    if (length > 128) throw "bad_route_length";
+    if (length > 128) LIBBGP_THROW("bad_route_length");
     cidr_to_mask6(length, mask);
 }
 
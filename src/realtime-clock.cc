@@ -17,4 +17,10 @@ uint64_t RealtimeClock::getTime() const {
     return time(NULL);
 }
 
+uint64_t RealtimeClock::getTimeMs() const {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 }
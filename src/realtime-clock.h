@@ -22,6 +22,7 @@ namespace libbgp {
 class RealtimeClock : public Clock {
 public:
     uint64_t getTime() const;
+    uint64_t getTimeMs() const;
 };
 
 }
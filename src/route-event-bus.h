@@ -22,7 +22,8 @@ class RouteEventReceiver;
  * 
  * The route event bus is used to share information and communicate with other 
  * BGP FSMs. For example, route add/withdrawn events are sent to other FSMs with
- * route event bus. Collision resolution also depends on the route event bus. 
+ * route event bus. Collision resolution also depends on the route event bus, 
+ * unless the FSMs share a BgpSessionRegistry.
  */
 class RouteEventBus {
 public:
@@ -45,7 +45,11 @@ protected:
 
     /**
      * @brief Handle the route event.
-     * 
+     *
+     * BgpFsm publishes route events with its RIB unlocked: the entries in the
+     * events are copies, so a handler can write to a slow peer without
+     * stalling the sessions sharing the RIB.
+     *
      * @param ev The event.
      * @return true Event handled.
      * @return false Event not handled.
@@ -13,13 +13,11 @@
 #include <vector>
 #include "bgp-path-attrib.h"
 #include "bgp-update-message.h"
+#include "bgp-rib.h"
+#include "prefix6.h"
 
 namespace libbgp {
 
-/* forward */
-class BgpRib4Entry;
-class BgpRib6Entry;
-
 /**
  * @brief Type of route events.
  * 
@@ -32,6 +30,106 @@ enum RouteEventType {
     COLLISION
 };
 
+/**
+ * @brief An IPv4 route that became the best route, copied out of the RIB.
+ * 
+ * Unlike a BgpRib4Entry in the RIB, it stays valid after the RIB is unlocked
+ * and modified, so route events are published without the RIB locked. Routes
+ * with the same update ID share the path attributes.
+ */
+struct Route4Replacement {
+    /**
+     * @brief The prefix.
+     * 
+     */
+    Prefix4 route;
+
+    /**
+     * @brief The originating BGP speaker's ID. (network bytes order)
+     * 
+     */
+    uint32_t src_router_id;
+
+    /**
+     * @brief The update ID of the entry in the RIB.
+     * 
+     */
+    uint64_t update_id;
+
+    /**
+     * @brief Source of the entry.
+     * 
+     */
+    BgpRouteSource src;
+
+    /**
+     * @brief ASN of the IBGP peer. (Valid iff src == SRC_IBGP)
+     * 
+     */
+    uint32_t ibgp_peer_asn;
+
+    /**
+     * @brief Path attributes of the entry.
+     * 
+     */
+    std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> attribs;
+};
+
+/**
+ * @brief An IPv6 route that became the best route, copied out of the RIB.
+ * 
+ * See Route4Replacement.
+ */
+struct Route6Replacement {
+    /**
+     * @brief The prefix.
+     * 
+     */
+    Prefix6 route;
+
+    /**
+     * @brief The originating BGP speaker's ID. (network bytes order)
+     * 
+     */
+    uint32_t src_router_id;
+
+    /**
+     * @brief The update ID of the entry in the RIB.
+     * 
+     */
+    uint64_t update_id;
+
+    /**
+     * @brief Source of the entry.
+     * 
+     */
+    BgpRouteSource src;
+
+    /**
+     * @brief ASN of the IBGP peer. (Valid iff src == SRC_IBGP)
+     * 
+     */
+    uint32_t ibgp_peer_asn;
+
+    /**
+     * @brief Global IPv6 nexthop.
+     * 
+     */
+    uint8_t nexthop_global[16];
+
+    /**
+     * @brief Link-local IPv6 nexthop.
+     * 
+     */
+    uint8_t nexthop_linklocal[16];
+
+    /**
+     * @brief Path attributes of the entry.
+     * 
+     */
+    std::shared_ptr<const std::vector<std::shared_ptr<BgpPathAttrib>>> attribs;
+};
+
 /**
  * @brief The RouteEvent base.
  * 
@@ -77,7 +175,7 @@ public:
      * @brief Pointer to the route replacement entries vector.
      * 
      */
-    const std::vector<BgpRib4Entry> *replaced_entries;
+    const std::vector<Route4Replacement> *replaced_entries;
 
     /**
      * @brief ASN of the IBGP peer if the originating session is a IBGP session.
@@ -136,7 +234,7 @@ public:
      * @brief Pointer to the route replacement entries vector.
      * 
      */
-    const std::vector<BgpRib6Entry> *replaced_entries;
+    const std::vector<Route6Replacement> *replaced_entries;
 
     /**
      * @brief Global IPv6 nexthop.
@@ -179,7 +277,9 @@ public:
  * 
  * When a BgpFsm receive RouteCollisionEvent, it will check if the peer BGP ID
  * is same as it's peer. If it is, collision resloution will be done. If someone
- * reported event handled, the sender of the event will go to IDLE.
+ * reported event handled, the sender of the event will go to IDLE. Not used by
+ * FSMs with a BgpSessionRegistry, they ask the sessions in the registry
+ * directly.
  */
 class RouteCollisionEvent : public RouteEvent {
 public:
@@ -56,17 +56,17 @@ bool Serializable::hasError() const {
  * @param suberr The error subcode.
  * @param data The error data buffer.
  * @param data_len The length of error data buffer.
- * @throws "err_exist" Error already set.
  */
 void Serializable::setError(uint8_t err, uint8_t suberr, const uint8_t *data, size_t data_len) {
-    err_code = err;
-    err_subcode = suberr;
-
     if (err_len != 0) {
+        // keep the first error, that's the one to report to the peer.
         logger->log(FATAL, "Serializable::setError: error already exists.\n");
-        throw "err_exist";
+        return;
     }
 
+    err_code = err;
+    err_subcode = suberr;
+
     if (data_len == 0) return;
     err_len = data_len;
     err_data = (uint8_t *) malloc(err_len);
@@ -0,0 +1,159 @@
+/**
+ * @file spsc-queue.h
+ * @author Nato Morichika <nat@nat.moe>
+ * @brief Bounded single-producer single-consumer queue.
+ * @version 0.1
+ * @date 2019-08-27
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <utility>
+
+#define SPSC_CACHE_LINE 64
+
+namespace libbgp {
+
+/**
+ * @brief Bounded single-producer single-consumer queue.
+ * 
+ * A lock-free ring buffer. One thread may push() while another thread pop()s
+ * at the same time. The capacity is rounded up to a power of two.
+ * 
+ * @tparam T Type of the items. Items are moved in and out of the queue.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    /**
+     * @brief Construct a new SpscQueue.
+     * 
+     * @param capacity Minimum number of items the queue can hold.
+     */
+    SpscQueue(size_t capacity) : head(0), tail(0) {
+        size_t sz = 1;
+        while (sz < capacity) sz <<= 1;
+        mask = sz - 1;
+        ring = new T[sz];
+    }
+
+    ~SpscQueue() {
+        delete[] ring;
+    }
+
+    /**
+     * @brief Push an item to the queue. (producer only)
+     * 
+     * @param item The item. Will be moved into the queue on success.
+     * @return true Item pushed.
+     * @return false Queue is full.
+     */
+    bool push(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        ring[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get the free slot at the back of the queue, to build an item in
+     * place. (producer only)
+     * 
+     * The slot may hold a stale item popped with drop(); reuse its storage.
+     * The item is not visible to the consumer until commit().
+     * 
+     * @return T* The slot.
+     * @retval NULL Queue is full.
+     */
+    T* back() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return NULL;
+        return &ring[t & mask];
+    }
+
+    /**
+     * @brief Push the item built in the slot from back(). (producer only)
+     * 
+     */
+    void commit() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Pop an item from the queue. (consumer only)
+     * 
+     * @param item Where to move the item to.
+     * @return true Item popped.
+     * @return false Queue is empty.
+     */
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = std::move(ring[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the item at the front of the queue, leaving it in its 
+     * slot so the producer can reuse its storage. (consumer only)
+     * 
+     * @return true Item removed.
+     * @return false Queue is empty.
+     */
+    bool drop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get the item at the front of the queue without removing it.
+     * (consumer only)
+     * 
+     * @return const T* The item.
+     * @retval NULL Queue is empty.
+     */
+    const T* front() const {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return NULL;
+        return &ring[h & mask];
+    }
+
+    // get number of items in the queue.
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    // get the capacity of the queue.
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue& operator= (const SpscQueue &);
+
+    T *ring;
+    size_t mask;
+
+    // head and tail padded to their own cache lines, so producer and consumer
+    // do not contend on them. (padding, not alignas, since the queue is
+    // allocated with new)
+    char pad0[SPSC_CACHE_LINE];
+    std::atomic<size_t> head;
+    char pad1[SPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[SPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+}
+
+#endif // SPSC_QUEUE_H_